@@ -0,0 +1,137 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+/* Measures the dispatch of the received frames to the instances. Each
+ * instance is a MRM with a closed ring and gets its own MRP_Test on its
+ * blocked secondary port, so the frame goes through mrp_recv_frame: the drop
+ * and process checks, the lock of the instance, the comparison with its mac
+ * address and the MRM state machine. With many instances they don't fit in
+ * the cache and each frame pays for the cache lines of struct mrp that it
+ * touches.
+ *
+ *   dispatch_bench [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+
+#include "../state_machine.h"
+#include "../pdu.h"
+#include "../utils.h"
+
+#define BENCH_INSTANCES_MAX	10000
+
+struct bench_instance {
+	struct mrp_port *port;
+	struct br_mrp_ring_test_hdr hdr;
+	struct mrp_frame f;
+};
+
+static void bench_port(struct mrp *mrp, enum br_mrp_port_role_type role,
+		       enum br_mrp_port_state_type state)
+{
+	struct mrp_port *p = &mrp->ports[role];
+
+	p->mrp = mrp;
+	p->role = role;
+	p->state = state;
+	p->hw_state = MRP_HW_UNKNOWN;
+}
+
+static int bench_add(int i, struct bench_instance *inst)
+{
+	struct mrp *mrp;
+	int err;
+
+	err = mrp_create(1 + i, 1, 0);
+	if (err)
+		return err;
+
+	mrp = mrp_find(1 + i, 1);
+	mrp->macaddr[0] = 0x02;
+	mrp->macaddr[4] = i >> 8;
+	mrp->macaddr[5] = i;
+	mrp->ring_role = BR_MRP_RING_ROLE_MRM;
+	mrp->mrm_state = MRP_MRM_STATE_CHK_RC;
+
+	bench_port(mrp, BR_MRP_PORT_ROLE_PRIMARY, BR_MRP_PORT_STATE_FORWARDING);
+	bench_port(mrp, BR_MRP_PORT_ROLE_SECONDARY, BR_MRP_PORT_STATE_BLOCKED);
+	mrp->p_port = &mrp->ports[BR_MRP_PORT_ROLE_PRIMARY];
+	mrp->s_port = &mrp->ports[BR_MRP_PORT_ROLE_SECONDARY];
+
+	inst->port = mrp->s_port;
+	inst->hdr.prio = htons(MRP_DEFAULT_PRIO);
+	ether_addr_copy(inst->hdr.sa, mrp->macaddr);
+	inst->f.type = BR_MRP_TLV_HEADER_RING_TEST;
+	inst->f.ring_test = &inst->hdr;
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static const int sizes[] = { 10, 1000, BENCH_INSTANCES_MAX };
+	struct bench_instance *inst;
+	unsigned int s;
+	int rounds = 50;
+	int count = 0;
+	int i, k, r, n;
+	uint64_t ns, best;
+
+	if (argc > 1)
+		rounds = atoi(argv[1]);
+	if (rounds <= 0) {
+		fprintf(stderr, "usage: %s [rounds]\n", argv[0]);
+		return 1;
+	}
+
+	inst = calloc(BENCH_INSTANCES_MAX, sizeof(*inst));
+	if (!inst)
+		return 1;
+
+	mrp_set_max_instances(BENCH_INSTANCES_MAX);
+	if (mrp_init())
+		return 1;
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		n = sizes[s];
+
+		for (; count < n; count++) {
+			if (bench_add(count, &inst[count])) {
+				fprintf(stderr, "instance %d failed\n", count);
+				return 1;
+			}
+		}
+
+		/* The frames of the rings arrive interleaved. The best round
+		 * is kept, the others were slowed down by the rest of the
+		 * system.
+		 */
+		best = UINT64_MAX;
+		for (r = 0; r < rounds; r++) {
+			ns = get_ns();
+			for (i = 0; i < n; i++) {
+				k = (uint32_t)i * 7919 % n;
+				mrp_recv_frame(inst[k].port, &inst[k].f);
+			}
+			ns = get_ns() - ns;
+			if (ns < best)
+				best = ns;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (inst[i].port->mrp->mrm_state != MRP_MRM_STATE_CHK_RC) {
+				fprintf(stderr, "instance %d changed state\n", i);
+				return 1;
+			}
+		}
+
+		printf("%5d instances: %4llu ns per frame\n", n,
+		       (unsigned long long)(best / n));
+	}
+
+	free(inst);
+
+	return 0;
+}
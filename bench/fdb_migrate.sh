@@ -0,0 +1,160 @@
+#!/bin/sh
+# Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+# SPDX-License-Identifier: (GPL-2.0)
+#
+# Compares the flush of the FDB entries with their migration (option -M of
+# mrp_server) when a ring closes. The ring is made of veth pairs and software
+# bridges, so no MRP offload is needed, only root and CONFIG_BRIDGE_MRP.
+#
+#   br0 (MRM) r0 ---- r0x br1 l1 ---- l2 br2 r1x ---- r1 br0
+#   br0: h1 (sends to h2), sn (counts the flooded frames)
+#   br2: h2 (silent, except one frame each second)
+#
+# The ring starts open, with the entry of h2 on the secondary port r1. When
+# l1 comes up the MRM closes the ring and blocks r1. With a flush, the frames
+# of h1 to h2 are flooded, also to sn, until h2 is learned again on r0. With
+# -M the entry is moved to r0 and nothing is flooded.
+#
+#   bench/fdb_migrate.sh [build dir]
+
+set -e
+
+BUILD=${1:-build}
+SERVER=$(realpath "$BUILD/mrp_server")
+CLI=$(realpath "$BUILD/mrp")
+NS=mrp_bench
+H1_MAC=02:00:00:00:00:01
+H2_MAC=02:00:00:00:00:02
+CAP=/tmp/mrp_bench.cap
+
+now_ms()
+{
+	echo $(($(date +%s%N) / 1000000))
+}
+
+in_ns()
+{
+	ip netns exec "$@"
+}
+
+setup()
+{
+	for ns in $NS h1 h2 sn; do
+		ip netns add $ns
+		in_ns $ns ip link set lo up
+	done
+
+	for br in br0 br1 br2; do
+		in_ns $NS ip link add $br type bridge
+		in_ns $NS ip link set $br up
+	done
+
+	in_ns $NS ip link add r0 type veth peer name r0x
+	in_ns $NS ip link add r1 type veth peer name r1x
+	in_ns $NS ip link add l1 type veth peer name l2
+	in_ns $NS ip link set r0 master br0
+	in_ns $NS ip link set r1 master br0
+	in_ns $NS ip link set r0x master br1
+	in_ns $NS ip link set l1 master br1
+	in_ns $NS ip link set l2 master br2
+	in_ns $NS ip link set r1x master br2
+
+	for h in h1 sn; do
+		in_ns $NS ip link add p_$h type veth peer name eth0 netns $h
+		in_ns $NS ip link set p_$h master br0
+	done
+	in_ns $NS ip link add p_h2 type veth peer name eth0 netns h2
+	in_ns $NS ip link set p_h2 master br2
+
+	for dev in r0 r0x r1 r1x l2 p_h1 p_sn p_h2; do
+		in_ns $NS ip link set $dev up
+	done
+
+	in_ns h1 ip link set eth0 address $H1_MAC
+	in_ns h2 ip link set eth0 address $H2_MAC
+	for h in h1 h2 sn; do
+		in_ns $h ip link set eth0 up
+	done
+	in_ns h1 ip addr add 10.0.0.1/24 dev eth0
+	in_ns h2 ip addr add 10.0.0.2/24 dev eth0
+	in_ns h1 ip neigh add 10.0.0.2 lladdr $H2_MAC dev eth0
+	in_ns h2 ip neigh add 10.0.0.1 lladdr $H1_MAC dev eth0
+	in_ns h2 sysctl -q net.ipv4.icmp_echo_ignore_all=1
+}
+
+cleanup()
+{
+	kill $PIDS 2>/dev/null || true
+	wait 2>/dev/null || true
+	for ns in $NS h1 h2 sn; do
+		ip netns del $ns 2>/dev/null || true
+	done
+	rm -f $CAP
+}
+
+wait_state()
+{
+	i=0
+	while ! in_ns $NS "$CLI" getmrp | grep -q "ring_state: $1"; do
+		i=$((i + 1))
+		if [ $i -gt 1000 ]; then
+			echo "ring didn't reach $1" >&2
+			return 1
+		fi
+		sleep 0.005
+	done
+}
+
+# run <name> <server options>
+run()
+{
+	PIDS=
+	setup
+
+	in_ns $NS "$SERVER" $2 >/dev/null 2>&1 &
+	PIDS="$PIDS $!"
+	sleep 0.5
+	in_ns $NS "$CLI" addmrp bridge br0 ring_nr 1 pport r0 sport r1 \
+		ring_role mrm ring_recv 10
+	wait_state CHK_RO
+
+	# h1 sends 500 frames per second to h2, h2 answers once per second
+	in_ns h1 ping -q -i 0.002 10.0.0.2 >/dev/null 2>&1 &
+	PIDS="$PIDS $!"
+	in_ns h2 ping -q -i 1 10.0.0.1 >/dev/null 2>&1 &
+	PIDS="$PIDS $!"
+	sleep 2
+
+	in_ns sn tcpdump -q -n -tt -i eth0 -w $CAP ether dst $H2_MAC \
+		>/dev/null 2>&1 &
+	TCPDUMP=$!
+	sleep 1
+
+	start=$(now_ms)
+	in_ns $NS ip link set l1 up
+	wait_state CHK_RC
+	closed=$(now_ms)
+	sleep 3
+
+	kill $TCPDUMP
+	wait $TCPDUMP 2>/dev/null || true
+
+	tcpdump -n -tt -r $CAP 2>/dev/null | awk -v start=$start \
+		-v name="$1" -v close=$((closed - start)) '
+		{ n++; last = $1 * 1000 }
+		END {
+			flood = n ? last - start : 0
+			if (flood < 0)
+				flood = 0
+			printf("%-8s ring_closed: %dms flooded: %d frames " \
+			       "flood_end: %dms\n", name, close, n, flood)
+		}'
+
+	in_ns $NS "$CLI" getstats | grep -E "fdb_migrat|flush r"
+	cleanup
+}
+
+trap cleanup EXIT
+
+run flush ""
+run migrate "-M"
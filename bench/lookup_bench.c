@@ -0,0 +1,111 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+/* Measures the lookups of the instances by ring number, mrp_find, and by CFM
+ * peer mepid, mrp_get_mrp, with 1 to 10000 instances on the loop. The cost of
+ * a lookup must not depend on the number of instances.
+ *
+ *   lookup_bench [lookups]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../state_machine.h"
+#include "../utils.h"
+
+#define BENCH_INSTANCES_MAX	10000
+#define BENCH_BRIDGES		16
+
+static uint32_t bench_br_ifindex(int i)
+{
+	return 1 + i % BENCH_BRIDGES;
+}
+
+static uint32_t bench_ring_nr(int i)
+{
+	return 1 + i / BENCH_BRIDGES;
+}
+
+static uint32_t bench_peer_mepid(int i)
+{
+	return 1 + i;
+}
+
+static int bench_add(int i)
+{
+	struct mrp *mrp;
+	int err;
+
+	err = mrp_create(bench_br_ifindex(i), bench_ring_nr(i), 0);
+	if (err)
+		return err;
+
+	/* Same as mrp_start_cfm, without the offload */
+	mrp = mrp_find(bench_br_ifindex(i), bench_ring_nr(i));
+	mrp_set_cfm_peer(mrp, bench_peer_mepid(i));
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static const int sizes[] = { 1, 10, 100, 1000, BENCH_INSTANCES_MAX };
+	uint64_t find_ns, get_mrp_ns, ns;
+	int lookups = 1000000;
+	unsigned int s;
+	int count = 0;
+	int i, k, n;
+	int found;
+
+	if (argc > 1)
+		lookups = atoi(argv[1]);
+	if (lookups <= 0) {
+		fprintf(stderr, "usage: %s [lookups]\n", argv[0]);
+		return 1;
+	}
+
+	mrp_set_max_instances(BENCH_INSTANCES_MAX);
+	if (mrp_init())
+		return 1;
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		n = sizes[s];
+
+		for (; count < n; count++) {
+			if (bench_add(count)) {
+				fprintf(stderr, "instance %d failed\n", count);
+				return 1;
+			}
+		}
+
+		/* Visit the instances out of order, like the frames do */
+		found = 0;
+		ns = get_ns();
+		for (i = 0; i < lookups; i++) {
+			k = (uint32_t)i * 7919 % n;
+			found += !!mrp_find(bench_br_ifindex(k),
+					    bench_ring_nr(k));
+		}
+		find_ns = get_ns() - ns;
+
+		ns = get_ns();
+		for (i = 0; i < lookups; i++) {
+			k = (uint32_t)i * 7919 % n;
+			found += !!mrp_get_mrp(bench_br_ifindex(k),
+					       bench_peer_mepid(k));
+		}
+		get_mrp_ns = get_ns() - ns;
+
+		if (found != 2 * lookups) {
+			fprintf(stderr, "lookups failed\n");
+			return 1;
+		}
+
+		printf("%5d instances: mrp_find %3llu ns mrp_get_mrp %3llu ns\n",
+		       n, (unsigned long long)(find_ns / lookups),
+		       (unsigned long long)(get_mrp_ns / lookups));
+	}
+
+	return 0;
+}
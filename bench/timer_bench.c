@@ -0,0 +1,189 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+/* Compares the timer wheel of mrp_server with the heap of libev. For 10,
+ * 1000 and 10000 timers it measures the cost to start and to stop each timer
+ * and the CPU time that the loop spends to expire them. The timeouts are
+ * spread over a few ms, like the test and the topology change timers of many
+ * instances.
+ *
+ *   timer_bench [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <ev.h>
+
+#include "../timer_wheel.h"
+#include "../utils.h"
+
+#define BENCH_SPREAD_US	4000
+#define BENCH_AFTER_US	1000
+
+struct bench_result {
+	uint64_t start_ns;
+	uint64_t stop_ns;
+	uint64_t expire_ns;
+};
+
+static struct ev_loop *loop;
+static int expired;
+static int count;
+
+static uint64_t cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Timeout of the timer 'i', spread so that the timers don't all expire in
+ * the same tick
+ */
+static uint32_t bench_after(int i)
+{
+	return BENCH_AFTER_US + (uint32_t)i * 7919 % BENCH_SPREAD_US;
+}
+
+static void bench_expired(void)
+{
+	if (++expired == count)
+		ev_break(loop, EVBREAK_ALL);
+}
+
+static void bench_wheel_expired(struct wheel_timer *t)
+{
+	bench_expired();
+}
+
+static void bench_ev_expired(EV_P_ ev_timer *w, int revents)
+{
+	bench_expired();
+}
+
+static void bench_wheel(struct wheel_timer *timers, int n,
+			struct bench_result *res)
+{
+	uint64_t ns;
+	int i;
+
+	ns = get_ns();
+	for (i = 0; i < n; i++)
+		wheel_timer_start(&timers[i], bench_after(i), 0);
+	res->start_ns += get_ns() - ns;
+
+	ns = get_ns();
+	for (i = 0; i < n; i++)
+		wheel_timer_stop(&timers[i]);
+	res->stop_ns += get_ns() - ns;
+
+	for (i = 0; i < n; i++)
+		wheel_timer_start(&timers[i], bench_after(i), 0);
+
+	expired = 0;
+	count = n;
+	ns = cpu_ns();
+	ev_run(loop, 0);
+	res->expire_ns += cpu_ns() - ns;
+}
+
+static void bench_ev(ev_timer *timers, int n, struct bench_result *res)
+{
+	uint64_t ns;
+	int i;
+
+	ev_now_update(loop);
+
+	ns = get_ns();
+	for (i = 0; i < n; i++) {
+		ev_timer_set(&timers[i], bench_after(i) / 1000000.0, 0);
+		ev_timer_start(loop, &timers[i]);
+	}
+	res->start_ns += get_ns() - ns;
+
+	ns = get_ns();
+	for (i = 0; i < n; i++)
+		ev_timer_stop(loop, &timers[i]);
+	res->stop_ns += get_ns() - ns;
+
+	for (i = 0; i < n; i++) {
+		ev_timer_set(&timers[i], bench_after(i) / 1000000.0, 0);
+		ev_timer_start(loop, &timers[i]);
+	}
+
+	expired = 0;
+	count = n;
+	ns = cpu_ns();
+	ev_run(loop, 0);
+	res->expire_ns += cpu_ns() - ns;
+}
+
+static void bench_print(const char *name, int n, int rounds,
+			const struct bench_result *res)
+{
+	uint64_t ops = (uint64_t)n * rounds;
+
+	printf("%-6s %6d timers: start %5llu ns stop %5llu ns expire %5llu ns\n",
+	       name, n, (unsigned long long)(res->start_ns / ops),
+	       (unsigned long long)(res->stop_ns / ops),
+	       (unsigned long long)(res->expire_ns / ops));
+}
+
+int main(int argc, char *argv[])
+{
+	static const int sizes[] = { 10, 1000, 10000 };
+	struct bench_result wheel_res, ev_res;
+	struct wheel_timer *wheel_timers;
+	ev_timer *ev_timers;
+	int rounds = 20;
+	unsigned int s;
+	int i, r, n;
+
+	if (argc > 1)
+		rounds = atoi(argv[1]);
+	if (rounds <= 0) {
+		fprintf(stderr, "usage: %s [rounds]\n", argv[0]);
+		return 1;
+	}
+
+	loop = EV_DEFAULT;
+	if (timer_wheel_init() < 0)
+		return 1;
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		n = sizes[s];
+
+		wheel_timers = calloc(n, sizeof(*wheel_timers));
+		ev_timers = calloc(n, sizeof(*ev_timers));
+		if (!wheel_timers || !ev_timers) {
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+
+		for (i = 0; i < n; i++) {
+			wheel_timer_init(&wheel_timers[i], bench_wheel_expired);
+			ev_timer_init(&ev_timers[i], bench_ev_expired, 0, 0);
+		}
+
+		wheel_res = (struct bench_result){ 0 };
+		ev_res = (struct bench_result){ 0 };
+
+		for (r = 0; r < rounds; r++) {
+			bench_wheel(wheel_timers, n, &wheel_res);
+			bench_ev(ev_timers, n, &ev_res);
+		}
+
+		bench_print("wheel", n, rounds, &wheel_res);
+		bench_print("libev", n, rounds, &ev_res);
+
+		free(wheel_timers);
+		free(ev_timers);
+	}
+
+	timer_wheel_uninit();
+
+	return 0;
+}
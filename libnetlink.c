@@ -708,7 +708,47 @@ static int __rtnl_recvmsg(int fd, struct msghdr *msg, int flags)
 	return len;
 }
 
-static int rtnl_recvmsg(int fd, struct msghdr *msg, char **answer)
+/* The replies are received in buffers of the calling thread instead of a
+ * malloc for each of them. A dump callback may talk to the kernel, so a few
+ * buffers can be in use at the same time.
+ */
+#define RTNL_BUF_LEN	32768
+#define RTNL_BUF_NR	4
+
+static __thread char rtnl_bufs[RTNL_BUF_NR][RTNL_BUF_LEN];
+static __thread unsigned int rtnl_bufs_used;
+
+/* Returns a buffer of at least len bytes. If the caller keeps the buffer, it
+ * is allocated and freed by the caller.
+ */
+static char *rtnl_buf_get(int len, bool keep)
+{
+	int i;
+
+	if (!keep && len <= RTNL_BUF_LEN) {
+		for (i = 0; i < RTNL_BUF_NR; ++i) {
+			if (rtnl_bufs_used & (1 << i))
+				continue;
+
+			rtnl_bufs_used |= 1 << i;
+			return rtnl_bufs[i];
+		}
+	}
+
+	return malloc(len);
+}
+
+static void rtnl_buf_put(char *buf)
+{
+	if (buf >= rtnl_bufs[0] && buf < rtnl_bufs[RTNL_BUF_NR]) {
+		rtnl_bufs_used &= ~(1 << ((buf - rtnl_bufs[0]) / RTNL_BUF_LEN));
+		return;
+	}
+
+	free(buf);
+}
+
+static int rtnl_recvmsg(int fd, struct msghdr *msg, char **answer, bool keep)
 {
 	struct iovec *iov = msg->msg_iov;
 	char *buf;
@@ -721,9 +761,9 @@ static int rtnl_recvmsg(int fd, struct msghdr *msg, char **answer)
 	if (len < 0)
 		return len;
 
-	if (len < 32768)
-		len = 32768;
-	buf = malloc(len);
+	if (len < RTNL_BUF_LEN)
+		len = RTNL_BUF_LEN;
+	buf = rtnl_buf_get(len, keep);
 	if (!buf) {
 		fprintf(stderr, "malloc error: not enough buffer\n");
 		return -ENOMEM;
@@ -734,14 +774,14 @@ static int rtnl_recvmsg(int fd, struct msghdr *msg, char **answer)
 
 	len = __rtnl_recvmsg(fd, msg, 0);
 	if (len < 0) {
-		free(buf);
+		rtnl_buf_put(buf);
 		return len;
 	}
 
 	if (answer)
 		*answer = buf;
 	else
-		free(buf);
+		rtnl_buf_put(buf);
 
 	return len;
 }
@@ -766,7 +806,7 @@ static int rtnl_dump_filter_l(struct rtnl_handle *rth,
 		int found_done = 0;
 		int msglen = 0;
 
-		status = rtnl_recvmsg(rth->fd, &msg, &buf);
+		status = rtnl_recvmsg(rth->fd, &msg, &buf, false);
 		if (status < 0)
 			return status;
 
@@ -794,7 +834,7 @@ static int rtnl_dump_filter_l(struct rtnl_handle *rth,
 				if (h->nlmsg_type == NLMSG_DONE) {
 					err = rtnl_dump_done(h);
 					if (err < 0) {
-						free(buf);
+						rtnl_buf_put(buf);
 						return -1;
 					}
 
@@ -804,14 +844,14 @@ static int rtnl_dump_filter_l(struct rtnl_handle *rth,
 
 				if (h->nlmsg_type == NLMSG_ERROR) {
 					rtnl_dump_error(rth, h);
-					free(buf);
+					rtnl_buf_put(buf);
 					return -1;
 				}
 
 				if (!rth->dump_fp) {
 					err = a->filter(h, a->arg1);
 					if (err < 0) {
-						free(buf);
+						rtnl_buf_put(buf);
 						return err;
 					}
 				}
@@ -820,7 +860,7 @@ skip_it:
 				h = NLMSG_NEXT(h, msglen);
 			}
 		}
-		free(buf);
+		rtnl_buf_put(buf);
 
 		if (found_done) {
 			if (dump_intr)
@@ -899,7 +939,7 @@ static int __rtnl_talk_iov(struct rtnl_handle *rtnl, struct iovec *iov,
 	i = 0;
 	while (1) {
 next:
-		status = rtnl_recvmsg(rtnl->fd, &msg, &buf);
+		status = rtnl_recvmsg(rtnl->fd, &msg, &buf, answer);
 		++i;
 
 		if (status < 0)
@@ -918,7 +958,7 @@ next:
 			if (l < 0 || len > status) {
 				if (msg.msg_flags & MSG_TRUNC) {
 					fprintf(stderr, "Truncated message\n");
-					free(buf);
+					rtnl_buf_put(buf);
 					return -1;
 				}
 				fprintf(stderr,
@@ -942,7 +982,7 @@ next:
 
 				if (l < sizeof(struct nlmsgerr)) {
 					fprintf(stderr, "ERROR truncated\n");
-					free(buf);
+					rtnl_buf_put(buf);
 					return -1;
 				}
 
@@ -960,7 +1000,7 @@ next:
 				if (answer)
 					*answer = (struct nlmsghdr *)buf;
 				else
-					free(buf);
+					rtnl_buf_put(buf);
 
 				if (i < iovlen)
 					goto next;
@@ -977,7 +1017,7 @@ next:
 			status -= NLMSG_ALIGN(len);
 			h = (struct nlmsghdr *)((char *)h + NLMSG_ALIGN(len));
 		}
-		free(buf);
+		rtnl_buf_put(buf);
 
 		if (msg.msg_flags & MSG_TRUNC) {
 			fprintf(stderr, "Message truncated\n");
@@ -0,0 +1,44 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "utils.h"
+
+/* Built with MRP_MALLOC_COUNT, the calls of the server to malloc, calloc and
+ * realloc are linked with --wrap and counted here. Once the instances are
+ * created the count must not change while frames are received, timers expire
+ * and the rings recover.
+ */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static uint64_t malloc_count;
+
+void *__wrap_malloc(size_t size)
+{
+	__atomic_add_fetch(&malloc_count, 1, __ATOMIC_RELAXED);
+
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	__atomic_add_fetch(&malloc_count, 1, __ATOMIC_RELAXED);
+
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	__atomic_add_fetch(&malloc_count, 1, __ATOMIC_RELAXED);
+
+	return __real_realloc(ptr, size);
+}
+
+uint64_t malloc_count_get(void)
+{
+	return __atomic_load_n(&malloc_count, __ATOMIC_RELAXED);
+}
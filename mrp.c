@@ -509,6 +509,132 @@ static int cmd_delmrp(int argc, char *const *argv)
 	return CTL_delmrp(br, ring_nr);
 }
 
+/* Parse a list of vlans like 10,20-30 into the bitmap */
+static int parse_vlans(const char *str, uint8_t *vlans)
+{
+	unsigned long start, end;
+	char *next;
+
+	memset(vlans, 0, MRP_VLAN_BITMAP_LEN);
+
+	if (strcmp(str, "none") == 0)
+		return 0;
+
+	while (*str) {
+		start = strtoul(str, &next, 10);
+		end = start;
+		if (*next == '-')
+			end = strtoul(next + 1, &next, 10);
+
+		if (next == str || start < 1 || end < start ||
+		    end >= MRP_VLAN_N_VID)
+			return -1;
+
+		for (; start <= end; ++start)
+			vlans[start / 8] |= 1 << (start % 8);
+
+		if (*next == ',')
+			next++;
+		else if (*next)
+			return -1;
+
+		str = next;
+	}
+
+	return 0;
+}
+
+static int cmd_setflushvlans(int argc, char *const *argv)
+{
+	uint8_t vlans[MRP_VLAN_BITMAP_LEN];
+	int br = 0, ring_nr = 0;
+	bool vlans_set = false;
+
+	/* skip the command */
+	argv++;
+	argc -= 1;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "bridge") == 0) {
+			NEXT_ARG();
+			br = if_nametoindex(*argv);
+		} else if (strcmp(*argv, "ring_nr") == 0) {
+			NEXT_ARG();
+			ring_nr = atoi(*argv);
+		} else if (strcmp(*argv, "vlans") == 0) {
+			NEXT_ARG();
+			if (parse_vlans(*argv, vlans))
+				return -1;
+			vlans_set = true;
+		}
+
+		argc--; argv++;
+	}
+
+	if (br == 0 || ring_nr == 0 || !vlans_set)
+		return -1;
+
+	return CTL_setflushvlans(br, ring_nr, vlans);
+}
+
+static int cmd_setprofile(int argc, char *const *argv)
+{
+	char profile[MRP_PROFILE_NAME_LEN] = { 0 };
+	int br = 0, ring_nr = 0;
+
+	/* skip the command */
+	argv++;
+	argc -= 1;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "bridge") == 0) {
+			NEXT_ARG();
+			br = if_nametoindex(*argv);
+		} else if (strcmp(*argv, "ring_nr") == 0) {
+			NEXT_ARG();
+			ring_nr = atoi(*argv);
+		} else if (strcmp(*argv, "profile") == 0) {
+			NEXT_ARG();
+			if (strlen(*argv) >= MRP_PROFILE_NAME_LEN)
+				return -1;
+			strcpy(profile, *argv);
+		}
+
+		argc--; argv++;
+	}
+
+	if (br == 0 || ring_nr == 0 || !profile[0])
+		return -1;
+
+	return CTL_setprofile(br, ring_nr, profile);
+}
+
+static void print_timing(const struct mrp_timing *t, bool in)
+{
+	if (!in) {
+		printf("ring_topo_interval: %uus ring_topo_max: %u\n",
+		       t->ring_topo_interval, t->ring_topo_max);
+		printf("ring_test_short: %uus ring_test_interval: %uus ",
+		       t->ring_test_short, t->ring_test_interval);
+		printf("ring_test_max: %u ring_test_ext_max: %u ",
+		       t->ring_test_max, t->ring_test_ext_max);
+		printf("ring_test_period: %uus ring_test_ext_hold: %uus\n",
+		       t->ring_test_period, t->ring_test_ext_hold);
+		printf("ring_link_interval: %uus ring_link_max: %u\n",
+		       t->ring_link_interval, t->ring_link_max);
+		return;
+	}
+
+	printf("in_topo_interval: %uus in_topo_max: %u\n",
+	       t->in_topo_interval, t->in_topo_max);
+	printf("in_test_interval: %uus in_test_max: %u in_test_period: %uus\n",
+	       t->in_test_interval, t->in_test_max, t->in_test_period);
+	printf("in_link_interval: %uus in_link_max: %u ",
+	       t->in_link_interval, t->in_link_max);
+	printf("in_link_status_interval: %uus in_link_status_max: %u\n",
+	       t->in_link_status_interval, t->in_link_status_max);
+}
+
 static int cmd_getmrp(int argc, char *const *argv)
 {
 	struct mrp_status status[MAX_MRP_INSTANCES];
@@ -535,6 +661,18 @@ static int cmd_getmrp(int argc, char *const *argv)
 			printf("ring_state: %s \n", mrm_state_str(status[i].ring_state));
 		if (status[i].ring_role == BR_MRP_RING_ROLE_MRC)
 			printf("ring_state: %s \n", mrc_state_str(status[i].ring_state));
+		printf("wakeups: %llu wakeups_rate: %u/s\n",
+		       (unsigned long long)status[i].wakeups,
+		       status[i].wakeups_rate);
+		if (status[i].profile[0])
+			printf("profile: %s\n", status[i].profile);
+		print_timing(&status[i].timing, false);
+		if (status[i].ring_role == BR_MRP_RING_ROLE_MRM)
+			printf("ring_test_ext: %d ring_open_false: %llu "
+			       "ring_open_suppressed: %llu\n",
+			       status[i].ring_test_ext,
+			       (unsigned long long)status[i].ring_open_false,
+			       (unsigned long long)status[i].ring_open_suppressed);
 
 		if (status[i].in_role == BR_MRP_IN_ROLE_DISABLED)
 			continue;
@@ -548,6 +686,84 @@ static int cmd_getmrp(int argc, char *const *argv)
 			printf("in_state: %s \n", mim_state_str(status[i].in_state));
 		if (status[i].in_role == BR_MRP_IN_ROLE_MIC)
 			printf("in_state: %s \n", mic_state_str(status[i].in_state));
+		print_timing(&status[i].timing, true);
+	}
+
+	return 0;
+}
+
+static int cmd_getstats(int argc, char *const *argv)
+{
+	struct mrp_stats stats;
+	int i;
+
+	if (CTL_getstats(&stats))
+		return -1;
+
+	printf("if_cache_hit: %llu ", (unsigned long long)stats.if_cache_hit);
+	printf("if_cache_miss: %llu\n", (unsigned long long)stats.if_cache_miss);
+
+	printf("rx_frames: %llu rx_batch:", (unsigned long long)stats.rx_frames);
+	for (i = 0; i < MRP_STATS_BATCH_HIST; ++i)
+		printf(" %d%s: %llu", 1 << i,
+		       i == MRP_STATS_BATCH_HIST - 1 ? "+" : "",
+		       (unsigned long long)stats.rx_batch[i]);
+	printf("\n");
+	printf("rx_invalid: %llu\n", (unsigned long long)stats.rx_invalid);
+
+	printf("tx_frames: %llu ", (unsigned long long)stats.tx_frames);
+	printf("tx_batches: %llu ", (unsigned long long)stats.tx_batches);
+	printf("tx_dropped: %llu\n", (unsigned long long)stats.tx_dropped);
+	printf("tx_latency_avg: %lluus ",
+	       (unsigned long long)(stats.tx_batches ?
+		stats.tx_latency_sum / stats.tx_batches / 1000 : 0));
+	printf("tx_latency_max: %lluus\n",
+	       (unsigned long long)stats.tx_latency_max / 1000);
+
+	printf("nl_async_sent: %llu ", (unsigned long long)stats.nl_async_sent);
+	printf("nl_async_errors: %llu ",
+	       (unsigned long long)stats.nl_async_errors);
+	printf("nl_async_sync: %llu ", (unsigned long long)stats.nl_async_sync);
+	printf("nl_async_pending: %llu\n",
+	       (unsigned long long)stats.nl_async_pending);
+	printf("nl_async_latency_max: %lluus\n",
+	       (unsigned long long)stats.nl_async_latency_max / 1000);
+	printf("nl_txn_commits: %llu ", (unsigned long long)stats.nl_txn_commits);
+	printf("nl_txn_msgs: %llu\n", (unsigned long long)stats.nl_txn_msgs);
+	printf("nl_avoided: %llu ", (unsigned long long)stats.nl_avoided);
+	printf("nl_drift: %llu\n", (unsigned long long)stats.nl_drift);
+	printf("ring_open: %llu ", (unsigned long long)stats.ring_open_count);
+	printf("ring_open_last: %lluus ",
+	       (unsigned long long)stats.ring_open_last / 1000);
+	printf("ring_open_max: %lluus\n",
+	       (unsigned long long)stats.ring_open_max / 1000);
+	printf("fdb_migrations: %llu ",
+	       (unsigned long long)stats.fdb_migrations);
+	printf("fdb_migrated: %llu ", (unsigned long long)stats.fdb_migrated);
+	printf("fdb_migrate_max: %lluus\n",
+	       (unsigned long long)stats.fdb_migrate_latency_max / 1000);
+	printf("timer_wakeups: %llu ", (unsigned long long)stats.timer_wakeups);
+	printf("timer_wakeups_rate: %llu/s\n",
+	       (unsigned long long)stats.timer_wakeups_rate);
+	printf("sched_latency_max: %lluus\n",
+	       (unsigned long long)stats.sched_latency_max / 1000);
+	if (stats.mallocs)
+		printf("mallocs: %llu\n", (unsigned long long)stats.mallocs);
+
+	for (i = 0; i < MRP_STATS_FLUSH_PORTS; ++i) {
+		struct mrp_flush_stats *flush = &stats.flush[i];
+		char ifname[IF_NAMESIZE];
+
+		if (!flush->ifindex)
+			continue;
+
+		printf("flush %s: requests: %llu flushes: %llu ",
+		       if_indextoname(flush->ifindex, ifname) ? : "?",
+		       (unsigned long long)flush->requests,
+		       (unsigned long long)flush->flushes);
+		printf("latency_last: %lluus latency_max: %lluus\n",
+		       (unsigned long long)flush->latency_last / 1000,
+		       (unsigned long long)flush->latency_max / 1000);
 	}
 
 	return 0;
@@ -564,6 +780,9 @@ static const struct command commands[] =
 	{"addmrp", cmd_addmrp},
 	{"delmrp", cmd_delmrp},
 	{"getmrp", cmd_getmrp},
+	{"getstats", cmd_getstats},
+	{"setflushvlans", cmd_setflushvlans},
+	{"setprofile", cmd_setprofile},
 };
 
 static void help(void)
@@ -597,7 +816,18 @@ static void help(void)
 		"Mandatory arguments:\n"
 		" --bridge          [bridge]    Bridge name on which the MRP instance exists\n"
 		" --ring_nr         [id]        The ID of MRP instance\n\n"
-		"getmrp: Show MRP instance\n\n");
+		"getmrp: Show MRP instance\n\n"
+		"getstats: Show MRP server statistics\n\n"
+		"setflushvlans: Flush only the FDB entries of these VLANs\n"
+		"Mandatory arguments:\n"
+		" --bridge          [bridge]    Bridge name on which the MRP instance exists\n"
+		" --ring_nr         [id]        The ID of MRP instance\n"
+		" --vlans           [vlans]     List of VLANs (10,20-30) or none\n\n"
+		"setprofile: Use the timing parameters of a profile\n"
+		"Mandatory arguments:\n"
+		" --bridge          [bridge]    Bridge name on which the MRP instance exists\n"
+		" --ring_nr         [id]        The ID of MRP instance\n"
+		" --profile         [name]      Name of a profile of the mrp_server profile file\n\n");
 }
 
 static const struct command *command_lookup(const char *cmd)
@@ -678,3 +908,6 @@ int main (int argc, char *const *argv)
 CLIENT_SIDE_FUNCTION(addmrp);
 CLIENT_SIDE_FUNCTION(delmrp);
 CLIENT_SIDE_FUNCTION(getmrp);
+CLIENT_SIDE_FUNCTION(getstats);
+CLIENT_SIDE_FUNCTION(setflushvlans);
+CLIENT_SIDE_FUNCTION(setprofile);
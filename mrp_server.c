@@ -12,6 +12,10 @@
 #include "server_socket.h"
 #include "utils.h"
 #include "packet.h"
+#include "netlink.h"
+#include "state_machine.h"
+#include "profile.h"
+#include "shard.h"
 #include "print.h"
 
 volatile bool quit = false;
@@ -21,7 +25,20 @@ static void usage(void)
 	printf("Usage::\n"
 	       " -m        print messages to stdout\n"
 	       " -h        print this message and exit\n"
-	       " -l [num]  set the logging level\n");
+	       " -l [num]  set the logging level\n"
+	       " -b [num]  maximum number of frames received per loop iteration\n"
+	       " -r        receive frames through a memory mapped ring\n"
+	       " -q        send topology change frames bypassing the qdisc\n"
+	       " -f [ms]   window in which the FDB flushes are coalesced\n"
+	       " -M        move the FDB entries to the forwarding ring port\n"
+	       "           instead of flushing them, when it is known\n"
+	       " -p [file] load the timing profiles from the file\n"
+	       " -w [num]  run the instances on num worker loops, split by\n"
+	       "           bridge\n"
+	       " -c [list] pin the worker loops to the comma separated CPUs\n"
+	       " -R [prio] run the worker loops as SCHED_FIFO threads at prio,\n"
+	       "           with the memory locked\n"
+	       " -n [num]  maximum number of instances of a loop (default 20)\n");
 }
 
 static void handle_signal(int sig)
@@ -51,7 +68,7 @@ int main(int argc, char *argv[])
 {
 	int c;
 
-	while ((c = getopt(argc, argv, "mhl:")) != -1) {
+	while ((c = getopt(argc, argv, "mhrqMl:b:f:p:w:c:R:n:")) != -1) {
 		switch (c) {
 		case 'm':
 			print_set_verbose(1);
@@ -59,6 +76,39 @@ int main(int argc, char *argv[])
 		case 'l':
 			print_set_level(atoi(optarg));
 			break;
+		case 'b':
+			packet_set_rx_budget(atoi(optarg));
+			break;
+		case 'r':
+			packet_set_rx_ring(true);
+			break;
+		case 'q':
+			packet_set_tx_bypass(true);
+			break;
+		case 'f':
+			mrp_netlink_set_flush_window(atoi(optarg));
+			break;
+		case 'M':
+			mrp_netlink_set_fdb_migrate(true);
+			break;
+		case 'p':
+			if (mrp_profile_load(optarg))
+				return 1;
+			break;
+		case 'w':
+			shard_set_count(atoi(optarg));
+			break;
+		case 'c':
+			if (shard_set_cpus(optarg))
+				return 1;
+			break;
+		case 'R':
+			if (shard_set_rt(atoi(optarg)))
+				return 1;
+			break;
+		case 'n':
+			mrp_set_max_instances(atoi(optarg));
+			break;
 		case 'h':
 			usage();
 			return 0;
@@ -69,11 +119,9 @@ int main(int argc, char *argv[])
 	}
 
 	ctl_socket_init();
-	packet_socket_init();
 
 	ev_run(EV_DEFAULT, 0);
 
-	packet_socket_cleanup();
 	ctl_socket_cleanup();
 
 	return 0;
@@ -11,13 +11,137 @@
 #include <linux/if_bridge.h>
 #include <net/if.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <ev.h>
 
 #include "state_machine.h"
+#include "netlink.h"
+#include "server_cmds.h"
+#include "shard.h"
 #include "utils.h"
 #include "libnetlink.h"
 #include "print.h"
 
-static struct rtnl_handle rth = { .fd = -1 };
+/* Each event loop talks to the kernel on its own sockets, so the state of the
+ * requests below is per loop. The ACKs are handled by the loop that runs the
+ * instance.
+ */
+static __thread struct ev_loop *mrp_nl_loop;
+static __thread struct rtnl_handle rth = { .fd = -1 };
+
+/* The requests that the state machine sends while it runs are sent on a non
+ * blocking socket and their ACKs are handled by the event loop. The requests
+ * that configure the instances still use rth and wait for the ACK.
+ */
+static __thread struct rtnl_handle rth_async = { .fd = -1 };
+static __thread ev_io mrp_nl_async_watcher;
+
+#define MRP_NL_PENDING_MAX	256
+/* Pending entries that the bulk requests, like the migration of the FDB
+ * entries, leave free for the requests of the state machines
+ */
+#define MRP_NL_PENDING_RESERVE	32
+
+struct mrp_nl_pending {
+	bool			used;
+	uint32_t		seq;
+	enum mrp_netlink_op	op;
+	uint32_t		br_ifindex;
+	uint32_t		ring_nr;
+	uint32_t		ifindex;
+	uint64_t		sent;
+};
+
+static __thread struct mrp_nl_pending mrp_nl_pending[MRP_NL_PENDING_MAX];
+static __thread unsigned char mrp_nl_buf[16384];
+
+/* A dump that is read on rth_async. Its messages are passed to entry as they
+ * are received and done is called with the error, or 0, after the last one.
+ * One dump runs at a time on a loop.
+ */
+static __thread struct mrp_nl_dump {
+	bool		active;
+	uint32_t	seq;
+	int		(*entry)(struct nlmsghdr *n, void *arg);
+	void		(*done)(int err);
+} mrp_nl_dump;
+
+/* Receive calls per wakeup of rth_async, so that a long dump doesn't delay
+ * the frames and the timers of the loop
+ */
+#define MRP_NL_ASYNC_BUDGET	4
+
+#ifndef NLM_F_BULK
+#define NLM_F_BULK	0x200
+#endif
+
+struct request {
+	struct nlmsghdr		n;
+	struct ifinfomsg	ifm;
+	char			buf[1024];
+};
+
+/* Messages collected between mrp_netlink_begin and mrp_netlink_commit. They
+ * are sent to the kernel with one sendmsg call.
+ */
+#define MRP_NL_TXN_MAX		16
+
+struct mrp_nl_txn_msg {
+	struct request		req;
+	enum mrp_netlink_op	op;
+	uint32_t		br_ifindex;
+	uint32_t		ring_nr;
+	uint32_t		ifindex;
+};
+
+static __thread struct mrp_nl_txn {
+	int			depth;
+	int			count;
+	/* first error of the messages sent because the transaction was full */
+	int			err;
+	struct mrp_nl_txn_msg	msgs[MRP_NL_TXN_MAX];
+	struct iovec		iov[MRP_NL_TXN_MAX];
+} mrp_nl_txn;
+
+static __thread uint64_t nl_async_sent;
+static __thread uint64_t nl_async_errors;
+static __thread uint64_t nl_async_sync;
+static __thread uint64_t nl_async_pending;
+static __thread uint64_t nl_async_latency_max;
+static __thread uint64_t nl_txn_commits;
+static __thread uint64_t nl_txn_msgs;
+static __thread uint64_t nl_avoided;
+static __thread uint64_t nl_drift;
+static __thread uint64_t ring_open_count;
+/* set by the loop that handled the last ring open */
+static uint64_t ring_open_last;
+static __thread uint64_t ring_open_max;
+static __thread uint64_t fdb_migrations;
+static __thread uint64_t fdb_migrated;
+static __thread uint64_t fdb_migrate_latency_max;
+
+static int mrp_nl_txn_send(int *results, int size);
+static int mrp_nl_txn_send_async(void);
+static void mrp_nl_async_resume(void);
+
+/* The FDB flushes are collected in the ports and sent together when the
+ * window expires. The ports that wait for the window are queued on
+ * mrp_nl_flush_list, then on mrp_nl_flush_sending until all their requests
+ * are sent.
+ */
+static __thread struct list_head mrp_nl_flush_list;
+static __thread struct list_head mrp_nl_flush_sending;
+/* Above this number of vlans, the entries of the port are deleted with one
+ * request instead of one request per vlan
+ */
+#define MRP_NL_FLUSH_VLANS_MAX	8
+static __thread ev_timer mrp_nl_flush_watcher;
+/* coalescing window in ms, 0 means until the end of the loop iteration */
+static uint32_t mrp_nl_flush_window;
+/* cleared when the kernel doesn't support the bulk delete of FDB entries */
+static __thread bool mrp_nl_flush_bulk = true;
+
+static void mrp_nl_flush_queue(uint32_t ifindex, const uint8_t *vlans);
 
 static LIST_HEAD(mrp_rings);
 
@@ -29,12 +153,6 @@ struct mrp_ring {
 	uint32_t s_ifindex;
 };
 
-struct request {
-	struct nlmsghdr		n;
-	struct ifinfomsg	ifm;
-	char			buf[1024];
-};
-
 static void mrp_nl_bridge_prepare(uint32_t ifindex, int cmd, struct request *req,
 				  struct rtattr **afspec, struct rtattr **afmrp,
 				  struct rtattr **af_submrp, int mrp_attr)
@@ -74,20 +192,662 @@ static void mrp_nl_port_prepare(struct mrp_port *port, int cmd,
 				  mrp_attr | NLA_F_NESTED);
 }
 
+/* Add a copy of the message to the current transaction. If the transaction is
+ * full, then the collected messages are sent without waiting for the ACKs and
+ * the transaction continues. Their errors are reported by mrp_netlink_failed.
+ */
+static int mrp_nl_txn_add(struct nlmsghdr *n, struct mrp *mrp,
+			  uint32_t ifindex, enum mrp_netlink_op op)
+{
+	struct mrp_nl_txn_msg *msg;
+	int err;
+
+	if (mrp_nl_txn.count == MRP_NL_TXN_MAX) {
+		if (rth_async.fd < 0)
+			err = mrp_nl_txn_send(NULL, 0);
+		else
+			err = mrp_nl_txn_send_async();
+		if (err && !mrp_nl_txn.err)
+			mrp_nl_txn.err = err;
+	}
+
+	msg = &mrp_nl_txn.msgs[mrp_nl_txn.count++];
+	memcpy(&msg->req, n, n->nlmsg_len);
+	msg->op = op;
+	msg->br_ifindex = mrp ? mrp->ifindex : 0;
+	msg->ring_nr = mrp ? mrp->ring_nr : 0;
+	msg->ifindex = ifindex;
+
+	return 0;
+}
+
+static struct mrp_port_flush *mrp_nl_flush_find(uint32_t ifindex)
+{
+	struct mrp_port *p = mrp_get_port(ifindex);
+
+	return p ? &p->flush : NULL;
+}
+
+static void mrp_nl_flush_done(uint32_t ifindex, enum mrp_netlink_op op,
+			      int err)
+{
+	struct mrp_port_flush *flush;
+	uint64_t latency;
+
+	if (op != MRP_NETLINK_FLUSH && op != MRP_NETLINK_FLUSH_VLAN)
+		return;
+
+	/* Older kernels reject RTM_DELNEIGH without an address */
+	if (op == MRP_NETLINK_FLUSH_VLAN && err) {
+		if (err == -EINVAL || err == -EOPNOTSUPP) {
+			if (mrp_nl_flush_bulk)
+				pr_info("bulk FDB delete is not supported");
+			mrp_nl_flush_bulk = false;
+		}
+		mrp_nl_flush_queue(ifindex, NULL);
+	}
+
+	flush = mrp_nl_flush_find(ifindex);
+	if (!flush || !flush->inflight || --flush->inflight)
+		return;
+
+	latency = get_ns() - flush->sent_ns;
+
+	flush->stats.latency_last = latency;
+	if (latency > flush->stats.latency_max)
+		flush->stats.latency_max = latency;
+}
+
+/* Called when the kernel acked the unblock of a port after a ring open, with
+ * the lock of the instance held
+ */
+static void mrp_nl_unblock_acked(struct mrp *mrp, uint32_t ifindex)
+{
+	uint64_t latency = get_ns() - mrp->ring_open_ns;
+
+	ring_open_count++;
+	__atomic_store_n(&ring_open_last, latency, __ATOMIC_RELAXED);
+	if (latency > ring_open_max)
+		ring_open_max = latency;
+
+	pr_info("ring open: port %d unblocked after %llu us", ifindex,
+		(unsigned long long)latency / 1000);
+}
+
+/* Send the request on rth and wait for the ACK. The caller holds the lock of
+ * the instance, if there is one.
+ */
+static int mrp_nl_talk(struct nlmsghdr *n, struct mrp *mrp, uint32_t ifindex,
+		       enum mrp_netlink_op op)
+{
+	int err;
+
+	err = rtnl_talk(&rth, n, NULL);
+	if (err) {
+		err = errno ? -errno : err;
+		pr_err("netlink request %d on ifindex %d failed: %d", op,
+		       ifindex, err);
+		if (mrp)
+			mrp_netlink_failed(mrp, ifindex, op, err);
+		mrp_nl_flush_done(ifindex, op, err);
+		return err;
+	}
+
+	if (op == MRP_NETLINK_UNBLOCK)
+		mrp_nl_unblock_acked(mrp, ifindex);
+	mrp_nl_flush_done(ifindex, op, 0);
+
+	return 0;
+}
+
 static int mrp_nl_terminate(struct request *req, struct rtattr *afspec,
-			    struct rtattr *afmrp, struct rtattr *af_submrp)
+			    struct rtattr *afmrp, struct rtattr *af_submrp,
+			    struct mrp *mrp, enum mrp_netlink_op op)
+{
+	addattr_nest_end(&req->n, af_submrp);
+	addattr_nest_end(&req->n, afmrp);
+	addattr_nest_end(&req->n, afspec);
+
+	if (mrp_nl_txn.depth)
+		return mrp_nl_txn_add(&req->n, mrp, req->ifm.ifi_index, op);
+
+	return mrp_nl_talk(&req->n, mrp, req->ifm.ifi_index, op);
+}
+
+/* Returns how many requests can be queued on rth_async, up to max, before
+ * one of them would need the pending entry of a request that is not acked
+ */
+static int mrp_nl_async_room(int max)
+{
+	int i;
+
+	if (rth_async.fd < 0)
+		return 0;
+
+	for (i = 0; i < max; ++i)
+		if (mrp_nl_pending[(rth_async.seq + 1 + i) %
+				   MRP_NL_PENDING_MAX].used)
+			break;
+
+	return i;
+}
+
+static void mrp_nl_pending_add(uint32_t seq, enum mrp_netlink_op op,
+			       uint32_t br_ifindex, uint32_t ring_nr,
+			       uint32_t ifindex, uint64_t now)
+{
+	struct mrp_nl_pending *pending;
+
+	pending = &mrp_nl_pending[seq % MRP_NL_PENDING_MAX];
+	pending->used = true;
+	pending->seq = seq;
+	pending->op = op;
+	pending->br_ifindex = br_ifindex;
+	pending->ring_nr = ring_nr;
+	pending->ifindex = ifindex;
+	pending->sent = now;
+
+	nl_async_sent++;
+	nl_async_pending++;
+}
+
+/* Reports a request that couldn't be queued on rth_async as failed, so that
+ * the value is sent again. As in mrp_nl_txn_send, the lock of the instance is
+ * not taken here, the caller runs on the loop that owns the instance.
+ */
+static void mrp_nl_async_failed(uint32_t br_ifindex, uint32_t ring_nr,
+				uint32_t ifindex, enum mrp_netlink_op op,
+				int err)
+{
+	struct mrp *mrp;
+
+	nl_async_errors++;
+	pr_err("netlink request %d on ifindex %d not sent: %d", op, ifindex,
+	       err);
+
+	mrp_nl_flush_done(ifindex, op, err);
+
+	mrp = mrp_find(br_ifindex, ring_nr);
+	if (mrp)
+		mrp_netlink_failed(mrp, ifindex, op, err);
+}
+
+/* Queue the request on rth_async. Its ACK is matched by the sequence number
+ * in mrp_nl_async_rcv. Returns -EAGAIN if there is no free pending entry or
+ * if the socket is full, then nothing is sent.
+ */
+/* Returns true if a bulk request may take a pending entry */
+static bool mrp_nl_async_bulk_room(void)
+{
+	return nl_async_pending + MRP_NL_PENDING_RESERVE < MRP_NL_PENDING_MAX &&
+	       mrp_nl_async_room(1);
+}
+
+static int mrp_nl_async_queue(struct nlmsghdr *n, uint32_t br_ifindex,
+			      uint32_t ring_nr, uint32_t ifindex,
+			      enum mrp_netlink_op op)
 {
+	uint32_t seq = rth_async.seq + 1;
+
+	if (!mrp_nl_async_room(1))
+		return -EAGAIN;
+
+	n->nlmsg_seq = seq;
+	n->nlmsg_flags |= NLM_F_ACK;
+
+	if (send(rth_async.fd, n, n->nlmsg_len, 0) < 0) {
+		n->nlmsg_flags &= ~NLM_F_ACK;
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return -EAGAIN;
+		pr_err("netlink async send failed: %d", errno);
+		return -errno;
+	}
+
+	rth_async.seq = seq;
+	mrp_nl_pending_add(seq, op, br_ifindex, ring_nr, ifindex,
+			   get_ns());
+
+	return 0;
+}
+
+/* Send the request without waiting for the ACK. If the request can't be
+ * queued, then it is reported as failed, the loop doesn't wait for the
+ * kernel. Only if the async socket couldn't be opened, the request is sent on
+ * rth and the function waits for the ACK.
+ */
+static int mrp_nl_send_async(struct nlmsghdr *n, struct mrp *mrp,
+			     uint32_t ifindex, enum mrp_netlink_op op)
+{
+	uint32_t br_ifindex = mrp ? mrp->ifindex : 0;
+	uint32_t ring_nr = mrp ? mrp->ring_nr : 0;
 	int err;
 
+	if (mrp_nl_txn.depth)
+		return mrp_nl_txn_add(n, mrp, ifindex, op);
+
+	if (rth_async.fd < 0) {
+		nl_async_sync++;
+		return mrp_nl_talk(n, mrp, ifindex, op);
+	}
+
+	err = mrp_nl_async_queue(n, br_ifindex, ring_nr, ifindex, op);
+	if (err)
+		mrp_nl_async_failed(br_ifindex, ring_nr, ifindex, op, err);
+
+	return err;
+}
+
+static int mrp_nl_terminate_async(struct request *req, struct rtattr *afspec,
+				  struct rtattr *afmrp,
+				  struct rtattr *af_submrp, struct mrp *mrp,
+				  enum mrp_netlink_op op)
+{
 	addattr_nest_end(&req->n, af_submrp);
 	addattr_nest_end(&req->n, afmrp);
 	addattr_nest_end(&req->n, afspec);
 
-	err = rtnl_talk(&rth, &req->n, NULL);
+	return mrp_nl_send_async(&req->n, mrp, req->ifm.ifi_index, op);
+}
+
+/* Starts a dump, the request is already built by one of the rtnl_*dump_req
+ * functions on rth_async
+ */
+static void mrp_nl_dump_start(int (*entry)(struct nlmsghdr *n, void *arg),
+			      void (*done)(int err))
+{
+	mrp_nl_dump.active = true;
+	mrp_nl_dump.seq = rth_async.dump;
+	mrp_nl_dump.entry = entry;
+	mrp_nl_dump.done = done;
+}
+
+static bool mrp_nl_dump_busy(void)
+{
+	return rth_async.fd < 0 || mrp_nl_dump.active;
+}
+
+static void mrp_nl_dump_end(int err)
+{
+	if (!mrp_nl_dump.active)
+		return;
+
+	mrp_nl_dump.active = false;
+	mrp_nl_dump.done(err);
+}
+
+static void mrp_nl_dump_rcv(struct nlmsghdr *n)
+{
+	struct nlmsgerr *err;
+
+	switch (n->nlmsg_type) {
+	case NLMSG_DONE:
+		mrp_nl_dump_end(0);
+		break;
+	case NLMSG_ERROR:
+		err = NLMSG_DATA(n);
+		if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*err)))
+			mrp_nl_dump_end(-EINVAL);
+		else
+			mrp_nl_dump_end(err->error ? err->error : -EINVAL);
+		break;
+	default:
+		mrp_nl_dump.entry(n, NULL);
+		break;
+	}
+}
+
+static void mrp_nl_async_complete(struct nlmsghdr *n)
+{
+	struct mrp_nl_pending *pending;
+	struct nlmsgerr *err;
+	uint64_t latency;
+	struct mrp *mrp;
+
+	if (mrp_nl_dump.active && n->nlmsg_seq == mrp_nl_dump.seq)
+		return mrp_nl_dump_rcv(n);
+
+	if (n->nlmsg_type != NLMSG_ERROR)
+		return;
+
+	if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*err)))
+		return;
+
+	pending = &mrp_nl_pending[n->nlmsg_seq % MRP_NL_PENDING_MAX];
+	if (!pending->used || pending->seq != n->nlmsg_seq)
+		return;
+
+	pending->used = false;
+	nl_async_pending--;
+
+	latency = get_ns() - pending->sent;
+	if (latency > nl_async_latency_max)
+		nl_async_latency_max = latency;
+
+	err = NLMSG_DATA(n);
+	mrp_nl_flush_done(pending->ifindex, pending->op, err->error);
+
+	if (!err->error && pending->op != MRP_NETLINK_UNBLOCK)
+		return;
+
+	if (err->error) {
+		nl_async_errors++;
+		pr_err("netlink request %d on ifindex %d failed: %d",
+		       pending->op, pending->ifindex, err->error);
+	}
+
+	/* The instance may be deleted in the meantime */
+	mrp = mrp_find(pending->br_ifindex, pending->ring_nr);
+	if (!mrp)
+		return;
+
+	pthread_mutex_lock(&mrp->lock);
+	if (err->error)
+		mrp_netlink_failed(mrp, pending->ifindex, pending->op,
+				   err->error);
+	else
+		mrp_nl_unblock_acked(mrp, pending->ifindex);
+	pthread_mutex_unlock(&mrp->lock);
+}
+
+static void mrp_nl_async_rcv(EV_P_ ev_io *w, int revents)
+{
+	struct nlmsghdr *n;
+	int len, i;
+
+	/* The watcher is called again if more is pending */
+	for (i = 0; i < MRP_NL_ASYNC_BUDGET; ++i) {
+		len = recv(rth_async.fd, mrp_nl_buf,
+			   sizeof(mrp_nl_buf), MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			/* Some ACKs were lost, don't wait for them anymore */
+			if (errno == ENOBUFS) {
+				pr_err("netlink async receive overrun");
+				memset(mrp_nl_pending, 0,
+				       sizeof(mrp_nl_pending));
+				nl_async_pending = 0;
+				mrp_nl_dump_end(-ENOBUFS);
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				pr_err("netlink async receive failed: %d",
+				       errno);
+			break;
+		}
+
+		for (n = (struct nlmsghdr *)mrp_nl_buf; NLMSG_OK(n, len);
+		     n = NLMSG_NEXT(n, len))
+			mrp_nl_async_complete(n);
+	}
+
+	/* The ACKs freed pending entries for the bulk requests */
+	mrp_nl_async_resume();
+}
+
+static int mrp_nl_async_init(void)
+{
+	int one = 1;
+
+	if (rtnl_open(&rth_async, 0) < 0) {
+		pr_err("Cannot open async rtnetlink");
+		return -1;
+	}
+
+	/* Don't echo the request in the error messages */
+	setsockopt(rth_async.fd, SOL_NETLINK, NETLINK_CAP_ACK, &one,
+		   sizeof(one));
+
+	if (fcntl(rth_async.fd, F_SETFL, O_NONBLOCK) < 0) {
+		pr_err("fcntl set nonblock failed: %d", errno);
+		rtnl_close(&rth_async);
+		rth_async.fd = -1;
+		return -1;
+	}
+
+	ev_io_init(&mrp_nl_async_watcher, mrp_nl_async_rcv, rth_async.fd,
+		   EV_READ);
+	ev_io_start(mrp_nl_loop, &mrp_nl_async_watcher);
+
+	return 0;
+}
+
+/* Start to collect the netlink messages instead of sending them. Transactions
+ * can be nested, the messages are sent when the outermost one is committed.
+ */
+void mrp_netlink_begin(void)
+{
+	mrp_nl_txn.depth++;
+}
+
+static int mrp_nl_txn_sendmsg(int fd, int count)
+{
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	struct msghdr msg = {
+		.msg_name = &nladdr,
+		.msg_namelen = sizeof(nladdr),
+		.msg_iov = mrp_nl_txn.iov,
+		.msg_iovlen = count,
+	};
+
+	if (sendmsg(fd, &msg, 0) < 0) {
+		pr_err("netlink transaction send failed: %d", errno);
+		return -errno;
+	}
+
+	nl_txn_commits++;
+	nl_txn_msgs += count;
+
+	return 0;
+}
+
+/* Send the collected messages and wait for all the ACKs. The kernel handles
+ * each message on its own, so a failed message doesn't stop the next ones.
+ * Returns the first error.
+ */
+static int mrp_nl_txn_send(int *results, int size)
+{
+	int count = mrp_nl_txn.count;
+	struct mrp_nl_txn_msg *msg;
+	struct nlmsgerr *nlerr;
+	struct mrp *mrp;
+	int acked = 0, ret = 0;
+	struct nlmsghdr *n;
+	uint32_t first;
+	int i, len;
+
+	mrp_nl_txn.count = 0;
+	if (!count)
+		return 0;
+
+	first = rth.seq + 1;
+	for (i = 0; i < count; ++i) {
+		n = &mrp_nl_txn.msgs[i].req.n;
+		n->nlmsg_seq = ++rth.seq;
+		n->nlmsg_flags |= NLM_F_ACK;
+
+		mrp_nl_txn.iov[i].iov_base = n;
+		mrp_nl_txn.iov[i].iov_len = n->nlmsg_len;
+
+		if (results && i < size)
+			results[i] = 0;
+	}
+
+	ret = mrp_nl_txn_sendmsg(rth.fd, count);
+	if (ret)
+		return ret;
+
+	while (acked < count) {
+		len = recv(rth.fd, mrp_nl_buf, sizeof(mrp_nl_buf), 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			pr_err("netlink transaction receive failed: %d",
+			       errno);
+			return -errno;
+		}
+
+		for (n = (struct nlmsghdr *)mrp_nl_buf; NLMSG_OK(n, len);
+		     n = NLMSG_NEXT(n, len)) {
+			if (n->nlmsg_type != NLMSG_ERROR)
+				continue;
+
+			i = n->nlmsg_seq - first;
+			if (i < 0 || i >= count)
+				continue;
+
+			acked++;
+
+			msg = &mrp_nl_txn.msgs[i];
+			nlerr = NLMSG_DATA(n);
+			mrp_nl_flush_done(msg->ifindex, msg->op, nlerr->error);
+			if (!nlerr->error)
+				continue;
+
+			pr_err("netlink request %d on ifindex %d failed: %d",
+			       msg->op, msg->ifindex, nlerr->error);
+
+			/* The caller holds the lock of the instance or, for the
+			 * watchdog refreshes, runs in the loop thread
+			 */
+			mrp = mrp_find(msg->br_ifindex, msg->ring_nr);
+			if (mrp)
+				mrp_netlink_failed(mrp, msg->ifindex, msg->op,
+						   nlerr->error);
+
+			if (results && i < size)
+				results[i] = nlerr->error;
+			if (!ret)
+				ret = nlerr->error;
+		}
+	}
+
+	return ret;
+}
+
+/* Send the messages collected since mrp_netlink_begin and wait for the ACKs.
+ * If results is not NULL, the result of the message i is stored in results[i].
+ * Returns the first error.
+ */
+int mrp_netlink_commit(int *results, int size)
+{
+	int err;
+
+	if (--mrp_nl_txn.depth)
+		return 0;
+
+	err = mrp_nl_txn_send(results, size);
+	if (mrp_nl_txn.err) {
+		err = mrp_nl_txn.err;
+		mrp_nl_txn.err = 0;
+	}
+
+	return err;
+}
+
+/* Send the collected messages on rth_async with one sendmsg call. If they
+ * can't all be queued, none is sent and all of them are reported as failed,
+ * the loop never waits for the kernel here.
+ */
+static int mrp_nl_txn_send_async(void)
+{
+	int count = mrp_nl_txn.count;
+	struct mrp_nl_txn_msg *msg;
+	uint64_t now;
+	int i, err;
+
+	mrp_nl_txn.count = 0;
+	if (!count)
+		return 0;
+
+	/* All the messages need a free pending entry */
+	if (mrp_nl_async_room(count) < count) {
+		err = -EAGAIN;
+		goto failed;
+	}
+
+	for (i = 0; i < count; ++i) {
+		msg = &mrp_nl_txn.msgs[i];
+		msg->req.n.nlmsg_seq = rth_async.seq + 1 + i;
+		msg->req.n.nlmsg_flags |= NLM_F_ACK;
+
+		mrp_nl_txn.iov[i].iov_base = &msg->req.n;
+		mrp_nl_txn.iov[i].iov_len = msg->req.n.nlmsg_len;
+	}
+
+	err = mrp_nl_txn_sendmsg(rth_async.fd, count);
 	if (err)
-		return err;
+		goto failed;
+
+	now = get_ns();
+	for (i = 0; i < count; ++i) {
+		msg = &mrp_nl_txn.msgs[i];
+		mrp_nl_pending_add(++rth_async.seq, msg->op, msg->br_ifindex,
+				   msg->ring_nr, msg->ifindex, now);
+	}
 
 	return 0;
+
+failed:
+	for (i = 0; i < count; ++i) {
+		msg = &mrp_nl_txn.msgs[i];
+		mrp_nl_async_failed(msg->br_ifindex, msg->ring_nr,
+				    msg->ifindex, msg->op, err);
+	}
+
+	return err;
+}
+
+/* Send the messages collected since mrp_netlink_begin without waiting for the
+ * ACKs. Errors are reported through mrp_netlink_failed. Only if the async
+ * socket couldn't be opened, the function waits for the ACKs.
+ */
+int mrp_netlink_commit_async(void)
+{
+	int count = mrp_nl_txn.count;
+
+	if (--mrp_nl_txn.depth)
+		return 0;
+
+	mrp_nl_txn.err = 0;
+	if (!count)
+		return 0;
+
+	if (rth_async.fd < 0) {
+		nl_async_sync += count;
+		return mrp_nl_txn_send(NULL, 0);
+	}
+
+	return mrp_nl_txn_send_async();
+}
+
+static void mrp_nl_stats_max(uint64_t *max, uint64_t val)
+{
+	if (val > *max)
+		*max = val;
+}
+
+/* Adds the counters of the loop to stats */
+void mrp_netlink_get_stats(struct mrp_stats *stats)
+{
+	stats->nl_async_sent += nl_async_sent;
+	stats->nl_async_errors += nl_async_errors;
+	stats->nl_async_sync += nl_async_sync;
+	stats->nl_async_pending += nl_async_pending;
+	mrp_nl_stats_max(&stats->nl_async_latency_max, nl_async_latency_max);
+	stats->nl_txn_commits += nl_txn_commits;
+	stats->nl_txn_msgs += nl_txn_msgs;
+	stats->nl_avoided += nl_avoided;
+	stats->nl_drift += nl_drift;
+	stats->ring_open_count += ring_open_count;
+	stats->ring_open_last = __atomic_load_n(&ring_open_last,
+						__ATOMIC_RELAXED);
+	mrp_nl_stats_max(&stats->ring_open_max, ring_open_max);
+	stats->fdb_migrations += fdb_migrations;
+	stats->fdb_migrated += fdb_migrated;
+	mrp_nl_stats_max(&stats->fdb_migrate_latency_max,
+			 fdb_migrate_latency_max);
+
 }
 
 static int get_bridges(struct nlmsghdr *n, void *arg)
@@ -141,20 +901,411 @@ static int get_bridges(struct nlmsghdr *n, void *arg)
 	return 0;
 }
 
-static int mrp_netlink_clear(void)
+/* Every MRP_NL_RECONCILE_INTERVAL seconds the bridge ports are dumped and the
+ * kernel values are compared with the last values that were sent. The values
+ * that are different are sent again by mrp_offload_repair.
+ */
+#define MRP_NL_RECONCILE_INTERVAL	10
+
+static __thread ev_timer mrp_nl_reconcile_watcher;
+
+static bool mrp_nl_differs(uint32_t hw, struct rtattr *attr)
 {
-	struct mrp_ring *mrp_ring;
+	if (hw == MRP_HW_UNKNOWN || !attr)
+		return false;
+
+	return rta_getattr_u32(attr) != hw;
+}
+
+static void mrp_nl_reconcile_port(struct ifinfomsg *ifi,
+				  struct rtattr *protinfo)
+{
+	struct rtattr *prtb[IFLA_BRPORT_MAX + 1];
+	struct mrp_port *p;
+	uint8_t state;
+
+	p = mrp_get_port(ifi->ifi_index);
+	if (!p || !p->mrp)
+		return;
+
+	parse_rtattr_nested(prtb, IFLA_BRPORT_MAX, protinfo);
+	if (!prtb[IFLA_BRPORT_STATE])
+		return;
+
+	state = rta_getattr_u8(prtb[IFLA_BRPORT_STATE]);
+
+	pthread_mutex_lock(&p->mrp->lock);
+
+	/* The kernel disables the port when the link is down */
+	if (p->operstate != IF_OPER_UP || p->hw_drift)
+		goto out;
+
+	if ((p->hw_state == BR_MRP_PORT_STATE_FORWARDING &&
+	     state != BR_STATE_FORWARDING) ||
+	    (p->hw_state == BR_MRP_PORT_STATE_BLOCKED &&
+	     state != BR_STATE_BLOCKING)) {
+		p->hw_drift = true;
+		nl_drift++;
+	}
+
+out:
+	pthread_mutex_unlock(&p->mrp->lock);
+}
+
+static void mrp_nl_reconcile_mrp(uint32_t br_ifindex, struct rtattr **infotb)
+{
+	struct mrp *mrp;
+
+	mrp = mrp_find(br_ifindex,
+		       rta_getattr_u32(infotb[IFLA_BRIDGE_MRP_INFO_RING_ID]));
+	if (!mrp)
+		return;
+
+	pthread_mutex_lock(&mrp->lock);
+
+	if (!mrp->hw_ring_drift &&
+	    (mrp_nl_differs(mrp->hw_ring_state,
+			    infotb[IFLA_BRIDGE_MRP_INFO_RING_STATE]) ||
+	     mrp_nl_differs(mrp->hw_ring_role,
+			    infotb[IFLA_BRIDGE_MRP_INFO_RING_ROLE]))) {
+		mrp->hw_ring_drift = true;
+		nl_drift++;
+	}
+
+	if (!mrp->hw_in_drift &&
+	    (mrp_nl_differs(mrp->hw_in_state,
+			    infotb[IFLA_BRIDGE_MRP_INFO_IN_STATE]) ||
+	     mrp_nl_differs(mrp->hw_in_role,
+			    infotb[IFLA_BRIDGE_MRP_INFO_IN_ROLE]))) {
+		mrp->hw_in_drift = true;
+		nl_drift++;
+	}
+
+	pthread_mutex_unlock(&mrp->lock);
+}
+
+static int mrp_nl_reconcile_link(struct nlmsghdr *n, void *arg)
+{
+	struct rtattr *mrp_infotb[IFLA_BRIDGE_MRP_INFO_MAX + 1];
+	struct rtattr *aftb[IFLA_BRIDGE_MAX + 1];
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr *tb[IFLA_MAX + 1];
+	int len = n->nlmsg_len;
+	struct rtattr *i, *list;
+	int rem;
+
+	len -= NLMSG_LENGTH(sizeof(*ifi));
+	if (len < 0) {
+		pr_err("Message too short!");
+		return -1;
+	}
+
+	if (ifi->ifi_family != AF_BRIDGE)
+		return 0;
+
+	parse_rtattr_flags(tb, IFLA_MAX, IFLA_RTA(ifi), len, NLA_F_NESTED);
+
+	if (tb[IFLA_PROTINFO])
+		mrp_nl_reconcile_port(ifi, tb[IFLA_PROTINFO]);
+
+	if (!tb[IFLA_AF_SPEC] || !tb[IFLA_MASTER])
+		return 0;
+
+	parse_rtattr_nested(aftb, IFLA_BRIDGE_MAX, tb[IFLA_AF_SPEC]);
+	if (!aftb[IFLA_BRIDGE_MRP])
+		return 0;
+
+	list = aftb[IFLA_BRIDGE_MRP];
+	rem = RTA_PAYLOAD(list);
+	for (i = RTA_DATA(list); RTA_OK(i, rem); i = RTA_NEXT(i, rem)) {
+		if (i->rta_type != IFLA_BRIDGE_MRP_INFO)
+			continue;
+
+		parse_rtattr_nested(mrp_infotb, IFLA_BRIDGE_MRP_INFO_MAX, i);
+		if (!mrp_infotb[IFLA_BRIDGE_MRP_INFO_RING_ID])
+			continue;
+
+		mrp_nl_reconcile_mrp(rta_getattr_u32(tb[IFLA_MASTER]),
+				     mrp_infotb);
+	}
+
+	return 0;
+}
+
+static void mrp_nl_reconcile_done(int err)
+{
+	if (err) {
+		pr_err("Cannot dump the bridge ports: %d", err);
+		return;
+	}
+
+	mrp_offload_repair();
+}
+
+/* The ports are dumped on rth_async, so the loop doesn't wait for the kernel.
+ * If another dump is running, the ports are checked at the next interval.
+ */
+static void mrp_nl_reconcile(EV_P_ ev_timer *w, int revents)
+{
+	if (mrp_nl_dump_busy())
+		return;
+
+	if (rtnl_linkdump_req_filter(&rth_async, PF_BRIDGE,
+				     RTEXT_FILTER_MRP) < 0) {
+		pr_err("Cannot rtnl_linkdump_req_filter");
+		return;
+	}
+
+	mrp_nl_dump_start(mrp_nl_reconcile_link, mrp_nl_reconcile_done);
+}
+
+/* Send a request of a flush. The requests are not collected in a transaction
+ * because a flush can have many of them. Returns -EAGAIN if the pending
+ * entries are full, then the request is sent again when the ACKs free them.
+ */
+static int mrp_nl_flush_request(struct nlmsghdr *n, uint32_t ifindex,
+				enum mrp_netlink_op op)
+{
+	if (rth_async.fd < 0) {
+		nl_async_sync++;
+		mrp_nl_talk(n, NULL, ifindex, op);
+		return 0;
+	}
+
+	if (!mrp_nl_async_bulk_room())
+		return -EAGAIN;
+
+	return mrp_nl_async_queue(n, 0, 0, ifindex, op);
+}
+
+static int mrp_nl_flush_send(uint32_t ifindex)
+{
+	struct request req = { 0 };
+	struct rtattr *protinfo;
+
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.n.nlmsg_flags = NLM_F_REQUEST;
+	req.n.nlmsg_type = RTM_SETLINK;
+	req.ifm.ifi_family = PF_BRIDGE;
+	req.ifm.ifi_index = ifindex;
+
+	protinfo = addattr_nest(&req.n, sizeof(req),
+				IFLA_PROTINFO | NLA_F_NESTED);
+	addattr(&req.n, 1024, IFLA_BRPORT_FLUSH);
+
+	addattr_nest_end(&req.n, protinfo);
+
+	return mrp_nl_flush_request(&req.n, ifindex, MRP_NETLINK_FLUSH);
+}
+
+/* Delete the entries of the port that are learned on the vlan, or on all the
+ * vlans if vid is 0. The static and the permanent entries are kept.
+ */
+static int mrp_nl_flush_vlan_send(uint32_t ifindex, uint16_t vid)
+{
+	struct {
+		struct nlmsghdr	n;
+		struct ndmsg	ndm;
+		char		buf[256];
+	} req = { 0 };
+
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg));
+	req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_BULK;
+	req.n.nlmsg_type = RTM_DELNEIGH;
+	req.ndm.ndm_family = PF_BRIDGE;
+	req.ndm.ndm_ifindex = ifindex;
+	req.ndm.ndm_flags = NTF_MASTER;
+	req.ndm.ndm_state = 0;
+
+	if (vid)
+		addattr16(&req.n, sizeof(req), NDA_VLAN, vid);
+	addattr16(&req.n, sizeof(req), NDA_NDM_STATE_MASK,
+		  NUD_PERMANENT | NUD_NOARP);
+
+	return mrp_nl_flush_request(&req.n, ifindex, MRP_NETLINK_FLUSH_VLAN);
+}
+
+static int mrp_nl_flush_vlan_count(const uint8_t *vlans)
+{
+	int i, count = 0;
+
+	for (i = 0; i < MRP_VLAN_BITMAP_LEN; ++i)
+		count += __builtin_popcount(vlans[i]);
+
+	return count;
+}
+
+/* Send the requests of the port that are not sent yet. Each vlan that is sent
+ * is removed from the port, so that after -EAGAIN the flush continues with
+ * the next one.
+ */
+static int mrp_nl_flush_port(struct mrp_port_flush *flush)
+{
+	uint32_t ifindex = flush->stats.ifindex;
+	int vid, err;
+
+	if (!flush->inflight)
+		flush->sent_ns = flush->queued_ns;
+
+	if (!mrp_nl_flush_bulk)
+		flush->all = true;
+
+	/* With many vlans, one request deletes the entries of all of them */
+	if (!flush->all &&
+	    mrp_nl_flush_vlan_count(flush->vlans) > MRP_NL_FLUSH_VLANS_MAX) {
+		flush->inflight++;
+		err = mrp_nl_flush_vlan_send(ifindex, 0);
+		if (err) {
+			flush->inflight--;
+			return err;
+		}
+
+		memset(flush->vlans, 0, sizeof(flush->vlans));
+		return 0;
+	}
+
+	if (flush->all) {
+		flush->inflight++;
+		err = mrp_nl_flush_send(ifindex);
+		if (err) {
+			flush->inflight--;
+			return err;
+		}
+
+		flush->all = false;
+		memset(flush->vlans, 0, sizeof(flush->vlans));
+		return 0;
+	}
+
+	for (vid = 1; vid < MRP_VLAN_N_VID; ++vid) {
+		if (!(flush->vlans[vid / 8] & (1 << (vid % 8))))
+			continue;
+
+		flush->inflight++;
+		err = mrp_nl_flush_vlan_send(ifindex, vid);
+		if (err) {
+			flush->inflight--;
+			return err;
+		}
+
+		flush->vlans[vid / 8] &= ~(1 << (vid % 8));
+	}
+
+	return 0;
+}
+
+/* Send the flushes of the ports whose window expired, as long as there are
+ * free pending entries. It is called again by mrp_nl_async_rcv when the ACKs
+ * free them, so the loop never waits for the kernel.
+ */
+static void mrp_nl_flush_resume(void)
+{
+	struct mrp_port_flush *flush, *tmp;
 	int err;
 
-	err = rtnl_linkdump_req_filter(&rth, PF_BRIDGE, RTEXT_FILTER_MRP);
+	list_for_each_entry_safe(flush, tmp, &mrp_nl_flush_sending, list) {
+		/* A failed request may queue the port again while sending */
+		do {
+			err = mrp_nl_flush_port(flush);
+		} while (!err && flush->all);
+
+		if (err == -EAGAIN)
+			return;
+		if (err) {
+			nl_async_errors++;
+			pr_err("Cannot flush port %d: %d", flush->stats.ifindex,
+			       err);
+		}
+
+		list_del_init(&flush->list);
+		flush->queued = false;
+		flush->stats.flushes++;
+	}
+}
+
+static void mrp_nl_flush_expired(EV_P_ ev_timer *w, int revents)
+{
+	list_splice_init(&mrp_nl_flush_list, mrp_nl_flush_sending.prev);
+	mrp_nl_flush_resume();
+}
+
+/* Add the port to the next flush. If vlans is NULL, then all the entries of
+ * the port are flushed.
+ */
+static void mrp_nl_flush_queue(uint32_t ifindex, const uint8_t *vlans)
+{
+	struct mrp_port_flush *flush;
+	int i;
+
+	/* Only the MRP ports have a flush state, others are flushed now */
+	flush = mrp_nl_flush_find(ifindex);
+	if (!flush) {
+		if (mrp_nl_flush_send(ifindex))
+			pr_err("Cannot flush port %d", ifindex);
+		return;
+	}
+
+	flush->stats.ifindex = ifindex;
+	flush->stats.requests++;
+
+	if (vlans)
+		for (i = 0; i < MRP_VLAN_BITMAP_LEN; ++i)
+			flush->vlans[i] |= vlans[i];
+	else
+		flush->all = true;
+
+	if (flush->queued)
+		return;
+
+	flush->queued = true;
+	flush->queued_ns = get_ns();
+	list_add_tail(&flush->list, &mrp_nl_flush_list);
+
+	if (!ev_is_active(&mrp_nl_flush_watcher)) {
+		ev_timer_set(&mrp_nl_flush_watcher,
+			     (ev_tstamp)mrp_nl_flush_window / 1000, 0.);
+		ev_timer_start(mrp_nl_loop, &mrp_nl_flush_watcher);
+	}
+}
+
+/* Called when the port is removed from its instance. The requests that wait
+ * for the ACKs are not counted anymore.
+ */
+void mrp_netlink_flush_cancel(struct mrp_port *p)
+{
+	list_del_init(&p->flush.list);
+	p->flush.queued = false;
+}
+
+void mrp_netlink_set_flush_window(uint32_t window)
+{
+	mrp_nl_flush_window = window;
+}
+
+/* Delete the instances that are left in the kernel. It is called once, before
+ * the loops start, so it uses its own socket.
+ */
+int mrp_netlink_clear(void)
+{
+	struct mrp_ring *mrp_ring, *tmp;
+	struct rtnl_handle crth;
+	int err;
+
+	if (rtnl_open(&crth, 0) < 0) {
+		pr_err("Cannot open rtnetlink");
+		return -1;
+	}
+
+	err = rtnl_linkdump_req_filter(&crth, PF_BRIDGE, RTEXT_FILTER_MRP);
 	if (err < 0) {
 		pr_err("Cannot rtnl_linkdump_req_filter");
+		rtnl_close(&crth);
 		return err;
 	}
 
-	rtnl_dump_filter(&rth, get_bridges, NULL);
+	rtnl_dump_filter(&crth, get_bridges, NULL);
 
-	list_for_each_entry(mrp_ring, &mrp_rings, list) {
+	list_for_each_entry_safe(mrp_ring, tmp, &mrp_rings, list) {
 		struct rtattr *afspec, *afmrp, *af_submrp;
 		struct request req = { 0 };
 
@@ -169,26 +1320,80 @@ static int mrp_netlink_clear(void)
 		addattr32(&req.n, sizeof(req), IFLA_BRIDGE_MRP_INSTANCE_S_IFINDEX,
 			  mrp_ring->s_ifindex);
 
-		mrp_nl_terminate(&req, afspec, afmrp, af_submrp);
+		addattr_nest_end(&req.n, af_submrp);
+		addattr_nest_end(&req.n, afmrp);
+		addattr_nest_end(&req.n, afspec);
+
+		if (rtnl_talk(&crth, &req.n, NULL) < 0)
+			pr_err("Cannot delete ring %d of bridge %d",
+			       mrp_ring->ring_id, mrp_ring->ifindex);
+
+		list_del(&mrp_ring->list);
+		free(mrp_ring);
 	}
 
+	rtnl_close(&crth);
+
 	return 0;
 }
 
+/* Open the sockets of the calling loop */
 int mrp_netlink_init(void)
 {
+	mrp_nl_loop = shard_loop();
+
 	if (rtnl_open(&rth, 0) < 0) {
 		pr_err("Cannot open rtnetlink");
 		return EXIT_FAILURE;
 	}
 
-	mrp_netlink_clear();
+	/* If it fails, all the requests wait for the ACK */
+	mrp_nl_async_init();
+
+	ev_timer_init(&mrp_nl_reconcile_watcher, mrp_nl_reconcile,
+		      MRP_NL_RECONCILE_INTERVAL, MRP_NL_RECONCILE_INTERVAL);
+	ev_timer_start(mrp_nl_loop, &mrp_nl_reconcile_watcher);
+
+	INIT_LIST_HEAD(&mrp_nl_flush_list);
+	INIT_LIST_HEAD(&mrp_nl_flush_sending);
+	ev_init(&mrp_nl_flush_watcher, mrp_nl_flush_expired);
 	return 0;
 }
 
 void mrp_netlink_uninit(void)
 {
+	ev_timer_stop(mrp_nl_loop, &mrp_nl_reconcile_watcher);
+	ev_timer_stop(mrp_nl_loop, &mrp_nl_flush_watcher);
+
+	if (rth_async.fd >= 0) {
+		ev_io_stop(mrp_nl_loop, &mrp_nl_async_watcher);
+		rtnl_close(&rth_async);
+		rth_async.fd = -1;
+	}
+	mrp_nl_dump.active = false;
+
 	rtnl_close(&rth);
+	rth.fd = -1;
+}
+
+/* The instance is added to or deleted from the kernel, so the values that were
+ * sent before are not valid anymore
+ */
+static void mrp_nl_shadow_reset(struct mrp *mrp)
+{
+	mrp->hw_ring_state = MRP_HW_UNKNOWN;
+	mrp->hw_ring_role = MRP_HW_UNKNOWN;
+	mrp->hw_in_state = MRP_HW_UNKNOWN;
+	mrp->hw_in_role = MRP_HW_UNKNOWN;
+	mrp->hw_ring_drift = false;
+	mrp->hw_in_drift = false;
+
+	if (mrp->p_port)
+		mrp->p_port->hw_state = MRP_HW_UNKNOWN;
+	if (mrp->s_port)
+		mrp->s_port->hw_state = MRP_HW_UNKNOWN;
+	if (mrp->i_port)
+		mrp->i_port->hw_state = MRP_HW_UNKNOWN;
 }
 
 int mrp_netlink_add(struct mrp *mrp, struct mrp_port *p, struct mrp_port *s,
@@ -197,6 +1402,8 @@ int mrp_netlink_add(struct mrp *mrp, struct mrp_port *p, struct mrp_port *s,
 	struct rtattr *afspec, *afmrp, *af_submrp;
 	struct request req = { 0 };
 
+	mrp_nl_shadow_reset(mrp);
+
 	mrp_nl_bridge_prepare(mrp->ifindex, RTM_SETLINK, &req, &afspec,
 			      &afmrp, &af_submrp, IFLA_BRIDGE_MRP_INSTANCE);
 
@@ -208,7 +1415,8 @@ int mrp_netlink_add(struct mrp *mrp, struct mrp_port *p, struct mrp_port *s,
 		  s->ifindex);
 	addattr16(&req.n, sizeof(req), IFLA_BRIDGE_MRP_INSTANCE_PRIO, prio);
 
-	return mrp_nl_terminate(&req, afspec, afmrp, af_submrp);
+	return mrp_nl_terminate(&req, afspec, afmrp, af_submrp, mrp,
+				MRP_NETLINK_CONFIG);
 }
 
 int mrp_netlink_del(struct mrp *mrp)
@@ -216,6 +1424,8 @@ int mrp_netlink_del(struct mrp *mrp)
 	struct rtattr *afspec, *afmrp, *af_submrp;
 	struct request req = { 0 };
 
+	mrp_nl_shadow_reset(mrp);
+
 	mrp_nl_bridge_prepare(mrp->ifindex, RTM_DELLINK, &req, &afspec, &afmrp,
 			      &af_submrp, IFLA_BRIDGE_MRP_INSTANCE);
 
@@ -226,23 +1436,48 @@ int mrp_netlink_del(struct mrp *mrp)
 	addattr32(&req.n, sizeof(req), IFLA_BRIDGE_MRP_INSTANCE_S_IFINDEX,
 		  mrp->s_port ? mrp->s_port->ifindex : 0);
 
-	return mrp_nl_terminate(&req, afspec, afmrp, af_submrp);
+	return mrp_nl_terminate(&req, afspec, afmrp, af_submrp, mrp,
+				MRP_NETLINK_CONFIG);
 }
 
-int mrp_port_netlink_set_state(struct mrp_port *p,
-			       enum br_mrp_port_state_type state)
+static int mrp_nl_port_set_state(struct mrp_port *p,
+				 enum br_mrp_port_state_type state,
+				 enum mrp_netlink_op op)
 {
 	struct rtattr *afspec, *afmrp, *af_submrp;
 	struct request req = { 0 };
 
 	p->state = state;
 
+	/* The kernel has already this state */
+	if (p->hw_state == state) {
+		nl_avoided++;
+		return 0;
+	}
+	p->hw_state = state;
+
 	mrp_nl_port_prepare(p, RTM_SETLINK, &req, &afspec, &afmrp,
 			    &af_submrp, IFLA_BRIDGE_MRP_PORT_STATE);
 
 	addattr32(&req.n, sizeof(req), IFLA_BRIDGE_MRP_PORT_STATE_STATE, state);
 
-	return mrp_nl_terminate(&req, afspec, afmrp, af_submrp);
+	return mrp_nl_terminate_async(&req, afspec, afmrp, af_submrp, p->mrp,
+				      op);
+}
+
+int mrp_port_netlink_set_state(struct mrp_port *p,
+			       enum br_mrp_port_state_type state)
+{
+	return mrp_nl_port_set_state(p, state, MRP_NETLINK_PORT_STATE);
+}
+
+/* Set the port to forwarding after a ring open. The time until the kernel acks
+ * it is measured from the notification of the ring open.
+ */
+int mrp_port_netlink_unblock(struct mrp_port *p)
+{
+	return mrp_nl_port_set_state(p, BR_MRP_PORT_STATE_FORWARDING,
+				     MRP_NETLINK_UNBLOCK);
 }
 
 int mrp_port_netlink_set_role(struct mrp_port *p,
@@ -258,7 +1493,8 @@ int mrp_port_netlink_set_role(struct mrp_port *p,
 
 	addattr32(&req.n, sizeof(req), IFLA_BRIDGE_MRP_PORT_ROLE_ROLE, role);
 
-	return mrp_nl_terminate(&req, afspec, afmrp, af_submrp);
+	return mrp_nl_terminate(&req, afspec, afmrp, af_submrp, p->mrp,
+				MRP_NETLINK_CONFIG);
 }
 
 int mrp_netlink_set_ring_state(struct mrp *mrp,
@@ -267,6 +1503,12 @@ int mrp_netlink_set_ring_state(struct mrp *mrp,
 	struct rtattr *afspec, *afmrp, *af_submrp;
 	struct request req = { 0 };
 
+	if (mrp->hw_ring_state == state) {
+		nl_avoided++;
+		return 0;
+	}
+	mrp->hw_ring_state = state;
+
 	mrp_nl_bridge_prepare(mrp->ifindex, RTM_SETLINK, &req, &afspec, &afmrp,
 			      &af_submrp, IFLA_BRIDGE_MRP_RING_STATE);
 
@@ -275,7 +1517,8 @@ int mrp_netlink_set_ring_state(struct mrp *mrp,
 	addattr32(&req.n, sizeof(req), IFLA_BRIDGE_MRP_RING_STATE_STATE,
 		  state);
 
-	return mrp_nl_terminate(&req, afspec, afmrp, af_submrp);
+	return mrp_nl_terminate_async(&req, afspec, afmrp, af_submrp, mrp,
+				      MRP_NETLINK_RING_STATE);
 }
 
 int mrp_netlink_set_ring_role(struct mrp *mrp, enum br_mrp_ring_role_type role)
@@ -285,18 +1528,25 @@ int mrp_netlink_set_ring_role(struct mrp *mrp, enum br_mrp_ring_role_type role)
 
 	mrp->ring_role = role;
 
-	mrp_nl_bridge_prepare(mrp->ifindex, RTM_SETLINK, &req, &afspec, &afmrp,
-			      &af_submrp, IFLA_BRIDGE_MRP_RING_ROLE);
-
 	if (mrp->mra_support)
 		role = BR_MRP_RING_ROLE_MRA;
 
+	if (mrp->hw_ring_role == role) {
+		nl_avoided++;
+		return 0;
+	}
+	mrp->hw_ring_role = role;
+
+	mrp_nl_bridge_prepare(mrp->ifindex, RTM_SETLINK, &req, &afspec, &afmrp,
+			      &af_submrp, IFLA_BRIDGE_MRP_RING_ROLE);
+
 	addattr32(&req.n, sizeof(req), IFLA_BRIDGE_MRP_RING_ROLE_RING_ID,
 		  mrp->ring_nr);
 	addattr32(&req.n, sizeof(req), IFLA_BRIDGE_MRP_RING_ROLE_ROLE,
 		  role);
 
-	return mrp_nl_terminate(&req, afspec, afmrp, af_submrp);
+	return mrp_nl_terminate(&req, afspec, afmrp, af_submrp, mrp,
+				MRP_NETLINK_RING_ROLE);
 }
 
 int mrp_netlink_send_ring_test(struct mrp *mrp, uint32_t interval, uint32_t max,
@@ -319,7 +1569,8 @@ int mrp_netlink_send_ring_test(struct mrp *mrp, uint32_t interval, uint32_t max,
 	addattr32(&req.n, sizeof(req), IFLA_BRIDGE_MRP_START_TEST_MONITOR,
 		  mrp->test_monitor);
 
-	return mrp_nl_terminate(&req, afspec, afmrp, af_submrp);
+	return mrp_nl_terminate_async(&req, afspec, afmrp, af_submrp, mrp,
+				      MRP_NETLINK_RING_TEST);
 }
 
 int mrp_netlink_set_in_state(struct mrp *mrp,
@@ -328,6 +1579,12 @@ int mrp_netlink_set_in_state(struct mrp *mrp,
 	struct rtattr *afspec, *afmrp, *af_submrp;
 	struct request req = { 0 };
 
+	if (mrp->hw_in_state == state) {
+		nl_avoided++;
+		return 0;
+	}
+	mrp->hw_in_state = state;
+
 	mrp_nl_bridge_prepare(mrp->ifindex, RTM_SETLINK, &req, &afspec, &afmrp,
 			      &af_submrp, IFLA_BRIDGE_MRP_IN_STATE);
 
@@ -336,7 +1593,8 @@ int mrp_netlink_set_in_state(struct mrp *mrp,
 	addattr32(&req.n, sizeof(req), IFLA_BRIDGE_MRP_IN_STATE_STATE,
 		  state);
 
-	return mrp_nl_terminate(&req, afspec, afmrp, af_submrp);
+	return mrp_nl_terminate_async(&req, afspec, afmrp, af_submrp, mrp,
+				      MRP_NETLINK_IN_STATE);
 }
 
 int mrp_netlink_set_in_role(struct mrp *mrp, enum br_mrp_in_role_type role)
@@ -346,6 +1604,12 @@ int mrp_netlink_set_in_role(struct mrp *mrp, enum br_mrp_in_role_type role)
 
 	mrp->in_role = role;
 
+	if (mrp->hw_in_role == role) {
+		nl_avoided++;
+		return 0;
+	}
+	mrp->hw_in_role = role;
+
 	mrp_nl_bridge_prepare(mrp->ifindex, RTM_SETLINK, &req, &afspec, &afmrp,
 			      &af_submrp, IFLA_BRIDGE_MRP_IN_ROLE);
 
@@ -358,7 +1622,8 @@ int mrp_netlink_set_in_role(struct mrp *mrp, enum br_mrp_in_role_type role)
 	addattr32(&req.n, sizeof(req), IFLA_BRIDGE_MRP_IN_ROLE_ROLE,
 		  role);
 
-	return mrp_nl_terminate(&req, afspec, afmrp, af_submrp);
+	return mrp_nl_terminate(&req, afspec, afmrp, af_submrp, mrp,
+				MRP_NETLINK_IN_ROLE);
 }
 
 int mrp_netlink_send_in_test(struct mrp *mrp, uint32_t interval, uint32_t max,
@@ -379,40 +1644,342 @@ int mrp_netlink_send_in_test(struct mrp *mrp, uint32_t interval, uint32_t max,
 	addattr32(&req.n, sizeof(req), IFLA_BRIDGE_MRP_START_IN_TEST_PERIOD,
 		  period);
 
-	return mrp_nl_terminate(&req, afspec, afmrp, af_submrp);
+	return mrp_nl_terminate_async(&req, afspec, afmrp, af_submrp, mrp,
+				      MRP_NETLINK_IN_TEST);
 }
 
-int mrp_netlink_flush(struct mrp *mrp)
-{
-	struct request req = { 0 };
-	struct rtattr *protinfo;
+/* When only one of the ring ports forwards, all the nodes of the ring are
+ * reachable through it. In that case the entries of the other ring port are
+ * moved to it instead of being flushed.
+ */
+#define MRP_NL_MIGRATE_MAX	4096
 
-	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
-	req.n.nlmsg_flags = NLM_F_REQUEST;
-	req.n.nlmsg_type = RTM_SETLINK;
-	req.ifm.ifi_family = PF_BRIDGE;
+struct mrp_nl_fdb {
+	uint8_t mac[ETH_ALEN];
+	uint16_t vid;
+};
 
-	protinfo = addattr_nest(&req.n, sizeof(req),
-				IFLA_PROTINFO | NLA_F_NESTED);
-	addattr(&req.n, 1024, IFLA_BRPORT_FLUSH);
+struct mrp_nl_migrate {
+	uint32_t br_ifindex;
+	uint32_t ring_nr;
+	uint32_t from;
+	uint32_t to;
+	uint64_t start;
+	bool flush_vlan;
+	uint8_t flush_vlans[MRP_VLAN_BITMAP_LEN];
+	int count;
+	bool overflow;
+	/* The entries are sent in chunks, as pending entries are free */
+	bool sending;
+	int sent;
+	struct mrp_nl_fdb fdbs[MRP_NL_MIGRATE_MAX];
+};
 
-	addattr_nest_end(&req.n, protinfo);
+static __thread struct mrp_nl_migrate mrp_nl_migrate;
+static bool mrp_nl_migrate_enabled;
+static __thread uint32_t mrp_nl_migrate_br;
 
-	req.ifm.ifi_index = mrp->p_port->ifindex;
-	if (rtnl_talk(&rth, &req.n, NULL) < 0)
-		return -1;
+static int mrp_nl_migrate_filter(struct nlmsghdr *n, int reqlen)
+{
+	return addattr32(n, reqlen, NDA_MASTER, mrp_nl_migrate_br);
+}
 
-	req.ifm.ifi_index = mrp->s_port->ifindex;
-	if (rtnl_talk(&rth, &req.n, NULL) < 0)
-		return -1;
+static int mrp_nl_migrate_entry(struct nlmsghdr *n, void *arg)
+{
+	struct mrp_nl_migrate *migrate = &mrp_nl_migrate;
+	struct ndmsg *ndm = NLMSG_DATA(n);
+	int len = n->nlmsg_len;
+	struct rtattr *tb[NDA_MAX + 1];
+	struct mrp_nl_fdb *fdb;
+	uint16_t vid = 0;
 
-	if (!mrp->i_port)
+	if (n->nlmsg_type != RTM_NEWNEIGH)
 		return 0;
 
-	req.ifm.ifi_index = mrp->i_port->ifindex;
-	if (rtnl_talk(&rth, &req.n, NULL) < 0)
+	len -= NLMSG_LENGTH(sizeof(*ndm));
+	if (len < 0)
 		return -1;
 
+	if (ndm->ndm_family != AF_BRIDGE || ndm->ndm_ifindex != migrate->from)
+		return 0;
+
+	/* The static entries and the entries of the HW are not touched */
+	if (ndm->ndm_state & (NUD_PERMANENT | NUD_NOARP) ||
+	    ndm->ndm_flags & NTF_EXT_LEARNED)
+		return 0;
+
+	parse_rtattr(tb, NDA_MAX, NDA_RTA(ndm), len);
+	if (!tb[NDA_LLADDR] || RTA_PAYLOAD(tb[NDA_LLADDR]) != ETH_ALEN)
+		return 0;
+
+	if (tb[NDA_VLAN])
+		vid = rta_getattr_u16(tb[NDA_VLAN]);
+
+	if (migrate->flush_vlan &&
+	    !(migrate->flush_vlans[vid / 8] & (1 << (vid % 8))))
+		return 0;
+
+	if (migrate->count == MRP_NL_MIGRATE_MAX) {
+		migrate->overflow = true;
+		return 0;
+	}
+
+	fdb = &migrate->fdbs[migrate->count++];
+	memcpy(fdb->mac, RTA_DATA(tb[NDA_LLADDR]), ETH_ALEN);
+	fdb->vid = vid;
+
+	return 0;
+}
+
+static int mrp_nl_migrate_send(struct mrp *mrp, uint32_t to,
+			       struct mrp_nl_fdb *fdb)
+{
+	struct {
+		struct nlmsghdr	n;
+		struct ndmsg	ndm;
+		char		buf[256];
+	} req = { 0 };
+
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg));
+	req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_REPLACE;
+	req.n.nlmsg_type = RTM_NEWNEIGH;
+	req.ndm.ndm_family = PF_BRIDGE;
+	req.ndm.ndm_ifindex = to;
+	req.ndm.ndm_flags = NTF_MASTER;
+	req.ndm.ndm_state = NUD_REACHABLE;
+
+	addattr_l(&req.n, sizeof(req), NDA_LLADDR, fdb->mac, ETH_ALEN);
+	if (fdb->vid)
+		addattr16(&req.n, sizeof(req), NDA_VLAN, fdb->vid);
+
+	return mrp_nl_async_queue(&req.n, mrp->ifindex, mrp->ring_nr, to,
+				  MRP_NETLINK_FDB_MIGRATE);
+}
+
+static bool mrp_nl_port_forwarding(struct mrp_port *p)
+{
+	return p->state == BR_MRP_PORT_STATE_FORWARDING &&
+	       p->operstate == IF_OPER_UP;
+}
+
+static const uint8_t *mrp_nl_flush_vlans(struct mrp *mrp)
+{
+	return mrp->flush_vlan && mrp_nl_flush_bulk ? mrp->flush_vlans : NULL;
+}
+
+/* Returns the ring port to which the entries are moved and sets from to the
+ * other one. Returns NULL if the forwarding of the ports changed since the
+ * migration started, then the ports are flushed instead.
+ */
+static struct mrp_port *mrp_nl_migrate_ports(struct mrp *mrp,
+					     struct mrp_port **from)
+{
+	struct mrp_nl_migrate *migrate = &mrp_nl_migrate;
+	struct mrp_port *to;
+
+	if (mrp->p_port->ifindex == migrate->to) {
+		*from = mrp->s_port;
+		to = mrp->p_port;
+	} else {
+		*from = mrp->p_port;
+		to = mrp->s_port;
+	}
+
+	if (mrp_nl_port_forwarding(*from) || !mrp_nl_port_forwarding(to))
+		return NULL;
+
+	return to;
+}
+
+/* Send the entries that were not sent yet, as long as there are free pending
+ * entries. It is called again by mrp_nl_async_rcv when the ACKs free them, so
+ * the loop never waits for the kernel. The caller holds the lock of mrp.
+ */
+static void mrp_nl_migrate_continue(struct mrp *mrp)
+{
+	struct mrp_nl_migrate *migrate = &mrp_nl_migrate;
+	struct mrp_port *from, *to;
+	uint64_t latency;
+	int err;
+
+	to = mrp_nl_migrate_ports(mrp, &from);
+	if (!to) {
+		mrp_nl_flush_queue(mrp->p_port->ifindex,
+				   mrp_nl_flush_vlans(mrp));
+		mrp_nl_flush_queue(mrp->s_port->ifindex,
+				   mrp_nl_flush_vlans(mrp));
+		migrate->sending = false;
+		return;
+	}
+
+	while (migrate->sent < migrate->count) {
+		if (!mrp_nl_async_bulk_room())
+			return;
+
+		err = mrp_nl_migrate_send(mrp, to->ifindex,
+					  &migrate->fdbs[migrate->sent]);
+		if (err == -EAGAIN)
+			return;
+		if (err) {
+			/* The entries that are not moved are flushed */
+			migrate->overflow = true;
+			break;
+		}
+
+		migrate->sent++;
+	}
+
+	/* The entries that didn't fit are flushed */
+	if (migrate->overflow)
+		mrp_nl_flush_queue(from->ifindex, mrp_nl_flush_vlans(mrp));
+
+	latency = get_ns() - migrate->start;
+	if (latency > fdb_migrate_latency_max)
+		fdb_migrate_latency_max = latency;
+
+	fdb_migrations++;
+	fdb_migrated += migrate->sent;
+
+	migrate->sending = false;
+}
+
+static void mrp_nl_migrate_resume(void)
+{
+	struct mrp_nl_migrate *migrate = &mrp_nl_migrate;
+	struct mrp *mrp;
+
+	if (!migrate->sending)
+		return;
+
+	/* The instance may be deleted in the meantime */
+	mrp = mrp_find(migrate->br_ifindex, migrate->ring_nr);
+	if (!mrp) {
+		migrate->sending = false;
+		return;
+	}
+
+	pthread_mutex_lock(&mrp->lock);
+	mrp_nl_migrate_continue(mrp);
+	pthread_mutex_unlock(&mrp->lock);
+}
+
+/* Called when the dump of the FDB of the bridge ends. If it failed, or the
+ * forwarding port changed in the meantime, the ring ports are flushed as if
+ * the entries were not migrated. Otherwise the entries are sent by
+ * mrp_nl_migrate_continue.
+ */
+static void mrp_nl_migrate_done(int err)
+{
+	struct mrp_nl_migrate *migrate = &mrp_nl_migrate;
+	struct mrp_port *from, *to;
+	struct mrp *mrp;
+
+	/* The instance may be deleted in the meantime */
+	mrp = mrp_find(migrate->br_ifindex, migrate->ring_nr);
+	if (!mrp)
+		return;
+
+	pthread_mutex_lock(&mrp->lock);
+
+	to = mrp_nl_migrate_ports(mrp, &from);
+	if (err || !to) {
+		if (err)
+			pr_err("Cannot dump the FDB entries: %d", err);
+		mrp_nl_flush_queue(mrp->p_port->ifindex,
+				   mrp_nl_flush_vlans(mrp));
+		mrp_nl_flush_queue(mrp->s_port->ifindex,
+				   mrp_nl_flush_vlans(mrp));
+		goto out;
+	}
+
+	migrate->sending = true;
+	migrate->sent = 0;
+	mrp_nl_migrate_continue(mrp);
+
+out:
+	pthread_mutex_unlock(&mrp->lock);
+}
+
+/* Returns false if it is not known through which ring port the entries are
+ * reachable, then the ports need to be flushed. Otherwise the FDB of the
+ * bridge is dumped on rth_async and the entries of the port that doesn't
+ * forward are moved by mrp_nl_migrate_done, so the loop doesn't wait for the
+ * dump. The ports are also flushed if the socket is busy with another dump or
+ * with the entries of another migration.
+ */
+static bool mrp_nl_fdb_migrate(struct mrp *mrp)
+{
+	struct mrp_nl_migrate *migrate = &mrp_nl_migrate;
+	struct mrp_port *from, *to;
+
+	if (mrp_nl_port_forwarding(mrp->p_port) ==
+	    mrp_nl_port_forwarding(mrp->s_port))
+		return false;
+
+	/* The entries of the previous migration are still being sent */
+	if (mrp_nl_dump_busy() || migrate->sending)
+		return false;
+
+	if (mrp_nl_port_forwarding(mrp->p_port)) {
+		from = mrp->s_port;
+		to = mrp->p_port;
+	} else {
+		from = mrp->p_port;
+		to = mrp->s_port;
+	}
+
+	migrate->br_ifindex = mrp->ifindex;
+	migrate->ring_nr = mrp->ring_nr;
+	migrate->from = from->ifindex;
+	migrate->to = to->ifindex;
+	migrate->start = get_ns();
+	migrate->flush_vlan = mrp->flush_vlan;
+	memcpy(migrate->flush_vlans, mrp->flush_vlans,
+	       sizeof(migrate->flush_vlans));
+	migrate->count = 0;
+	migrate->overflow = false;
+
+	mrp_nl_migrate_br = mrp->ifindex;
+	if (rtnl_neighdump_req(&rth_async, PF_BRIDGE,
+			       mrp_nl_migrate_filter) < 0) {
+		pr_err("Cannot rtnl_neighdump_req");
+		return false;
+	}
+
+	mrp_nl_dump_start(mrp_nl_migrate_entry, mrp_nl_migrate_done);
+
+	return true;
+}
+
+/* Continue the bulk requests that wait for free pending entries */
+static void mrp_nl_async_resume(void)
+{
+	mrp_nl_flush_resume();
+	mrp_nl_migrate_resume();
+}
+
+void mrp_netlink_set_fdb_migrate(bool enable)
+{
+	mrp_nl_migrate_enabled = enable;
+}
+
+/* The flush of the ports is delayed until the end of the loop iteration or
+ * until the coalescing window expires
+ */
+int mrp_netlink_flush(struct mrp *mrp)
+{
+	const uint8_t *vlans = mrp_nl_flush_vlans(mrp);
+
+	if (mrp_nl_migrate_enabled && mrp_nl_fdb_migrate(mrp))
+		goto in_port;
+
+	mrp_nl_flush_queue(mrp->p_port->ifindex, vlans);
+	mrp_nl_flush_queue(mrp->s_port->ifindex, vlans);
+
+in_port:
+	if (mrp->i_port)
+		mrp_nl_flush_queue(mrp->i_port->ifindex, vlans);
+
 	return 0;
 }
 
@@ -4,7 +4,13 @@
 #ifndef MRP_NETLINK_H
 #define MRP_NETLINK_H
 
+struct mrp_stats;
+
 int mrp_netlink_init(void);
 void mrp_netlink_uninit(void);
+int mrp_netlink_clear(void);
+void mrp_netlink_get_stats(struct mrp_stats *stats);
+void mrp_netlink_set_flush_window(uint32_t window);
+void mrp_netlink_set_fdb_migrate(bool enable);
 
 #endif
@@ -1,6 +1,7 @@
 // Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
 // SPDX-License-Identifier: (GPL-2.0)
 
+#define _GNU_SOURCE
 #include <ev.h>
 #include <stdio.h>
 
@@ -15,103 +16,492 @@
 #include <net/if.h>
 #include <linux/if_ether.h>
 #include <errno.h>
+#include <sys/mman.h>
 
 #include "state_machine.h"
+#include "packet.h"
+#include "shard.h"
 #include "utils.h"
 #include "print.h"
 
-static ev_io packet_watcher;
-static int fd;
+#define PACKET_FRAME_LEN	2048
 
-void packet_send(int ifindex, const struct iovec *iov, int iov_count, int len)
+/* Each event loop has its own sockets, buffers and counters */
+static __thread struct ev_loop *packet_loop;
+static __thread ev_io packet_watcher;
+static __thread ev_prepare packet_tx_watcher;
+static __thread int fd = -1;
+static __thread int bypass_fd = -1;
+
+/* Preallocated buffers used by recvmmsg */
+static __thread unsigned char rx_buf[PACKET_BATCH_MAX][PACKET_FRAME_LEN];
+static __thread struct sockaddr_ll rx_sl[PACKET_BATCH_MAX];
+static __thread struct iovec rx_iov[PACKET_BATCH_MAX];
+static __thread struct mmsghdr rx_msgs[PACKET_BATCH_MAX];
+
+/* Maximum number of frames received in one loop iteration */
+static int rx_budget = PACKET_BATCH_MAX;
+
+/* Optional TPACKET_V3 ring. A block is given to user space when it is full
+ * or after PACKET_RING_TIMEOUT ms, which bounds the added latency.
+ */
+#define PACKET_RING_BLOCK_SIZE	(1 << 16)
+#define PACKET_RING_BLOCK_NR	16
+#define PACKET_RING_FRAME_SIZE	2048
+#define PACKET_RING_TIMEOUT	1
+
+static bool rx_ring_enable;
+static __thread uint8_t *rx_ring;
+static __thread unsigned int rx_ring_block;
+
+static __thread uint64_t rx_frames;
+static __thread uint64_t rx_batch[MRP_STATS_BATCH_HIST];
+
+/* Frames queued for transmission. They are sent with one sendmmsg call per
+ * queue at the end of the event loop iteration or when a queue is full.
+ */
+struct packet_tx_queue {
+	int count;
+	uint64_t first;
+	unsigned char buf[PACKET_TX_BATCH_MAX][PACKET_FRAME_LEN];
+	struct sockaddr_ll sl[PACKET_TX_BATCH_MAX];
+	struct iovec iov[PACKET_TX_BATCH_MAX];
+	struct mmsghdr msgs[PACKET_TX_BATCH_MAX];
+};
+
+enum packet_tx_queue_type {
+	PACKET_TX_QUEUE_DEFAULT,
+	PACKET_TX_QUEUE_BYPASS,
+	PACKET_TX_QUEUE_MAX,
+};
+
+static __thread struct packet_tx_queue tx_queue[PACKET_TX_QUEUE_MAX];
+static bool tx_bypass_enable;
+
+static __thread uint64_t tx_frames;
+static __thread uint64_t tx_batches;
+static __thread uint64_t tx_dropped;
+static __thread uint64_t tx_latency_sum;
+static __thread uint64_t tx_latency_max;
+
+static void packet_tx_flush(struct packet_tx_queue *q, int s)
+{
+	uint64_t latency;
+	int sent = 0;
+	int cc, i;
+
+	while (sent < q->count) {
+		cc = sendmmsg(s, &q->msgs[sent], q->count - sent, 0);
+		if (cc < 0) {
+			if (errno != EWOULDBLOCK)
+				pr_err("sendmmsg failed: %d", errno);
+
+			tx_dropped += q->count - sent;
+			break;
+		}
+
+		for (i = sent; i < sent + cc; ++i) {
+			if (q->msgs[i].msg_len != q->iov[i].iov_len)
+				pr_err("short write in sendmmsg: %d instead of %zu",
+				       q->msgs[i].msg_len, q->iov[i].iov_len);
+		}
+
+		sent += cc;
+	}
+
+	latency = get_ns() - q->first;
+	tx_latency_sum += latency;
+	if (latency > tx_latency_max)
+		tx_latency_max = latency;
+
+	tx_frames += sent;
+	tx_batches++;
+	q->count = 0;
+}
+
+/* Send all the queued frames */
+void packet_flush(void)
+{
+	struct packet_tx_queue *q;
+
+	q = &tx_queue[PACKET_TX_QUEUE_DEFAULT];
+	if (q->count)
+		packet_tx_flush(q, fd);
+
+	q = &tx_queue[PACKET_TX_QUEUE_BYPASS];
+	if (q->count)
+		packet_tx_flush(q, bypass_fd >= 0 ? bypass_fd : fd);
+}
+
+/* Queue a frame to be sent on the interface ifindex. The frame is copied so
+ * the caller can reuse its buffers. If bypass is set and the qdisc bypass is
+ * enabled, the frame is sent directly to the driver.
+ */
+void packet_queue(int ifindex, const struct iovec *iov, int iov_count, int len,
+		  bool bypass)
+{
+	struct packet_tx_queue *q;
+	struct sockaddr_ll *sl;
+	unsigned char *buf;
+	int i, off = 0;
+
+	if (len > PACKET_FRAME_LEN) {
+		pr_err("frame too long: %d", len);
+		return;
+	}
+
+	q = &tx_queue[bypass ? PACKET_TX_QUEUE_BYPASS :
+			       PACKET_TX_QUEUE_DEFAULT];
+	if (q->count == PACKET_TX_BATCH_MAX)
+		packet_flush();
+
+	if (!q->count)
+		q->first = get_ns();
+
+	buf = q->buf[q->count];
+	for (i = 0; i < iov_count; ++i) {
+		memcpy(buf + off, iov[i].iov_base, iov[i].iov_len);
+		off += iov[i].iov_len;
+	}
+
+	sl = &q->sl[q->count];
+	sl->sll_ifindex = ifindex;
+	/* First ETH_ALEN of the frame contains the DMAC */
+	memcpy(sl->sll_addr, buf, ETH_ALEN);
+
+	q->iov[q->count].iov_len = off;
+	q->count++;
+}
+
+static void packet_tx_prepare(EV_P_ ev_prepare *w, int revents)
+{
+	packet_flush();
+}
+
+static void packet_tx_init(void)
 {
-	int l;
+	struct packet_tx_queue *q;
+	int i, j;
 
-	struct sockaddr_ll sl =
-	{
-		.sll_family = AF_PACKET,
-		.sll_protocol = __constant_cpu_to_be16(ETH_P_MRP),
-		.sll_ifindex = ifindex,
-		.sll_halen = ETH_ALEN,
-	};
+	for (i = 0; i < PACKET_TX_QUEUE_MAX; ++i) {
+		q = &tx_queue[i];
 
-	/* First ETH_ALEN in iov[0] contains the DMAC */
-	memcpy(&sl.sll_addr, iov[0].iov_base, ETH_ALEN);
+		for (j = 0; j < PACKET_TX_BATCH_MAX; ++j) {
+			q->sl[j].sll_family = AF_PACKET;
+			q->sl[j].sll_protocol = __constant_cpu_to_be16(ETH_P_MRP);
+			q->sl[j].sll_halen = ETH_ALEN;
 
-	struct msghdr msg =
-	{
-		.msg_name = &sl,
-		.msg_namelen = sizeof(sl),
-		.msg_iov = (struct iovec *)iov,
-		.msg_iovlen = iov_count,
-		.msg_control = NULL,
-		.msg_controllen = 0,
-		.msg_flags = 0,
-	};
+			q->iov[j].iov_base = q->buf[j];
 
-	l = sendmsg(fd, &msg, 0);
+			q->msgs[j].msg_hdr.msg_name = &q->sl[j];
+			q->msgs[j].msg_hdr.msg_namelen = sizeof(q->sl[j]);
+			q->msgs[j].msg_hdr.msg_iov = &q->iov[j];
+			q->msgs[j].msg_hdr.msg_iovlen = 1;
+		}
+	}
+
+	/* The queued frames are sent before the loop waits for new events */
+	ev_prepare_init(&packet_tx_watcher, packet_tx_prepare);
+	ev_prepare_start(packet_loop, &packet_tx_watcher);
+	ev_unref(packet_loop);
+}
+
+/* Open a socket that is used only to send frames that bypass the qdisc layer.
+ * It doesn't receive any frames because the protocol is 0.
+ */
+static int packet_tx_bypass_init(void)
+{
+	int optval = 7;
+	int one = 1;
+	int s;
+
+	s = socket(PF_PACKET, SOCK_RAW, 0);
+	if (s < 0) {
+		pr_err("socket failed: %d", errno);
+		return -1;
+	}
 
-	if (l < 0) {
-		if(errno != EWOULDBLOCK)
-			pr_err("send failed: %d", errno);
+	if (setsockopt(s, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one)) < 0) {
+		pr_err("setsockopt qdisc bypass failed: %d", errno);
+	} else if (setsockopt(s, SOL_SOCKET, SO_PRIORITY, &optval, 4)) {
+		pr_err("setsockopt priority failed: %d", errno);
+	} else if (fcntl(s, F_SETFL, O_NONBLOCK) < 0) {
+		pr_err("fcntl set nonblock failed: %d", errno);
 	} else {
-		if (l != len)
-			pr_err("short write in sendto: %d instead of %d",
-			       l, len);
+		return s;
+	}
+
+	close(s);
+	return -1;
+}
+
+void packet_set_tx_bypass(bool enable)
+{
+	tx_bypass_enable = enable;
+}
+
+void packet_set_rx_budget(int budget)
+{
+	if (budget < 1)
+		budget = 1;
+
+	rx_budget = budget;
+}
+
+void packet_set_rx_ring(bool enable)
+{
+	rx_ring_enable = enable;
+}
+
+/* Adds the counters of the loop to stats */
+void packet_get_stats(struct mrp_stats *stats)
+{
+	int i;
+
+	stats->rx_frames += rx_frames;
+	for (i = 0; i < MRP_STATS_BATCH_HIST; ++i)
+		stats->rx_batch[i] += rx_batch[i];
+	stats->tx_frames += tx_frames;
+	stats->tx_batches += tx_batches;
+	stats->tx_dropped += tx_dropped;
+	stats->tx_latency_sum += tx_latency_sum;
+	if (tx_latency_max > stats->tx_latency_max)
+		stats->tx_latency_max = tx_latency_max;
+}
+
+static void packet_rx_init(void)
+{
+	int i;
+
+	for (i = 0; i < PACKET_BATCH_MAX; ++i) {
+		rx_iov[i].iov_base = rx_buf[i];
+		rx_iov[i].iov_len = PACKET_FRAME_LEN;
+
+		rx_msgs[i].msg_hdr.msg_iov = &rx_iov[i];
+		rx_msgs[i].msg_hdr.msg_iovlen = 1;
+		rx_msgs[i].msg_hdr.msg_name = &rx_sl[i];
 	}
 }
 
+/* Account a batch of received frames in a log2 histogram */
+static void packet_rx_account(int count)
+{
+	int bucket = 31 - __builtin_clz(count);
+
+	if (bucket >= MRP_STATS_BATCH_HIST)
+		bucket = MRP_STATS_BATCH_HIST - 1;
+
+	rx_batch[bucket]++;
+	rx_frames += count;
+}
+
 static void packet_rcv(EV_P_ ev_io *w, int revents)
 {
-	int cc;
-	unsigned char buf[2048];
-	struct sockaddr_ll sl;
-	socklen_t salen = sizeof sl;
 	unsigned char mac[ETH_ALEN];
+	int budget = rx_budget;
+	struct sockaddr_ll *sl;
+	int cc, i, vlen;
 
-	cc = recvfrom(fd, &buf, sizeof(buf), 0, (struct sockaddr *) &sl, &salen);
-	if (cc <= 0) {
-		pr_err("recvfrom failed: %d", errno);
-		return;
+	while (budget > 0) {
+		vlen = budget < PACKET_BATCH_MAX ? budget : PACKET_BATCH_MAX;
+
+		for (i = 0; i < vlen; ++i)
+			rx_msgs[i].msg_hdr.msg_namelen = sizeof(rx_sl[i]);
+
+		cc = recvmmsg(fd, rx_msgs, vlen, MSG_DONTWAIT, NULL);
+		if (cc <= 0) {
+			if (cc < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+				pr_err("recvmmsg failed: %d", errno);
+			return;
+		}
+
+		packet_rx_account(cc);
+
+		for (i = 0; i < cc; ++i) {
+			sl = &rx_sl[i];
+
+			if_get_mac(sl->sll_ifindex, mac);
+
+			if (memcmp(&rx_buf[i][ETH_ALEN], mac, ETH_ALEN) == 0)
+				continue;
+
+			mrp_recv(rx_buf[i], rx_msgs[i].msg_len, sl,
+				 rx_msgs[i].msg_hdr.msg_namelen);
+		}
+
+		/* The socket is drained */
+		if (cc < vlen)
+			return;
+
+		budget -= cc;
 	}
+}
 
-	if_get_mac(sl.sll_ifindex, mac);
+static void packet_rcv_ring(EV_P_ ev_io *w, int revents)
+{
+	struct tpacket_block_desc *bd;
+	unsigned char mac[ETH_ALEN];
+	struct tpacket3_hdr *hdr;
+	int budget = rx_budget;
+	struct sockaddr_ll *sl;
+	unsigned char *frame;
+	uint32_t i, num;
 
-	if (memcmp(&buf[ETH_ALEN], mac, ETH_ALEN) == 0)
-		return;
+	while (budget > 0) {
+		bd = (struct tpacket_block_desc *)(rx_ring +
+			rx_ring_block * PACKET_RING_BLOCK_SIZE);
+		if (!(bd->hdr.bh1.block_status & TP_STATUS_USER))
+			return;
+
+		num = bd->hdr.bh1.num_pkts;
+		hdr = (struct tpacket3_hdr *)((uint8_t *)bd +
+			bd->hdr.bh1.offset_to_first_pkt);
+
+		for (i = 0; i < num; ++i) {
+			sl = (struct sockaddr_ll *)((uint8_t *)hdr +
+				TPACKET_ALIGN(sizeof(*hdr)));
+			frame = (uint8_t *)hdr + hdr->tp_mac;
 
-	mrp_recv(buf, cc, &sl, salen);
+			if_get_mac(sl->sll_ifindex, mac);
+
+			if (memcmp(&frame[ETH_ALEN], mac, ETH_ALEN) != 0)
+				mrp_recv(frame, hdr->tp_snaplen, sl,
+					 sizeof(*sl));
+
+			hdr = (struct tpacket3_hdr *)((uint8_t *)hdr +
+				hdr->tp_next_offset);
+		}
+
+		if (num)
+			packet_rx_account(num);
+
+		/* Give the block back to the kernel */
+		__sync_synchronize();
+		bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+
+		rx_ring_block = (rx_ring_block + 1) % PACKET_RING_BLOCK_NR;
+		budget -= num;
+	}
 }
 
-static struct sock_filter mrp_filter[] = {
-	{ 0x28, 0, 0, 0x0000000c },
-	{ 0x15, 0, 1, 0x000088e3 },
-	{ 0x6, 0, 0, 0xffffffff },
-	{ 0x6, 0, 0, 0x00000000 },
-};
+static int packet_rx_ring_init(int s)
+{
+	int version = TPACKET_V3;
+	struct tpacket_req3 req;
+
+	if (setsockopt(s, SOL_PACKET, PACKET_VERSION, &version,
+		       sizeof(version)) < 0) {
+		pr_err("setsockopt packet version failed: %d", errno);
+		return -1;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = PACKET_RING_BLOCK_SIZE;
+	req.tp_block_nr = PACKET_RING_BLOCK_NR;
+	req.tp_frame_size = PACKET_RING_FRAME_SIZE;
+	req.tp_frame_nr = PACKET_RING_BLOCK_SIZE * PACKET_RING_BLOCK_NR /
+			  PACKET_RING_FRAME_SIZE;
+	req.tp_retire_blk_tov = PACKET_RING_TIMEOUT;
+
+	if (setsockopt(s, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+		pr_err("setsockopt packet rx ring failed: %d", errno);
+		return -1;
+	}
+
+	rx_ring = mmap(NULL, PACKET_RING_BLOCK_SIZE * PACKET_RING_BLOCK_NR,
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, s, 0);
+	if (rx_ring == MAP_FAILED) {
+		pr_err("mmap packet rx ring failed: %d", errno);
+		rx_ring = NULL;
+
+		/* Release the ring, the frames are received with recvmmsg */
+		memset(&req, 0, sizeof(req));
+		setsockopt(s, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+		return -1;
+	}
+
+	rx_ring_block = 0;
+
+	return 0;
+}
+
+/* Accept the MRP frames that are received on the ports:
+ *
+ *	ldh [12]; jeq #ETH_P_MRP, 1, 0; ret #0; ld ifidx;
+ *	jeq #port, 0, 1; ret #-1; ... ret #0
+ *
+ * If there are too many ports, all the MRP frames are accepted and mrp_recv
+ * drops the frames of the other ports.
+ */
+static int packet_filter_attach(int s, const uint32_t *ifindexes, int count)
+{
+	struct sock_filter filter[2 * PACKET_FILTER_PORTS + 5];
+	struct sock_fprog prog = { .filter = filter };
+	int i, len = 0;
+
+	filter[len++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS,
+						     12);
+	filter[len++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+						     ETH_P_MRP, 1, 0);
+	filter[len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+
+	if (count > PACKET_FILTER_PORTS) {
+		filter[len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K,
+							     0xffffffff);
+	} else {
+		filter[len++] = (struct sock_filter)
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+				 SKF_AD_OFF + SKF_AD_IFINDEX);
+
+		for (i = 0; i < count; ++i) {
+			filter[len++] = (struct sock_filter)
+				BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+					 ifindexes[i], 0, 1);
+			filter[len++] = (struct sock_filter)
+				BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+		}
+
+		filter[len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K,
+							     0);
+	}
+
+	prog.len = len;
+
+	return setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, &prog,
+			  sizeof(prog));
+}
+
+/* Called when the ports of the instances of the loop change. With several
+ * loops, this keeps the frames of a port on the socket of its loop.
+ */
+void packet_set_filter(const uint32_t *ifindexes, int count)
+{
+	if (fd < 0)
+		return;
+
+	if (packet_filter_attach(fd, ifindexes, count) < 0)
+		pr_err("setsockopt packet filter failed: %d", errno);
+}
 
 /*
- * Open up a raw packet socket to catch all MRP packets
+ * Open up a raw packet socket of the loop to catch the MRP packets of its
+ * ports, initially there is none
  */
 int packet_socket_init(void)
 {
 	int optval = 7;
 	int ignore_out = 1;
-
-	struct sock_fprog prog =
-	{
-		.len = sizeof(mrp_filter) / sizeof(mrp_filter[0]),
-		.filter = mrp_filter,
-	};
 	int s;
 
+	packet_loop = shard_loop();
+
 	s = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
 	if(s < 0) {
 		pr_err("socket failed: %d", errno);
 		return -1;
 	}
 
-	if (setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
+	if (packet_filter_attach(s, NULL, 0) < 0) {
 		pr_err("setsockopt packet filter failed: %d", errno);
 	} else if (setsockopt(s, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignore_out, sizeof(ignore_out)) < 0) {
 		pr_err("setsockopt packet ignore outgoing: %d", errno);
@@ -121,8 +511,22 @@ int packet_socket_init(void)
 		pr_err("fcntl set nonblock failed: %d", errno);
 	} else {
 		fd = s;
-		ev_io_init(&packet_watcher, packet_rcv, fd, EV_READ);
-		ev_io_start(EV_DEFAULT, &packet_watcher);
+
+		if (rx_ring_enable && packet_rx_ring_init(fd) == 0) {
+			ev_io_init(&packet_watcher, packet_rcv_ring, fd,
+				   EV_READ);
+		} else {
+			packet_rx_init();
+			ev_io_init(&packet_watcher, packet_rcv, fd, EV_READ);
+		}
+		ev_io_start(packet_loop, &packet_watcher);
+
+		/* If the bypass socket can't be opened, all the frames are
+		 * sent through the qdisc layer
+		 */
+		if (tx_bypass_enable)
+			bypass_fd = packet_tx_bypass_init();
+		packet_tx_init();
 
 		return 0;
 	}
@@ -133,6 +537,16 @@ int packet_socket_init(void)
 
 void packet_socket_cleanup(void)
 {
-	ev_io_stop(EV_DEFAULT, &packet_watcher);
+	packet_flush();
+
+	ev_ref(packet_loop);
+	ev_prepare_stop(packet_loop, &packet_tx_watcher);
+	if (bypass_fd >= 0)
+		close(bypass_fd);
+
+	ev_io_stop(packet_loop, &packet_watcher);
+	if (rx_ring)
+		munmap(rx_ring, PACKET_RING_BLOCK_SIZE * PACKET_RING_BLOCK_NR);
 	close(fd);
+	fd = -1;
 }
@@ -5,8 +5,28 @@
 #define PACKET_H
 
 #include <sys/uio.h>
+#include <stdint.h>
+#include <stdbool.h>
 
-void packet_send(int ifindex, const struct iovec *iov, int iov_count, int len);
+#include "utils.h"
+
+/* Maximum number of frames received with one recvmmsg call */
+#define PACKET_BATCH_MAX	64
+
+/* Maximum number of frames sent with one sendmmsg call */
+#define PACKET_TX_BATCH_MAX	32
+
+/* Maximum number of ports that the packet filter of a loop matches */
+#define PACKET_FILTER_PORTS	128
+
+void packet_queue(int ifindex, const struct iovec *iov, int iov_count, int len,
+		  bool bypass);
+void packet_flush(void);
+void packet_set_tx_bypass(bool enable);
+void packet_set_rx_budget(int budget);
+void packet_set_rx_ring(bool enable);
+void packet_get_stats(struct mrp_stats *stats);
+void packet_set_filter(const uint32_t *ifindexes, int count);
 int packet_socket_init(void);
 void packet_socket_cleanup(void);
 
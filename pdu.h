@@ -98,4 +98,35 @@ struct br_mrp_in_link_status_hdr {
 	__be16 id;
 };
 
+/* Read-only view of a received MRP frame. It points inside the received buffer
+ * and it is filled only after the frame was validated against its length.
+ */
+struct mrp_frame {
+	/* Type of the first TLV, which identifies the frame */
+	__u8 type;
+	union {
+		const void *hdr;
+		const struct br_mrp_ring_test_hdr *ring_test;
+		const struct br_mrp_ring_topo_hdr *ring_topo;
+		const struct br_mrp_ring_link_hdr *ring_link;
+		const struct br_mrp_oui_hdr *oui;
+		const struct br_mrp_in_test_hdr *in_test;
+		const struct br_mrp_in_topo_hdr *in_topo;
+		const struct br_mrp_in_link_hdr *in_link;
+		const struct br_mrp_in_link_status_hdr *in_link_status;
+	};
+
+	/* First sub-TLV of MRP_Option frames, sub_type is 0 if there is none */
+	__u8 sub_type;
+	union {
+		const void *sub_hdr;
+		const struct br_mrp_test_mgr_nack_hdr *nack;
+		const struct br_mrp_test_prop_hdr *prop;
+	};
+
+	/* Common TLV, NULL if the frame doesn't have one */
+	const struct br_mrp_common_hdr *common;
+	__u16 seq_id;
+};
+
 #endif
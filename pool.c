@@ -0,0 +1,89 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "pool.h"
+#include "print.h"
+
+struct pool_obj {
+	struct pool_obj *next;
+};
+
+int pool_init(struct pool *pool, const char *name, size_t size,
+	      unsigned int count)
+{
+	unsigned int i;
+
+	memset(pool, 0, sizeof(*pool));
+
+	/* The free objects hold the link to the next one */
+	if (size < sizeof(struct pool_obj))
+		size = sizeof(struct pool_obj);
+	size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+	pool->name = name;
+	pool->size = size;
+	pool->count = count;
+
+	if (!count)
+		return 0;
+
+	pool->mem = malloc(count * size);
+	if (!pool->mem) {
+		pr_err("cannot allocate the %s pool", name);
+		return -ENOMEM;
+	}
+
+	/* Fault in the pages now instead of when an object is taken */
+	memset(pool->mem, 0, count * size);
+
+	for (i = 0; i < count; ++i) {
+		struct pool_obj *obj = (struct pool_obj *)(pool->mem + i * size);
+
+		obj->next = i + 1 < count ?
+			    (struct pool_obj *)(pool->mem + (i + 1) * size) : NULL;
+	}
+	pool->free = (struct pool_obj *)pool->mem;
+
+	return 0;
+}
+
+void pool_uninit(struct pool *pool)
+{
+	if (pool->used)
+		pr_err("%s pool: %u objects are still in use", pool->name,
+		       pool->used);
+
+	free(pool->mem);
+	pool->mem = NULL;
+	pool->free = NULL;
+}
+
+void *pool_alloc(struct pool *pool)
+{
+	struct pool_obj *obj = pool->free;
+
+	if (!obj) {
+		pool->exhausted++;
+		return NULL;
+	}
+
+	pool->free = obj->next;
+	pool->used++;
+	if (pool->used > pool->used_max)
+		pool->used_max = pool->used;
+
+	return obj;
+}
+
+void pool_free(struct pool *pool, void *ptr)
+{
+	struct pool_obj *obj = ptr;
+
+	obj->next = pool->free;
+	pool->free = obj;
+	pool->used--;
+}
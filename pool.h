@@ -0,0 +1,43 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A pool of count objects of the same size, allocated and faulted in when it
+ * is created, so that taking an object never calls malloc. A pool is not
+ * locked, it is used from one thread or under the lock of its owner.
+ */
+struct pool_obj;
+
+struct pool {
+	const char		*name;
+	size_t			size;
+	unsigned int		count;
+	unsigned char		*mem;
+	struct pool_obj		*free;
+	/* Objects in use, the most in use and the failed allocations */
+	unsigned int		used;
+	unsigned int		used_max;
+	uint64_t		exhausted;
+};
+
+int pool_init(struct pool *pool, const char *name, size_t size,
+	      unsigned int count);
+void pool_uninit(struct pool *pool);
+void *pool_alloc(struct pool *pool);
+void pool_free(struct pool *pool, void *obj);
+
+static inline bool pool_owns(const struct pool *pool, const void *obj)
+{
+	const unsigned char *p = obj;
+
+	return pool->mem && p >= pool->mem &&
+	       p < pool->mem + pool->size * pool->count;
+}
+
+#endif /* POOL_H */
@@ -3,15 +3,40 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <syslog.h>
 #include <time.h>
 #include <unistd.h>
+#include <ev.h>
 
 #include "print.h"
 
 static int verbose = 0;
 static int print_level = LOG_INFO;
 
+/* The messages of the real time threads are queued and written by the main
+ * loop, so these threads never wait for the console.
+ */
+#define PRINT_RING_SIZE		128
+#define PRINT_MSG_LEN		1024
+
+struct print_msg {
+	int level;
+	struct timespec ts;
+	char buf[PRINT_MSG_LEN];
+};
+
+static struct print_msg print_ring[PRINT_RING_SIZE];
+static unsigned int print_head;
+static unsigned int print_tail;
+static uint64_t print_dropped;
+static pthread_mutex_t print_lock;
+static struct ev_loop *print_loop;
+static ev_async print_watcher;
+static __thread bool print_deferred;
+
 void print_set_level(int level)
 {
 	print_level = level;
@@ -22,12 +47,113 @@ void print_set_verbose(int value)
 	verbose = value;
 }
 
+static void print_out(int level, const struct timespec *ts, const char *buf)
+{
+	FILE *f;
+
+	f = level >= LOG_NOTICE ? stdout : stderr;
+	fprintf(f, "MRP[%lld.%03ld]: %s\n",
+		(long long)ts->tv_sec, ts->tv_nsec / 1000000,
+		buf);
+	fflush(f);
+}
+
+static void print_queue(int level, const struct timespec *ts, const char *buf)
+{
+	struct print_msg *msg;
+
+	pthread_mutex_lock(&print_lock);
+
+	if (print_head - print_tail == PRINT_RING_SIZE) {
+		print_dropped++;
+		pthread_mutex_unlock(&print_lock);
+		return;
+	}
+
+	msg = &print_ring[print_head % PRINT_RING_SIZE];
+	msg->level = level;
+	msg->ts = *ts;
+	snprintf(msg->buf, sizeof(msg->buf), "%s", buf);
+	print_head++;
+
+	pthread_mutex_unlock(&print_lock);
+
+	ev_async_send(print_loop, &print_watcher);
+}
+
+static void print_flush(void)
+{
+	struct print_msg msg;
+	uint64_t dropped;
+
+	pthread_mutex_lock(&print_lock);
+	while (print_tail != print_head) {
+		msg = print_ring[print_tail % PRINT_RING_SIZE];
+		print_tail++;
+
+		/* The message is written without holding the lock */
+		pthread_mutex_unlock(&print_lock);
+		print_out(msg.level, &msg.ts, msg.buf);
+		pthread_mutex_lock(&print_lock);
+	}
+
+	dropped = print_dropped;
+	print_dropped = 0;
+	pthread_mutex_unlock(&print_lock);
+
+	if (dropped)
+		pr_warning("dropped %llu log messages",
+			   (unsigned long long)dropped);
+}
+
+static void print_async(EV_P_ ev_async *w, int revents)
+{
+	print_flush();
+}
+
+/* Writes the deferred messages on loop, which must run in a thread that is
+ * not real time
+ */
+int print_defer_init(struct ev_loop *loop)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	/* The main thread holds the lock only to copy a message out */
+	pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+	pthread_mutex_init(&print_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	print_loop = loop;
+	ev_async_init(&print_watcher, print_async);
+	ev_async_start(loop, &print_watcher);
+
+	return 0;
+}
+
+void print_defer_uninit(void)
+{
+	if (!print_loop)
+		return;
+
+	ev_async_stop(print_loop, &print_watcher);
+	print_flush();
+	print_loop = NULL;
+}
+
+/* The messages of the calling thread are written by the loop of
+ * print_defer_init
+ */
+void print_defer_thread(void)
+{
+	print_deferred = true;
+}
+
 void print(int level, char const *format, ...)
 {
 	struct timespec ts;
-	char buf[1024];
+	char buf[PRINT_MSG_LEN];
 	va_list ap;
-	FILE *f;
 
 	if (level > print_level)
 		return;
@@ -39,10 +165,9 @@ void print(int level, char const *format, ...)
 	va_end(ap);
 
 	if (verbose) {
-		f = level >= LOG_NOTICE ? stdout : stderr;
-		fprintf(f, "MRP[%lld.%03ld]: %s\n",
-			(long long)ts.tv_sec, ts.tv_nsec / 1000000,
-			buf);
-		fflush(f);
+		if (print_deferred && print_loop)
+			print_queue(level, &ts, buf);
+		else
+			print_out(level, &ts, buf);
 	}
 }
@@ -6,8 +6,13 @@
 
 #include <syslog.h>
 
+struct ev_loop;
+
 void print_set_level(int level);
 void print_set_verbose(int value);
+int print_defer_init(struct ev_loop *loop);
+void print_defer_uninit(void);
+void print_defer_thread(void);
 
 #ifdef __GNUC__
 __attribute__ ((format (printf, 2, 3)))
@@ -0,0 +1,397 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include "profile.h"
+#include "timer_wheel.h"
+#include "print.h"
+
+/* The profile file has one setting per line, '#' starts a comment:
+ *
+ *   profile <name>
+ *   ring_recv <500|200|30|10>
+ *   in_recv <500|200>
+ *   <field> <value>
+ *
+ * Each 'profile' line starts a new profile, the next lines override the
+ * fields of mrp_profile_fields. The intervals and periods are in us.
+ */
+struct mrp_profile_field {
+	const char *name;
+	size_t offset;
+	uint32_t min;
+	uint32_t max;
+};
+
+/* The timers don't run more often than the tick of the wheel */
+#define MRP_TICK_US		(TIMER_WHEEL_TICK_NS / 1000)
+
+#define MRP_PROFILE_FIELD(field, min, max) \
+	{ #field, offsetof(struct mrp_timing, field), min, max }
+
+static const struct mrp_profile_field mrp_profile_fields[] = {
+	MRP_PROFILE_FIELD(ring_topo_interval, MRP_TICK_US, 1000000),
+	MRP_PROFILE_FIELD(ring_topo_max, 1, 255),
+	MRP_PROFILE_FIELD(ring_test_short, MRP_TICK_US, 1000000),
+	MRP_PROFILE_FIELD(ring_test_interval, MRP_TICK_US, 1000000),
+	MRP_PROFILE_FIELD(ring_test_max, 1, 255),
+	MRP_PROFILE_FIELD(ring_test_ext_max, 1, 255),
+	MRP_PROFILE_FIELD(ring_test_period, 100000, 60000000),
+	MRP_PROFILE_FIELD(ring_test_ext_hold, 0, 3600000000),
+	MRP_PROFILE_FIELD(ring_link_interval, MRP_TICK_US, 1000000),
+	MRP_PROFILE_FIELD(ring_link_max, 1, 255),
+	MRP_PROFILE_FIELD(in_topo_interval, MRP_TICK_US, 1000000),
+	MRP_PROFILE_FIELD(in_topo_max, 1, 255),
+	MRP_PROFILE_FIELD(in_test_interval, MRP_TICK_US, 1000000),
+	MRP_PROFILE_FIELD(in_test_max, 1, 255),
+	MRP_PROFILE_FIELD(in_test_period, 100000, 60000000),
+	MRP_PROFILE_FIELD(in_link_interval, MRP_TICK_US, 1000000),
+	MRP_PROFILE_FIELD(in_link_max, 1, 255),
+	MRP_PROFILE_FIELD(in_link_status_interval, MRP_TICK_US, 1000000),
+	MRP_PROFILE_FIELD(in_link_status_max, 1, 255),
+};
+
+/* There are 4 different recovery times in which an MRP ring can recover. Based
+ * on the each time returns all the timing parameters. The interval are
+ * represented in us.
+ */
+static void mrp_recovery_fill(enum mrp_ring_recovery_type ring_recv,
+			      enum mrp_in_recovery_type in_recv,
+			      struct mrp_timing *t)
+{
+	switch (ring_recv) {
+	case MRP_RING_RECOVERY_500:
+		t->ring_topo_interval = 20 * 1000;
+		t->ring_topo_max = 3;
+		t->ring_test_short = 30 * 1000;
+		t->ring_test_interval = 50 * 1000;
+		t->ring_test_period = 10000 * 1000;
+		t->ring_test_max = 5;
+		t->ring_test_ext_max = 15;
+		t->ring_test_ext_hold = 0;
+		t->ring_link_interval = 100 * 1000;
+		t->ring_link_max = 4;
+		break;
+	case MRP_RING_RECOVERY_200:
+		t->ring_topo_interval = 10 * 1000;
+		t->ring_topo_max = 3;
+		t->ring_test_short = 10 * 1000;
+		t->ring_test_interval = 20 * 1000;
+		t->ring_test_period = 10000 * 1000;
+		t->ring_test_max = 3;
+		t->ring_test_ext_max = 15;
+		t->ring_test_ext_hold = 0;
+		t->ring_link_interval = 20 * 1000;
+		t->ring_link_max = 4;
+		break;
+	case MRP_RING_RECOVERY_30:
+		t->ring_topo_interval = 500;
+		t->ring_topo_max = 3;
+		t->ring_test_short = 1 * 1000;
+		t->ring_test_interval = 3500;
+		t->ring_test_period = 10000 * 1000;
+		t->ring_test_max = 3;
+		t->ring_test_ext_max = 15;
+		t->ring_test_ext_hold = 0;
+		t->ring_link_interval = 1;
+		t->ring_link_max = 4;
+		break;
+	case MRP_RING_RECOVERY_10:
+		t->ring_topo_interval = 500;
+		t->ring_topo_max = 3;
+		t->ring_test_short = 500;
+		t->ring_test_interval = 1000;
+		t->ring_test_period = 10000 * 1000;
+		t->ring_test_max = 3;
+		t->ring_test_ext_max = 15;
+		t->ring_test_ext_hold = 0;
+		t->ring_link_interval = 1;
+		t->ring_link_max = 4;
+		break;
+	default:
+		break;
+	}
+
+	switch (in_recv) {
+	case MRP_IN_RECOVERY_500:
+		t->in_topo_interval = 20 * 1000;
+		t->in_topo_max = 3;
+		t->in_test_interval = 50 * 1000;
+		t->in_test_period = 10000 * 1000;
+		t->in_test_max = 8;
+		t->in_link_interval = 20 * 1000;
+		t->in_link_max = 4;
+		t->in_link_status_interval = 20 * 1000;
+		t->in_link_status_max = 8;
+		break;
+	case MRP_IN_RECOVERY_200:
+		t->in_topo_interval = 10 * 1000;
+		t->in_topo_max = 3;
+		t->in_test_interval = 20 * 1000;
+		t->in_test_period = 10000 * 1000;
+		t->in_test_max = 8;
+		t->in_link_interval = 20 * 1000;
+		t->in_link_max = 4;
+		t->in_link_status_interval = 20 * 1000;
+		t->in_link_status_max = 8;
+		break;
+	default:
+		break;
+	}
+}
+
+/* The timings of the recovery times, shared by all the instances that don't
+ * use a profile. They are filled once and never changed after.
+ */
+static struct mrp_timing
+mrp_recovery_timings[MRP_RING_RECOVERY_10 + 1][MRP_IN_RECOVERY_200 + 1];
+static pthread_once_t mrp_recovery_once = PTHREAD_ONCE_INIT;
+
+static void mrp_recovery_init(void)
+{
+	int ring_recv, in_recv;
+
+	for (ring_recv = 0; ring_recv <= MRP_RING_RECOVERY_10; ++ring_recv)
+		for (in_recv = 0; in_recv <= MRP_IN_RECOVERY_200; ++in_recv)
+			mrp_recovery_fill(ring_recv, in_recv,
+					  &mrp_recovery_timings[ring_recv][in_recv]);
+}
+
+/* Returns the timing of the recovery times, NULL if one of them is invalid */
+const struct mrp_timing *
+mrp_recovery_timing(enum mrp_ring_recovery_type ring_recv,
+		    enum mrp_in_recovery_type in_recv)
+{
+	if ((unsigned int)ring_recv > MRP_RING_RECOVERY_10 ||
+	    (unsigned int)in_recv > MRP_IN_RECOVERY_200)
+		return NULL;
+
+	pthread_once(&mrp_recovery_once, mrp_recovery_init);
+
+	return &mrp_recovery_timings[ring_recv][in_recv];
+}
+
+static struct mrp_profile mrp_profiles[MRP_PROFILE_MAX];
+static int mrp_profile_count;
+
+static uint32_t *mrp_profile_value(struct mrp_timing *timing, int field)
+{
+	return (uint32_t *)((char *)timing + mrp_profile_fields[field].offset);
+}
+
+static int mrp_profile_ring_recv(const char *value,
+				 enum mrp_ring_recovery_type *ring_recv)
+{
+	if (strcmp(value, "500") == 0)
+		*ring_recv = MRP_RING_RECOVERY_500;
+	else if (strcmp(value, "200") == 0)
+		*ring_recv = MRP_RING_RECOVERY_200;
+	else if (strcmp(value, "30") == 0)
+		*ring_recv = MRP_RING_RECOVERY_30;
+	else if (strcmp(value, "10") == 0)
+		*ring_recv = MRP_RING_RECOVERY_10;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+static int mrp_profile_in_recv(const char *value,
+			       enum mrp_in_recovery_type *in_recv)
+{
+	if (strcmp(value, "500") == 0)
+		*in_recv = MRP_IN_RECOVERY_500;
+	else if (strcmp(value, "200") == 0)
+		*in_recv = MRP_IN_RECOVERY_200;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+static int mrp_profile_set(struct mrp_profile *profile, const char *key,
+			   const char *value)
+{
+	const struct mrp_profile_field *field;
+	unsigned long val;
+	char *end;
+	int i;
+
+	if (strcmp(key, "ring_recv") == 0)
+		return mrp_profile_ring_recv(value, &profile->ring_recv);
+	if (strcmp(key, "in_recv") == 0)
+		return mrp_profile_in_recv(value, &profile->in_recv);
+
+	for (i = 0; i < COUNT_OF(mrp_profile_fields); ++i) {
+		field = &mrp_profile_fields[i];
+		if (strcmp(key, field->name))
+			continue;
+
+		errno = 0;
+		val = strtoul(value, &end, 10);
+		if (errno || *end || end == value ||
+		    val < field->min || val > field->max) {
+			pr_err("%s must be between %u and %u", field->name,
+			       field->min, field->max);
+			return -EINVAL;
+		}
+
+		*mrp_profile_value(&profile->timing, i) = val;
+		profile->set |= 1 << i;
+		return 0;
+	}
+
+	pr_err("unknown profile field: %s", key);
+	return -EINVAL;
+}
+
+/* Overwrite the fields of timing that are set in the profile */
+static void mrp_profile_override(const struct mrp_profile *profile,
+				 struct mrp_timing *timing)
+{
+	const char *src = (const char *)&profile->timing;
+	int i;
+
+	for (i = 0; i < COUNT_OF(mrp_profile_fields); ++i)
+		if (profile->set & (1 << i))
+			*mrp_profile_value(timing, i) = *(const uint32_t *)
+				(src + mrp_profile_fields[i].offset);
+}
+
+/* Load the profiles of the file at path. On error none of them is kept. */
+int mrp_profile_load(const char *path)
+{
+	struct mrp_profile *profile = NULL;
+	char line[256], key[64], value[64];
+	/* line where each profile starts */
+	int profile_lineno[MRP_PROFILE_MAX];
+	int lineno = 0, err = 0;
+	char *comment;
+	FILE *f;
+	int i, n;
+
+	f = fopen(path, "r");
+	if (!f) {
+		pr_err("Couldn't open profile file %s: %d", path, errno);
+		return -errno;
+	}
+
+	mrp_profile_count = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+
+		comment = strchr(line, '#');
+		if (comment)
+			*comment = '\0';
+
+		n = sscanf(line, "%63s %63s", key, value);
+		if (n <= 0)
+			continue;
+		if (n != 2) {
+			err = -EINVAL;
+			break;
+		}
+
+		if (strcmp(key, "profile") == 0) {
+			if (mrp_profile_count == MRP_PROFILE_MAX ||
+			    strlen(value) >= MRP_PROFILE_NAME_LEN ||
+			    mrp_profile_find(value)) {
+				err = -EINVAL;
+				break;
+			}
+
+			profile_lineno[mrp_profile_count] = lineno;
+			profile = &mrp_profiles[mrp_profile_count++];
+			memset(profile, 0, sizeof(*profile));
+			strcpy(profile->name, value);
+			profile->ring_recv = MRP_RING_RECOVERY_500;
+			profile->in_recv = MRP_IN_RECOVERY_500;
+			continue;
+		}
+
+		if (!profile) {
+			err = -EINVAL;
+			break;
+		}
+
+		err = mrp_profile_set(profile, key, value);
+		if (err)
+			break;
+	}
+
+	fclose(f);
+
+	if (err) {
+		pr_err("%s:%d: invalid profile line", path, lineno);
+		mrp_profile_count = 0;
+		return err;
+	}
+
+	/* The instances that use a profile point to its timing, so it is
+	 * checked here and not when it is applied
+	 */
+	for (i = 0; i < mrp_profile_count; ++i) {
+		profile = &mrp_profiles[i];
+		profile->resolved = *mrp_recovery_timing(profile->ring_recv,
+							 profile->in_recv);
+		mrp_profile_override(profile, &profile->resolved);
+
+		err = mrp_timing_validate(&profile->resolved);
+		if (err) {
+			pr_err("%s:%d: invalid profile %s", path,
+			       profile_lineno[i], profile->name);
+			mrp_profile_count = 0;
+			return err;
+		}
+	}
+
+	pr_info("loaded %d profiles from %s", mrp_profile_count, path);
+
+	return 0;
+}
+
+const struct mrp_profile *mrp_profile_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < mrp_profile_count; ++i)
+		if (strcmp(mrp_profiles[i].name, name) == 0)
+			return &mrp_profiles[i];
+
+	return NULL;
+}
+
+/* Checks the fields that depend on each other */
+int mrp_timing_validate(const struct mrp_timing *t)
+{
+	if (t->ring_test_short > t->ring_test_interval) {
+		pr_err("ring_test_short is bigger than ring_test_interval");
+		return -EINVAL;
+	}
+
+	if (t->ring_test_max > t->ring_test_ext_max) {
+		pr_err("ring_test_max is bigger than ring_test_ext_max");
+		return -EINVAL;
+	}
+
+	/* The test offload has to detect a ring open before the period ends */
+	if (t->ring_test_period <=
+	    (uint64_t)t->ring_test_interval * t->ring_test_ext_max) {
+		pr_err("ring_test_period is too short");
+		return -EINVAL;
+	}
+
+	if (t->in_test_period <=
+	    (uint64_t)t->in_test_interval * t->in_test_max) {
+		pr_err("in_test_period is too short");
+		return -EINVAL;
+	}
+
+	return 0;
+}
@@ -0,0 +1,35 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+#include "utils.h"
+
+/* Maximum number of profiles in the profile file */
+#define MRP_PROFILE_MAX 16
+
+/* A named set of timing parameters. The parameters that are not overridden
+ * keep the values of the ring_recv and in_recv recovery times.
+ */
+struct mrp_profile {
+	char name[MRP_PROFILE_NAME_LEN];
+	enum mrp_ring_recovery_type ring_recv;
+	enum mrp_in_recovery_type in_recv;
+	struct mrp_timing timing;
+	/* bit i is set if the field i of mrp_profile_fields is overridden */
+	uint32_t set;
+	/* timing of the recovery times with the overridden fields */
+	struct mrp_timing resolved;
+};
+
+const struct mrp_timing *
+mrp_recovery_timing(enum mrp_ring_recovery_type ring_recv,
+		    enum mrp_in_recovery_type in_recv);
+int mrp_profile_load(const char *path);
+const struct mrp_profile *mrp_profile_find(const char *name);
+int mrp_timing_validate(const struct mrp_timing *timing);
+
+#endif /* PROFILE_H */
@@ -21,11 +21,17 @@
 #include "state_machine.h"
 #include "list.h"
 #include "netlink.h"
+#include "packet.h"
+#include "timer_wheel.h"
+#include "shard.h"
 #include "cfm_netlink.h"
 #include "print.h"
 
-static struct rtnl_handle rth;
-static ev_io netlink_watcher;
+/* In real time mode each loop listens to the link events itself, so they
+ * don't wait for the main thread
+ */
+static __thread struct rtnl_handle rth;
+static __thread ev_io netlink_watcher;
 
 int CTL_addmrp(int br_index, int ring_nr, int pport, int sport, int ring_role,
 	       uint16_t prio, uint8_t ring_recv, uint8_t react_on_link_change,
@@ -44,47 +50,182 @@ int CTL_delmrp(int br_index, int ring_nr)
 	return mrp_del(br_index, ring_nr);
 }
 
+struct ctl_getmrp {
+	int *count;
+	struct mrp_status *status;
+};
+
+static int ctl_getmrp(void *arg)
+{
+	struct ctl_getmrp *get = arg;
+
+	return mrp_get(get->count, get->status);
+}
+
 int CTL_getmrp(int *count, struct mrp_status *status)
 {
-	return mrp_get(count, status);
+	struct ctl_getmrp get = {
+		.count = count,
+		.status = status,
+	};
+
+	/* Each loop appends its instances */
+	*count = 0;
+
+	return shard_call_all(ctl_getmrp, &get);
 }
 
-static int netlink_listen(struct rtnl_ctrl_data *who, struct nlmsghdr *n,
-			  void *arg)
+static int ctl_getstats(void *arg)
+{
+	struct mrp_stats *stats = arg;
+
+	if_get_stats(stats);
+	packet_get_stats(stats);
+	mrp_get_stats(stats);
+	mrp_netlink_get_stats(stats);
+
+	return 0;
+}
+
+int CTL_getstats(struct mrp_stats *stats)
+{
+	int err;
+
+	memset(stats, 0, sizeof(*stats));
+
+	/* The counters of the loops are added together */
+	err = shard_call_all(ctl_getstats, stats);
+	if (err)
+		return err;
+
+	mrp_get_stats_rate(stats);
+
+#ifdef MRP_MALLOC_COUNT
+	stats->mallocs = malloc_count_get();
+#endif
+
+	return 0;
+}
+
+int CTL_setflushvlans(int br_index, int ring_nr, uint8_t *vlans)
+{
+	return mrp_set_flush_vlans(br_index, ring_nr, vlans);
+}
+
+int CTL_setprofile(int br_index, int ring_nr, char *profile)
+{
+	profile[MRP_PROFILE_NAME_LEN - 1] = '\0';
+
+	return mrp_set_profile(br_index, ring_nr, profile);
+}
+
+static void if_cache_update(struct nlmsghdr *n, struct ifinfomsg *ifi,
+			    struct rtattr **tb)
+{
+	struct if_info *info;
+
+	if (n->nlmsg_type == RTM_DELLINK) {
+		/* On AF_BRIDGE it only means that the port left the bridge */
+		if (ifi->ifi_family == AF_UNSPEC) {
+			if_cache_del(ifi->ifi_index);
+			return;
+		}
+
+		info = if_cache_get(ifi->ifi_index, false);
+		if (info)
+			info->master = 0;
+		return;
+	}
+
+	info = if_cache_get(ifi->ifi_index, true);
+	if (!info)
+		return;
+
+	info->flags = ifi->ifi_flags;
+	info->master = tb[IFLA_MASTER] ? rta_getattr_u32(tb[IFLA_MASTER]) : 0;
+
+	if (tb[IFLA_IFNAME])
+		strncpy(info->name, rta_getattr_str(tb[IFLA_IFNAME]),
+			IF_NAMESIZE - 1);
+
+	if (tb[IFLA_ADDRESS] && RTA_PAYLOAD(tb[IFLA_ADDRESS]) == ETH_ALEN) {
+		memcpy(info->macaddr, RTA_DATA(tb[IFLA_ADDRESS]), ETH_ALEN);
+		info->has_mac = true;
+	}
+
+	if (tb[IFLA_OPERSTATE])
+		info->operstate = rta_getattr_u8(tb[IFLA_OPERSTATE]);
+
+	if (tb[IFLA_CARRIER])
+		info->carrier = rta_getattr_u8(tb[IFLA_CARRIER]);
+}
+
+static int if_cache_dump(struct nlmsghdr *n, void *arg)
 {
-	struct rtattr *infotb[IFLA_BRIDGE_CFM_MEP_STATUS_MAX + 1];
-	struct rtattr *aftb[IFLA_BRIDGE_MAX + 1];
 	struct ifinfomsg *ifi = NLMSG_DATA(n);
-	struct rtattr * tb[IFLA_MAX + 1];
-	struct mrp_port *port;
+	struct rtattr *tb[IFLA_MAX + 1];
 	int len = n->nlmsg_len;
-	int af_family;
-	int rem, instance;
-	struct rtattr *i, *list;
 
-	if (n->nlmsg_type == NLMSG_DONE)
+	if (n->nlmsg_type != RTM_NEWLINK)
 		return 0;
 
 	len -= NLMSG_LENGTH(sizeof(*ifi));
 	if (len < 0)
 		return -1;
 
-	af_family = ifi->ifi_family;
-
-	port = mrp_get_port(ifi->ifi_index);
+	parse_rtattr_flags(tb, IFLA_MAX, IFLA_RTA(ifi), len, NLA_F_NESTED);
 
-	if (af_family != AF_BRIDGE && af_family != AF_UNSPEC)
-		return 0;
+	if_cache_lock();
+	if_cache_update(n, ifi, tb);
+	if_cache_unlock();
 
-	if (n->nlmsg_type != RTM_NEWLINK && n->nlmsg_type != RTM_DELLINK)
-		return 0;
+	return 0;
+}
 
-	parse_rtattr_flags(tb, IFLA_MAX, IFLA_RTA(ifi), len, NLA_F_NESTED);
+/* Populate the interface cache with all the existing interfaces. The dump is
+ * done on a separate socket while the events are queued on the listening
+ * socket, so the events that happen during the dump are applied after it.
+ */
+static int if_cache_init(void)
+{
+	struct rtnl_handle drth;
+	int err;
 
-	if (tb[IFLA_IFNAME] == NULL) {
-		pr_err("BUG: nil ifname");
+	if (rtnl_open(&drth, 0) < 0)
 		return -1;
-	}
+
+	err = rtnl_linkdump_req(&drth, AF_UNSPEC);
+	if (err < 0)
+		goto out;
+
+	err = rtnl_dump_filter(&drth, if_cache_dump, NULL);
+
+out:
+	rtnl_close(&drth);
+	return err < 0 ? err : 0;
+}
+
+/* Runs on each loop that has instances, with a message that was already
+ * checked by netlink_listen. The ports of the instances of other loops are not
+ * found by mrp_get_port, so each loop handles only its own ports.
+ */
+static void netlink_process(void *arg)
+{
+	struct rtattr *infotb[IFLA_BRIDGE_CFM_MEP_STATUS_MAX + 1];
+	struct rtattr *aftb[IFLA_BRIDGE_MAX + 1];
+	struct nlmsghdr *n = arg;
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr * tb[IFLA_MAX + 1];
+	struct mrp_port *port;
+	int len = n->nlmsg_len;
+	int rem, instance;
+	struct rtattr *i, *list;
+
+	len -= NLMSG_LENGTH(sizeof(*ifi));
+
+	port = mrp_get_port(ifi->ifi_index);
+
+	parse_rtattr_flags(tb, IFLA_MAX, IFLA_RTA(ifi), len, NLA_F_NESTED);
 
 	if (tb[IFLA_ADDRESS]) {
 		mrp_mac_change(ifi->ifi_index,
@@ -120,7 +261,7 @@ static int netlink_listen(struct rtnl_ctrl_data *who, struct nlmsghdr *n,
 
 mrp_process:
 	if (!port)
-		return 0;
+		return;
 
 	if (tb[IFLA_OPERSTATE]) {
 		__u8 state = *(__u8*)RTA_DATA(tb[IFLA_OPERSTATE]);
@@ -163,16 +304,91 @@ mrp_process:
 	if (!tb[IFLA_MASTER]) {
 		mrp_destroy(port->mrp->ifindex, port->mrp->ring_nr, false);
 	}
+}
+
+/* Returns 1 if the message is a link event to handle, 0 if it is ignored */
+static int netlink_parse(struct nlmsghdr *n, struct rtattr **tb)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	int len = n->nlmsg_len;
+	int af_family;
+
+	if (n->nlmsg_type == NLMSG_DONE)
+		return 0;
+
+	len -= NLMSG_LENGTH(sizeof(*ifi));
+	if (len < 0)
+		return -1;
+
+	af_family = ifi->ifi_family;
+
+	if (af_family != AF_BRIDGE && af_family != AF_UNSPEC)
+		return 0;
+
+	if (n->nlmsg_type != RTM_NEWLINK && n->nlmsg_type != RTM_DELLINK)
+		return 0;
+
+	parse_rtattr_flags(tb, IFLA_MAX, IFLA_RTA(ifi), len, NLA_F_NESTED);
+
+	if (tb[IFLA_IFNAME] == NULL) {
+		pr_err("BUG: nil ifname");
+		return -1;
+	}
+
+	return 1;
+}
+
+/* Listener of the main loop, the only writer of the interface cache */
+static int netlink_listen(struct rtnl_ctrl_data *who, struct nlmsghdr *n,
+			  void *arg)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr * tb[IFLA_MAX + 1];
+	int err;
+
+	err = netlink_parse(n, tb);
+	if (err <= 0)
+		return err;
+
+	/* The cache is updated before the instances see the message */
+	if_cache_lock();
+	if_cache_update(n, ifi, tb);
+	if_cache_unlock();
+
+	if (shard_runs_instances())
+		netlink_process(n);
+	else if (!shard_rt())
+		shard_post_all(netlink_process, n, n->nlmsg_len);
+
+	return 0;
+}
+
+/* Listener of the real time loops. They don't take the write lock of the cache
+ * nor allocate its entries, the main loop does it for the same message. The
+ * instances use the values of the message, so they don't wait for it.
+ */
+static int netlink_listen_rt(struct rtnl_ctrl_data *who, struct nlmsghdr *n,
+			     void *arg)
+{
+	struct rtattr * tb[IFLA_MAX + 1];
+	int err;
+
+	err = netlink_parse(n, tb);
+	if (err <= 0)
+		return err;
+
+	netlink_process(n);
 
 	return 0;
 }
 
 static void netlink_rcv(EV_P_ ev_io *w, int revents)
 {
-	rtnl_listen(&rth, netlink_listen, stdout);
+	rtnl_listen(&rth, shard_runs_instances() && shard_rt() ?
+		    netlink_listen_rt : netlink_listen, stdout);
 }
 
-static int netlink_init(void)
+static int netlink_listen_init(void)
 {
 	int err;
 
@@ -183,17 +399,72 @@ static int netlink_init(void)
 	fcntl(rth.fd, F_SETFL, O_NONBLOCK);
 
 	ev_io_init(&netlink_watcher, netlink_rcv, rth.fd, EV_READ);
-	ev_io_start(EV_DEFAULT, &netlink_watcher);
+	ev_io_start(shard_loop(), &netlink_watcher);
+
+	return 0;
+}
+
+static int netlink_init(void)
+{
+	int err;
+
+	err = netlink_listen_init();
+	if (err)
+		return err;
+
+	if (if_cache_init())
+		pr_err("interface cache init failed");
 
 	return 0;
 }
 
 static void netlink_uninit(void)
 {
-	ev_io_stop(EV_DEFAULT, &netlink_watcher);
+	ev_io_stop(shard_loop(), &netlink_watcher);
 	rtnl_close(&rth);
 }
 
+/* Called on each loop that runs instances, before the loop starts */
+static int CTL_loop_init(void)
+{
+	if (timer_wheel_init()) {
+		pr_err("timer wheel init failed");
+		return -1;
+	}
+
+	if (mrp_init()) {
+		pr_err("mrp init failed");
+		return -1;
+	}
+
+	if (mrp_netlink_init()) {
+		pr_err("mrp netlink init failed");
+		return -1;
+	}
+
+	/* As before, the loop runs without MRP frames if it fails */
+	if (packet_socket_init())
+		pr_err("packet socket init failed");
+
+	if (shard_rt() && netlink_listen_init()) {
+		pr_err("netlink init failed!");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void CTL_loop_cleanup(void)
+{
+	if (shard_rt())
+		netlink_uninit();
+
+	mrp_netlink_uninit();
+	mrp_uninit();
+	packet_socket_cleanup();
+	timer_wheel_uninit();
+}
+
 int CTL_init(void)
 {
 	if (netlink_init()) {
@@ -206,13 +477,15 @@ int CTL_init(void)
 		return -1;
 	}
 
-	if (mrp_netlink_init()) {
-		pr_err("mrp netlink init failed");
+	if (cfm_offload_init()) {
+		pr_err("cfm offload init failed");
 		return -1;
 	}
 
-	if (cfm_offload_init()) {
-		pr_err("cfm offload init failed");
+	mrp_netlink_clear();
+
+	if (shard_init(CTL_loop_init, CTL_loop_cleanup)) {
+		pr_err("loop init failed");
 		return -1;
 	}
 
@@ -221,7 +494,7 @@ int CTL_init(void)
 
 void CTL_cleanup(void)
 {
-	mrp_netlink_uninit();
+	shard_uninit();
 	netlink_uninit();
-	mrp_uninit();
+	if_cleanup();
 }
@@ -24,6 +24,9 @@ int CTL_addmrp(int br_index, int ring_nr, int pport, int sport, int ring_role,
 	       int cfm_peer_mepid, char *cfm_maid, char *cfm_dmac);
 int CTL_delmrp(int br_index, int ring_nr);
 int CTL_getmrp(int *count, struct mrp_status *status);
+int CTL_getstats(struct mrp_stats *stats);
+int CTL_setflushvlans(int br_index, int ring_nr, uint8_t *vlans);
+int CTL_setprofile(int br_index, int ring_nr, char *profile);
 
 int CTL_init(void);
 void CTL_cleanup(void);
@@ -10,6 +10,7 @@
 #include <ev.h>
 
 #include "server_cmds.h"
+#include "shard.h"
 #include "utils.h"
 #include "print.h"
 
@@ -45,11 +46,50 @@ static int handle_message(int cmd, void *inbuf, int lin,
 	SERVER_MESSAGE_CASE(addmrp);
 	SERVER_MESSAGE_CASE(delmrp);
 	SERVER_MESSAGE_CASE(getmrp);
+	SERVER_MESSAGE_CASE(getstats);
+	SERVER_MESSAGE_CASE(setflushvlans);
+	SERVER_MESSAGE_CASE(setprofile);
 	default:
 		return -1;
 	}
 }
 
+#define SHARD_MESSAGE_CASE(name)				\
+	case CMD_CODE_ ## name:					\
+		if (lin != sizeof(struct name ## _IN))		\
+			return NULL;				\
+		return shard_get(((struct name ## _IN *)inbuf)->br)
+
+/* Returns the shard that runs the instances of the bridge of the command, NULL
+ * for the commands that run on the main loop
+ */
+static struct shard *ctl_shard(int cmd, void *inbuf, int lin)
+{
+	switch (cmd) {
+	SHARD_MESSAGE_CASE(addmrp);
+	SHARD_MESSAGE_CASE(delmrp);
+	SHARD_MESSAGE_CASE(setflushvlans);
+	SHARD_MESSAGE_CASE(setprofile);
+	default:
+		return NULL;
+	}
+}
+
+struct ctl_message {
+	int cmd;
+	void *inbuf;
+	int lin;
+	void *outbuf;
+	int lout;
+};
+
+static int ctl_handle_message(void *arg)
+{
+	struct ctl_message *m = arg;
+
+	return handle_message(m->cmd, m->inbuf, m->lin, m->outbuf, m->lout);
+}
+
 #define MSG_BUF_LEN 10000
 static unsigned char msg_inbuf[MSG_BUF_LEN];
 static unsigned char msg_outbuf[MSG_BUF_LEN];
@@ -57,6 +97,7 @@ static unsigned char msg_outbuf[MSG_BUF_LEN];
 static void ctl_rcv_handler(EV_P_ ev_io *w, int revents)
 {
 	struct ctl_msg_hdr mhdr;
+	struct ctl_message m;
 	struct msghdr msg;
 	struct sockaddr_un sa;
 	struct iovec iov[2];
@@ -83,8 +124,14 @@ static void ctl_rcv_handler(EV_P_ ev_io *w, int revents)
 		return;
 	}
 
-	mhdr.res = handle_message(mhdr.cmd, msg_inbuf, mhdr.lin,
-				  msg_outbuf, mhdr.lout);
+	m.cmd = mhdr.cmd;
+	m.inbuf = msg_inbuf;
+	m.lin = mhdr.lin;
+	m.outbuf = msg_outbuf;
+	m.lout = mhdr.lout;
+
+	mhdr.res = shard_call(ctl_shard(m.cmd, m.inbuf, m.lin),
+			      ctl_handle_message, &m);
 
 	if(0 > mhdr.res)
 		memset(msg_outbuf, 0, mhdr.lout);
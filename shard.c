@@ -0,0 +1,534 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "shard.h"
+#include "pool.h"
+#include "list.h"
+#include "print.h"
+
+struct shard_work {
+	struct list_head	list;
+	/* set for shard_call, the caller waits until done is set */
+	int			(*call)(void *arg);
+	/* set for shard_post_all, the work is freed after it runs */
+	void			(*post)(void *arg);
+	void			*arg;
+	int			ret;
+	bool			done;
+	unsigned char		data[];
+};
+
+struct shard {
+	int			id;
+	/* CPU to which the thread is pinned, -1 if it is not pinned */
+	int			cpu;
+	pthread_t		thread;
+	struct ev_loop		*loop;
+	ev_async		wakeup;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	struct list_head	work;
+	/* Records of shard_post_all, taken by the main thread and freed by
+	 * the shard under lock
+	 */
+	struct pool		post_pool;
+	bool			started;
+	bool			ready;
+	bool			running;
+};
+
+static struct shard shards[SHARD_MAX];
+static int shard_nr;
+static int shard_cpus[SHARD_MAX];
+static int shard_cpu_nr;
+/* SCHED_FIFO priority of the shards, 0 if they are not real time */
+static int shard_rt_prio;
+
+static int (*shard_init_fn)(void);
+static void (*shard_cleanup_fn)(void);
+
+/* Shard of the calling thread, NULL in the main thread */
+static __thread struct shard *shard_self;
+
+void shard_set_count(int count)
+{
+	if (count < 0)
+		count = 0;
+	if (count > SHARD_MAX)
+		count = SHARD_MAX;
+
+	shard_nr = count;
+}
+
+/* Set the CPUs from a comma separated list. The shard i is pinned to the CPU i
+ * of the list, the list is reused if it is shorter than the number of shards.
+ */
+int shard_set_cpus(const char *list)
+{
+	const char *p = list;
+	char *end;
+	long cpu;
+
+	shard_cpu_nr = 0;
+
+	while (*p) {
+		errno = 0;
+		cpu = strtol(p, &end, 10);
+		if (errno || end == p || cpu < 0 || cpu >= CPU_SETSIZE ||
+		    (*end && *end != ',') || shard_cpu_nr == SHARD_MAX) {
+			pr_err("invalid CPU list: %s", list);
+			shard_cpu_nr = 0;
+			return -EINVAL;
+		}
+
+		shard_cpus[shard_cpu_nr++] = cpu;
+		p = *end ? end + 1 : end;
+	}
+
+	return 0;
+}
+
+/* Run the shards as SCHED_FIFO threads at priority prio. The main thread,
+ * which handles the control socket and writes the logs, keeps its priority.
+ */
+int shard_set_rt(int prio)
+{
+	if (prio < sched_get_priority_min(SCHED_FIFO) ||
+	    prio > sched_get_priority_max(SCHED_FIFO)) {
+		pr_err("invalid real time priority: %d", prio);
+		return -EINVAL;
+	}
+
+	shard_rt_prio = prio;
+
+	return 0;
+}
+
+bool shard_rt(void)
+{
+	return shard_rt_prio;
+}
+
+int shard_count(void)
+{
+	return shard_nr;
+}
+
+/* Returns the shard that runs the instances of the bridge, NULL if they run on
+ * the main loop
+ */
+struct shard *shard_get(uint32_t br_ifindex)
+{
+	if (!shard_nr)
+		return NULL;
+
+	return &shards[br_ifindex % shard_nr];
+}
+
+/* Returns the event loop of the calling thread */
+struct ev_loop *shard_loop(void)
+{
+	return shard_self ? shard_self->loop : EV_DEFAULT;
+}
+
+/* Returns true if the instances run on the loop of the calling thread */
+bool shard_runs_instances(void)
+{
+	return shard_self || !shard_nr;
+}
+
+static struct shard_work *shard_work_alloc(struct shard *shard, size_t size)
+{
+	struct shard_work *work = NULL;
+
+	if (size <= SHARD_POST_DATA) {
+		pthread_mutex_lock(&shard->lock);
+		work = pool_alloc(&shard->post_pool);
+		pthread_mutex_unlock(&shard->lock);
+	}
+
+	if (!work)
+		work = malloc(sizeof(*work) + size);
+
+	return work;
+}
+
+static void shard_work_free(struct shard *shard, struct shard_work *work)
+{
+	if (!pool_owns(&shard->post_pool, work)) {
+		free(work);
+		return;
+	}
+
+	pthread_mutex_lock(&shard->lock);
+	pool_free(&shard->post_pool, work);
+	pthread_mutex_unlock(&shard->lock);
+}
+
+static void shard_queue(struct shard *shard, struct shard_work *work)
+{
+	pthread_mutex_lock(&shard->lock);
+	list_add_tail(&work->list, &shard->work);
+	pthread_mutex_unlock(&shard->lock);
+
+	ev_async_send(shard->loop, &shard->wakeup);
+}
+
+static void shard_wakeup(EV_P_ ev_async *w, int revents)
+{
+	struct shard *shard = container_of(w, struct shard, wakeup);
+	struct shard_work *work, *tmp;
+	LIST_HEAD(list);
+	int ret;
+
+	pthread_mutex_lock(&shard->lock);
+	list_splice_init(&shard->work, &list);
+	pthread_mutex_unlock(&shard->lock);
+
+	list_for_each_entry_safe(work, tmp, &list, list) {
+		list_del(&work->list);
+
+		if (work->post) {
+			work->post(work->arg);
+			shard_work_free(shard, work);
+			continue;
+		}
+
+		/* The work is on the stack of the caller, which returns as
+		 * soon as done is set
+		 */
+		ret = work->call(work->arg);
+
+		pthread_mutex_lock(&shard->lock);
+		work->ret = ret;
+		work->done = true;
+		pthread_cond_broadcast(&shard->cond);
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+/* Runs fn on the loop of the shard and waits for its result. If shard is NULL,
+ * fn runs on the main loop. It is called only from the main thread, so the
+ * shards never wait for each other.
+ */
+int shard_call(struct shard *shard, int (*fn)(void *arg), void *arg)
+{
+	struct shard_work work = {
+		.call = fn,
+		.arg = arg,
+	};
+
+	if (!shard || shard == shard_self)
+		return fn(arg);
+
+	if (!shard->running)
+		return -ENODEV;
+
+	pthread_mutex_lock(&shard->lock);
+	list_add_tail(&work.list, &shard->work);
+	ev_async_send(shard->loop, &shard->wakeup);
+
+	while (!work.done)
+		pthread_cond_wait(&shard->cond, &shard->lock);
+	pthread_mutex_unlock(&shard->lock);
+
+	return work.ret;
+}
+
+/* Runs fn on the loop of every shard, one after the other, or on the main loop
+ * if there are no shards. Stops at the first error.
+ */
+int shard_call_all(int (*fn)(void *arg), void *arg)
+{
+	int i, err;
+
+	if (!shard_nr)
+		return fn(arg);
+
+	for (i = 0; i < shard_nr; ++i) {
+		err = shard_call(&shards[i], fn, arg);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/* Queues fn on every shard with a copy of the size bytes at arg and returns
+ * without waiting. The work of a shard runs in the order in which it was
+ * queued. If there are no shards, fn runs now on arg.
+ */
+void shard_post_all(void (*fn)(void *arg), void *arg, size_t size)
+{
+	struct shard_work *work;
+	int i;
+
+	if (!shard_nr) {
+		fn(arg);
+		return;
+	}
+
+	for (i = 0; i < shard_nr; ++i) {
+		if (!shards[i].running)
+			continue;
+
+		work = shard_work_alloc(&shards[i], size);
+		if (!work) {
+			pr_err("shard %d: cannot queue the work", i);
+			continue;
+		}
+
+		memset(work, 0, sizeof(*work));
+		work->post = fn;
+		work->arg = work->data;
+		memcpy(work->data, arg, size);
+
+		shard_queue(&shards[i], work);
+	}
+}
+
+/* Touch the stack that the loop may use, so it never page faults */
+static void __attribute__((noinline)) shard_prefault_stack(void)
+{
+	volatile unsigned char stack[SHARD_RT_STACK];
+
+	memset((unsigned char *)stack, 0, sizeof(stack));
+}
+
+static void shard_rt_thread(struct shard *shard)
+{
+	struct sched_param param = {
+		.sched_priority = shard_rt_prio,
+	};
+	int err;
+
+	err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (err)
+		pr_err("shard %d: cannot set SCHED_FIFO %d: %d", shard->id,
+		       shard_rt_prio, err);
+
+	shard_prefault_stack();
+	print_defer_thread();
+}
+
+/* Lock the memory of the process and fault in the heap that the shards use
+ * later, so that a page fault doesn't delay the recovery
+ */
+static void shard_rt_memory(void)
+{
+	void *heap;
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE))
+		pr_err("mlockall failed: %d", errno);
+
+	/* Keep the freed memory in the process and allocate from the heap
+	 * that is faulted in below
+	 */
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+
+	heap = malloc(SHARD_RT_HEAP);
+	if (!heap) {
+		pr_err("cannot prefault the heap");
+		return;
+	}
+
+	memset(heap, 0, SHARD_RT_HEAP);
+	free(heap);
+}
+
+static void *shard_run(void *arg)
+{
+	struct shard *shard = arg;
+	cpu_set_t cpus;
+	int err;
+
+	shard_self = shard;
+
+	if (shard->cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(shard->cpu, &cpus);
+
+		err = pthread_setaffinity_np(pthread_self(), sizeof(cpus),
+					     &cpus);
+		if (err)
+			pr_err("shard %d: cannot pin to CPU %d: %d", shard->id,
+			       shard->cpu, err);
+	}
+
+	if (shard_rt_prio)
+		shard_rt_thread(shard);
+
+	err = shard_init_fn();
+
+	pthread_mutex_lock(&shard->lock);
+	shard->ready = true;
+	shard->running = !err;
+	pthread_cond_broadcast(&shard->cond);
+	pthread_mutex_unlock(&shard->lock);
+
+	if (err)
+		return NULL;
+
+	ev_run(shard->loop, 0);
+
+	shard_cleanup_fn();
+
+	return NULL;
+}
+
+static int shard_stop(void *arg)
+{
+	ev_break(shard_self->loop, EVBREAK_ALL);
+
+	return 0;
+}
+
+/* Start the shards, each one calls init in its thread before it runs its loop
+ * and cleanup after. Without shards init is called on the main loop.
+ */
+int shard_init(int (*init)(void), void (*cleanup)(void))
+{
+	pthread_mutexattr_t attr;
+	sigset_t all, old;
+	struct shard *shard;
+	int i, err = 0;
+
+	shard_init_fn = init;
+	shard_cleanup_fn = cleanup;
+
+	/* The instances can't run on the main thread in real time mode */
+	if (shard_rt_prio && !shard_nr)
+		shard_nr = 1;
+
+	if (!shard_nr)
+		return init();
+
+	if (shard_rt_prio) {
+		shard_rt_memory();
+		print_defer_init(EV_DEFAULT);
+	}
+
+	/* The main thread, which isn't real time, may hold the lock of a
+	 * shard while it queues a work
+	 */
+	pthread_mutexattr_init(&attr);
+	if (shard_rt_prio)
+		pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+
+	/* The signals are handled by the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+
+	for (i = 0; i < shard_nr; ++i) {
+		shard = &shards[i];
+
+		shard->id = i;
+		shard->cpu = shard_cpu_nr ? shard_cpus[i % shard_cpu_nr] : -1;
+		INIT_LIST_HEAD(&shard->work);
+		pthread_mutex_init(&shard->lock, &attr);
+		pthread_cond_init(&shard->cond, NULL);
+
+		err = pool_init(&shard->post_pool, "event",
+				sizeof(struct shard_work) + SHARD_POST_DATA,
+				SHARD_POST_POOL);
+		if (err)
+			break;
+
+		shard->loop = ev_loop_new(EVFLAG_AUTO);
+		if (!shard->loop) {
+			pr_err("shard %d: cannot create the loop", i);
+			pool_uninit(&shard->post_pool);
+			err = -ENOMEM;
+			break;
+		}
+
+		ev_async_init(&shard->wakeup, shard_wakeup);
+		ev_async_start(shard->loop, &shard->wakeup);
+
+		err = pthread_create(&shard->thread, NULL, shard_run, shard);
+		if (err) {
+			pr_err("shard %d: cannot create the thread: %d", i,
+			       err);
+			ev_loop_destroy(shard->loop);
+			shard->loop = NULL;
+			pool_uninit(&shard->post_pool);
+			err = -err;
+			break;
+		}
+
+		shard->started = true;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	pthread_mutexattr_destroy(&attr);
+
+	for (i = 0; i < shard_nr; ++i) {
+		shard = &shards[i];
+		if (!shard->started)
+			continue;
+
+		pthread_mutex_lock(&shard->lock);
+		while (!shard->ready)
+			pthread_cond_wait(&shard->cond, &shard->lock);
+		pthread_mutex_unlock(&shard->lock);
+
+		if (!shard->running) {
+			pr_err("shard %d: init failed", i);
+			err = -EINVAL;
+		}
+	}
+
+	if (!err)
+		pr_info("running the instances on %d shards%s", shard_nr,
+			shard_rt_prio ? " in real time mode" : "");
+
+	return err;
+}
+
+void shard_uninit(void)
+{
+	struct shard_work *work, *tmp;
+	struct shard *shard;
+	int i;
+
+	if (!shard_nr) {
+		if (shard_cleanup_fn)
+			shard_cleanup_fn();
+		return;
+	}
+
+	for (i = 0; i < shard_nr; ++i) {
+		shard = &shards[i];
+		if (!shard->started)
+			continue;
+
+		shard_call(shard, shard_stop, NULL);
+		pthread_join(shard->thread, NULL);
+		shard->running = false;
+		shard->started = false;
+
+		/* The work that was queued after the stop */
+		list_for_each_entry_safe(work, tmp, &shard->work, list) {
+			list_del(&work->list);
+			shard_work_free(shard, work);
+		}
+		pool_uninit(&shard->post_pool);
+
+		ev_async_stop(shard->loop, &shard->wakeup);
+		ev_loop_destroy(shard->loop);
+		shard->loop = NULL;
+	}
+
+	print_defer_uninit();
+}
@@ -0,0 +1,50 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <ev.h>
+
+/* Maximum number of worker event loops */
+#define SHARD_MAX	16
+
+/* Stack and heap faulted in at startup in real time mode */
+#define SHARD_RT_STACK	(64 * 1024)
+#define SHARD_RT_HEAP	(8 * 1024 * 1024)
+
+/* Link events forwarded to each shard without a malloc, a bigger or an extra
+ * event is allocated
+ */
+#define SHARD_POST_POOL	64
+#define SHARD_POST_DATA	4096
+
+/* The instances can be split over several worker threads, each running its
+ * own event loop with its own timers, packet socket and netlink sockets. An
+ * instance belongs to the shard of its bridge. The main loop keeps the control
+ * socket and the link events and forwards them to the shards. Without shards
+ * the instances run on the main loop.
+ */
+struct shard;
+
+void shard_set_count(int count);
+int shard_set_cpus(const char *list);
+int shard_set_rt(int prio);
+bool shard_rt(void);
+int shard_count(void);
+
+struct shard *shard_get(uint32_t br_ifindex);
+struct ev_loop *shard_loop(void);
+bool shard_runs_instances(void);
+
+int shard_call(struct shard *shard, int (*fn)(void *arg), void *arg);
+int shard_call_all(int (*fn)(void *arg), void *arg);
+void shard_post_all(void (*fn)(void *arg), void *arg, size_t size);
+
+int shard_init(int (*init)(void), void (*cleanup)(void));
+void shard_uninit(void);
+
+#endif /* SHARD_H */
@@ -6,6 +6,7 @@
 #include <sys/time.h>
 #include <stdio.h>
 #include <errno.h>
+#include <stddef.h>
 
 #include "state_machine.h"
 #include "server_cmds.h"
@@ -14,8 +15,39 @@
 #include "pdu.h"
 #include "cfm_netlink.h"
 #include "print.h"
+#include "profile.h"
+#include "pool.h"
+#include "transition.h"
 
-static LIST_HEAD(mrp_instances);
+/* Each event loop keeps the instances that it runs, so the lookups don't need
+ * a lock. The other loops reach them only through their loop.
+ */
+static __thread struct list_head mrp_instances;
+
+/* The hash tables are sized by mrp_init for the instances of the loop, so
+ * that the chains stay short up to the limit
+ */
+#define MRP_INSTANCE_HASH_BITS_MIN	8
+static __thread unsigned int mrp_instance_hash_bits;
+static __thread struct hlist_head *mrp_ring_hash;
+static __thread struct hlist_head *mrp_cfm_hash;
+
+/* An instance has up to 3 ports */
+#define MRP_PORT_HASH_SHIFT	2
+static __thread unsigned int mrp_port_hash_bits;
+static __thread struct hlist_head *mrp_ports;
+
+/* Number of received frames that were dropped because they were malformed */
+static __thread uint64_t mrp_rx_invalid;
+
+/* The instances, with their ports, are taken from a pool sized at startup,
+ * the limit is per loop
+ */
+static unsigned int mrp_max_instances = MAX_MRP_INSTANCES;
+static __thread struct pool mrp_pool;
+
+/* The CFM offload library is shared by all the loops */
+pthread_mutex_t mrp_cfm_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static const uint8_t mrp_test_dmac[ETH_ALEN] = { 0x1, 0x15, 0x4e, 0x0, 0x0, 0x1 };
 static const uint8_t mrp_control_dmac[ETH_ALEN] = { 0x1, 0x15, 0x4e, 0x0, 0x0, 0x2 };
@@ -23,25 +55,34 @@ static const uint8_t mrp_icontrol_dmac[ETH_ALEN] = { 0x1, 0x15, 0x4e, 0x0, 0x0,
 
 struct mrp_port *mrp_get_port(uint32_t ifindex)
 {
-	struct mrp *mrp;
+	struct hlist_head *head;
+	struct hlist_node *pos;
+	struct mrp_port *p;
 
-	list_for_each_entry(mrp, &mrp_instances, list) {
-		if (mrp->p_port && mrp->p_port->ifindex == ifindex)
-			return mrp->p_port;
-		if (mrp->s_port && mrp->s_port->ifindex == ifindex)
-			return mrp->s_port;
-		if (mrp->i_port && mrp->i_port->ifindex == ifindex)
-			return mrp->i_port;
+	head = &mrp_ports[hash_32(ifindex, mrp_port_hash_bits)];
+	hlist_for_each_entry(p, pos, head, node) {
+		if (p->ifindex == ifindex)
+			return p;
 	}
 
 	return NULL;
 }
 
-static struct mrp *mrp_get_mrp(uint32_t ifindex, uint32_t peer_mepid)
+static struct hlist_head *mrp_instance_head(struct hlist_head *hash,
+					    uint32_t br_ifindex, uint32_t id)
+{
+	return &hash[hash_32(br_ifindex ^ hash_32(id, 32),
+			     mrp_instance_hash_bits)];
+}
+
+struct mrp *mrp_get_mrp(uint32_t ifindex, uint32_t peer_mepid)
 {
+	struct hlist_head *head;
+	struct hlist_node *pos;
 	struct mrp *mrp;
 
-	list_for_each_entry(mrp, &mrp_instances, list) {
+	head = mrp_instance_head(mrp_cfm_hash, ifindex, peer_mepid);
+	hlist_for_each_entry(mrp, pos, head, cfm_node) {
 		if (mrp->ifindex == ifindex &&
 		    mrp->cfm_peer_mepid == peer_mepid)
 			return mrp;
@@ -82,7 +123,7 @@ static void mrp_reset_ring_state(struct mrp *mrp)
 	mrp->mrc_state = MRP_MRC_STATE_AC_STAT1;
 }
 
-static char *mrp_get_mrm_state(enum mrp_mrm_state_type state)
+char *mrp_get_mrm_state(enum mrp_mrm_state_type state)
 {
 	switch (state) {
 	case MRP_MRM_STATE_AC_STAT1: return "AC_STAT1";
@@ -93,7 +134,7 @@ static char *mrp_get_mrm_state(enum mrp_mrm_state_type state)
 	}
 }
 
-static char *mrp_get_mrc_state(enum mrp_mrc_state_type state)
+char *mrp_get_mrc_state(enum mrp_mrc_state_type state)
 {
 	switch (state) {
 	case MRP_MRC_STATE_AC_STAT1: return "AC_STAT1";
@@ -105,7 +146,7 @@ static char *mrp_get_mrc_state(enum mrp_mrc_state_type state)
 	}
 }
 
-static char *mrp_get_mim_state(enum mrp_mim_state_type state)
+char *mrp_get_mim_state(enum mrp_mim_state_type state)
 {
 	switch (state) {
 	case MRP_MIM_STATE_AC_STAT1: return "AC_STAT1";
@@ -115,7 +156,7 @@ static char *mrp_get_mim_state(enum mrp_mim_state_type state)
 	}
 }
 
-static char *mrp_get_mic_state(enum mrp_mic_state_type state)
+char *mrp_get_mic_state(enum mrp_mic_state_type state)
 {
 	switch (state) {
 	case MRP_MIC_STATE_AC_STAT1: return "AC_STAT1";
@@ -134,7 +175,7 @@ void mrp_set_mrm_init(struct mrp *mrp)
 
 void mrp_set_mrc_init(struct mrp *mrp)
 {
-	mrp->ring_link_curr_max = mrp->ring_link_conf_max;
+	mrp->ring_link_curr_max = mrp->timing->ring_link_max;
 	mrp->ring_test_curr = 0;
 }
 
@@ -182,9 +223,10 @@ static int mrp_set_mra_role(struct mrp *mrp)
 
 	mrp->mra_support = true;
 
-	err = mrp_netlink_add(mrp, mrp->p_port, mrp->s_port, mrp->prio);
-	if (err)
-		return err;
+	/* Send all the netlink messages of the role change together */
+	mrp_netlink_begin();
+
+	mrp_netlink_add(mrp, mrp->p_port, mrp->s_port, mrp->prio);
 
 	/* When changing the role everything is reset */
 	mrp_reset_ring_state(mrp);
@@ -195,7 +237,9 @@ static int mrp_set_mra_role(struct mrp *mrp)
 
 	mrp_port_netlink_set_state(mrp->p_port, BR_MRP_PORT_STATE_BLOCKED);
 	mrp_port_netlink_set_state(mrp->s_port, BR_MRP_PORT_STATE_BLOCKED);
-	err = mrp_netlink_set_ring_role(mrp, BR_MRP_RING_ROLE_MRM);
+	mrp_netlink_set_ring_role(mrp, BR_MRP_RING_ROLE_MRM);
+
+	err = mrp_netlink_commit(NULL, 0);
 	if (err)
 		return err;
 
@@ -218,9 +262,9 @@ static int mrp_set_mrm_role(struct mrp *mrp)
 	if (!mrp->p_port || !mrp->s_port)
 		return -EINVAL;
 
-	err = mrp_netlink_add(mrp, mrp->p_port, mrp->s_port, mrp->prio);
-	if (err)
-		return err;
+	mrp_netlink_begin();
+
+	mrp_netlink_add(mrp, mrp->p_port, mrp->s_port, mrp->prio);
 
 	/* When changing the role everything is reset */
 	mrp_reset_ring_state(mrp);
@@ -230,7 +274,9 @@ static int mrp_set_mrm_role(struct mrp *mrp)
 
 	mrp_port_netlink_set_state(mrp->p_port, BR_MRP_PORT_STATE_BLOCKED);
 	mrp_port_netlink_set_state(mrp->s_port, BR_MRP_PORT_STATE_BLOCKED);
-	err = mrp_netlink_set_ring_role(mrp, BR_MRP_RING_ROLE_MRM);
+	mrp_netlink_set_ring_role(mrp, BR_MRP_RING_ROLE_MRM);
+
+	err = mrp_netlink_commit(NULL, 0);
 	if (err)
 		return err;
 
@@ -253,9 +299,9 @@ static int mrp_set_mrc_role(struct mrp *mrp)
 	if (!mrp->p_port || !mrp->s_port)
 		return -EINVAL;
 
-	err = mrp_netlink_add(mrp, mrp->p_port, mrp->s_port, mrp->prio);
-	if (err)
-		return err;
+	mrp_netlink_begin();
+
+	mrp_netlink_add(mrp, mrp->p_port, mrp->s_port, mrp->prio);
 
 	/* When changing the role everything is reset */
 	mrp_reset_ring_state(mrp);
@@ -265,7 +311,9 @@ static int mrp_set_mrc_role(struct mrp *mrp)
 
 	mrp_port_netlink_set_state(mrp->p_port, BR_MRP_PORT_STATE_BLOCKED);
 	mrp_port_netlink_set_state(mrp->s_port, BR_MRP_PORT_STATE_BLOCKED);
-	err = mrp_netlink_set_ring_role(mrp, BR_MRP_RING_ROLE_MRC);
+	mrp_netlink_set_ring_role(mrp, BR_MRP_RING_ROLE_MRC);
+
+	err = mrp_netlink_commit(NULL, 0);
 	if (err)
 		return err;
 
@@ -289,13 +337,16 @@ static int mrp_set_mim_role(struct mrp *mrp)
 	mrp->mim_state = MRP_MIM_STATE_AC_STAT1;
 	mrp->mic_state = MRP_MIC_STATE_AC_STAT1;
 
-	err = mrp_netlink_set_in_role(mrp, BR_MRP_IN_ROLE_MIM);
-	if (err)
-		return err;
+	mrp_netlink_begin();
 
+	mrp_netlink_set_in_role(mrp, BR_MRP_IN_ROLE_MIM);
 	mrp_set_mim_state(mrp, MRP_MIM_STATE_AC_STAT1);
 	mrp_port_netlink_set_state(mrp->i_port, BR_MRP_PORT_STATE_BLOCKED);
 
+	err = mrp_netlink_commit(NULL, 0);
+	if (err)
+		return err;
+
 	if (mrp_is_port_up(mrp->i_port)) {
 		if (mrp->in_mode == MRP_IN_MODE_RC)
 			mrp_port_link_change(mrp->i_port, true);
@@ -320,12 +371,15 @@ static int mrp_set_mic_role(struct mrp *mrp)
 
 	mrp_set_mic_state(mrp, MRP_MIC_STATE_AC_STAT1);
 
-	err = mrp_netlink_set_in_role(mrp, BR_MRP_IN_ROLE_MIC);
-	if (err)
-		return err;
+	mrp_netlink_begin();
 
+	mrp_netlink_set_in_role(mrp, BR_MRP_IN_ROLE_MIC);
 	mrp_port_netlink_set_state(mrp->i_port, BR_MRP_PORT_STATE_BLOCKED);
 
+	err = mrp_netlink_commit(NULL, 0);
+	if (err)
+		return err;
+
 	if (mrp_is_port_up(mrp->i_port)) {
 		if (mrp->in_mode == MRP_IN_MODE_RC)
 			mrp_port_link_change(mrp->i_port, true);
@@ -346,38 +400,25 @@ static uint16_t mrp_next_seq(struct mrp *mrp)
 	return mrp->seq_id;
 }
 
-/* Allocates MRP frame and set head part of the frames. This is the ethernet
- * and the MRP version
- */
-static struct frame_buf *mrp_fb_alloc(void)
-{
-	struct frame_buf *fb;
-	uint16_t *version;
-
-	fb = fb_alloc(MRP_MAX_FRAME_LENGTH);
-	if (!fb)
-		return NULL;
-
-	version = fb_put(fb, sizeof(*version));
-	*version = __cpu_to_be16(MRP_VERSION);
-
-	return fb;
-}
+static const uint8_t *mrp_dmac[MRP_DMAC_MAX] = {
+	[MRP_DMAC_TEST] = mrp_test_dmac,
+	[MRP_DMAC_CONTROL] = mrp_control_dmac,
+	[MRP_DMAC_ICONTROL] = mrp_icontrol_dmac,
+};
 
-static struct ethhdr *mrp_eth_alloc(const unsigned char *src,
-				    const unsigned char *dst)
+/* Set the ethernet headers of the frames sent on the port p */
+static void mrp_port_tx_init(struct mrp_port *p)
 {
 	struct ethhdr *hdr;
+	int i;
 
-	hdr = malloc(sizeof(*hdr));
-	if (!hdr)
-		return NULL;
+	for (i = 0; i < MRP_DMAC_MAX; ++i) {
+		hdr = &p->tx_eth[i];
 
-	memcpy(hdr->h_dest, dst, ETH_ALEN);
-	memcpy(hdr->h_source, src, ETH_ALEN);
-	hdr->h_proto = __cpu_to_be16(ETH_P_MRP);
-
-	return hdr;
+		memcpy(hdr->h_dest, mrp_dmac[i], ETH_ALEN);
+		memcpy(hdr->h_source, p->macaddr, ETH_ALEN);
+		hdr->h_proto = __cpu_to_be16(ETH_P_MRP);
+	}
 }
 
 static void mrp_fb_tlv(struct frame_buf *fb, enum br_mrp_tlv_header_type type,
@@ -400,30 +441,179 @@ static void mrp_fb_sub_tlv(struct frame_buf *fb,
 	hdr->length = length;
 }
 
-static void mrp_fb_common(struct frame_buf *fb, struct mrp_port *p)
+/* The sequence number is set when the frame is sent */
+static struct br_mrp_common_hdr *mrp_fb_common(struct frame_buf *fb,
+					       struct mrp *mrp)
 {
 	struct br_mrp_common_hdr *hdr;
 
 	mrp_fb_tlv(fb, BR_MRP_TLV_HEADER_COMMON, sizeof(*hdr));
 
 	hdr = fb_put(fb, sizeof(*hdr));
-	hdr->seq_id = __cpu_to_be16(mrp_next_seq(p->mrp));
-	memcpy(hdr->domain, p->mrp->domain, MRP_DOMAIN_UUID_LENGTH);
+	memcpy(hdr->domain, mrp->domain, MRP_DOMAIN_UUID_LENGTH);
+
+	return hdr;
+}
+
+/* Start a template, the first part of each frame is the MRP version */
+static void mrp_tx_start(struct mrp_tx_tmpl *t, struct frame_buf *fb,
+			 enum mrp_dmac_type dmac)
+{
+	uint16_t *version;
+
+	memset(t->data, 0x0, sizeof(t->data));
+	fb->start = t->data;
+	fb->data = t->data;
+	fb->size = 0;
+
+	t->dmac = dmac;
+	t->bypass = false;
+
+	version = fb_put(fb, sizeof(*version));
+	*version = __cpu_to_be16(MRP_VERSION);
+
+	t->tlv = (struct br_mrp_tlv_hdr *)fb->data;
+}
+
+/* End a template with the common TLV and the end TLV. The frame is padded to
+ * the minimum ethernet frame size.
+ */
+static void mrp_tx_end(struct mrp *mrp, struct mrp_tx_tmpl *t,
+		       struct frame_buf *fb)
+{
+	t->common = mrp_fb_common(fb, mrp);
+	mrp_fb_tlv(fb, BR_MRP_TLV_HEADER_END, 0x0);
+
+	if (sizeof(struct ethhdr) + fb->size < 60)
+		fb->size = 60 - sizeof(struct ethhdr);
+
+	t->size = fb->size;
+}
+
+/* Build a template for a frame that has only one TLV before the common TLV */
+static void *mrp_tx_build(struct mrp *mrp, enum mrp_tx_type type,
+			  enum mrp_dmac_type dmac,
+			  enum br_mrp_tlv_header_type tlv, uint8_t length)
+{
+	struct mrp_tx_tmpl *t = &mrp->tx[type];
+	struct frame_buf fb;
+
+	mrp_tx_start(t, &fb, dmac);
+
+	mrp_fb_tlv(&fb, tlv, length);
+	t->hdr = fb_put(&fb, length);
+
+	mrp_tx_end(mrp, t, &fb);
+
+	return t->hdr;
+}
+
+/* Build a template for a MRP_Option frame with one sub-TLV */
+static void *mrp_tx_build_option(struct mrp *mrp, enum mrp_tx_type type,
+				 enum br_mrp_sub_tlv_header_type sub_tlv,
+				 uint8_t length, bool pad)
+{
+	struct mrp_tx_tmpl *t = &mrp->tx[type];
+	struct br_mrp_sub_opt_hdr *sub_opt_hdr;
+	struct br_mrp_oui_hdr *oui_hdr;
+	struct frame_buf fb;
+
+	mrp_tx_start(t, &fb, MRP_DMAC_TEST);
+
+	mrp_fb_tlv(&fb, BR_MRP_TLV_HEADER_OPTION,
+		   sizeof(struct br_mrp_oui_hdr) +
+		   sizeof(struct br_mrp_sub_opt_hdr) +
+		   sizeof(struct br_mrp_sub_tlv_hdr) + length);
+
+	oui_hdr = fb_put(&fb, sizeof(*oui_hdr));
+	memset(oui_hdr->oui, 0x0, MRP_OUI_LENGTH);
+
+	sub_opt_hdr = fb_put(&fb, sizeof(*sub_opt_hdr));
+	sub_opt_hdr->type = 0x0;
+	memset(sub_opt_hdr->manufacture_data, 0x0, MRP_MANUFACTURE_DATA_LENGTH);
+
+	/* The number 2 is for padding */
+	mrp_fb_sub_tlv(&fb, sub_tlv, length + 2);
+	t->hdr = fb_put(&fb, length);
+
+	if (pad)
+		fb_put(&fb, 2);
+
+	mrp_tx_end(mrp, t, &fb);
+
+	return t->hdr;
+}
+
+/* Build the templates of all the frames sent by the MRP instance. The fields
+ * that don't change between frames are set here, therefore this needs to be
+ * called each time the bridge MAC address changes.
+ */
+static void mrp_tx_init(struct mrp *mrp)
+{
+	struct br_mrp_in_link_status_hdr *in_link_status_hdr;
+	struct br_mrp_test_mgr_nack_hdr *nack_hdr;
+	struct br_mrp_ring_topo_hdr *ring_topo_hdr;
+	struct br_mrp_ring_link_hdr *ring_link_hdr;
+	struct br_mrp_test_prop_hdr *prop_hdr;
+	struct br_mrp_in_topo_hdr *in_topo_hdr;
+	struct br_mrp_in_link_hdr *in_link_hdr;
+
+	ring_topo_hdr = mrp_tx_build(mrp, MRP_TX_RING_TOPO, MRP_DMAC_CONTROL,
+				     BR_MRP_TLV_HEADER_RING_TOPO,
+				     sizeof(*ring_topo_hdr));
+	ether_addr_copy(ring_topo_hdr->sa, mrp->macaddr);
+	mrp->tx[MRP_TX_RING_TOPO].bypass = true;
+
+	ring_link_hdr = mrp_tx_build(mrp, MRP_TX_RING_LINK, MRP_DMAC_CONTROL,
+				     BR_MRP_TLV_HEADER_RING_LINK_UP,
+				     sizeof(*ring_link_hdr));
+	ether_addr_copy(ring_link_hdr->sa, mrp->macaddr);
+
+	nack_hdr = mrp_tx_build_option(mrp, MRP_TX_TEST_MGR_NACK,
+				       BR_MRP_SUB_TLV_HEADER_TEST_MGR_NACK,
+				       sizeof(*nack_hdr), true);
+	ether_addr_copy(nack_hdr->sa, mrp->macaddr);
+
+	prop_hdr = mrp_tx_build_option(mrp, MRP_TX_TEST_PROP,
+				       BR_MRP_SUB_TLV_HEADER_TEST_PROPAGATE,
+				       sizeof(*prop_hdr), false);
+	ether_addr_copy(prop_hdr->sa, mrp->macaddr);
+
+	in_topo_hdr = mrp_tx_build(mrp, MRP_TX_IN_TOPO, MRP_DMAC_ICONTROL,
+				   BR_MRP_TLV_HEADER_IN_TOPO,
+				   sizeof(*in_topo_hdr));
+	ether_addr_copy(in_topo_hdr->sa, mrp->macaddr);
+	in_topo_hdr->id = __cpu_to_be16(mrp->in_id);
+	mrp->tx[MRP_TX_IN_TOPO].bypass = true;
+
+	in_link_hdr = mrp_tx_build(mrp, MRP_TX_IN_LINK, MRP_DMAC_ICONTROL,
+				   BR_MRP_TLV_HEADER_IN_LINK_UP,
+				   sizeof(*in_link_hdr));
+	ether_addr_copy(in_link_hdr->sa, mrp->macaddr);
+	in_link_hdr->id = __cpu_to_be16(mrp->in_id);
+
+	in_link_status_hdr = mrp_tx_build(mrp, MRP_TX_IN_LINK_STATUS,
+					  MRP_DMAC_ICONTROL,
+					  BR_MRP_TLV_HEADER_IN_LINK_STATUS,
+					  sizeof(*in_link_status_hdr));
+	ether_addr_copy(in_link_status_hdr->sa, mrp->macaddr);
+	in_link_status_hdr->id = __cpu_to_be16(mrp->in_id);
 }
 
-static void mrp_send(struct mrp_port *p, struct ethhdr *h, struct frame_buf *fb)
+/* Set the sequence number of the template and send it on the port p */
+static void mrp_send(struct mrp_port *p, struct mrp_tx_tmpl *t)
 {
-	if (sizeof(*h) + fb->size < 60)
-		fb->size += 60 - fb->size - sizeof(*h);
+	t->common->seq_id = __cpu_to_be16(mrp_next_seq(p->mrp));
 
 	struct iovec iov[2] =
 	{
-		{ .iov_base = h, .iov_len = sizeof(*h) },
-		{ .iov_base = fb->start, .iov_len = fb->size }
+		{ .iov_base = &p->tx_eth[t->dmac], .iov_len = sizeof(struct ethhdr) },
+		{ .iov_base = t->data, .iov_len = t->size }
 	};
 
 	if (p->operstate == IF_OPER_UP)
-		packet_send(p->ifindex, iov, 2, sizeof(*h) + fb->size);
+		packet_queue(p->ifindex, iov, 2, sizeof(struct ethhdr) + t->size,
+			     t->bypass);
 }
 
 /* Notify the HW to start to send frames, if the HW can't do it then the kernel
@@ -436,41 +626,20 @@ void mrp_ring_test_req(struct mrp *mrp, uint32_t interval)
 	mrp_ring_test_start(mrp, interval);
 }
 
-/* Compose MRP_TopologyChange frame and forward the frame to the port p.
+/* Send MRP_TopologyChange frame to the port p.
  * The MRP_TopologyChange frame has the following format:
  * MRP_Version, MRP_TLVHeader, MRP_Prio, MRP_SA, MRP_Interval
  */
 static void mrp_send_ring_topo(struct mrp_port *p, uint32_t interval)
 {
-	struct br_mrp_ring_topo_hdr *hdr = NULL;
-	struct frame_buf *fb = NULL;
+	struct mrp_tx_tmpl *t = &p->mrp->tx[MRP_TX_RING_TOPO];
+	struct br_mrp_ring_topo_hdr *hdr = t->hdr;
 	struct mrp *mrp = p->mrp;
-	struct ethhdr *h = NULL;
-
-	fb = mrp_fb_alloc();
-	if (!fb)
-		return;
-
-	mrp_fb_tlv(fb, BR_MRP_TLV_HEADER_RING_TOPO, sizeof(*hdr));
-	hdr = fb_put(fb, sizeof(*hdr));
 
 	hdr->prio = __cpu_to_be16(mrp->prio);
-	ether_addr_copy(hdr->sa, mrp->macaddr);
 	hdr->interval = interval == 0 ? 0 : __cpu_to_be16(interval / 1000);
 
-	mrp_fb_common(fb, p);
-	mrp_fb_tlv(fb, BR_MRP_TLV_HEADER_END, 0x0);
-
-	h = mrp_eth_alloc(p->macaddr, mrp_control_dmac);
-	if (!h)
-		goto out;
-
-	mrp_send(p, h, fb);
-
-	free(h);
-out:
-	free(fb->start);
-	free(fb);
+	mrp_send(p, t);
 }
 
 void mrp_ring_topo_send(struct mrp *mrp, uint32_t time)
@@ -488,55 +657,35 @@ void mrp_ring_topo_req(struct mrp *mrp, uint32_t time)
 {
 	pr_info("topo_req: %d", time);
 
-	mrp_ring_topo_send(mrp, time * mrp->ring_topo_conf_max);
+	mrp_ring_topo_send(mrp, time * mrp->timing->ring_topo_max);
 
 	if (!time) {
 		mrp_netlink_flush(mrp);
 	} else {
-		uint32_t delay = mrp->ring_topo_conf_interval;
+		uint32_t delay = mrp->timing->ring_topo_interval;
 
 		mrp_ring_topo_start(mrp, delay);
 	}
 }
 
-/* Compose MRP_LinkChange frame and forward the frame to the port p.
+/* Send MRP_LinkChange frame to the port p.
  * The MRP_LinkChange frame has the following format:
  * MRP_Version, MRP_TLVHeader, MRP_SA, MRP_PortRole, MRP_Interval, MRP_Blocked
  */
 static void mrp_send_ring_link(struct mrp_port *p, bool up, uint32_t interval)
 {
-	struct br_mrp_ring_link_hdr *hdr = NULL;
-	struct frame_buf *fb = NULL;
+	struct mrp_tx_tmpl *t = &p->mrp->tx[MRP_TX_RING_LINK];
+	struct br_mrp_ring_link_hdr *hdr = t->hdr;
 	struct mrp *mrp = p->mrp;
-	struct ethhdr *h = NULL;
-
-	fb = mrp_fb_alloc();
-	if (!fb)
-		return;
 
-	mrp_fb_tlv(fb, up ? BR_MRP_TLV_HEADER_RING_LINK_UP :
-			    BR_MRP_TLV_HEADER_RING_LINK_DOWN,
-		      sizeof(*hdr));
-	hdr = fb_put(fb, sizeof(*hdr));
+	t->tlv->type = up ? BR_MRP_TLV_HEADER_RING_LINK_UP :
+			    BR_MRP_TLV_HEADER_RING_LINK_DOWN;
 
-	ether_addr_copy(hdr->sa, mrp->macaddr);
 	hdr->port_role = __cpu_to_be16(p->role);
 	hdr->interval = interval == 0 ? 0 : __cpu_to_be16(interval / 1000);
 	hdr->blocked = __cpu_to_be16(mrp->blocked);
 
-	mrp_fb_common(fb, p);
-	mrp_fb_tlv(fb, BR_MRP_TLV_HEADER_END, 0x0);
-
-	h = mrp_eth_alloc(p->macaddr, mrp_control_dmac);
-	if (!h)
-		goto out;
-
-	mrp_send(p, h, fb);
-
-	free(h);
-out:
-	free(fb->start);
-	free(fb);
+	mrp_send(p, t);
 }
 
 /* Send MRP_LinkChange frames on one of MRP ports */
@@ -547,60 +696,20 @@ void mrp_ring_link_req(struct mrp_port *p, bool up, uint32_t interval)
 	mrp_send_ring_link(p, up, interval);
 }
 
-static void mrp_send_test_mgr_nack(struct mrp_port *p, uint8_t sa[ETH_ALEN])
+static void mrp_send_test_mgr_nack(struct mrp_port *p, const uint8_t *sa)
 {
-	struct br_mrp_test_mgr_nack_hdr *nack_hdr = NULL;
-	struct br_mrp_sub_opt_hdr *sub_opt_hdr = NULL;
-	struct br_mrp_oui_hdr *oui_hdr = NULL;
-	struct frame_buf *fb = NULL;
+	struct mrp_tx_tmpl *t = &p->mrp->tx[MRP_TX_TEST_MGR_NACK];
+	struct br_mrp_test_mgr_nack_hdr *hdr = t->hdr;
 	struct mrp *mrp = p->mrp;
-	struct ethhdr *h = NULL;
-
-	fb = mrp_fb_alloc();
-	if (!fb)
-		return;
-
-	mrp_fb_tlv(fb, BR_MRP_TLV_HEADER_OPTION,
-		   sizeof(struct br_mrp_oui_hdr) +
-		   sizeof(struct br_mrp_sub_opt_hdr) +
-		   sizeof(struct br_mrp_sub_tlv_hdr) +
-		   sizeof(struct br_mrp_test_mgr_nack_hdr));
-
-	oui_hdr = fb_put(fb, sizeof(*oui_hdr));
-	memset(oui_hdr->oui, 0x0, MRP_OUI_LENGTH);
-
-	sub_opt_hdr = fb_put(fb, sizeof(*sub_opt_hdr));
-	sub_opt_hdr->type = 0x0;
-	memset(sub_opt_hdr->manufacture_data, 0x0, MRP_MANUFACTURE_DATA_LENGTH);
-
-	/* The number 2 is for padding */
-	mrp_fb_sub_tlv(fb, BR_MRP_SUB_TLV_HEADER_TEST_MGR_NACK,
-		       sizeof(*nack_hdr) + 2);
-	nack_hdr = fb_put(fb, sizeof(*nack_hdr));
-
-	nack_hdr->prio = __cpu_to_be16(mrp->prio);
-	ether_addr_copy(nack_hdr->sa, mrp->macaddr);
-	nack_hdr->other_prio = 0;
-	ether_addr_copy(nack_hdr->other_sa, sa);
 
-	fb_put(fb, 2);
-
-	mrp_fb_common(fb, p);
-	mrp_fb_tlv(fb, BR_MRP_TLV_HEADER_END, 0x0);
-
-	h = mrp_eth_alloc(p->macaddr, mrp_test_dmac);
-	if (!h)
-		goto out;
-
-	mrp_send(p, h, fb);
+	hdr->prio = __cpu_to_be16(mrp->prio);
+	hdr->other_prio = 0;
+	ether_addr_copy(hdr->other_sa, sa);
 
-	free(h);
-out:
-	free(fb->start);
-	free(fb);
+	mrp_send(p, t);
 }
 
-static void mrp_test_mgr_nack_req(struct mrp *mrp, uint8_t sa[ETH_ALEN])
+static void mrp_test_mgr_nack_req(struct mrp *mrp, const uint8_t *sa)
 {
 	mrp_send_test_mgr_nack(mrp->p_port, sa);
 	mrp_send_test_mgr_nack(mrp->s_port, sa);
@@ -608,53 +717,15 @@ static void mrp_test_mgr_nack_req(struct mrp *mrp, uint8_t sa[ETH_ALEN])
 
 static void mrp_send_test_prop(struct mrp_port *p)
 {
-	struct br_mrp_sub_opt_hdr *sub_opt_hdr = NULL;
-	struct br_mrp_test_prop_hdr *prop_hdr = NULL;
-	struct br_mrp_oui_hdr *oui_hdr = NULL;
-	struct frame_buf *fb = NULL;
+	struct mrp_tx_tmpl *t = &p->mrp->tx[MRP_TX_TEST_PROP];
+	struct br_mrp_test_prop_hdr *hdr = t->hdr;
 	struct mrp *mrp = p->mrp;
-	struct ethhdr *h = NULL;
-
-	fb = mrp_fb_alloc();
-	if (!fb)
-		return;
-
-	mrp_fb_tlv(fb, BR_MRP_TLV_HEADER_OPTION,
-		   sizeof(struct br_mrp_oui_hdr) +
-		   sizeof(struct br_mrp_sub_opt_hdr) +
-		   sizeof(struct br_mrp_sub_tlv_hdr) +
-		   sizeof(struct br_mrp_test_prop_hdr));
-
-	oui_hdr = fb_put(fb, sizeof(*oui_hdr));
-	memset(oui_hdr->oui, 0x0, MRP_OUI_LENGTH);
-
-	sub_opt_hdr = fb_put(fb, sizeof(*sub_opt_hdr));
-	sub_opt_hdr->type = 0x0;
-	memset(sub_opt_hdr->manufacture_data, 0x0, MRP_MANUFACTURE_DATA_LENGTH);
-
-	/* The number 2 is for padding */
-	mrp_fb_sub_tlv(fb, BR_MRP_SUB_TLV_HEADER_TEST_PROPAGATE,
-		       sizeof(*prop_hdr) + 2);
-	prop_hdr = fb_put(fb, sizeof(*prop_hdr));
-
-	prop_hdr->prio = __cpu_to_be16(mrp->prio);
-	ether_addr_copy(prop_hdr->sa, mrp->macaddr);
-	prop_hdr->other_prio = __cpu_to_be16(mrp->prio);
-	ether_addr_copy(prop_hdr->other_sa, mrp->ring_mac);
-
-	mrp_fb_common(fb, p);
-	mrp_fb_tlv(fb, BR_MRP_TLV_HEADER_END, 0x0);
-
-	h = mrp_eth_alloc(p->macaddr, mrp_test_dmac);
-	if (!h)
-		goto out;
 
-	mrp_send(p, h, fb);
+	hdr->prio = __cpu_to_be16(mrp->prio);
+	hdr->other_prio = __cpu_to_be16(mrp->prio);
+	ether_addr_copy(hdr->other_sa, mrp->ring_mac);
 
-	free(h);
-out:
-	free(fb->start);
-	free(fb);
+	mrp_send(p, t);
 }
 
 static void mrp_test_prop_req(struct mrp *mrp)
@@ -674,41 +745,18 @@ void mrp_in_test_req(struct mrp *mrp, uint32_t interval)
 	mrp_in_test_start(mrp, interval);
 }
 
-/* Compose MRP_IntTopologyChange frame and send the frame to the port p.
+/* Send MRP_IntTopologyChange frame to the port p.
  * The MRP_IntTopologyChange frame has the following format:
  * MRP_Version, MRP_TLVHeader, MRP_SA, MRP_IntId, MRP_Interval
  */
 static void mrp_send_in_topo(struct mrp_port *p, uint32_t interval)
 {
-	struct br_mrp_in_topo_hdr *hdr = NULL;
-	struct frame_buf *fb = NULL;
-	struct mrp *mrp = p->mrp;
-	struct ethhdr *h = NULL;
-
-	fb = mrp_fb_alloc();
-	if (!fb)
-		return;
-
-	mrp_fb_tlv(fb, BR_MRP_TLV_HEADER_IN_TOPO, sizeof(*hdr));
-	hdr = fb_put(fb, sizeof(*hdr));
+	struct mrp_tx_tmpl *t = &p->mrp->tx[MRP_TX_IN_TOPO];
+	struct br_mrp_in_topo_hdr *hdr = t->hdr;
 
-	ether_addr_copy(hdr->sa, mrp->macaddr);
-	hdr->id = __cpu_to_be16(mrp->in_id);
 	hdr->interval = interval == 0 ? 0 : __cpu_to_be16(interval / 1000);
 
-	mrp_fb_common(fb, p);
-	mrp_fb_tlv(fb, BR_MRP_TLV_HEADER_END, 0x0);
-
-	h = mrp_eth_alloc(p->macaddr, mrp_icontrol_dmac);
-	if (!h)
-		goto out;
-
-	mrp_send(p, h, fb);
-
-	free(h);
-out:
-	free(fb->start);
-	free(fb);
+	mrp_send(p, t);
 }
 
 void mrp_in_topo_send(struct mrp *mrp, uint32_t interval)
@@ -727,55 +775,33 @@ void mrp_in_topo_req(struct mrp *mrp, uint32_t time)
 {
 	pr_info("in_topo_reg: %d", time);
 
-	mrp_in_topo_send(mrp, time * mrp->in_topo_conf_max);
+	mrp_in_topo_send(mrp, time * mrp->timing->in_topo_max);
 
 	if (!time) {
 		mrp_netlink_flush(mrp);
 	} else {
-		uint32_t delay = mrp->in_topo_conf_interval;
+		uint32_t delay = mrp->timing->in_topo_interval;
 
 		mrp_in_topo_start(mrp, delay);
 	}
 }
 
-/* Compose MRP_LinkChange frame and send the frame to the port p.
+/* Send MRP_LinkChange frame to the port p.
  * The MRP_LinkChange frame has the following format:
  * MRP_Version, MRP_TLVHeader, MRP_SA, MRP_IntId,  MRP_PortRole, MRP_Interval
  */
 static void mrp_send_in_link(struct mrp_port *p, bool up, uint32_t interval)
 {
-	struct br_mrp_in_link_hdr *hdr = NULL;
-	struct frame_buf *fb = NULL;
-	struct mrp *mrp = p->mrp;
-	struct ethhdr *h = NULL;
-
-	fb = mrp_fb_alloc();
-	if (!fb)
-		return;
+	struct mrp_tx_tmpl *t = &p->mrp->tx[MRP_TX_IN_LINK];
+	struct br_mrp_in_link_hdr *hdr = t->hdr;
 
-	mrp_fb_tlv(fb, up ? BR_MRP_TLV_HEADER_IN_LINK_UP:
-			    BR_MRP_TLV_HEADER_IN_LINK_DOWN,
-		       sizeof(*hdr));
-	hdr = fb_put(fb, sizeof(*hdr));
+	t->tlv->type = up ? BR_MRP_TLV_HEADER_IN_LINK_UP :
+			    BR_MRP_TLV_HEADER_IN_LINK_DOWN;
 
-	ether_addr_copy(hdr->sa, mrp->macaddr);
 	hdr->port_role = __cpu_to_be16(p->role);
-	hdr->id = __cpu_to_be16(mrp->in_id);
 	hdr->interval = interval == 0 ? 0 : __cpu_to_be16(interval / 1000);
 
-	mrp_fb_common(fb, p);
-	mrp_fb_tlv(fb, BR_MRP_TLV_HEADER_END, 0x0);
-
-	h = mrp_eth_alloc(p->macaddr, mrp_icontrol_dmac);
-	if (!h)
-		goto out;
-
-	mrp_send(p, h, fb);
-
-	free(h);
-out:
-	free(fb->start);
-	free(fb);
+	mrp_send(p, t);
 }
 
 /* Send MRP_IntLinkChange frames on all MRP ports */
@@ -788,47 +814,24 @@ void mrp_in_link_req(struct mrp *mrp, bool up, uint32_t  interval)
 	mrp_send_in_link(mrp->i_port, up, interval);
 }
 
-/* Compose MRP_LinkStatusPoll frame and send the frame to the port p.
+/* Send MRP_LinkStatusPoll frame to the port p.
  * The MRP_LinkStatusPoll frame has the following format:
  * MRP_Version, MRP_TLVHeader, MRP_SA, MRP_IntId,  MRP_PortRole
  */
 static void mrp_send_in_link_status(struct mrp_port *p)
 {
-	struct br_mrp_in_link_status_hdr *hdr = NULL;
-	struct frame_buf *fb = NULL;
-	struct mrp *mrp = p->mrp;
-	struct ethhdr *h = NULL;
-
-	fb = mrp_fb_alloc();
-	if (!fb)
-		return;
-
-	mrp_fb_tlv(fb, BR_MRP_TLV_HEADER_IN_LINK_STATUS, sizeof(*hdr));
-	hdr = fb_put(fb, sizeof(*hdr));
+	struct mrp_tx_tmpl *t = &p->mrp->tx[MRP_TX_IN_LINK_STATUS];
+	struct br_mrp_in_link_status_hdr *hdr = t->hdr;
 
-	ether_addr_copy(hdr->sa, mrp->macaddr);
 	hdr->port_role = __cpu_to_be16(p->role);
-	hdr->id = __cpu_to_be16(mrp->in_id);
-
-	mrp_fb_common(fb, p);
-	mrp_fb_tlv(fb, BR_MRP_TLV_HEADER_END, 0x0);
-
-	h = mrp_eth_alloc(p->macaddr, mrp_icontrol_dmac);
-	if (!h)
-		goto out;
-
-	mrp_send(p, h, fb);
 
-	free(h);
-out:
-	free(fb->start);
-	free(fb);
+	mrp_send(p, t);
 }
 
 /* Send MRP_IntLinkStatusPoll frames on MRP ring ports */
 void mrp_in_link_status_req(struct mrp *mrp, uint32_t interval)
 {
-	uint32_t delay = mrp->in_link_status_conf_interval;
+	uint32_t delay = mrp->timing->in_link_status_interval;
 
 	mrp_send_in_link_status(mrp->p_port);
 	mrp_send_in_link_status(mrp->s_port);
@@ -837,53 +840,99 @@ void mrp_in_link_status_req(struct mrp *mrp, uint32_t interval)
 		mrp_in_link_status_start(mrp, delay);
 }
 
-/* Represents the state machine for when a MRP_Test frame was received on one
- * of the MRP ports and the MRP instance has the role MRM. When MRP instance has
- * the role MRC, it doesn't need to process MRP_Test frames.
+/* Extended monitoring. A ring that closes again within the time in which
+ * ring_test_ext_max MRP_Test frames are sent was lost only transiently,
+ * for example because the frames were dropped under load. After such a loss
+ * the MRM opens the ring only when also the extended number of frames is
+ * missed, until ring_test_ext_hold passes without another transient loss.
  */
-static void mrp_mrm_recv_ring_test(struct mrp *mrp)
+static uint64_t mrp_ring_ext_window(struct mrp *mrp)
 {
-	uint32_t topo_interval = mrp->ring_topo_conf_interval;
+	return (uint64_t)mrp->timing->ring_test_interval *
+	       mrp->timing->ring_test_ext_max * 1000;
+}
 
-	switch (mrp->mrm_state) {
-	case MRP_MRM_STATE_AC_STAT1:
-		/* Ignore */
-		break;
-	case MRP_MRM_STATE_PRM_UP:
-		mrp->ring_test_curr_max = mrp->ring_test_conf_max - 1;
-		mrp->ring_test_curr = 0;
-		mrp->no_tc = false;
+static void mrp_ring_ext_loss(struct mrp *mrp, uint64_t now)
+{
+	if (!mrp->timing->ring_test_ext_hold)
+		return;
 
-		mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
+	if (!mrp->ring_test_ext)
+		pr_info("ring_nr: %d extended test monitoring", mrp->ring_nr);
 
-		mrp_set_mrm_state(mrp, MRP_MRM_STATE_CHK_RC);
-		break;
-	case MRP_MRM_STATE_CHK_RO:
-		mrp_port_netlink_set_state(mrp->s_port,
-					   BR_MRP_PORT_STATE_BLOCKED);
+	mrp->ring_test_ext = true;
+	mrp->ring_test_ext_ns = now;
+}
 
-		mrp->ring_test_curr_max = mrp->ring_test_conf_max - 1;
-		mrp->ring_test_curr = 0;
-		mrp->no_tc = false;
+/* Returns true if the ring open waits for the extended number of frames */
+static bool mrp_ring_ext_open(struct mrp *mrp, uint64_t now)
+{
+	uint32_t extra;
 
-		mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
+	if (!mrp->ring_test_ext)
+		return false;
 
-		topo_interval = mrp->react_on_link_change ? 0 : topo_interval;
-		mrp_ring_topo_req(mrp, topo_interval);
+	if (now - mrp->ring_test_ext_ns >
+	    (uint64_t)mrp->timing->ring_test_ext_hold * 1000) {
+		pr_info("ring_nr: %d strict test monitoring", mrp->ring_nr);
+		mrp->ring_test_ext = false;
+		return false;
+	}
 
-		mrp_set_mrm_state(mrp, MRP_MRM_STATE_CHK_RC);
-		break;
-	case MRP_MRM_STATE_CHK_RC:
-		mrp->ring_test_curr_max = mrp->ring_test_conf_max - 1;
-		mrp->ring_test_curr = 0;
-		mrp->no_tc = false;
+	if (wheel_timer_active(&mrp->ring_ext_work))
+		return true;
 
-		break;
+	/* The kernel notifies after ring_test_max missed frames */
+	extra = mrp->timing->ring_test_ext_max - mrp->timing->ring_test_max;
+	if (!extra)
+		return false;
+
+	mrp_ring_ext_start(mrp, extra * mrp->timing->ring_test_interval);
+	return true;
+}
+
+/* A MRP_Test frame came back soon after the kernel notified that the ring is
+ * open, so the ring was lost only transiently
+ */
+void mrp_ring_test_open_false(struct mrp *mrp)
+{
+	uint64_t now = get_ns();
+
+	if (now - mrp->ring_open_ns < mrp_ring_ext_window(mrp)) {
+		mrp->ring_open_false++;
+		mrp_ring_ext_loss(mrp, now);
 	}
 }
 
+/* The frames came back before the extended number was missed. The kernel
+ * doesn't notify that the ring is closed, because for it the ring never
+ * opened.
+ */
+void mrp_ring_test_ext_back(struct mrp *mrp)
+{
+	if (!wheel_timer_active(&mrp->ring_ext_work))
+		return;
+
+	mrp_ring_ext_stop(mrp);
+	mrp->ring_open_suppressed++;
+	mrp_ring_ext_loss(mrp, get_ns());
+	mrp->p_port->loc = false;
+	mrp->s_port->loc = false;
+}
+
+/* Represents the state machine for when a MRP_Test frame was received on one
+ * of the MRP ports and the MRP instance has the role MRM. When MRP instance has
+ * the role MRC, it doesn't need to process MRP_Test frames.
+ */
+static void mrp_mrm_recv_ring_test(struct mrp *mrp)
+{
+	struct mrp_event e = { 0 };
+
+	mrp_mrm_event(mrp, MRP_MRM_EV_TEST_RECV, &e);
+}
+
 static bool mrp_better_than_own(struct mrp *mrp,
-				struct br_mrp_ring_test_hdr *hdr)
+				const struct br_mrp_ring_test_hdr *hdr)
 {
 	uint16_t prio = __be16_to_cpu(hdr->prio);
 
@@ -896,7 +945,7 @@ static bool mrp_better_than_own(struct mrp *mrp,
 }
 
 static void mrp_mra_recv_ring_test(struct mrp *mrp,
-				   struct br_mrp_ring_test_hdr *hdr)
+				   const struct br_mrp_ring_test_hdr *hdr)
 {
 	if (mrp->ring_role == BR_MRP_RING_ROLE_MRM) {
 		if (!mrp_better_than_own(mrp, hdr))
@@ -916,15 +965,11 @@ static void mrp_mra_recv_ring_test(struct mrp *mrp,
 	}
 }
 
-static void mrp_recv_ring_test(struct mrp_port *p, unsigned char *buf)
+static void mrp_recv_ring_test(struct mrp_port *p, const struct mrp_frame *f)
 {
-	struct br_mrp_ring_test_hdr *hdr;
+	const struct br_mrp_ring_test_hdr *hdr = f->ring_test;
 	struct mrp *mrp = p->mrp;
 
-	/* remove MRP version, tlv and get test header */
-	buf += sizeof(int16_t) + sizeof(struct br_mrp_tlv_hdr);
-	hdr = (struct br_mrp_ring_test_hdr*)buf;
-
 	/* If the MRP_Test frames was not send by this instance, then don't
 	 * process it.
 	 */
@@ -945,18 +990,15 @@ static void mrp_recv_ring_test(struct mrp_port *p, unsigned char *buf)
  * received on one of the MRP ports and the MRP instance has the role MRM and
  * has MRA support;
  */
-static void mrp_mra_recv_ring_topo(struct mrp_port *p, unsigned char *buf)
+static void mrp_mra_recv_ring_topo(struct mrp_port *p,
+				   const struct mrp_frame *f)
 {
-	struct br_mrp_ring_topo_hdr *hdr;
+	const struct br_mrp_ring_topo_hdr *hdr = f->ring_topo;
 	struct mrp *mrp = p->mrp;
 
 	pr_info("recv ring_topo, mrm state: %s",
 	        mrp_get_mrm_state(mrp->mrm_state));
 
-	/* remove MRP version, tlv and get ring topo header */
-	buf += sizeof(int16_t) + sizeof(struct br_mrp_tlv_hdr);
-	hdr = (struct br_mrp_ring_topo_hdr *)buf;
-
 	if (ether_addr_equal(hdr->sa, mrp->macaddr))
 		return;
 
@@ -967,176 +1009,53 @@ static void mrp_mra_recv_ring_topo(struct mrp_port *p, unsigned char *buf)
 /* Represents the state machine for when a MRP_TopologyChange frame was
  * received on one of the MRP ports and the MRP instance has the role MRC
  */
-static void mrp_mrc_recv_ring_topo(struct mrp_port *p, unsigned char *buf)
+static void mrp_mrc_recv_ring_topo(struct mrp_port *p,
+				   const struct mrp_frame *f)
+{
+	struct mrp_event e = {
+		.p = p,
+		.interval = ntohs(f->ring_topo->interval) * 1000,
+	};
+
+	mrp_mrc_event(p->mrp, MRP_MRC_EV_TOPO, &e);
+}
+
+static void mrp_recv_ring_topo(struct mrp_port *p, const struct mrp_frame *f)
 {
-	struct br_mrp_ring_topo_hdr *hdr;
 	struct mrp *mrp = p->mrp;
 
-	pr_info("recv ring_topo, mrc state: %s",
-	        mrp_get_mrc_state(mrp->mrc_state));
+	if (mrp->mra_support && mrp->ring_role == BR_MRP_RING_ROLE_MRM)
+		return mrp_mra_recv_ring_topo(p, f);
 
-	/* remove MRP version, tlv and get ring topo header */
-	buf += sizeof(int16_t) + sizeof(struct br_mrp_tlv_hdr);
-	hdr = (struct br_mrp_ring_topo_hdr *)buf;
-
-	switch (mrp->mrc_state) {
-	case MRP_MRC_STATE_AC_STAT1:
-		/* Ignore */
-		break;
-	case MRP_MRC_STATE_DE_IDLE:
-		mrp_clear_fdb_start(mrp, ntohs(hdr->interval) * 1000);
-		break;
-	case MRP_MRC_STATE_PT:
-		mrp->ring_link_curr_max = mrp->ring_link_conf_max;
-		mrp_ring_link_up_stop(mrp);
-		mrp_port_netlink_set_state(mrp->s_port,
-					   BR_MRP_PORT_STATE_FORWARDING);
-		mrp_clear_fdb_start(mrp, ntohs(hdr->interval) * 1000);
-		mrp_set_mrc_state(mrp, MRP_MRC_STATE_PT_IDLE);
-		break;
-	case MRP_MRC_STATE_DE:
-		mrp->ring_link_curr_max = mrp->ring_link_conf_max;
-		mrp_ring_link_down_stop(mrp);
-		mrp_clear_fdb_start(mrp, ntohs(hdr->interval) * 1000);
-		mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE_IDLE);
-		break;
-	case MRP_MRC_STATE_PT_IDLE:
-		mrp_clear_fdb_start(mrp, ntohs(hdr->interval) * 1000);
-		break;
-	}
-}
-
-static void mrp_recv_ring_topo(struct mrp_port *p, unsigned char *buf)
-{
-	struct mrp *mrp = p->mrp;
-
-	if (mrp->mra_support && mrp->ring_role == BR_MRP_RING_ROLE_MRM)
-		return mrp_mra_recv_ring_topo(p, buf);
-
-	return mrp_mrc_recv_ring_topo(p, buf);
-}
+	return mrp_mrc_recv_ring_topo(p, f);
+}
 
 /* Represents the state machine for when a MRP_LinkChange frame was
  * received on one of the MRP ports and the MRP instance has the role MRM. When
  * MRP instance has the role MRC it doesn't need to process the frame.
  */
-static void mrp_recv_ring_link(struct mrp_port *p, unsigned char *buf)
+static void mrp_recv_ring_link(struct mrp_port *p, const struct mrp_frame *f)
 {
-	enum br_mrp_tlv_header_type type;
+	struct mrp_event e = { .p = p };
 	struct mrp *mrp = p->mrp;
-	struct br_mrp_tlv_hdr *tlv;
-
-	pr_info("recv ring_link, mrm state: %s",
-	        mrp_get_mrm_state(mrp->mrm_state));
-
-	/* remove MRP version to get the tlv */
-	buf += sizeof(uint16_t);
-	tlv = (struct br_mrp_tlv_hdr *)buf;
-
-	type = tlv->type;
+	enum mrp_mrm_event_type ev;
 
-	switch (mrp->mrm_state) {
-	case MRP_MRM_STATE_AC_STAT1:
-		/* Ignore */
-		break;
-	case MRP_MRM_STATE_PRM_UP:
-		if (mrp->blocked) {
-			if (mrp->add_test)
-				break;
-			mrp->add_test = true;
-			mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
-		} else {
-			if (type == BR_MRP_TLV_HEADER_RING_LINK_DOWN)
-				break;
-
-			if (!mrp->add_test) {
-				mrp->add_test = true;
-				mrp_ring_test_req(mrp,
-						  mrp->ring_test_conf_short);
-			}
-			mrp_ring_topo_req(mrp, 0);
-		}
-		break;
-	case MRP_MRM_STATE_CHK_RO:
-		if (!mrp->add_test && type == BR_MRP_TLV_HEADER_RING_LINK_UP &&
-		    mrp->blocked) {
-			mrp->add_test = true;
-			mrp_ring_test_req(mrp, mrp->ring_test_conf_short);
-			break;
-		}
-
-		if (mrp->add_test && type == BR_MRP_TLV_HEADER_RING_LINK_UP &&
-		    mrp->blocked)
-			break;
-
-		if (mrp->add_test && type == BR_MRP_TLV_HEADER_RING_LINK_DOWN)
-			break;
-
-		if (!mrp->add_test && type == BR_MRP_TLV_HEADER_RING_LINK_DOWN) {
-			mrp->add_test = true;
-			mrp_ring_test_req(mrp, mrp->ring_test_conf_short);
-			break;
-		}
-
-		if (type == BR_MRP_TLV_HEADER_RING_LINK_UP && !mrp->blocked) {
-			mrp_port_netlink_set_state(mrp->s_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp->ring_test_curr_max = mrp->ring_test_conf_max - 1;
-			mrp->ring_test_curr = 0;
-
-			if (!mrp->add_test) {
-				mrp_ring_test_req(mrp,
-						  mrp->ring_test_conf_short);
-				mrp->add_test = true;
-			} else {
-				mrp_ring_test_req(mrp,
-						  mrp->ring_test_conf_interval);
-			}
-
-			mrp_ring_topo_req(mrp, 0);
-			mrp_set_mrm_state(mrp, MRP_MRM_STATE_CHK_RC);
-			break;
-		}
-		break;
-	case MRP_MRM_STATE_CHK_RC:
-		if (mrp->add_test && !mrp->react_on_link_change &&
-		    mrp->blocked)
-			break;
-
-		if (!mrp->add_test && !mrp->react_on_link_change &&
-		    mrp->blocked) {
-			mrp->add_test = true;
-			mrp_ring_test_req(mrp, mrp->ring_test_conf_short);
-			break;
-		}
-
-		if (type == BR_MRP_TLV_HEADER_RING_LINK_DOWN &&
-		    mrp->react_on_link_change) {
-			mrp_port_netlink_set_state(mrp->s_port,
-						   BR_MRP_PORT_STATE_FORWARDING);
-			mrp->ring_transitions++;
-			mrp_ring_topo_req(mrp, 0);
-			mrp_set_mrm_state(mrp, MRP_MRM_STATE_CHK_RO);
-			break;
-		}
+	if (f->type == BR_MRP_TLV_HEADER_RING_LINK_UP)
+		ev = MRP_MRM_EV_LINK_UP;
+	else
+		ev = MRP_MRM_EV_LINK_DOWN;
 
-		if (type == BR_MRP_TLV_HEADER_RING_LINK_UP &&
-		    mrp->react_on_link_change && !mrp->blocked) {
-			mrp->ring_test_curr_max = mrp->ring_test_conf_max - 1;
-			mrp_ring_topo_req(mrp, 0);
-		}
+	/* The events with the instance conditions follow each other */
+	if (mrp->blocked)
+		ev += MRP_MRM_EV_LINK_UP_BLK - MRP_MRM_EV_LINK_UP;
+	if (mrp->react_on_link_change)
+		ev += MRP_MRM_EV_LINK_UP_REACT - MRP_MRM_EV_LINK_UP;
 
-		if (type == BR_MRP_TLV_HEADER_RING_LINK_UP &&
-		    mrp->react_on_link_change && mrp->blocked) {
-			mrp->ring_test_curr_max = mrp->ring_test_conf_max - 1;
-			mrp_ring_topo_req(mrp, 0);
-		}
-		break;
-	}
+	mrp_mrm_event(mrp, ev, &e);
 }
 
 static bool mrp_better_than_host(struct mrp *mrp,
-				 struct br_mrp_test_mgr_nack_hdr *hdr)
+				 const struct br_mrp_test_mgr_nack_hdr *hdr)
 {
 	uint16_t prio = __be16_to_cpu(hdr->prio);
 
@@ -1148,15 +1067,10 @@ static bool mrp_better_than_host(struct mrp *mrp,
 	return false;
 }
 
-static void mrp_recv_nack(struct mrp_port *p, unsigned char *buf)
+static void mrp_recv_nack(struct mrp_port *p, const struct mrp_frame *f)
 {
-	struct br_mrp_test_mgr_nack_hdr *hdr;
-	struct mrp *mrp;
-
-	buf += sizeof(struct br_mrp_sub_tlv_hdr);
-	mrp = p->mrp;
-
-	hdr = (struct br_mrp_test_mgr_nack_hdr *)buf;
+	const struct br_mrp_test_mgr_nack_hdr *hdr = f->nack;
+	struct mrp *mrp = p->mrp;
 
 	if (mrp->ring_role == BR_MRP_RING_ROLE_MRC)
 		return;
@@ -1200,20 +1114,15 @@ static void mrp_recv_nack(struct mrp_port *p, unsigned char *buf)
 	mrp->test_monitor = true;
 	mrp->p_port->loc = 0;
 	mrp->s_port->loc = 0;
-	mrp_netlink_send_ring_test(mrp, mrp->ring_test_conf_interval,
-				   mrp->ring_test_conf_max,
-				   mrp->ring_test_conf_period);
+	mrp_netlink_send_ring_test(mrp, mrp->timing->ring_test_interval,
+				   mrp->timing->ring_test_max,
+				   mrp->timing->ring_test_period);
 }
 
-static void mrp_recv_propagate(struct mrp_port *p, unsigned char *buf)
+static void mrp_recv_propagate(struct mrp_port *p, const struct mrp_frame *f)
 {
-	struct br_mrp_test_prop_hdr *hdr;
-	struct mrp *mrp;
-
-	buf += sizeof(struct br_mrp_sub_tlv_hdr);
-	mrp = p->mrp;
-
-	hdr = (struct br_mrp_test_prop_hdr *)buf;
+	const struct br_mrp_test_prop_hdr *hdr = f->prop;
+	struct mrp *mrp = p->mrp;
 
 	if (mrp->ring_role == BR_MRP_RING_ROLE_MRM)
 		return;
@@ -1231,26 +1140,17 @@ static void mrp_recv_propagate(struct mrp_port *p, unsigned char *buf)
 /* Represents the state machine for when a MRP_Option frame was
  * received on one of the MRP ports.
  */
-static void mrp_recv_option(struct mrp_port *p, unsigned char *buf)
+static void mrp_recv_option(struct mrp_port *p, const struct mrp_frame *f)
 {
-	struct br_mrp_sub_tlv_hdr *sub_tlv;
 	struct mrp *mrp = p->mrp;
 
 	pr_info("recv opt frame, mrm state: %s",
 	        mrp_get_mrm_state(mrp->mrm_state));
 
-	/* remove MRP version to get the tlv */
-	buf += sizeof(uint16_t);
-	/* remove also the tlv_hdr, mrp_oui, and sub_opt */
-	buf += sizeof(struct br_mrp_tlv_hdr) +
-	       sizeof(struct br_mrp_oui_hdr) +
-	       sizeof(struct br_mrp_sub_opt_hdr);
-
-	sub_tlv = (struct br_mrp_sub_tlv_hdr *)buf;
-	if (sub_tlv->type == BR_MRP_SUB_TLV_HEADER_TEST_MGR_NACK)
-		return mrp_recv_nack(p, buf);
-	if (sub_tlv->type == BR_MRP_SUB_TLV_HEADER_TEST_PROPAGATE)
-		return mrp_recv_propagate(p, buf);
+	if (f->sub_type == BR_MRP_SUB_TLV_HEADER_TEST_MGR_NACK)
+		return mrp_recv_nack(p, f);
+	if (f->sub_type == BR_MRP_SUB_TLV_HEADER_TEST_PROPAGATE)
+		return mrp_recv_propagate(p, f);
 }
 
 static void mrp_mim_recv_in_test(struct mrp *mrp)
@@ -1259,10 +1159,10 @@ static void mrp_mim_recv_in_test(struct mrp *mrp)
 		mrp_port_netlink_set_state(mrp->i_port,
 					   BR_MRP_PORT_STATE_BLOCKED);
 
-		mrp->in_test_curr_max = mrp->in_test_conf_max - 1;
+		mrp->in_test_curr_max = mrp->timing->in_test_max - 1;
 		mrp->in_test_curr = 0;
 
-		mrp_in_test_req(mrp, mrp->in_test_conf_interval);
+		mrp_in_test_req(mrp, mrp->timing->in_test_interval);
 
 		mrp_set_mim_state(mrp, MRP_MIM_STATE_CHK_IC);
 	}
@@ -1271,30 +1171,26 @@ static void mrp_mim_recv_in_test(struct mrp *mrp)
 		mrp_port_netlink_set_state(mrp->i_port,
 					   BR_MRP_PORT_STATE_BLOCKED);
 
-		mrp->in_test_curr_max = mrp->in_test_conf_max - 1;
+		mrp->in_test_curr_max = mrp->timing->in_test_max - 1;
 		mrp->in_test_curr = 0;
 
-		mrp_in_topo_req(mrp, mrp->in_topo_conf_interval);
-		mrp_in_test_req(mrp, mrp->in_test_conf_interval);
+		mrp_in_topo_req(mrp, mrp->timing->in_topo_interval);
+		mrp_in_test_req(mrp, mrp->timing->in_test_interval);
 
 		mrp_set_mim_state(mrp, MRP_MIM_STATE_CHK_IC);
 	}
 
 	if (mrp->mim_state == MRP_MIM_STATE_CHK_IC) {
-		mrp->in_test_curr_max = mrp->in_test_conf_max - 1;
+		mrp->in_test_curr_max = mrp->timing->in_test_max - 1;
 		mrp->in_test_curr = 0;
 	}
 }
 
-static void mrp_recv_in_test(struct mrp_port *p, unsigned char *buf)
+static void mrp_recv_in_test(struct mrp_port *p, const struct mrp_frame *f)
 {
-	struct br_mrp_in_test_hdr *hdr;
+	const struct br_mrp_in_test_hdr *hdr = f->in_test;
 	struct mrp *mrp = p->mrp;
 
-	/* remove MRP version, tlv and get int test header */
-	buf += sizeof(int16_t) + sizeof(struct br_mrp_tlv_hdr);
-	hdr = (struct br_mrp_in_test_hdr*)buf;
-
 	if (mrp->in_id != ntohs(hdr->id))
 		return;
 
@@ -1304,19 +1200,15 @@ static void mrp_recv_in_test(struct mrp_port *p, unsigned char *buf)
 /* Represents the state machine for when a MRP_IntTopologyChange frame was
  * received on one of the MRP ports.
  */
-static void mrp_recv_in_topo(struct mrp_port *p, unsigned char *buf)
+static void mrp_recv_in_topo(struct mrp_port *p, const struct mrp_frame *f)
 {
-	struct br_mrp_in_topo_hdr *hdr;
+	const struct br_mrp_in_topo_hdr *hdr = f->in_topo;
 	struct mrp *mrp = p->mrp;
 
 	pr_info("recv in_topo, mic state: %s mrm state %s",
 	        mrp_get_mic_state(mrp->mic_state),
 	        mrp_get_mrm_state(mrp->mrm_state));
 
-	/* remove MRP version, tlv and get int topo change header */
-	buf += sizeof(int16_t) + sizeof(struct br_mrp_tlv_hdr);
-	hdr = (struct br_mrp_in_topo_hdr *)buf;
-
 	if (mrp->ring_role == BR_MRP_RING_ROLE_MRM &&
 	    mrp->ring_topo_running == false) {
 		mrp_ring_topo_req(mrp, ntohs(hdr->interval) * 1000);
@@ -1332,79 +1224,37 @@ static void mrp_recv_in_topo(struct mrp_port *p, unsigned char *buf)
 	}
 
 	if (mrp->in_role == BR_MRP_IN_ROLE_MIC) {
-		switch (mrp->mic_state) {
-		case MRP_MIC_STATE_AC_STAT1:
-			if (ntohs(hdr->id) == mrp->in_id)
-				mrp_in_link_down_stop(mrp);
-			break;
-		case MRP_MIC_STATE_PT:
-			mrp->in_link_curr_max = mrp->in_link_conf_max;
-			mrp_in_link_up_stop(mrp);
-			mrp_port_netlink_set_state(mrp->i_port,
-						   BR_MRP_PORT_STATE_FORWARDING);
-			mrp_set_mic_state(mrp, MRP_MIC_STATE_IP_IDLE);
-			break;
-		case MRP_MIC_STATE_IP_IDLE:
-			/* Ignore */
-			break;
-		}
+		struct mrp_event e = { .p = p };
+
+		mrp_mic_event(mrp, ntohs(hdr->id) == mrp->in_id ?
+			      MRP_MIC_EV_IN_TOPO : MRP_MIC_EV_IN_TOPO_OTHER, &e);
 	}
 }
 
 /* Represents the state machine for when a MRP_IntLinkChange frame was
  * received on one of the MRP ports.
  */
-static void mrp_recv_in_link(struct mrp_port *p, unsigned char *buf)
+static void mrp_recv_in_link(struct mrp_port *p, const struct mrp_frame *f)
 {
-	enum br_mrp_tlv_header_type type;
-	struct br_mrp_in_link_hdr *hdr;
-	struct br_mrp_tlv_hdr *tlv;
+	const struct br_mrp_in_link_hdr *hdr = f->in_link;
+	struct mrp_event e = { .p = p };
 	struct mrp *mrp = p->mrp;
 
-	pr_info("recv in_link, mim state: %s",
-	        mrp_get_mim_state(mrp->mim_state));
-
-	/* remove MRP version to get the tlv */
-	buf += sizeof(int16_t);
-	tlv = (struct br_mrp_tlv_hdr *)buf;
-
-	type = tlv->type;
-
-	buf += sizeof(struct br_mrp_tlv_hdr);
-	hdr = (struct br_mrp_in_link_hdr *)buf;
+	if (ntohs(hdr->id) != mrp->in_id)
+		return;
 
-	switch (mrp->mim_state) {
-	case MRP_MIM_STATE_AC_STAT1:
-		/* Ignore */
-		break;
-	case MRP_MIM_STATE_CHK_IO:
-		if (ntohs(hdr->id) == mrp->in_id &&
-		    type == BR_MRP_TLV_HEADER_IN_LINK_UP)
-			mrp_in_test_req(mrp, mrp->in_test_conf_interval);
-		break;
-	case MRP_MIM_STATE_CHK_IC:
-		if (ntohs(hdr->id) == mrp->in_id &&
-		    type == BR_MRP_TLV_HEADER_IN_LINK_UP) {
-			mrp->in_test_curr_max = mrp->in_test_conf_max;
-			mrp_in_topo_req(mrp, mrp->in_topo_conf_interval);
-		}
-		if (ntohs(hdr->id) == mrp->in_id &&
-		    type == BR_MRP_TLV_HEADER_IN_LINK_DOWN) {
-			mrp_port_netlink_set_state(mrp->i_port,
-						   BR_MRP_PORT_STATE_FORWARDING);
-			mrp_in_topo_req(mrp, mrp->in_topo_conf_interval);
-			mrp_set_mim_state(mrp, MRP_MIM_STATE_CHK_IO);
-		}
-		break;
-	}
+	mrp_mim_event(mrp, f->type == BR_MRP_TLV_HEADER_IN_LINK_UP ?
+		      MRP_MIM_EV_IN_LINK_UP : MRP_MIM_EV_IN_LINK_DOWN, &e);
 }
 
 /* Represents the state machine for when a MRP_IntLinkStatus frame was
  * received on one of the MRP ports.
  */
-static void mrp_recv_in_link_status(struct mrp_port *p, unsigned char *buf)
+static void mrp_recv_in_link_status(struct mrp_port *p,
+				    const struct mrp_frame *f)
 {
-	struct br_mrp_in_link_status_hdr *hdr;
+	const struct br_mrp_in_link_status_hdr *hdr = f->in_link_status;
+	struct mrp_event e = { .p = p };
 	struct mrp *mrp = p->mrp;
 
 	if (mrp->in_role != BR_MRP_IN_ROLE_MIC)
@@ -1413,27 +1263,10 @@ static void mrp_recv_in_link_status(struct mrp_port *p, unsigned char *buf)
 	if (mrp->in_mode != MRP_IN_MODE_LC)
 		return;
 
-	pr_info("recv in_link_status, mic state: %s",
-	        mrp_get_mic_state(mrp->mic_state));
-
-	/* remove MRP version, tlv and get in link status header */
-	buf += sizeof(int16_t) + sizeof(struct br_mrp_tlv_hdr);
-	hdr = (struct br_mrp_in_link_status_hdr *)buf;
-
 	if (ntohs(hdr->id) != mrp->in_id)
 		return;
 
-	switch (mrp->mic_state) {
-	case MRP_MIC_STATE_AC_STAT1:
-		mrp_in_link_req(mrp, false, 0);
-		break;
-	case MRP_MIC_STATE_PT:
-		mrp_in_link_req(mrp, true, 0);
-		break;
-	case MRP_MIC_STATE_IP_IDLE:
-		mrp_in_link_req(mrp, true, 0);
-		break;
-	}
+	mrp_mic_event(mrp, MRP_MIC_EV_LINK_STATUS, &e);
 }
 
 /* Check if the MRP frame needs to be dropped */
@@ -1521,506 +1354,279 @@ static bool mrp_should_process(const struct mrp_port *p,
 	return false;
 }
 
-static void mrp_process(struct mrp_port *p, unsigned char *buf,
-			enum br_mrp_tlv_header_type type)
+static void mrp_process(struct mrp_port *p, const struct mrp_frame *f)
 {
-	switch (type) {
+	switch (f->type) {
 	case BR_MRP_TLV_HEADER_RING_TEST:
-		mrp_recv_ring_test(p, buf);
+		mrp_recv_ring_test(p, f);
 		break;
 	case BR_MRP_TLV_HEADER_RING_TOPO:
-		mrp_recv_ring_topo(p, buf);
+		mrp_recv_ring_topo(p, f);
 		break;
 	case BR_MRP_TLV_HEADER_RING_LINK_DOWN:
 	case BR_MRP_TLV_HEADER_RING_LINK_UP:
-		mrp_recv_ring_link(p, buf);
+		mrp_recv_ring_link(p, f);
 		break;
 	case BR_MRP_TLV_HEADER_OPTION:
-		mrp_recv_option(p, buf);
+		mrp_recv_option(p, f);
 		break;
 	case BR_MRP_TLV_HEADER_IN_TEST:
-		mrp_recv_in_test(p, buf);
+		mrp_recv_in_test(p, f);
 		break;
 	case BR_MRP_TLV_HEADER_IN_TOPO:
-		mrp_recv_in_topo(p, buf);
+		mrp_recv_in_topo(p, f);
 		break;
 	case BR_MRP_TLV_HEADER_IN_LINK_DOWN:
 	case BR_MRP_TLV_HEADER_IN_LINK_UP:
-		mrp_recv_in_link(p, buf);
+		mrp_recv_in_link(p, f);
 		break;
 	case BR_MRP_TLV_HEADER_IN_LINK_STATUS:
-		mrp_recv_in_link_status(p, buf);
+		mrp_recv_in_link_status(p, f);
 		break;
 	default:
-		pr_err("Unknown type: %d", type);
+		pr_err("Unknown type: %d", f->type);
 	}
 }
 
-/* All received MRP frames are added to a list of skbs and this function
- * pops the frame and process them. It decides if the MRP instance needs to
- * process it, forward it or dropp it
+/* Decides if the MRP instance needs to process the frame or drop it. The
+ * frame is not modified, so the handlers use it in place.
  */
-static void mrp_process_frame(struct mrp_port *port, struct frame_buf *fb,
-			      enum br_mrp_tlv_header_type type)
+static void mrp_process_frame(struct mrp_port *port, const struct mrp_frame *f)
 {
 	struct mrp *mrp = port->mrp;
 
 	pthread_mutex_lock(&mrp->lock);
 
-	if (mrp_should_process(port, type)) {
-		unsigned char nbuf[2048];
+	if (mrp_should_process(port, f->type))
+		mrp_process(port, f);
 
-		/* Because there are cases when a frame needs to be
-		 * proccesed and also forward, it is required to clone
-		 * the frame for processing not to alter the original
-		 * one.
-		 */
-		memcpy(nbuf, fb->data, fb->size - sizeof(struct ethhdr));
+	pthread_mutex_unlock(&mrp->lock);
+}
 
-		mrp_process(port, nbuf, type);
+/* Returns the length of the header that follows the TLV header or -1 if the
+ * TLV is not the first TLV of a known MRP frame.
+ */
+static int mrp_tlv_hdr_len(uint8_t type)
+{
+	switch (type) {
+	case BR_MRP_TLV_HEADER_RING_TEST:
+		return sizeof(struct br_mrp_ring_test_hdr);
+	case BR_MRP_TLV_HEADER_RING_TOPO:
+		return sizeof(struct br_mrp_ring_topo_hdr);
+	case BR_MRP_TLV_HEADER_RING_LINK_DOWN:
+	case BR_MRP_TLV_HEADER_RING_LINK_UP:
+		return sizeof(struct br_mrp_ring_link_hdr);
+	case BR_MRP_TLV_HEADER_OPTION:
+		return sizeof(struct br_mrp_oui_hdr) +
+		       sizeof(struct br_mrp_sub_opt_hdr);
+	case BR_MRP_TLV_HEADER_IN_TEST:
+		return sizeof(struct br_mrp_in_test_hdr);
+	case BR_MRP_TLV_HEADER_IN_TOPO:
+		return sizeof(struct br_mrp_in_topo_hdr);
+	case BR_MRP_TLV_HEADER_IN_LINK_DOWN:
+	case BR_MRP_TLV_HEADER_IN_LINK_UP:
+		return sizeof(struct br_mrp_in_link_hdr);
+	case BR_MRP_TLV_HEADER_IN_LINK_STATUS:
+		return sizeof(struct br_mrp_in_link_status_hdr);
+	default:
+		return -1;
 	}
+}
 
-	pthread_mutex_unlock(&mrp->lock);
+static int mrp_sub_tlv_hdr_len(uint8_t type)
+{
+	switch (type) {
+	case BR_MRP_SUB_TLV_HEADER_TEST_MGR_NACK:
+		return sizeof(struct br_mrp_test_mgr_nack_hdr);
+	case BR_MRP_SUB_TLV_HEADER_TEST_PROPAGATE:
+		return sizeof(struct br_mrp_test_prop_hdr);
+	default:
+		return -1;
+	}
 }
 
-/* Returns the MRP_TLVHeader */
-static enum br_mrp_tlv_header_type mrp_get_tlv_hdr(unsigned char *buf)
+/* Parse the MRP_Option TLV which starts at data and ends at end */
+static int mrp_parse_option(const unsigned char *data, const unsigned char *end,
+			    struct mrp_frame *f)
 {
-	struct br_mrp_tlv_hdr *hdr;
+	const struct br_mrp_sub_tlv_hdr *sub;
+	int len;
+
+	data += sizeof(struct br_mrp_oui_hdr) + sizeof(struct br_mrp_sub_opt_hdr);
+	if (data + sizeof(*sub) > end)
+		return 0;
 
-	/* First 2 bytes in each MRP frame is the version and after that
-	 * is the tlv header, therefor skip the version
+	sub = (const struct br_mrp_sub_tlv_hdr *)data;
+	data += sizeof(*sub);
+
+	len = mrp_sub_tlv_hdr_len(sub->type);
+	if (len < 0)
+		return 0;
+
+	/* The length of the sub-TLV may include 2 bytes of padding that are
+	 * not counted in the length of the MRP_Option TLV
 	 */
-	hdr = (struct br_mrp_tlv_hdr *)(buf + sizeof(uint16_t));
-	return hdr->type;
+	if (sub->length < len || data + len > end ||
+	    data + sub->length > end + 2)
+		return -EINVAL;
+
+	f->sub_type = sub->type;
+	f->sub_hdr = data;
+
+	return 0;
+}
+
+/* Validate the frame against its length and fill the view of the frame */
+static int mrp_parse_frame(const unsigned char *buf, int buf_len,
+			   struct mrp_frame *f)
+{
+	const unsigned char *end = buf + buf_len;
+	const struct br_mrp_tlv_hdr *tlv;
+	const unsigned char *data, *next;
+	int len;
+
+	memset(f, 0, sizeof(*f));
+
+	/* Skip the ethernet header and the MRP_Version */
+	buf += sizeof(struct ethhdr) + sizeof(uint16_t);
+	if (buf + sizeof(*tlv) > end)
+		return -EINVAL;
+
+	tlv = (const struct br_mrp_tlv_hdr *)buf;
+	data = buf + sizeof(*tlv);
+	next = data + tlv->length;
+
+	len = mrp_tlv_hdr_len(tlv->type);
+	if (len < 0)
+		return -EOPNOTSUPP;
+
+	if (tlv->length < len || next > end)
+		return -EINVAL;
+
+	f->type = tlv->type;
+	f->hdr = data;
+
+	if (f->type == BR_MRP_TLV_HEADER_OPTION) {
+		if (mrp_parse_option(data, next, f))
+			return -EINVAL;
+
+		/* Skip the padding of the sub-TLV if there is one */
+		if (next + sizeof(*tlv) <= end &&
+		    ((const struct br_mrp_tlv_hdr *)next)->type !=
+		    BR_MRP_TLV_HEADER_COMMON)
+			next += 2;
+	}
+
+	tlv = (const struct br_mrp_tlv_hdr *)next;
+	data = next + sizeof(*tlv);
+	if (data + sizeof(*f->common) <= end &&
+	    tlv->type == BR_MRP_TLV_HEADER_COMMON &&
+	    tlv->length >= sizeof(*f->common)) {
+		f->common = (const struct br_mrp_common_hdr *)data;
+		f->seq_id = __be16_to_cpu(f->common->seq_id);
+	}
+
+	return 0;
+}
+
+/* Processes a parsed frame received on the port */
+void mrp_recv_frame(struct mrp_port *port, const struct mrp_frame *f)
+{
+	if (mrp_should_drop(port, f->type))
+		return;
+
+	mrp_process_frame(port, f);
 }
 
-/* Receives all MRP frames and add them in a queue to be processed */
+/* Receives all MRP frames, validates them and process them in place */
 int mrp_recv(unsigned char *buf, int buf_len, struct sockaddr_ll *sl,
 	     socklen_t salen)
 {
-	enum br_mrp_tlv_header_type type;
 	struct mrp_port *port;
-	struct frame_buf fb;
+	struct mrp_frame f;
+	int err;
 
 	port = mrp_get_port(sl->sll_ifindex);
 	if (!port)
 		goto out;
 
-	/* The buf contains also the link layer information. It is not possible
-	 * to get rid completely of this because it is possible to forward the
-	 * frame with this information therefor just putt it in fb and pass it
-	 * arround
-	 */
-	fb.start = buf;
-	fb.data = buf;
-	fb.size = buf_len;
-	fb.data += sizeof(struct ethhdr);
-
-	type = mrp_get_tlv_hdr(fb.data);
-
-	if (mrp_should_drop(port, type))
+	err = mrp_parse_frame(buf, buf_len, &f);
+	if (err) {
+		if (err == -EINVAL)
+			mrp_rx_invalid++;
 		goto out;
+	}
 
-	mrp_process_frame(port, &fb, type);
+	mrp_recv_frame(port, &f);
 
 out:
 	return 0;
 }
 
-/* Represents the state machine for when MRP instance has the role MRM and the
- * link of one of the MRP ports is changed.
+/* Represents the state machines for when the MRP instance has the role MRM or
+ * MRC and the link of one of the ring ports is changed.
  */
 static void mrp_mrm_port_link(struct mrp_port *p, bool up)
 {
+	struct mrp_event e = { .p = p, .up = up };
+	enum mrp_mrm_event_type ev;
 	struct mrp *mrp = p->mrp;
-	uint32_t topo_interval = mrp->ring_topo_conf_interval;
-
-	pr_info("up: %d, mrm_state: %s",
-	        up, mrp_get_mrm_state(mrp->mrm_state));
-
-	switch (mrp->mrm_state) {
-	case MRP_MRM_STATE_AC_STAT1:
-		if (up && p == mrp->p_port) {
-			mrp_port_netlink_set_state(mrp->p_port,
-						   BR_MRP_PORT_STATE_FORWARDING);
-			mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
-			mrp_set_mrm_state(mrp, MRP_MRM_STATE_PRM_UP);
-		}
-		if (up && p != mrp->p_port) {
-			mrp->s_port = mrp->p_port;
-			mrp->p_port = p;
-			mrp_port_netlink_set_state(mrp->p_port,
-						   BR_MRP_PORT_STATE_FORWARDING);
-			mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
-			mrp_set_mrm_state(mrp, MRP_MRM_STATE_PRM_UP);
-		}
-		break;
-	case MRP_MRM_STATE_PRM_UP:
-		if (!up && p == mrp->p_port) {
-			mrp_ring_test_stop(mrp);
-			mrp_port_netlink_set_state(mrp->p_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_set_mrm_state(mrp, MRP_MRM_STATE_AC_STAT1);
-		}
-		if (up && p != mrp->p_port) {
-			mrp->ring_test_curr_max = mrp->ring_test_conf_max - 1;
-			mrp->ring_test_curr = 0;
-			mrp->no_tc = true;
-			mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
-			mrp->p_port->loc = 0;
-			mrp->s_port->loc = 0;
-			mrp_set_mrm_state(mrp, MRP_MRM_STATE_CHK_RC);
-		}
-		break;
-	case MRP_MRM_STATE_CHK_RO:
-		if (!up && p == mrp->p_port) {
-			mrp->p_port = mrp->s_port;
-			mrp->s_port = p;
-			mrp_port_netlink_set_state(mrp->s_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
-			mrp_ring_topo_req(mrp, topo_interval);
-			mrp_set_mrm_state(mrp, MRP_MRM_STATE_PRM_UP);
-			break;
-		}
-		if (!up && p != mrp->p_port) {
-			mrp_port_netlink_set_state(mrp->s_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_set_mrm_state(mrp, MRP_MRM_STATE_PRM_UP);
-		}
-		break;
-	case MRP_MRM_STATE_CHK_RC:
-		if (!up && p == mrp->p_port) {
-			mrp->p_port = mrp->s_port;
-			mrp->s_port = p;
-			mrp_port_netlink_set_state(mrp->s_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_port_netlink_set_state(mrp->p_port,
-						   BR_MRP_PORT_STATE_FORWARDING);
-			mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
-			mrp_ring_topo_req(mrp, topo_interval);
-			mrp->ring_transitions++;
-			mrp_set_mrm_state(mrp, MRP_MRM_STATE_PRM_UP);
-			break;
-		}
-		if (!up && p != mrp->p_port) {
-			mrp->ring_transitions++;
-			mrp_set_mrm_state(mrp, MRP_MRM_STATE_PRM_UP);
-			break;
-		}
 
-		break;
-	}
+	if (p == mrp->p_port)
+		ev = up ? MRP_MRM_EV_P_UP : MRP_MRM_EV_P_DOWN;
+	else
+		ev = up ? MRP_MRM_EV_S_UP : MRP_MRM_EV_S_DOWN;
 
-	pr_info("new mrm_state: %s", mrp_get_mrm_state(mrp->mrm_state));
+	mrp_mrm_event(mrp, ev, &e);
 }
 
-/* Represents the state machine for when MRP instance has the role MRC and the
- * link of one of the MRP ports is changed.
- */
 static void mrp_mrc_port_link(struct mrp_port *p, bool up)
 {
+	struct mrp_event e = { .p = p, .up = up };
+	enum mrp_mrc_event_type ev;
 	struct mrp *mrp = p->mrp;
 
-	pr_info("up: %d, mrc_state: %s",
-	        up, mrp_get_mrc_state(mrp->mrc_state));
-
-	switch (mrp->mrc_state) {
-	case MRP_MRC_STATE_AC_STAT1:
-		if (up && p == mrp->p_port) {
-			mrp_port_netlink_set_state(mrp->p_port,
-						   BR_MRP_PORT_STATE_FORWARDING);
-			mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE_IDLE);
-		}
-		if (up && p != mrp->p_port) {
-			mrp->s_port = mrp->p_port;
-			mrp->p_port = p;
-			mrp_port_netlink_set_state(mrp->p_port,
-						   BR_MRP_PORT_STATE_FORWARDING);
-			mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE_IDLE);
-		}
-		break;
-	case MRP_MRC_STATE_DE_IDLE:
-		if (up && p != mrp->p_port) {
-			mrp->ring_link_curr_max = mrp->ring_link_conf_max;
-			mrp_ring_link_up_start(mrp,
-					       mrp->ring_link_conf_interval);
-			mrp_ring_link_req(mrp->p_port, up,
-					  mrp->ring_link_curr_max *
-					  mrp->ring_link_conf_interval);
-			mrp_set_mrc_state(mrp, MRP_MRC_STATE_PT);
-		}
-		if (!up && p == mrp->p_port) {
-			mrp_port_netlink_set_state(mrp->p_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_set_mrc_state(mrp, MRP_MRC_STATE_AC_STAT1);
-		}
-		break;
-	case MRP_MRC_STATE_PT:
-		if (!up && p != mrp->p_port) {
-			mrp->ring_link_curr_max = mrp->ring_link_conf_max;
-			mrp_ring_link_up_stop(mrp);
-			mrp_port_netlink_set_state(mrp->s_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_ring_link_down_start(mrp,
-						 mrp->ring_link_conf_interval);
-			mrp_ring_link_req(mrp->p_port, up,
-					  mrp->ring_link_curr_max *
-					  mrp->ring_link_conf_interval);
-			mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE);
-			break;
-		}
-		if (!up && p == mrp->p_port) {
-			mrp->ring_link_curr_max = mrp->ring_link_conf_max;
-			mrp_ring_link_up_stop(mrp);
-			mrp->p_port = mrp->s_port;
-			mrp->s_port = p;
-			mrp_port_netlink_set_state(mrp->p_port,
-						   BR_MRP_PORT_STATE_FORWARDING);
-			mrp_port_netlink_set_state(mrp->s_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_ring_link_down_start(mrp,
-						 mrp->ring_link_conf_interval);
-			mrp_ring_link_req(mrp->p_port, up,
-					  mrp->ring_link_curr_max *
-					  mrp->ring_link_conf_interval);
-			mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE);
-		}
-		break;
-	case MRP_MRC_STATE_DE:
-		if (up && p != mrp->p_port) {
-			mrp->ring_link_curr_max = mrp->ring_link_conf_max;
-			mrp_ring_link_down_stop(mrp);
-			mrp_ring_link_up_start(mrp,
-					       mrp->ring_link_conf_interval);
-			mrp_ring_link_req(mrp->p_port, up,
-					  mrp->ring_link_curr_max *
-					  mrp->ring_link_conf_interval);
-			mrp_set_mrc_state(mrp, MRP_MRC_STATE_PT);
-		}
-		if (!up && p == mrp->p_port) {
-			mrp->ring_link_curr_max = mrp->ring_link_conf_max;
-			mrp_port_netlink_set_state(mrp->p_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_ring_link_down_stop(mrp);
-			mrp_set_mrc_state(mrp, MRP_MRC_STATE_AC_STAT1);
-		}
-		break;
-	case MRP_MRC_STATE_PT_IDLE:
-		if (!up && p != mrp->p_port) {
-			mrp->ring_link_curr_max = mrp->ring_link_conf_max;
-			mrp_port_netlink_set_state(mrp->s_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_ring_link_down_start(mrp,
-						 mrp->ring_link_conf_interval);
-			mrp_ring_link_req(mrp->p_port, up,
-					  mrp->ring_link_curr_max *
-					  mrp->ring_link_conf_interval);
-			mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE);
-		}
-		if (!up && p == mrp->p_port) {
-			mrp->ring_link_curr_max = mrp->ring_link_conf_max;
-			mrp->p_port = mrp->s_port;
-			mrp->s_port = p;
-			mrp_port_netlink_set_state(mrp->s_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_ring_link_down_start(mrp,
-						 mrp->ring_link_conf_interval);
-			mrp_ring_link_req(mrp->p_port, up,
-					  mrp->ring_link_curr_max *
-					  mrp->ring_link_conf_interval);
-			mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE);
-		}
-		break;
-	}
+	if (p == mrp->p_port)
+		ev = up ? MRP_MRC_EV_P_UP : MRP_MRC_EV_P_DOWN;
+	else
+		ev = up ? MRP_MRC_EV_S_UP : MRP_MRC_EV_S_DOWN;
 
-	pr_info("new mrc_state: %s", mrp_get_mrc_state(mrp->mrc_state));
+	mrp_mrc_event(mrp, ev, &e);
 }
 
-/* Represents the state machine for when MRP instance has the role MIM and the
- * link of one of the MRP ports is changed.
+/* Represents the state machines for when the MRP instance has the role MIM or
+ * MIC and the link of the interconnect port is changed.
  */
 static void mrp_mim_port_link(struct mrp_port *p, bool up)
 {
+	struct mrp_event e = { .p = p, .up = up };
+	enum mrp_mim_event_type ev;
 	struct mrp *mrp = p->mrp;
 
-	pr_info("up: %d, mim_state: %s",
-	        up, mrp_get_mim_state(mrp->mim_state));
-
-	if (up && mrp->in_mode == MRP_IN_MODE_RC) {
-		switch (mrp->mim_state) {
-		case MRP_MIM_STATE_AC_STAT1:
-			mrp_port_netlink_set_state(mrp->i_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp->in_test_curr_max = mrp->in_test_conf_max - 1;
-			mrp->in_test_curr = 0;
-			mrp_in_test_req(mrp, mrp->in_test_conf_interval);
-			mrp_set_mim_state(mrp, MRP_MIM_STATE_CHK_IC);
-			break;
-		case MRP_MIM_STATE_CHK_IO:
-			/* Ignore */
-			break;
-		case MRP_MIM_STATE_CHK_IC:
-			/* Ignore */
-			break;
-		}
-	}
-
-	if (!up && mrp->in_mode == MRP_IN_MODE_RC) {
-		switch (mrp->mim_state) {
-		case MRP_MIM_STATE_AC_STAT1:
-			/* Ignore */
-			break;
-		case MRP_MIM_STATE_CHK_IO: /* fallthrough */
-		case MRP_MIM_STATE_CHK_IC:
-			mrp_port_netlink_set_state(mrp->i_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_in_topo_req(mrp, mrp->in_topo_conf_interval);
-			mrp_in_test_req(mrp, mrp->in_test_conf_interval);
-			mrp_set_mim_state(mrp, MRP_MIM_STATE_AC_STAT1);
-			break;
-		}
-	}
-
-	if (up && mrp->in_mode == MRP_IN_MODE_LC) {
-		switch (mrp->mim_state) {
-		case MRP_MIM_STATE_AC_STAT1:
-			mrp->in_link_status_curr_max = mrp->in_link_status_conf_max;
-			mrp_port_netlink_set_state(mrp->i_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_in_link_status_req(mrp,
-					       mrp->in_link_status_conf_interval);
-			mrp_set_mim_state(mrp, MRP_MIM_STATE_CHK_IC);
-			break;
-		case MRP_MIM_STATE_CHK_IO:
-			/* Ignore */
-			break;
-		case MRP_MIM_STATE_CHK_IC:
-			/* Ignore */
-			break;
-		}
-	}
-
-	if (!up && mrp->in_mode == MRP_IN_MODE_LC) {
-		switch (mrp->mim_state) {
-		case MRP_MIM_STATE_AC_STAT1:
-			/* Ignore */
-			break;
-		case MRP_MIM_STATE_CHK_IO:
-			mrp_port_netlink_set_state(mrp->i_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_in_link_status_stop(mrp);
-			mrp_set_mim_state(mrp, MRP_MIM_STATE_AC_STAT1);
-			break;
-		case MRP_MIM_STATE_CHK_IC:
-			mrp_port_netlink_set_state(mrp->i_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_set_mim_state(mrp, MRP_MIM_STATE_AC_STAT1);
-			break;
-		}
-	}
-
+	if (mrp->in_mode == MRP_IN_MODE_RC)
+		ev = up ? MRP_MIM_EV_RC_UP : MRP_MIM_EV_RC_DOWN;
+	else if (mrp->in_mode == MRP_IN_MODE_LC)
+		ev = up ? MRP_MIM_EV_LC_UP : MRP_MIM_EV_LC_DOWN;
+	else
+		return;
 
-	pr_info("%s: new mim_state: %s", __func__,
-	        mrp_get_mim_state(mrp->mim_state));
+	mrp_mim_event(mrp, ev, &e);
 }
 
-/* Represents the state machine for when MRP instance has the role MIC and the
- * link of one of the MRP ports is changed.
- */
 static void mrp_mic_port_link(struct mrp_port *p, bool up)
 {
+	struct mrp_event e = { .p = p, .up = up };
+	enum mrp_mic_event_type ev;
 	struct mrp *mrp = p->mrp;
 
-	pr_info("up: %d, mic_state: %s",
-	        up, mrp_get_mic_state(mrp->mic_state));
-
-	if (up && mrp->in_mode == MRP_IN_MODE_RC) {
-		switch (mrp->mic_state) {
-		case MRP_MIC_STATE_AC_STAT1:
-			mrp->in_link_curr_max = mrp->in_link_conf_max;
-			mrp_in_link_down_stop(mrp);
-			mrp_in_link_up_start(mrp, mrp->in_link_conf_interval);
-			mrp_in_link_req(mrp, up, mrp->in_link_conf_max *
-					mrp->in_link_conf_interval);
-			mrp_set_mic_state(mrp, MRP_MIC_STATE_PT);
-			break;
-		case MRP_MIC_STATE_PT: /* Fallthrough */
-		case MRP_MIC_STATE_IP_IDLE:
-			/* Ignore */
-			break;
-		}
-	}
-
-	if (!up && mrp->in_mode == MRP_IN_MODE_RC) {
-		switch (mrp->mic_state) {
-		case MRP_MIC_STATE_AC_STAT1:
-			/* Ignore */
-			break;
-		case MRP_MIC_STATE_PT:
-			mrp->in_link_curr_max = mrp->in_link_conf_max;
-			mrp_in_link_up_stop(mrp);
-			mrp_port_netlink_set_state(mrp->i_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_in_link_down_start(mrp, mrp->in_link_conf_interval);
-			mrp_in_link_req(mrp, up, mrp->in_link_conf_max *
-					mrp->in_link_conf_interval);
-			mrp_set_mic_state(mrp, MRP_MIC_STATE_AC_STAT1);
-			break;
-		case MRP_MIC_STATE_IP_IDLE:
-			mrp->in_link_curr_max = mrp->in_link_conf_max;
-			mrp_port_netlink_set_state(mrp->i_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_in_link_down_start(mrp, mrp->in_link_conf_interval);
-			mrp_in_link_req(mrp, up, mrp->in_link_conf_max *
-					mrp->in_link_conf_interval);
-			mrp_set_mic_state(mrp, MRP_MIC_STATE_AC_STAT1);
-			break;
-		}
-	}
-
-	if (up && mrp->in_mode == MRP_IN_MODE_LC) {
-		switch (mrp->mic_state) {
-		case MRP_MIC_STATE_AC_STAT1:
-			mrp->in_link_curr_max = mrp->in_link_conf_max;
-			mrp_in_link_down_stop(mrp);
-			mrp_in_link_up_start(mrp, mrp->in_link_conf_interval);
-			mrp_in_link_req(mrp, up,
-					mrp->in_link_conf_max *
-					mrp->in_link_conf_interval);
-			mrp_set_mic_state(mrp, MRP_MIC_STATE_PT);
-			break;
-		case MRP_MIC_STATE_PT: /* Fallthrough */
-		case MRP_MIC_STATE_IP_IDLE:
-			/* Ignore */
-			break;
-		}
-	}
-
-	if (!up && mrp->in_mode == MRP_IN_MODE_LC) {
-		switch (mrp->mic_state) {
-		case MRP_MIC_STATE_AC_STAT1:
-			/* Ignore */
-			break;
-		case MRP_MIC_STATE_PT: /* Fallthrough */
-		case MRP_MIC_STATE_IP_IDLE:
-			mrp->in_link_curr_max = mrp->in_link_conf_max;
-			mrp_in_link_up_stop(mrp);
-			mrp_port_netlink_set_state(mrp->i_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_in_link_down_start(mrp,
-					       mrp->in_link_conf_interval);
-			mrp_in_link_req(mrp, up,
-					mrp->in_link_conf_max *
-					mrp->in_link_conf_interval);
-			mrp_set_mic_state(mrp, MRP_MIC_STATE_AC_STAT1);
-			break;
-		}
-	}
+	if (mrp->in_mode == MRP_IN_MODE_RC)
+		ev = up ? MRP_MIC_EV_RC_UP : MRP_MIC_EV_RC_DOWN;
+	else if (mrp->in_mode == MRP_IN_MODE_LC)
+		ev = up ? MRP_MIC_EV_LC_UP : MRP_MIC_EV_LC_DOWN;
+	else
+		return;
 
-	pr_info("%s: new mic_state: %s", __func__,
-	        mrp_get_mic_state(mrp->mic_state));
+	mrp_mic_event(mrp, ev, &e);
 }
 
 /* Whenever the port link changes, this function is called */
@@ -2049,6 +1655,9 @@ void mrp_port_link_change(struct mrp_port *p, bool up)
 	else
 		p->operstate = IF_OPER_DOWN;
 
+	/* The kernel changes the port state when the link changes */
+	p->hw_state = MRP_HW_UNKNOWN;
+
 	if (mrp_is_ring_port(p)) {
 		if (mrp->ring_role == BR_MRP_RING_ROLE_MRM)
 			return mrp_mrm_port_link(p, up);
@@ -2095,132 +1704,209 @@ void mrp_mac_change(uint32_t ifindex, unsigned char *mac)
 	struct mrp_port *p;
 	struct mrp *mrp;
 
+	/* Each RTM_NEWLINK carries the address, the templates are rebuilt only
+	 * if it changed
+	 */
 	p = mrp_get_port(ifindex);
 	if (p) {
+		if (ether_addr_equal(p->macaddr, mac))
+			return;
+
 		memcpy(p->macaddr, mac, ETH_ALEN);
+		mrp_port_tx_init(p);
 		return;
 	}
 
 	list_for_each_entry(mrp, &mrp_instances, list) {
-		if (mrp->ifindex == ifindex)
-			memcpy(mrp->macaddr, mac, ETH_ALEN);
+		if (mrp->ifindex != ifindex ||
+		    ether_addr_equal(mrp->macaddr, mac))
+			continue;
+
+		memcpy(mrp->macaddr, mac, ETH_ALEN);
+		mrp_tx_init(mrp);
 	}
 }
 
-/* There are 4 different recovery times in which an MRP ring can recover. Based
- * on the each time updates all the configuration variables. The interval are
- * represented in ns.
+/* Called when the kernel rejected a request, with the lock of the instance
+ * held. The value is unknown so the next request is not skipped.
  */
-static void mrp_update_recovery(struct mrp *mrp,
-				enum mrp_ring_recovery_type ring_recv,
-				enum mrp_in_recovery_type in_recv)
+void mrp_netlink_failed(struct mrp *mrp, uint32_t ifindex,
+			enum mrp_netlink_op op, int err)
 {
-	mrp->ring_recv = ring_recv;
+	struct mrp_port *p;
 
-	switch (ring_recv) {
-	case MRP_RING_RECOVERY_500:
-		mrp->ring_topo_conf_interval = 20 * 1000;
-		mrp->ring_topo_conf_max = 3;
-		mrp->ring_topo_curr_max = mrp->ring_topo_conf_max - 1;
-		mrp->ring_test_conf_short = 30 * 1000;
-		mrp->ring_test_conf_interval = 50 * 1000;
-		mrp->ring_test_conf_period = 10000 * 1000;
-		mrp->ring_test_conf_max = 5;
-		mrp->ring_test_curr_max = mrp->ring_test_conf_max;
-		mrp->ring_test_conf_ext_max = 15;
-		mrp->ring_link_conf_interval = 100 * 1000;
-		mrp->ring_link_conf_max = 4;
-		mrp->ring_link_curr_max = 0;
+	switch (op) {
+	case MRP_NETLINK_PORT_STATE:
+	case MRP_NETLINK_UNBLOCK:
+		p = mrp_get_port(ifindex);
+		if (p)
+			p->hw_state = MRP_HW_UNKNOWN;
 		break;
-	case MRP_RING_RECOVERY_200:
-		mrp->ring_topo_conf_interval = 10 * 1000;
-		mrp->ring_topo_conf_max = 3;
-		mrp->ring_topo_curr_max = mrp->ring_topo_conf_max - 1;
-		mrp->ring_test_conf_short = 10 * 1000;
-		mrp->ring_test_conf_interval = 20 * 1000;
-		mrp->ring_test_conf_period = 10000 * 1000;
-		mrp->ring_test_conf_max = 3;
-		mrp->ring_test_curr_max = mrp->ring_test_conf_max;
-		mrp->ring_test_conf_ext_max = 15;
-		mrp->ring_link_conf_interval = 20 * 1000;
-		mrp->ring_link_conf_max = 4;
-		mrp->ring_link_curr_max = 0;
+	case MRP_NETLINK_RING_ROLE:
+		mrp->hw_ring_role = MRP_HW_UNKNOWN;
 		break;
-	case MRP_RING_RECOVERY_30:
-		mrp->ring_topo_conf_interval = 500;
-		mrp->ring_topo_conf_max = 3;
-		mrp->ring_topo_curr_max = mrp->ring_topo_conf_max - 1;
-		mrp->ring_test_conf_short = 1 * 1000;
-		mrp->ring_test_conf_interval = 3500;
-		mrp->ring_test_conf_period = 10000 * 1000;
-		mrp->ring_test_conf_max = 3;
-		mrp->ring_test_curr_max = mrp->ring_test_conf_max;
-		mrp->ring_test_conf_ext_max = 15;
-		mrp->ring_link_conf_interval = 1;
-		mrp->ring_link_conf_max = 4;
-		mrp->ring_link_curr_max = 0;
+	case MRP_NETLINK_RING_STATE:
+		mrp->hw_ring_state = MRP_HW_UNKNOWN;
 		break;
-	case MRP_RING_RECOVERY_10:
-		mrp->ring_topo_conf_interval = 500;
-		mrp->ring_topo_conf_max = 3;
-		mrp->ring_topo_curr_max = mrp->ring_topo_conf_max - 1;
-		mrp->ring_test_conf_short = 500;
-		mrp->ring_test_conf_interval = 1000;
-		mrp->ring_test_conf_period = 10000 * 1000;
-		mrp->ring_test_conf_max = 3;
-		mrp->ring_test_curr_max = mrp->ring_test_conf_max;
-		mrp->ring_test_conf_ext_max = 15;
-		mrp->ring_link_conf_interval = 1;
-		mrp->ring_link_conf_max = 4;
-		mrp->ring_link_curr_max = 0;
+	case MRP_NETLINK_RING_TEST:
+		/* Make sure that at the next request the HW is updated */
+		mrp->ring_test_hw_interval = -1;
 		break;
-	default:
+	case MRP_NETLINK_IN_ROLE:
+		mrp->hw_in_role = MRP_HW_UNKNOWN;
 		break;
-	}
-
-	switch (in_recv) {
-	case MRP_IN_RECOVERY_500:
-		mrp->in_topo_conf_interval = 20 * 1000;
-		mrp->in_topo_conf_max = 3;
-		mrp->in_topo_curr_max = mrp->in_topo_conf_max - 1;
-		mrp->in_test_conf_interval = 50 * 1000;
-		mrp->in_test_conf_period = 10000 * 1000;
-		mrp->in_test_conf_max = 8;
-		mrp->in_test_curr_max = mrp->in_test_conf_max;
-		mrp->in_link_conf_interval = 20 * 1000;
-		mrp->in_link_conf_max = 4;
-		mrp->in_link_curr_max = 0;
-		mrp->in_link_status_conf_interval = 20 * 1000;
-		mrp->in_link_status_conf_max = 8;
-		mrp->in_link_status_curr_max = 0;
-		mrp->cfm_ccm_period = 10000 * 1000;
+	case MRP_NETLINK_IN_STATE:
+		mrp->hw_in_state = MRP_HW_UNKNOWN;
 		break;
-	case MRP_IN_RECOVERY_200:
-		mrp->in_topo_conf_interval = 10 * 1000;
-		mrp->in_topo_conf_max = 3;
-		mrp->in_topo_curr_max = mrp->in_topo_conf_max - 1;
-		mrp->in_test_conf_interval = 20 * 1000;
-		mrp->in_test_conf_period = 10000 * 1000;
-		mrp->in_test_conf_max = 8;
-		mrp->in_test_curr_max = mrp->in_test_conf_max;
-		mrp->in_link_conf_interval = 20 * 1000;
-		mrp->in_link_conf_max = 4;
-		mrp->in_link_curr_max = 0;
-		mrp->in_link_status_conf_interval = 20 * 1000;
-		mrp->in_link_status_conf_max = 8;
-		mrp->in_link_status_curr_max = 0;
-		mrp->cfm_ccm_period = 10000 * 1000;
+	case MRP_NETLINK_IN_TEST:
+		mrp->in_test_hw_interval = -1;
 		break;
 	default:
 		break;
 	}
 }
 
-struct mrp *mrp_find(uint32_t br_ifindex, uint32_t ring_nr)
+static void mrp_port_repair(struct mrp_port *p)
 {
+	if (!p || !p->hw_drift)
+		return;
+
+	p->hw_drift = false;
+	p->hw_state = MRP_HW_UNKNOWN;
+	mrp_port_netlink_set_state(p, p->state);
+}
+
+/* Send again the values that are different in the kernel */
+void mrp_offload_repair(void)
+{
+	uint32_t state, role;
 	struct mrp *mrp;
 
 	list_for_each_entry(mrp, &mrp_instances, list) {
+		pthread_mutex_lock(&mrp->lock);
+		mrp_netlink_begin();
+
+		mrp_port_repair(mrp->p_port);
+		mrp_port_repair(mrp->s_port);
+		mrp_port_repair(mrp->i_port);
+
+		if (mrp->hw_ring_drift) {
+			state = mrp->hw_ring_state;
+			role = mrp->hw_ring_role;
+
+			mrp->hw_ring_drift = false;
+			mrp->hw_ring_state = MRP_HW_UNKNOWN;
+			mrp->hw_ring_role = MRP_HW_UNKNOWN;
+
+			if (role != MRP_HW_UNKNOWN)
+				mrp_netlink_set_ring_role(mrp, mrp->ring_role);
+			if (state != MRP_HW_UNKNOWN)
+				mrp_netlink_set_ring_state(mrp, state);
+		}
+
+		if (mrp->hw_in_drift) {
+			state = mrp->hw_in_state;
+			role = mrp->hw_in_role;
+
+			mrp->hw_in_drift = false;
+			mrp->hw_in_state = MRP_HW_UNKNOWN;
+			mrp->hw_in_role = MRP_HW_UNKNOWN;
+
+			if (role != MRP_HW_UNKNOWN && mrp->i_port)
+				mrp_netlink_set_in_role(mrp, mrp->in_role);
+			if (state != MRP_HW_UNKNOWN)
+				mrp_netlink_set_in_state(mrp, state);
+		}
+
+		mrp_netlink_commit_async();
+		pthread_mutex_unlock(&mrp->lock);
+	}
+}
+
+/* Refresh the test offload of the instances whose watchdog expires in less
+ * than half of the period. All the refreshes are sent in one transaction and,
+ * because the refreshed instances get the same deadline, after one round the
+ * instances are refreshed together. Returns the next deadline in ns, 0 if no
+ * watchdog is running.
+ */
+uint64_t mrp_watchdog_refresh(uint64_t now)
+{
+	uint64_t next = 0;
+	struct mrp *mrp;
+
+	mrp_netlink_begin();
+
+	list_for_each_entry(mrp, &mrp_instances, list) {
+		pthread_mutex_lock(&mrp->lock);
+
+		if (mrp->ring_watchdog_ns &&
+		    mrp->ring_watchdog_ns <= now +
+		    (uint64_t)mrp->timing->ring_test_period * 1000 / 2) {
+			mrp_netlink_send_ring_test(mrp,
+						   mrp->timing->ring_test_interval,
+						   mrp->timing->ring_test_max,
+						   mrp->timing->ring_test_period);
+			mrp->ring_watchdog_ns = now +
+				(uint64_t)mrp->timing->ring_test_period * 1000;
+		}
+
+		if (mrp->in_watchdog_ns &&
+		    mrp->in_watchdog_ns <= now +
+		    (uint64_t)mrp->timing->in_test_period * 1000 / 2) {
+			mrp_netlink_send_in_test(mrp, mrp->timing->in_test_interval,
+						 mrp->timing->in_test_max,
+						 mrp->timing->in_test_period);
+			mrp->in_watchdog_ns = now +
+				(uint64_t)mrp->timing->in_test_period * 1000;
+		}
+
+		if (mrp->ring_watchdog_ns &&
+		    (!next || mrp->ring_watchdog_ns < next))
+			next = mrp->ring_watchdog_ns;
+		if (mrp->in_watchdog_ns &&
+		    (!next || mrp->in_watchdog_ns < next))
+			next = mrp->in_watchdog_ns;
+
+		pthread_mutex_unlock(&mrp->lock);
+	}
+
+	mrp_netlink_commit_async();
+
+	return next;
+}
+
+static void mrp_update_recovery(struct mrp *mrp,
+				enum mrp_ring_recovery_type ring_recv,
+				enum mrp_in_recovery_type in_recv)
+{
+	const struct mrp_timing *timing;
+
+	mrp->ring_recv = ring_recv;
+	mrp->in_recv = in_recv;
+
+	/* An invalid recovery time keeps the current timing */
+	timing = mrp_recovery_timing(ring_recv, in_recv);
+	if (timing)
+		mrp->timing = timing;
+
+	mrp->ring_topo_curr_max = mrp->timing->ring_topo_max - 1;
+	mrp->ring_test_curr_max = mrp->timing->ring_test_max;
+	mrp->ring_link_curr_max = 0;
+	mrp->in_topo_curr_max = mrp->timing->in_topo_max - 1;
+	mrp->in_test_curr_max = mrp->timing->in_test_max;
+	mrp->in_link_curr_max = 0;
+	mrp->in_link_status_curr_max = 0;
+	mrp->cfm_ccm_period = 10000 * 1000;
+}
+
+struct mrp *mrp_find(uint32_t br_ifindex, uint32_t ring_nr)
+{
+	struct hlist_head *head;
+	struct hlist_node *pos;
+	struct mrp *mrp;
+
+	head = mrp_instance_head(mrp_ring_hash, br_ifindex, ring_nr);
+	hlist_for_each_entry(mrp, pos, head, ring_node) {
 		if (mrp->ring_nr == ring_nr && mrp->ifindex == br_ifindex)
 			return mrp;
 	}
@@ -2228,28 +1914,51 @@ struct mrp *mrp_find(uint32_t br_ifindex, uint32_t ring_nr)
 	return NULL;
 }
 
+/* The packet socket of the loop receives only the frames of its ports */
+static void mrp_update_filter(void)
+{
+	uint32_t ifindexes[PACKET_FILTER_PORTS];
+	struct hlist_node *pos;
+	struct mrp_port *p;
+	int i, count = 0;
+
+	for (i = 0; i < (1 << mrp_port_hash_bits); ++i) {
+		hlist_for_each_entry(p, pos, &mrp_ports[i], node) {
+			if (count < PACKET_FILTER_PORTS)
+				ifindexes[count] = p->ifindex;
+			count++;
+		}
+	}
+
+	packet_set_filter(ifindexes, count);
+}
+
 /* Initialize an MRP port */
 static int mrp_port_init(uint32_t p_ifindex, struct mrp *mrp,
 			 enum br_mrp_port_role_type role)
 {
 	struct mrp_port *port;
 
-	port = malloc(sizeof(struct mrp_port));
-	if (!port)
-		return -ENOMEM;
-
-	memset(port, 0x0, sizeof(struct mrp_port));
-
 	/* It is possible for port intdex to be 0. In case the interconnect port
 	 * is not set
 	 */
 	if (p_ifindex == 0)
 		return 0;
 
+	/* A port can be part of only one MRP instance */
+	if (mrp_get_port(p_ifindex))
+		return -EINVAL;
+
+	port = &mrp->ports[role];
+	memset(port, 0x0, sizeof(struct mrp_port));
+
 	port->mrp = mrp;
 	port->ifindex = p_ifindex;
 	port->role = role;
+	port->hw_state = MRP_HW_UNKNOWN;
+	INIT_LIST_HEAD(&port->flush.list);
 	if_get_mac(port->ifindex, port->macaddr);
+	mrp_port_tx_init(port);
 
 	if (role == BR_MRP_PORT_ROLE_PRIMARY)
 		mrp->p_port = port;
@@ -2258,9 +1967,21 @@ static int mrp_port_init(uint32_t p_ifindex, struct mrp *mrp,
 	if (role == BR_MRP_PORT_ROLE_INTER)
 		mrp->i_port = port;
 
+	hlist_add_head(&port->node,
+		       &mrp_ports[hash_32(p_ifindex, mrp_port_hash_bits)]);
+	mrp_update_filter();
+
 	return 0;
 }
 
+/* The port is part of its instance, it is only removed from the hash */
+static void mrp_port_free(struct mrp_port *port)
+{
+	mrp_netlink_flush_cancel(port);
+	hlist_del_init(&port->node);
+	mrp_update_filter();
+}
+
 /* Uninitialize MRP port */
 static void mrp_port_uninit(struct mrp_port *port)
 {
@@ -2275,7 +1996,7 @@ static void mrp_port_uninit(struct mrp_port *port)
 
 	port->mrp = NULL;
 
-	free(port);
+	mrp_port_free(port);
 
 	pthread_mutex_unlock(&mrp->lock);
 }
@@ -2283,6 +2004,7 @@ static void mrp_port_uninit(struct mrp_port *port)
 /* Notified by kernel when a port stop receiving MRP_Test frames */
 void mrp_port_ring_open(struct mrp_port *p, bool loc)
 {
+	uint64_t now = get_ns();
 	struct mrp *mrp;
 
 	if (!p->mrp)
@@ -2292,6 +2014,12 @@ void mrp_port_ring_open(struct mrp_port *p, bool loc)
 
 	pthread_mutex_lock(&mrp->lock);
 
+	/* The ring opens with the first port that stops receiving MRP_Test
+	 * frames, the repeated notifications don't move the time of the open
+	 */
+	if (loc && !mrp->p_port->loc && !mrp->s_port->loc)
+		mrp->ring_open_ns = now;
+
 	if (mrp->ring_role != BR_MRP_RING_ROLE_MRM &&
 	    mrp->mra_support != true)
 		goto out;
@@ -2304,7 +2032,9 @@ void mrp_port_ring_open(struct mrp_port *p, bool loc)
 	if (!mrp->p_port->loc ||
 	    !mrp->s_port->loc) {
 		mrp_mrm_recv_ring_test(mrp);
-	} else {
+	} else if (mrp->ring_role != BR_MRP_RING_ROLE_MRM ||
+		   mrp->mrm_state != MRP_MRM_STATE_CHK_RC ||
+		   !mrp_ring_ext_open(mrp, now)) {
 		mrp_ring_open(mrp);
 	}
 
@@ -2352,13 +2082,15 @@ out:
 }
 
 /* Creates an MRP instance and initialize it */
-static int mrp_create(uint32_t br_ifindex, uint32_t ring_nr, uint16_t in_id)
+int mrp_create(uint32_t br_ifindex, uint32_t ring_nr, uint16_t in_id)
 {
 	struct mrp *mrp;
 
-	mrp = malloc(sizeof(struct mrp));
-	if (!mrp)
+	mrp = pool_alloc(&mrp_pool);
+	if (!mrp) {
+		pr_err("no free instance, the limit is %u", mrp_max_instances);
 		return -ENOMEM;
+	}
 
 	memset(mrp, 0x0, sizeof(struct mrp));
 
@@ -2371,6 +2103,11 @@ static int mrp_create(uint32_t br_ifindex, uint32_t ring_nr, uint16_t in_id)
 	mrp->ring_nr = ring_nr;
 	mrp->in_id = in_id;
 
+	mrp->hw_ring_state = MRP_HW_UNKNOWN;
+	mrp->hw_ring_role = MRP_HW_UNKNOWN;
+	mrp->hw_in_state = MRP_HW_UNKNOWN;
+	mrp->hw_in_role = MRP_HW_UNKNOWN;
+
 	mrp->ring_role = BR_MRP_RING_ROLE_MRC;
 	mrp->in_role = BR_MRP_IN_ROLE_DISABLED;
 	mrp->ring_transitions = 0;
@@ -2388,13 +2125,20 @@ static int mrp_create(uint32_t br_ifindex, uint32_t ring_nr, uint16_t in_id)
 	mrp_timer_init(mrp);
 
 	list_add_tail(&mrp->list, &mrp_instances);
+	hlist_add_head(&mrp->ring_node,
+		       mrp_instance_head(mrp_ring_hash, br_ifindex, ring_nr));
+	hlist_add_head(&mrp->cfm_node,
+		       mrp_instance_head(mrp_cfm_hash, br_ifindex,
+					 mrp->cfm_peer_mepid));
 
 	return 0;
 }
 
 static void mrp_delete_cfm(struct mrp *mrp)
 {
+	pthread_mutex_lock(&mrp_cfm_lock);
 	cfm_offload_mep_delete(mrp->ifindex, mrp->cfm_instance);
+	pthread_mutex_unlock(&mrp_cfm_lock);
 }
 
 /* Uninitialize MRP instance and remove it */
@@ -2416,30 +2160,105 @@ void mrp_destroy(uint32_t br_ifindex, uint32_t ring_nr, bool offload)
 		mrp_netlink_del(mrp);
 
 	if (mrp->p_port)
-		free(mrp->p_port);
+		mrp_port_free(mrp->p_port);
 
 	if (mrp->s_port)
-		free(mrp->s_port);
+		mrp_port_free(mrp->s_port);
 
 	if (mrp->i_port)
-		free(mrp->i_port);
+		mrp_port_free(mrp->i_port);
 
 	pthread_mutex_unlock(&mrp->lock);
 
 	list_del(&mrp->list);
-	free(mrp);
+	hlist_del(&mrp->ring_node);
+	hlist_del(&mrp->cfm_node);
+	pool_free(&mrp_pool, mrp);
+}
+
+/* Returns the wakeups per second since the previous call */
+static uint32_t mrp_wakeups_rate(uint64_t wakeups, uint64_t *last,
+				 uint64_t *last_ns)
+{
+	uint64_t now = get_ns();
+	uint32_t rate = 0;
+
+	if (*last_ns && now > *last_ns)
+		rate = (wakeups - *last) * 1000000000ULL / (now - *last_ns);
+
+	*last = wakeups;
+	*last_ns = now;
+
+	return rate;
+}
+
+/* Adds the counters of the loop to stats */
+void mrp_get_stats(struct mrp_stats *stats)
+{
+	struct mrp_port *p;
+	struct mrp *mrp;
+	int i, j = 0;
+
+	stats->rx_invalid += mrp_rx_invalid;
+	stats->timer_wakeups += mrp_timer_get_wakeups();
+	if (timer_wheel_get_latency_max() > stats->sched_latency_max)
+		stats->sched_latency_max = timer_wheel_get_latency_max();
+
+	/* A port is flushed only by the loop of its instance, so the flushed
+	 * ports of the loops are appended, as many as the reply has room for
+	 */
+	list_for_each_entry(mrp, &mrp_instances, list) {
+		for (i = 0; i < MRP_PORT_MAX; ++i) {
+			p = &mrp->ports[i];
+			if (!p->mrp || !p->flush.stats.requests)
+				continue;
+
+			while (j < MRP_STATS_FLUSH_PORTS &&
+			       stats->flush[j].ifindex)
+				j++;
+			if (j == MRP_STATS_FLUSH_PORTS)
+				return;
+
+			stats->flush[j] = p->flush.stats;
+		}
+	}
+}
+
+/* Called once the counters of all the loops are added */
+void mrp_get_stats_rate(struct mrp_stats *stats)
+{
+	static uint64_t wakeups_last, wakeups_ns;
+
+	stats->timer_wakeups_rate = mrp_wakeups_rate(stats->timer_wakeups,
+						     &wakeups_last,
+						     &wakeups_ns);
 }
 
+/* Adds the instances of the loop after the first count entries of status */
 int mrp_get(int *count, struct mrp_status *status)
 {
 	struct mrp *mrp;
-	int i = 0;
+	int i = *count;
 
 	list_for_each_entry(mrp, &mrp_instances, list) {
+		/* The reply has room only for MAX_MRP_INSTANCES */
+		if (i == MAX_MRP_INSTANCES)
+			break;
+
 		pthread_mutex_lock(&mrp->lock);
 
 		status[i].br = mrp->ifindex;
 		status[i].ring_nr = mrp->ring_nr;
+		status[i].wakeups = mrp->wakeups;
+		status[i].wakeups_rate = mrp_wakeups_rate(mrp->wakeups,
+							  &mrp->wakeups_last,
+							  &mrp->wakeups_ns);
+		strcpy(status[i].profile,
+		       mrp->profile ? mrp->profile->name : "");
+		status[i].timing = *mrp->timing;
+		status[i].ring_test_ext = mrp->ring_test_ext;
+		status[i].ring_open_false = mrp->ring_open_false;
+		status[i].ring_open_suppressed = mrp->ring_open_suppressed;
 		if (mrp->p_port)
 			status[i].pport = mrp->p_port->ifindex;
 		if (mrp->s_port)
@@ -2478,6 +2297,17 @@ int mrp_get(int *count, struct mrp_status *status)
 	return 0;
 }
 
+/* The peer mepid is part of the key, so rehash the instance */
+void mrp_set_cfm_peer(struct mrp *mrp, uint32_t peer_mepid)
+{
+	mrp->cfm_peer_mepid = peer_mepid;
+
+	hlist_del(&mrp->cfm_node);
+	hlist_add_head(&mrp->cfm_node,
+		       mrp_instance_head(mrp_cfm_hash, mrp->ifindex,
+					 peer_mepid));
+}
+
 static void mrp_start_cfm(struct mrp *mrp, uint32_t cfm_instance,
 			  uint32_t cfm_level, uint32_t cfm_mepid,
 			  uint32_t cfm_peer_mepid, char *cfm_maid,
@@ -2488,8 +2318,8 @@ static void mrp_start_cfm(struct mrp *mrp, uint32_t cfm_instance,
 	struct maid_data maid;
 
 	mrp->cfm_mepid = cfm_mepid;
-	mrp->cfm_peer_mepid = cfm_peer_mepid;
 	mrp->cfm_instance = cfm_instance;
+	mrp_set_cfm_peer(mrp, cfm_peer_mepid);
 
 	memcpy(smac.addr, mrp->i_port->macaddr, ETH_ALEN);
 	memcpy(dmac.addr, cfm_dmac, ETH_ALEN);
@@ -2498,6 +2328,7 @@ static void mrp_start_cfm(struct mrp *mrp, uint32_t cfm_instance,
 	memset(maid.data, 0, sizeof(maid));
 	memcpy(maid.data, cfm_maid, strlen(cfm_maid));
 
+	pthread_mutex_lock(&mrp_cfm_lock);
 	cfm_offload_mep_create(mrp->ifindex, mrp->cfm_instance,
 			       BR_CFM_PORT, BR_CFM_MEP_DIRECTION_DOWN,
 			       mrp->i_port->ifindex);
@@ -2511,6 +2342,8 @@ static void mrp_start_cfm(struct mrp *mrp, uint32_t cfm_instance,
 	/* Start the transmision of the frames */
 	cfm_offload_cc_ccm_tx(mrp->ifindex, mrp->cfm_instance, &dmac, 1,
 			      mrp->cfm_ccm_period, 1, 100, 1, 200);
+	pthread_mutex_unlock(&mrp_cfm_lock);
+
 	mrp_cfm_ccm_start(mrp, mrp->cfm_ccm_period);
 }
 
@@ -2547,6 +2380,7 @@ int mrp_add(uint32_t br_ifindex, uint32_t ring_nr, uint32_t pport,
 	mrp->in_mode = in_mode;
 
 	if_get_mac(mrp->ifindex, mrp->macaddr);
+	mrp_tx_init(mrp);
 
 	/* Initialize the ports */
 	err = mrp_port_init(pport, mrp, BR_MRP_PORT_ROLE_PRIMARY);
@@ -2621,6 +2455,146 @@ int mrp_del(uint32_t br_ifindex, uint32_t ring_nr)
 	return 0;
 }
 
+int mrp_set_flush_vlans(uint32_t br_ifindex, uint32_t ring_nr,
+			const uint8_t *vlans)
+{
+	struct mrp *mrp;
+	int i;
+
+	mrp = mrp_find(br_ifindex, ring_nr);
+	if (!mrp) {
+		pr_err("%s with invalid ring nr: %d", __func__, ring_nr);
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&mrp->lock);
+
+	memcpy(mrp->flush_vlans, vlans, MRP_VLAN_BITMAP_LEN);
+
+	/* An empty set flushes all the entries of the ports */
+	mrp->flush_vlan = false;
+	for (i = 0; i < MRP_VLAN_BITMAP_LEN; ++i)
+		if (vlans[i])
+			mrp->flush_vlan = true;
+
+	pthread_mutex_unlock(&mrp->lock);
+
+	return 0;
+}
+
+int mrp_set_profile(uint32_t br_ifindex, uint32_t ring_nr, const char *name)
+{
+	const struct mrp_timing *timing, *old;
+	const struct mrp_profile *profile;
+	uint32_t interval;
+	struct mrp *mrp;
+	int err;
+
+	mrp = mrp_find(br_ifindex, ring_nr);
+	if (!mrp) {
+		pr_err("%s with invalid ring nr: %d", __func__, ring_nr);
+		return -EINVAL;
+	}
+
+	profile = mrp_profile_find(name);
+	if (!profile) {
+		pr_err("%s with unknown profile: %s", __func__, name);
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&mrp->lock);
+
+	old = mrp->timing;
+	timing = &profile->resolved;
+
+	err = mrp_timing_validate(timing);
+	if (err)
+		goto out;
+
+	/* Only the configuration is changed, the sequences that are running
+	 * use the new values at their next step
+	 */
+	mrp->timing = timing;
+	mrp->ring_recv = profile->ring_recv;
+	mrp->in_recv = profile->in_recv;
+	mrp->profile = profile;
+
+	pr_info("ring_nr: %d uses profile %s", ring_nr, profile->name);
+
+	/* A running test offload is sent again with the new values */
+	mrp_netlink_begin();
+	if (mrp->ring_watchdog_ns) {
+		interval = timing->ring_test_interval;
+		if (mrp->ring_test_hw_interval == old->ring_test_short)
+			interval = timing->ring_test_short;
+
+		mrp->ring_test_hw_interval = -1;
+		mrp_ring_test_req(mrp, interval);
+	}
+	if (mrp->in_watchdog_ns) {
+		mrp->in_test_hw_interval = -1;
+		mrp_in_test_req(mrp, timing->in_test_interval);
+	}
+	mrp_netlink_commit_async();
+
+out:
+	pthread_mutex_unlock(&mrp->lock);
+
+	return err;
+}
+
+void mrp_set_max_instances(unsigned int count)
+{
+	if (count < 1)
+		count = 1;
+
+	mrp_max_instances = count;
+}
+
+static void mrp_free_hash(void)
+{
+	free(mrp_ring_hash);
+	free(mrp_cfm_hash);
+	free(mrp_ports);
+	mrp_ring_hash = NULL;
+	mrp_cfm_hash = NULL;
+	mrp_ports = NULL;
+}
+
+/* Creates the tables and the pools of the calling loop */
+int mrp_init(void)
+{
+	int err;
+
+	INIT_LIST_HEAD(&mrp_instances);
+
+	mrp_instance_hash_bits = MRP_INSTANCE_HASH_BITS_MIN;
+	while ((1U << mrp_instance_hash_bits) < mrp_max_instances)
+		mrp_instance_hash_bits++;
+	mrp_port_hash_bits = mrp_instance_hash_bits + MRP_PORT_HASH_SHIFT;
+
+	mrp_ring_hash = calloc(1 << mrp_instance_hash_bits,
+			       sizeof(*mrp_ring_hash));
+	mrp_cfm_hash = calloc(1 << mrp_instance_hash_bits,
+			      sizeof(*mrp_cfm_hash));
+	mrp_ports = calloc(1 << mrp_port_hash_bits, sizeof(*mrp_ports));
+	if (!mrp_ring_hash || !mrp_cfm_hash || !mrp_ports) {
+		err = -ENOMEM;
+		goto free_hash;
+	}
+
+	err = pool_init(&mrp_pool, "instance", sizeof(struct mrp),
+			mrp_max_instances);
+	if (err)
+		goto free_hash;
+
+	return 0;
+
+free_hash:
+	mrp_free_hash();
+	return err;
+}
+
 void mrp_uninit(void)
 {
 	struct mrp *mrp, *tmp;
@@ -2631,4 +2605,7 @@ void mrp_uninit(void)
 	list_for_each_entry_safe(mrp, tmp, &mrp_instances, list) {
 		mrp_destroy(mrp->ifindex, mrp->ring_nr, true);
 	}
+
+	pool_uninit(&mrp_pool);
+	mrp_free_hash();
 }
@@ -17,8 +17,83 @@
 #include "list.h"
 #include "linux.h"
 #include "utils.h"
+#include "timer_wheel.h"
+#include "profile.h"
+
+/* Destination MAC addresses of the MRP frames */
+enum mrp_dmac_type {
+	MRP_DMAC_TEST,
+	MRP_DMAC_CONTROL,
+	MRP_DMAC_ICONTROL,
+	MRP_DMAC_MAX,
+};
+
+/* Frames for which each MRP instance keeps a template */
+enum mrp_tx_type {
+	MRP_TX_RING_TOPO,
+	MRP_TX_RING_LINK,
+	MRP_TX_TEST_MGR_NACK,
+	MRP_TX_TEST_PROP,
+	MRP_TX_IN_TOPO,
+	MRP_TX_IN_LINK,
+	MRP_TX_IN_LINK_STATUS,
+	MRP_TX_MAX,
+};
+
+/* Value of the shadow fields when the kernel value is unknown */
+#define MRP_HW_UNKNOWN			((uint32_t)-1)
+
+/* Type of the netlink requests, used to report the failed ones */
+enum mrp_netlink_op {
+	MRP_NETLINK_CONFIG,
+	MRP_NETLINK_PORT_STATE,
+	MRP_NETLINK_UNBLOCK,
+	MRP_NETLINK_RING_ROLE,
+	MRP_NETLINK_RING_STATE,
+	MRP_NETLINK_RING_TEST,
+	MRP_NETLINK_IN_ROLE,
+	MRP_NETLINK_IN_STATE,
+	MRP_NETLINK_IN_TEST,
+	MRP_NETLINK_FLUSH,
+	MRP_NETLINK_FLUSH_VLAN,
+	MRP_NETLINK_FDB_MIGRATE,
+};
+
+/* Preencoded MRP frame without the ethernet header. Only the fields that
+ * change between frames are updated before sending it.
+ */
+struct mrp_tx_tmpl {
+	uint8_t				data[MRP_MAX_FRAME_LENGTH];
+	uint32_t			size;
+	enum mrp_dmac_type		dmac;
+	/* send the frame bypassing the qdisc layer */
+	bool				bypass;
+	struct br_mrp_tlv_hdr		*tlv;
+	void				*hdr;
+	struct br_mrp_common_hdr	*common;
+};
+
+/* The FDB flushes of a port are collected and sent together by netlink.c, so
+ * a port is flushed once even if several MRP_TopologyChange frames request it
+ */
+struct mrp_port_flush {
+	struct mrp_flush_stats		stats;
+	/* entry in the flush queue of the loop */
+	struct list_head		list;
+	bool				queued;
+	/* flush all the entries of the port, otherwise only the vlans */
+	bool				all;
+	uint8_t				vlans[MRP_VLAN_BITMAP_LEN];
+	/* time of the first request that is not sent yet */
+	uint64_t			queued_ns;
+	/* time of the first request of the flush that waits for the ACKs */
+	uint64_t			sent_ns;
+	uint32_t			inflight;
+};
 
 struct mrp_port {
+	/* entry in the ifindex hash of MRP ports */
+	struct hlist_node		node;
 	struct mrp			*mrp;
 	enum br_mrp_port_state_type	state;
 	enum br_mrp_port_role_type	role;
@@ -27,12 +102,30 @@ struct mrp_port {
 	bool				loc;
 	bool				in_loc;
 	uint8_t				operstate;
+
+	/* last state sent to the kernel and if the kernel has another one */
+	uint32_t			hw_state;
+	bool				hw_drift;
+
+	/* ethernet headers of the frames sent on this port */
+	struct ethhdr			tx_eth[MRP_DMAC_MAX];
+
+	struct mrp_port_flush		flush;
 };
 
+/* Number of ports of an instance: the two ring ports and the interconnect */
+#define MRP_PORT_MAX			3
+
 struct mrp {
 	/* list of mrp instances */
 	struct list_head		list;
 
+	/* entries in the (bridge, ring_nr) and (bridge, cfm_peer_mepid)
+	 * hashes of mrp instances
+	 */
+	struct hlist_node		ring_node;
+	struct hlist_node		cfm_node;
+
 	/* lock for each MRP instance */
 	pthread_mutex_t			lock;
 
@@ -53,11 +146,23 @@ struct mrp {
 	bool				mra_support;
 	bool				test_monitor;
 
+	/* last values sent to the kernel and if the kernel has other ones */
+	uint32_t			hw_ring_state;
+	uint32_t			hw_ring_role;
+	uint32_t			hw_in_state;
+	uint32_t			hw_in_role;
+	bool				hw_ring_drift;
+	bool				hw_in_drift;
+
 	enum br_mrp_ring_role_type	ring_role;
 	enum mrp_ring_recovery_type	ring_recv;
 	enum br_mrp_in_role_type	in_role;
 	enum mrp_in_mode_type		in_mode;
 	enum mrp_in_recovery_type	in_recv;
+	/* applied profile, NULL if none */
+	const struct mrp_profile	*profile;
+	/* timing of the recovery times or of the profile, shared */
+	const struct mrp_timing		*timing;
 
 	enum mrp_mrm_state_type		mrm_state;
 	enum mrp_mrc_state_type		mrc_state;
@@ -68,78 +173,89 @@ struct mrp {
 	bool				no_tc;
 
 	uint16_t			ring_transitions;
+
+	/* callbacks of the timers, the last two are used to get the rate */
+	uint64_t			wakeups;
+	uint64_t			wakeups_last;
+	uint64_t			wakeups_ns;
+	/* when the kernel notified the last ring open, in ns */
+	uint64_t			ring_open_ns;
+	struct wheel_timer		ring_open_work;
 	uint16_t			in_transitions;
 
 	uint16_t			seq_id;
 	uint16_t			prio;
+
+	/* if flush_vlan is set, only these VLANs are flushed */
+	uint8_t				flush_vlans[MRP_VLAN_BITMAP_LEN];
+	bool				flush_vlan;
 	uint8_t				domain[MRP_DOMAIN_UUID_LENGTH];
 
-	ev_timer			clear_fdb_work;
+	struct mrp_tx_tmpl		tx[MRP_TX_MAX];
 
-	ev_timer			ring_test_work;
-	ev_timer			ring_watcher_work;
-	uint32_t			ring_test_conf_short;
-	uint32_t			ring_test_conf_interval;
-	uint32_t			ring_test_conf_max;
-	uint32_t			ring_test_conf_ext_max;
+	struct wheel_timer		clear_fdb_work;
+
+	struct wheel_timer		ring_test_work;
+	/* deadline of the test offload refresh in ns, 0 if not running */
+	uint64_t			ring_watchdog_ns;
 	uint32_t			ring_test_curr;
 	uint32_t			ring_test_curr_max;
-	uint32_t			ring_test_conf_period;
 	uint32_t			ring_test_hw_interval;
 
-	ev_timer			ring_topo_work;
-	uint32_t			ring_topo_conf_interval;
-	uint32_t			ring_topo_conf_max;
+	/* extended monitoring, see mrp_ring_ext_open */
+	struct wheel_timer		ring_ext_work;
+	bool				ring_test_ext;
+	/* time of the last transient loss of the ring, in ns */
+	uint64_t			ring_test_ext_ns;
+	uint64_t			ring_open_false;
+	uint64_t			ring_open_suppressed;
+
+	struct wheel_timer		ring_topo_work;
 	uint32_t			ring_topo_curr_max;
 	bool				ring_topo_running;
 
-	ev_timer			ring_link_up_work;
-	ev_timer			ring_link_down_work;
-	uint32_t			ring_link_conf_interval;
-	uint32_t			ring_link_conf_max;
+	struct wheel_timer		ring_link_up_work;
+	struct wheel_timer		ring_link_down_work;
 	uint32_t			ring_link_curr_max;
 
-	ev_timer			in_test_work;
-	ev_timer			in_watcher_work;
-	uint32_t			in_test_conf_short;
-	uint32_t			in_test_conf_interval;
-	uint32_t			in_test_conf_max;
-	uint32_t			in_test_conf_ext_max;
+	struct wheel_timer		in_test_work;
+	uint64_t			in_watchdog_ns;
 	uint32_t			in_test_curr;
 	uint32_t			in_test_curr_max;
-	uint32_t			in_test_conf_period;
 	uint32_t			in_test_hw_interval;
 
-	ev_timer			in_topo_work;
-	uint32_t			in_topo_conf_interval;
-	uint32_t			in_topo_conf_max;
+	struct wheel_timer		in_topo_work;
 	uint32_t			in_topo_curr_max;
 
-	ev_timer			in_link_up_work;
-	ev_timer			in_link_down_work;
-	uint32_t			in_link_conf_interval;
-	uint32_t			in_link_conf_max;
+	struct wheel_timer		in_link_up_work;
+	struct wheel_timer		in_link_down_work;
 	uint32_t			in_link_curr_max;
 
-	ev_timer			in_link_status_work;
-	uint32_t			in_link_status_conf_interval;
-	uint32_t			in_link_status_conf_max;
+	struct wheel_timer		in_link_status_work;
 	uint32_t			in_link_status_curr_max;
 
 	uint32_t			blocked;
 	uint32_t			react_on_link_change;
 
 	/* CFM configuration - Used only in LC mode */
-	ev_timer			cfm_ccm_work;
+	struct wheel_timer		cfm_ccm_work;
 	uint32_t			cfm_ccm_period;
 	uint32_t			cfm_instance;
 	uint32_t			cfm_mepid;
 	uint32_t			cfm_peer_mepid;
 	uint8_t				cfm_ccm_dmac[ETH_ALEN];
+
+	/* the ports, p_port, s_port and i_port point to them */
+	struct mrp_port			ports[MRP_PORT_MAX];
 };
 
+extern pthread_mutex_t mrp_cfm_lock;
+
+struct mrp_frame;
+
 int mrp_recv(unsigned char *buf, int buf_len, struct sockaddr_ll *sl,
 	     socklen_t salen);
+void mrp_recv_frame(struct mrp_port *port, const struct mrp_frame *f);
 void mrp_port_link_change(struct mrp_port *p, bool up);
 void mrp_destroy(uint32_t ifindex, uint32_t ring_nr, bool offload);
 void mrp_mac_change(uint32_t ifindex, unsigned char *mac);
@@ -147,8 +263,14 @@ void mrp_port_ring_open(struct mrp_port *p, bool loc);
 void mrp_port_in_open(struct mrp_port *p, bool loc);
 void mrp_cfm_link_change(uint32_t br_ifindex, uint32_t peer_mepid,
 			 uint32_t defect);
+void mrp_netlink_failed(struct mrp *mrp, uint32_t ifindex,
+			enum mrp_netlink_op op, int err);
+void mrp_offload_repair(void);
+uint64_t mrp_watchdog_refresh(uint64_t now);
 
 int mrp_get(int *count, struct mrp_status *status);
+void mrp_get_stats(struct mrp_stats *stats);
+void mrp_get_stats_rate(struct mrp_stats *stats);
 int mrp_add(uint32_t br_ifindex, uint32_t ring_nr, uint32_t pport,
 	    uint32_t sport, uint32_t ring_role, uint16_t prio,
 	    uint8_t ring_recv, uint8_t react_on_link_change,
@@ -157,6 +279,11 @@ int mrp_add(uint32_t br_ifindex, uint32_t ring_nr, uint32_t pport,
 	    uint32_t cfm_level, uint32_t cfm_mepid,
 	    uint32_t cfm_peer_mepid, char *cfm_maid, char *cfm_dmac);
 int mrp_del(uint32_t br_ifindex, uint32_t ring_nr);
+int mrp_set_profile(uint32_t br_ifindex, uint32_t ring_nr, const char *name);
+int mrp_set_flush_vlans(uint32_t br_ifindex, uint32_t ring_nr,
+			const uint8_t *vlans);
+void mrp_set_max_instances(unsigned int count);
+int mrp_init(void);
 void mrp_uninit(void);
 
 void mrp_set_mrm_init(struct mrp* mrp);
@@ -164,11 +291,16 @@ void mrp_set_mrc_init(struct mrp* mrp);
 
 struct mrp_port *mrp_get_port(uint32_t ifindex);
 struct mrp *mrp_find(uint32_t br_ifindex, uint32_t ring_nr);
+struct mrp *mrp_get_mrp(uint32_t ifindex, uint32_t peer_mepid);
+int mrp_create(uint32_t br_ifindex, uint32_t ring_nr, uint16_t in_id);
+void mrp_set_cfm_peer(struct mrp *mrp, uint32_t peer_mepid);
 
 void mrp_ring_test_req(struct mrp *mrp, uint32_t interval);
 void mrp_ring_topo_req(struct mrp *mrp, uint32_t interval);
 void mrp_ring_topo_send(struct mrp *mrp, uint32_t interval);
 void mrp_ring_link_req(struct mrp_port *p, bool up, uint32_t interval);
+void mrp_ring_test_open_false(struct mrp *mrp);
+void mrp_ring_test_ext_back(struct mrp *mrp);
 
 void mrp_in_test_req(struct mrp *mrp, uint32_t interval);
 void mrp_in_topo_req(struct mrp *mrp, uint32_t interval);
@@ -176,6 +308,11 @@ void mrp_in_topo_send(struct mrp *mrp, uint32_t interval);
 void mrp_in_link_req(struct mrp *mrp, bool up, uint32_t interval);
 void mrp_in_link_status_req(struct mrp *mrp, uint32_t interval);
 
+char *mrp_get_mrm_state(enum mrp_mrm_state_type state);
+char *mrp_get_mrc_state(enum mrp_mrc_state_type state);
+char *mrp_get_mim_state(enum mrp_mim_state_type state);
+char *mrp_get_mic_state(enum mrp_mic_state_type state);
+
 void mrp_set_mrm_state(struct mrp *mrp, enum mrp_mrm_state_type state);
 void mrp_set_mrc_state(struct mrp *mrp, enum mrp_mrc_state_type state);
 
@@ -185,8 +322,10 @@ void mrp_set_mic_state(struct mrp *mrp, enum mrp_mic_state_type state);
 /* mrp_timer.c */
 void mrp_timer_init(struct mrp *mrp);
 void mrp_timer_stop(struct mrp *mrp);
+uint64_t mrp_timer_get_wakeups(void);
 
 void mrp_ring_open(struct mrp *mrp);
+void mrp_ring_unblock(struct mrp *mrp);
 void mrp_in_open(struct mrp *mrp);
 
 void mrp_clear_fdb_start(struct mrp *mrp, uint32_t interval);
@@ -200,6 +339,8 @@ void mrp_ring_link_up_start(struct mrp *mrp, uint32_t interval);
 void mrp_ring_link_up_stop(struct mrp *mrp);
 void mrp_ring_link_down_start(struct mrp *mrp, uint32_t interval);
 void mrp_ring_link_down_stop(struct mrp *mrp);
+void mrp_ring_ext_start(struct mrp *mrp, uint32_t interval);
+void mrp_ring_ext_stop(struct mrp *mrp);
 
 int mrp_in_test_start(struct mrp *mrp, uint32_t interval);
 void mrp_in_test_stop(struct mrp *mrp);
@@ -216,11 +357,15 @@ void mrp_cfm_ccm_start(struct mrp *mrp, uint32_t interval);
 void mrp_cfm_ccm_stop(struct mrp *mrp);
 
 /* netlink.c */
+void mrp_netlink_begin(void);
+int mrp_netlink_commit(int *results, int size);
+int mrp_netlink_commit_async(void);
 int mrp_netlink_add(struct mrp *mrp, struct mrp_port *p, struct mrp_port *s,
 		    uint16_t prio);
 int mrp_netlink_del(struct mrp *mrp);
 int mrp_port_netlink_set_state(struct mrp_port *p,
 			       enum br_mrp_port_state_type state);
+int mrp_port_netlink_unblock(struct mrp_port *p);
 int mrp_port_netlink_set_role(struct mrp_port *p,
 			      enum br_mrp_port_role_type role);
 
@@ -236,6 +381,7 @@ int mrp_netlink_send_in_test(struct mrp *mrp, uint32_t interval, uint32_t max,
 			     uint32_t period);
 
 int mrp_netlink_flush(struct mrp *mrp);
+void mrp_netlink_flush_cancel(struct mrp_port *p);
 
 #endif /* STATE_MACHINE_H */
 
@@ -6,13 +6,72 @@
 
 #include "state_machine.h"
 #include "cfm_netlink.h"
+#include "packet.h"
 #include "print.h"
+#include "transition.h"
 
-static bool mrp_mrc_ring_open(struct mrp *mrp)
+/* Number of callbacks of the timers of the instances of this loop */
+static __thread uint64_t mrp_timer_wakeups;
+
+static void mrp_timer_wakeup(struct mrp *mrp)
+{
+	mrp->wakeups++;
+	mrp_timer_wakeups++;
+}
+
+uint64_t mrp_timer_get_wakeups(void)
+{
+	return mrp_timer_wakeups;
+}
+
+/* The watchdogs of the test offload of all the instances of a loop share one
+ * timer, which is armed for the first deadline.
+ */
+static void mrp_watchdog_expired(struct wheel_timer *w);
+
+static __thread struct wheel_timer mrp_watchdog_work;
+/* deadline for which the timer is armed in ns, 0 if it is stopped */
+static __thread uint64_t mrp_watchdog_ns;
+
+static void mrp_watchdog_arm(uint64_t deadline)
+{
+	uint64_t now = get_ns();
+
+	if (mrp_watchdog_ns && mrp_watchdog_ns <= deadline)
+		return;
+
+	if (!mrp_watchdog_work.cb)
+		wheel_timer_init(&mrp_watchdog_work, mrp_watchdog_expired);
+
+	mrp_watchdog_ns = deadline;
+	wheel_timer_start(&mrp_watchdog_work,
+			  deadline > now ? (deadline - now) / 1000 : 0, 0);
+}
+
+static void mrp_watchdog_expired(struct wheel_timer *w)
+{
+	uint64_t next;
+
+	mrp_timer_wakeups++;
+	mrp_watchdog_ns = 0;
+
+	next = mrp_watchdog_refresh(get_ns());
+	if (next)
+		mrp_watchdog_arm(next);
+}
+
+/* The kernel stops the test offload when the period expires, so it has to be
+ * refreshed before
+ */
+static void mrp_watchdog_start(uint64_t *watchdog_ns, uint32_t period)
 {
-	if (mrp->ring_role == BR_MRP_RING_ROLE_MRM)
-		return false;
+	*watchdog_ns = get_ns() + (uint64_t)period * 1000;
+	mrp_watchdog_arm(*watchdog_ns);
+}
 
+/* A MRA that runs as MRC becomes the MRM when the ring opens */
+static void mrp_mrc_ring_open(struct mrp *mrp)
+{
 	mrp_set_mrm_init(mrp);
 
 	switch (mrp->mrc_state) {
@@ -36,101 +95,119 @@ static bool mrp_mrc_ring_open(struct mrp *mrp)
 	}
 
 	mrp->test_monitor = false;
-	mrp_ring_test_req(mrp, mrp->ring_test_conf_short);
+	mrp_ring_test_req(mrp, mrp->timing->ring_test_short);
+}
 
-	return true;
+/* The secondary port is unblocked and the MRP_TopologyChange frames are sent
+ * before anything else. The ring state and the test offload are done after
+ * the current loop iteration in mrp_ring_open_expired.
+ */
+void mrp_ring_unblock(struct mrp *mrp)
+{
+	mrp_port_netlink_unblock(mrp->s_port);
+	if (!mrp->no_tc)
+		mrp_ring_topo_send(mrp, mrp->timing->ring_topo_interval *
+					mrp->timing->ring_topo_max);
+	packet_flush();
+
+	mrp->ring_test_curr_max = mrp->timing->ring_test_max - 1;
+	mrp->ring_test_curr = 0;
+
+	mrp->add_test = false;
+
+	if (!mrp->no_tc)
+		mrp_ring_topo_start(mrp, mrp->timing->ring_topo_interval);
+
+	mrp->no_tc = false;
+
+	wheel_timer_start(&mrp->ring_open_work, 0, 0);
 }
 
 void mrp_ring_open(struct mrp *mrp)
 {
-	if (mrp->mra_support)
-		if (mrp_mrc_ring_open(mrp))
-			return;
+	struct mrp_event e = { 0 };
 
-	if (mrp->mrm_state != MRP_MRM_STATE_CHK_RC) {
-		mrp->add_test = false;
-		mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
+	if (mrp->ring_role == BR_MRP_RING_ROLE_MRM) {
+		mrp_mrm_event(mrp, MRP_MRM_EV_RING_OPEN, &e);
 		return;
 	}
 
-	mrp_port_netlink_set_state(mrp->s_port, BR_MRP_PORT_STATE_FORWARDING);
-
-	mrp->ring_test_curr_max = mrp->ring_test_conf_max - 1;
-	mrp->ring_test_curr = 0;
+	/* The netlink messages of the transition are sent with one sendmsg */
+	mrp_netlink_begin();
+	mrp_mrc_ring_open(mrp);
+	mrp_netlink_commit_async();
+}
 
-	mrp->add_test = false;
+static void mrp_ring_open_expired(struct wheel_timer *w)
+{
+	struct mrp *mrp = container_of(w, struct mrp, ring_open_work);
 
-	if (!mrp->no_tc)
-		mrp_ring_topo_req(mrp, mrp->ring_topo_conf_interval);
+	mrp_timer_wakeup(mrp);
 
-	mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
+	pthread_mutex_lock(&mrp->lock);
 
 	mrp->ring_transitions++;
-	mrp_set_mrm_state(mrp, MRP_MRM_STATE_CHK_RO);
+
+	/* The state may be changed in the meantime */
+	if (mrp->mrm_state != MRP_MRM_STATE_CHK_RO)
+		goto out;
+
+	mrp_netlink_begin();
+	mrp_netlink_set_ring_state(mrp, BR_MRP_RING_STATE_OPEN);
+	mrp_ring_test_req(mrp, mrp->timing->ring_test_interval);
+	mrp_netlink_commit_async();
+
+out:
+	pthread_mutex_unlock(&mrp->lock);
 }
 
 void mrp_in_open(struct mrp *mrp)
 {
+	mrp_netlink_begin();
+
 	mrp_port_netlink_set_state(mrp->i_port, BR_MRP_PORT_STATE_FORWARDING);
 
-	mrp->in_test_curr_max = mrp->in_test_conf_max - 1;
+	mrp->in_test_curr_max = mrp->timing->in_test_max - 1;
 	mrp->in_test_curr = 0;
 
-	mrp_in_topo_req(mrp, mrp->in_topo_conf_interval);
-	mrp_in_test_req(mrp, mrp->in_test_conf_interval);
+	mrp_in_topo_req(mrp, mrp->timing->in_topo_interval);
+	mrp_in_test_req(mrp, mrp->timing->in_test_interval);
 
 	mrp->in_transitions++;
 	mrp_set_mim_state(mrp, MRP_MIM_STATE_CHK_IO);
+
+	mrp_netlink_commit_async();
 }
 
-static void mrp_clear_fdb_expired(struct ev_loop *loop,
-				  ev_timer *w, int revents)
+static void mrp_clear_fdb_expired(struct wheel_timer *w)
 {
 	struct mrp *mrp = container_of(w, struct mrp, clear_fdb_work);
 
+	mrp_timer_wakeup(mrp);
+
 	mrp_netlink_flush(mrp);
 
 	mrp_clear_fdb_stop(mrp);
 }
 
-static void mrp_ring_test_expired(struct ev_loop *loop,
-				  ev_timer *w, int revents)
+static void mrp_ring_test_expired(struct wheel_timer *w)
 {
 	struct mrp *mrp = container_of(w, struct mrp, ring_test_work);
+	struct mrp_event e = { 0 };
 
-	pthread_mutex_lock(&mrp->lock);
-
-	if (mrp->mrm_state == MRP_MRM_STATE_AC_STAT1)
-		goto out;
-
-	mrp->add_test = false;
-
-out:
-	pthread_mutex_unlock(&mrp->lock);
-}
-
-static void mrp_ring_watcher_expired(struct ev_loop *loop,
-				     ev_timer *w, int revents)
-{
-	struct mrp *mrp = container_of(w, struct mrp, ring_watcher_work);
+	mrp_timer_wakeup(mrp);
 
 	pthread_mutex_lock(&mrp->lock);
-
-	mrp_netlink_send_ring_test(mrp, mrp->ring_test_conf_interval,
-				   mrp->ring_test_conf_max,
-				   mrp->ring_test_conf_period);
-
-	mrp->ring_watcher_work.repeat = (ev_tstamp)mrp->ring_test_conf_period/ 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->ring_watcher_work);
-
+	mrp_mrm_event(mrp, MRP_MRM_EV_TEST_TIMEOUT, &e);
 	pthread_mutex_unlock(&mrp->lock);
 }
 
-static void mrp_ring_topo_expired(struct ev_loop *loop,
-				  ev_timer *w, int revents)
+static void mrp_ring_topo_expired(struct wheel_timer *w)
 {
 	struct mrp *mrp = container_of(w, struct mrp, ring_topo_work);
 
+	mrp_timer_wakeup(mrp);
+
 	pr_info("ring topo expired: ring_topo_curr_max: %d",
 	        mrp->ring_topo_curr_max);
 
@@ -138,11 +215,11 @@ static void mrp_ring_topo_expired(struct ev_loop *loop,
 
 	if (mrp->ring_topo_curr_max > 0) {
 		mrp_ring_topo_send(mrp, mrp->ring_topo_curr_max *
-					mrp->ring_topo_conf_interval);
+					mrp->timing->ring_topo_interval);
 
 		mrp->ring_topo_curr_max--;
 	} else {
-		mrp->ring_topo_curr_max = mrp->ring_topo_conf_max - 1;
+		mrp->ring_topo_curr_max = mrp->timing->ring_topo_max - 1;
 
 		mrp_netlink_flush(mrp);
 		mrp_ring_topo_send(mrp, 0);
@@ -153,19 +230,20 @@ static void mrp_ring_topo_expired(struct ev_loop *loop,
 	pthread_mutex_unlock(&mrp->lock);
 }
 
-static void mrp_ring_link_up_expired(struct ev_loop *loop,
-				     ev_timer *w, int revents)
+static void mrp_ring_link_up_expired(struct wheel_timer *w)
 {
 	struct mrp *mrp = container_of(w, struct mrp, ring_link_up_work);
 	uint32_t interval;
 	uint32_t delay;
 
+	mrp_timer_wakeup(mrp);
+
 	pr_info("ring link up expired: ring_link_curr_max: %d",
 	        mrp->ring_link_curr_max);
 
 	pthread_mutex_lock(&mrp->lock);
 
-	delay = mrp->ring_link_conf_interval;
+	delay = mrp->timing->ring_link_interval;
 
 	if (mrp->ring_link_curr_max > 0) {
 		mrp->ring_link_curr_max--;
@@ -176,7 +254,7 @@ static void mrp_ring_link_up_expired(struct ev_loop *loop,
 
 		mrp_ring_link_req(mrp->p_port, true, interval);
 	} else {
-		mrp->ring_link_curr_max = mrp->ring_link_conf_max;
+		mrp->ring_link_curr_max = mrp->timing->ring_link_max;
 		mrp_port_netlink_set_state(mrp->s_port,
 					   BR_MRP_PORT_STATE_FORWARDING);
 		mrp_set_mrc_state(mrp, MRP_MRC_STATE_PT_IDLE);
@@ -187,19 +265,20 @@ static void mrp_ring_link_up_expired(struct ev_loop *loop,
 	pthread_mutex_unlock(&mrp->lock);
 }
 
-static void mrp_ring_link_down_expired(struct ev_loop *loop,
-				       ev_timer *w, int revents)
+static void mrp_ring_link_down_expired(struct wheel_timer *w)
 {
 	struct mrp *mrp = container_of(w, struct mrp, ring_link_down_work);
 	uint32_t interval;
 	uint32_t delay;
 
+	mrp_timer_wakeup(mrp);
+
 	pr_info("ring link down expired: ring_link_curr_max: %d",
 	        mrp->ring_link_curr_max);
 
 	pthread_mutex_lock(&mrp->lock);
 
-	delay = mrp->ring_link_conf_interval;
+	delay = mrp->timing->ring_link_interval;
 
 	if (mrp->ring_link_curr_max > 0) {
 		mrp->ring_link_curr_max--;
@@ -210,7 +289,7 @@ static void mrp_ring_link_down_expired(struct ev_loop *loop,
 
 		mrp_ring_link_req(mrp->p_port, false, interval);
 	} else {
-		mrp->ring_link_curr_max = mrp->ring_link_conf_max;
+		mrp->ring_link_curr_max = mrp->timing->ring_link_max;
 
 		mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE_IDLE);
 
@@ -220,44 +299,49 @@ static void mrp_ring_link_down_expired(struct ev_loop *loop,
 	pthread_mutex_unlock(&mrp->lock);
 }
 
-static void mrp_in_test_expired(struct ev_loop *loop,
-				ev_timer *w, int revents)
+static void mrp_ring_ext_expired(struct wheel_timer *w)
 {
-	struct mrp *mrp = container_of(w, struct mrp, in_test_work);
+	struct mrp *mrp = container_of(w, struct mrp, ring_ext_work);
 
-	pthread_mutex_lock(&mrp->lock);
+	mrp_timer_wakeup(mrp);
 
-	if (mrp->mrm_state == MRP_MRM_STATE_AC_STAT1)
-		goto out;
+	pthread_mutex_lock(&mrp->lock);
 
-	mrp->add_test = false;
+	/* Also the extended number of MRP_Test frames was missed */
+	if (mrp->mrm_state == MRP_MRM_STATE_CHK_RC &&
+	    mrp->p_port->loc && mrp->s_port->loc) {
+		pr_info("ring_nr: %d open after extended monitoring",
+			mrp->ring_nr);
+		mrp_ring_open(mrp);
+	}
 
-out:
 	pthread_mutex_unlock(&mrp->lock);
 }
 
-static void mrp_in_watcher_expired(struct ev_loop *loop,
-				   ev_timer *w, int revents)
+static void mrp_in_test_expired(struct wheel_timer *w)
 {
-	struct mrp *mrp = container_of(w, struct mrp, in_watcher_work);
+	struct mrp *mrp = container_of(w, struct mrp, in_test_work);
+
+	mrp_timer_wakeup(mrp);
 
 	pthread_mutex_lock(&mrp->lock);
 
-	mrp_netlink_send_in_test(mrp, mrp->in_test_conf_interval,
-				 mrp->in_test_conf_max,
-				 mrp->in_test_conf_period);
+	if (mrp->mrm_state == MRP_MRM_STATE_AC_STAT1)
+		goto out;
 
-	mrp->in_watcher_work.repeat = (ev_tstamp)mrp->in_test_conf_period/ 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->in_watcher_work);
+	mrp->add_test = false;
+	wheel_timer_stop(&mrp->in_test_work);
 
+out:
 	pthread_mutex_unlock(&mrp->lock);
 }
 
-static void mrp_in_topo_expired(struct ev_loop *loop,
-				ev_timer *w, int revents)
+static void mrp_in_topo_expired(struct wheel_timer *w)
 {
 	struct mrp *mrp = container_of(w, struct mrp, in_topo_work);
 
+	mrp_timer_wakeup(mrp);
+
 	pr_info("int topo expired: in_topo_curr_max: %d",
 	        mrp->in_topo_curr_max);
 
@@ -265,11 +349,11 @@ static void mrp_in_topo_expired(struct ev_loop *loop,
 
 	if (mrp->in_topo_curr_max > 0) {
 		mrp_in_topo_send(mrp, mrp->in_topo_curr_max *
-				 mrp->in_topo_conf_interval);
+				 mrp->timing->in_topo_interval);
 
 		mrp->in_topo_curr_max--;
 	} else {
-		mrp->in_topo_curr_max = mrp->in_topo_conf_max - 1;
+		mrp->in_topo_curr_max = mrp->timing->in_topo_max - 1;
 
 		mrp_netlink_flush(mrp);
 		mrp_in_topo_send(mrp, 0);
@@ -280,19 +364,20 @@ static void mrp_in_topo_expired(struct ev_loop *loop,
 	pthread_mutex_unlock(&mrp->lock);
 }
 
-static void mrp_in_link_up_expired(struct ev_loop *loop,
-				   ev_timer *w, int revents)
+static void mrp_in_link_up_expired(struct wheel_timer *w)
 {
 	struct mrp *mrp = container_of(w, struct mrp, in_link_up_work);
 	uint32_t interval;
 	uint32_t delay;
 
+	mrp_timer_wakeup(mrp);
+
 	pr_info("int link up expired: in_link_curr_max: %d",
 	        mrp->in_link_curr_max);
 
 	pthread_mutex_lock(&mrp->lock);
 
-	delay = mrp->in_link_conf_interval;
+	delay = mrp->timing->in_link_interval;
 
 	if (mrp->in_link_curr_max > 0) {
 		mrp->in_link_curr_max--;
@@ -303,7 +388,7 @@ static void mrp_in_link_up_expired(struct ev_loop *loop,
 
 		mrp_in_link_req(mrp, true, interval);
 	} else {
-		mrp->in_link_curr_max = mrp->in_link_conf_max;
+		mrp->in_link_curr_max = mrp->timing->in_link_max;
 		mrp_port_netlink_set_state(mrp->i_port,
 					   BR_MRP_PORT_STATE_FORWARDING);
 		mrp_set_mic_state(mrp, MRP_MIC_STATE_IP_IDLE);
@@ -314,19 +399,20 @@ static void mrp_in_link_up_expired(struct ev_loop *loop,
 	pthread_mutex_unlock(&mrp->lock);
 }
 
-static void mrp_in_link_down_expired(struct ev_loop *loop,
-				     ev_timer *w, int revents)
+static void mrp_in_link_down_expired(struct wheel_timer *w)
 {
 	struct mrp *mrp = container_of(w, struct mrp, in_link_down_work);
 	uint32_t interval;
 	uint32_t delay;
 
+	mrp_timer_wakeup(mrp);
+
 	pr_info("int link down expired: in_link_curr_max: %d",
 	        mrp->in_link_curr_max);
 
 	pthread_mutex_lock(&mrp->lock);
 
-	delay = mrp->in_link_conf_interval;
+	delay = mrp->timing->in_link_interval;
 
 	if (mrp->in_link_curr_max > 0) {
 		mrp->in_link_curr_max--;
@@ -337,7 +423,7 @@ static void mrp_in_link_down_expired(struct ev_loop *loop,
 
 		mrp_in_link_req(mrp, false, interval);
 	} else {
-		mrp->in_link_curr_max = mrp->in_link_conf_max;
+		mrp->in_link_curr_max = mrp->timing->in_link_max;
 
 		mrp_in_link_down_stop(mrp);
 	}
@@ -345,19 +431,20 @@ static void mrp_in_link_down_expired(struct ev_loop *loop,
 	pthread_mutex_unlock(&mrp->lock);
 }
 
-static void mrp_in_link_status_expired(struct ev_loop *loop,
-				       ev_timer *w, int revents)
+static void mrp_in_link_status_expired(struct wheel_timer *w)
 {
 	struct mrp *mrp = container_of(w, struct mrp, in_link_status_work);
 	uint32_t interval;
 	uint32_t delay;
 
+	mrp_timer_wakeup(mrp);
+
 	pr_info("in link status expired: in_link_status_curr_max: %d",
 	        mrp->in_link_status_curr_max);
 
 	pthread_mutex_lock(&mrp->lock);
 
-	delay = mrp->in_link_status_conf_interval;
+	delay = mrp->timing->in_link_status_interval;
 
 	if (mrp->in_link_status_curr_max > 0) {
 		mrp->in_link_status_curr_max--;
@@ -366,7 +453,7 @@ static void mrp_in_link_status_expired(struct ev_loop *loop,
 
 		mrp_in_link_status_req(mrp,  interval);
 	} else {
-		mrp->in_link_status_curr_max = mrp->in_link_status_conf_max;
+		mrp->in_link_status_curr_max = mrp->timing->in_link_status_max;
 
 		mrp_in_link_status_stop(mrp);
 	}
@@ -374,19 +461,21 @@ static void mrp_in_link_status_expired(struct ev_loop *loop,
 	pthread_mutex_unlock(&mrp->lock);
 }
 
-static void mrp_cfm_ccm_expired(struct ev_loop *loop,
-				ev_timer *w, int revents)
+static void mrp_cfm_ccm_expired(struct wheel_timer *w)
 {
 	struct mrp *mrp = container_of(w, struct mrp, cfm_ccm_work);
 	struct mac_addr dmac;
 
+	mrp_timer_wakeup(mrp);
+
 	memcpy(dmac.addr, mrp->cfm_ccm_dmac, ETH_ALEN);
 
-	mrp->cfm_ccm_work.repeat = (ev_tstamp)mrp->cfm_ccm_period / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->cfm_ccm_work);
+	wheel_timer_again(&mrp->cfm_ccm_work, mrp->cfm_ccm_period);
 
+	pthread_mutex_lock(&mrp_cfm_lock);
 	cfm_offload_cc_ccm_tx(mrp->ifindex, mrp->cfm_instance, &dmac, 1,
 			      mrp->cfm_ccm_period, 1, 100, 1, 200);
+	pthread_mutex_unlock(&mrp_cfm_lock);
 }
 
 int mrp_ring_test_start(struct mrp *mrp, uint32_t interval)
@@ -396,19 +485,21 @@ int mrp_ring_test_start(struct mrp *mrp, uint32_t interval)
 	if (interval == mrp->ring_test_hw_interval)
 		goto update_only_sw;
 
-	mrp->ring_watcher_work.repeat = (ev_tstamp)mrp->ring_test_conf_period/ 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->ring_watcher_work);
+	mrp_watchdog_start(&mrp->ring_watchdog_ns, mrp->timing->ring_test_period);
 
 	mrp->ring_test_hw_interval = interval;
 	err = mrp_netlink_send_ring_test(mrp, interval,
-					 mrp->ring_test_conf_max,
-					 mrp->ring_test_conf_period);
+					 mrp->timing->ring_test_max,
+					 mrp->timing->ring_test_period);
 	if (err)
 		return err;
 
 update_only_sw:
-	mrp->ring_test_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->ring_test_work);
+	/* The timer only clears add_test, so it runs only while it is set */
+	if (mrp->add_test)
+		wheel_timer_again(&mrp->ring_test_work, interval);
+	else
+		wheel_timer_stop(&mrp->ring_test_work);
 	return 0;
 }
 
@@ -417,43 +508,50 @@ void mrp_ring_test_stop(struct mrp *mrp)
 	mrp_netlink_send_ring_test(mrp, 0, 0, 0);
 	/* Make sure that at the next start the HW is updated */
 	mrp->ring_test_hw_interval = -1;
-	ev_timer_stop(EV_DEFAULT, &mrp->ring_test_work);
-	ev_timer_stop(EV_DEFAULT, &mrp->ring_watcher_work);
+	wheel_timer_stop(&mrp->ring_test_work);
+	mrp->ring_watchdog_ns = 0;
 }
 
 void mrp_ring_topo_start(struct mrp *mrp, uint32_t interval)
 {
 	mrp->ring_topo_running = true;
-	mrp->ring_topo_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->ring_topo_work);
+	wheel_timer_again(&mrp->ring_topo_work, interval);
 }
 
 void mrp_ring_topo_stop(struct mrp *mrp)
 {
 	mrp->ring_topo_running = false;
-	ev_timer_stop(EV_DEFAULT, &mrp->ring_topo_work);
+	wheel_timer_stop(&mrp->ring_topo_work);
 }
 
 void mrp_ring_link_up_start(struct mrp *mrp, uint32_t interval)
 {
-	mrp->ring_link_up_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->ring_link_up_work);
+	wheel_timer_again(&mrp->ring_link_up_work, interval);
 }
 
 void mrp_ring_link_up_stop(struct mrp *mrp)
 {
-	ev_timer_stop(EV_DEFAULT, &mrp->ring_link_up_work);
+	wheel_timer_stop(&mrp->ring_link_up_work);
 }
 
 void mrp_ring_link_down_start(struct mrp *mrp, uint32_t interval)
 {
-	mrp->ring_link_down_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->ring_link_down_work);
+	wheel_timer_again(&mrp->ring_link_down_work, interval);
 }
 
 void mrp_ring_link_down_stop(struct mrp *mrp)
 {
-	ev_timer_stop(EV_DEFAULT, &mrp->ring_link_down_work);
+	wheel_timer_stop(&mrp->ring_link_down_work);
+}
+
+void mrp_ring_ext_start(struct mrp *mrp, uint32_t interval)
+{
+	wheel_timer_start(&mrp->ring_ext_work, interval, 0);
+}
+
+void mrp_ring_ext_stop(struct mrp *mrp)
+{
+	wheel_timer_stop(&mrp->ring_ext_work);
 }
 
 int mrp_in_test_start(struct mrp *mrp, uint32_t interval)
@@ -463,18 +561,19 @@ int mrp_in_test_start(struct mrp *mrp, uint32_t interval)
 	if (interval == mrp->in_test_hw_interval)
 		goto update_only_sw;
 
-	mrp->in_watcher_work.repeat = (ev_tstamp)mrp->in_test_conf_period/ 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->in_watcher_work);
+	mrp_watchdog_start(&mrp->in_watchdog_ns, mrp->timing->in_test_period);
 
 	mrp->in_test_hw_interval = interval;
-	err = mrp_netlink_send_in_test(mrp, interval, mrp->in_test_conf_max,
-				       mrp->in_test_conf_period);
+	err = mrp_netlink_send_in_test(mrp, interval, mrp->timing->in_test_max,
+				       mrp->timing->in_test_period);
 	if (err)
 		return err;
 
 update_only_sw:
-	mrp->in_test_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->in_test_work);
+	if (mrp->add_test)
+		wheel_timer_again(&mrp->in_test_work, interval);
+	else
+		wheel_timer_stop(&mrp->in_test_work);
 	return 0;
 }
 
@@ -483,85 +582,81 @@ void mrp_in_test_stop(struct mrp *mrp)
 	mrp_netlink_send_in_test(mrp, 0, 0, 0);
 	/* Make sure that at the next start the HW is updated */
 	mrp->in_test_hw_interval = -1;
-	ev_timer_stop(EV_DEFAULT, &mrp->in_test_work);
-	ev_timer_stop(EV_DEFAULT, &mrp->in_watcher_work);
+	wheel_timer_stop(&mrp->in_test_work);
+	mrp->in_watchdog_ns = 0;
 }
 
 void mrp_in_topo_start(struct mrp *mrp, uint32_t interval)
 {
-	mrp->in_topo_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->in_topo_work);
+	wheel_timer_again(&mrp->in_topo_work, interval);
 }
 
 void mrp_in_topo_stop(struct mrp *mrp)
 {
-	ev_timer_stop(EV_DEFAULT, &mrp->in_topo_work);
+	wheel_timer_stop(&mrp->in_topo_work);
 }
 
 void mrp_in_link_up_start(struct mrp *mrp, uint32_t interval)
 {
-	mrp->in_link_up_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->in_link_up_work);
+	wheel_timer_again(&mrp->in_link_up_work, interval);
 }
 
 void mrp_in_link_up_stop(struct mrp *mrp)
 {
-	ev_timer_stop(EV_DEFAULT, &mrp->in_link_up_work);
+	wheel_timer_stop(&mrp->in_link_up_work);
 }
 
 void mrp_in_link_down_start(struct mrp *mrp, uint32_t interval)
 {
-	mrp->in_link_down_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->in_link_down_work);
+	wheel_timer_again(&mrp->in_link_down_work, interval);
 }
 
 void mrp_in_link_down_stop(struct mrp *mrp)
 {
-	ev_timer_stop(EV_DEFAULT, &mrp->in_link_down_work);
+	wheel_timer_stop(&mrp->in_link_down_work);
 }
 
 void mrp_in_link_status_start(struct mrp *mrp, uint32_t interval)
 {
-	mrp->in_link_status_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->in_link_status_work);
+	wheel_timer_again(&mrp->in_link_status_work, interval);
 }
 
 void mrp_in_link_status_stop(struct mrp *mrp)
 {
-	ev_timer_stop(EV_DEFAULT, &mrp->in_link_status_work);
+	wheel_timer_stop(&mrp->in_link_status_work);
 }
 
 void mrp_clear_fdb_start(struct mrp *mrp, uint32_t interval)
 {
-	mrp->clear_fdb_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->clear_fdb_work);
+	wheel_timer_again(&mrp->clear_fdb_work, interval);
 	if (interval == 0)
 		mrp_netlink_flush(mrp);
 }
 
 void mrp_clear_fdb_stop(struct mrp *mrp)
 {
-	ev_timer_stop(EV_DEFAULT, &mrp->clear_fdb_work);
+	wheel_timer_stop(&mrp->clear_fdb_work);
 }
 
 void mrp_cfm_ccm_start(struct mrp *mrp, uint32_t interval)
 {
-	mrp->cfm_ccm_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->cfm_ccm_work);
+	wheel_timer_again(&mrp->cfm_ccm_work, interval);
 }
 
 void mrp_cfm_ccm_stop(struct mrp *mrp)
 {
-	ev_timer_stop(EV_DEFAULT, &mrp->cfm_ccm_work);
+	wheel_timer_stop(&mrp->cfm_ccm_work);
 }
 
 /* Stops all the timers */
 void mrp_timer_stop(struct mrp *mrp)
 {
 	mrp_clear_fdb_stop(mrp);
+	wheel_timer_stop(&mrp->ring_open_work);
 	mrp_ring_topo_stop(mrp);
 	mrp_ring_link_up_stop(mrp);
 	mrp_ring_link_down_stop(mrp);
+	mrp_ring_ext_stop(mrp);
 	mrp_ring_test_stop(mrp);
 
 	if (mrp->in_role != BR_MRP_IN_ROLE_DISABLED) {
@@ -580,17 +675,17 @@ void mrp_timer_stop(struct mrp *mrp)
 
 void mrp_timer_init(struct mrp *mrp)
 {
-	ev_init(&mrp->clear_fdb_work, mrp_clear_fdb_expired);
-	ev_init(&mrp->ring_topo_work, mrp_ring_topo_expired);
-	ev_init(&mrp->ring_test_work, mrp_ring_test_expired);
-	ev_init(&mrp->ring_watcher_work, mrp_ring_watcher_expired);
-	ev_init(&mrp->ring_link_up_work, mrp_ring_link_up_expired);
-	ev_init(&mrp->ring_link_down_work, mrp_ring_link_down_expired);
-	ev_init(&mrp->in_watcher_work, mrp_in_watcher_expired);
-	ev_init(&mrp->in_test_work, mrp_in_test_expired);
-	ev_init(&mrp->in_topo_work, mrp_in_topo_expired);
-	ev_init(&mrp->in_link_up_work, mrp_in_link_up_expired);
-	ev_init(&mrp->in_link_down_work, mrp_in_link_down_expired);
-	ev_init(&mrp->in_link_status_work, mrp_in_link_status_expired);
-	ev_init(&mrp->cfm_ccm_work, mrp_cfm_ccm_expired);
+	wheel_timer_init(&mrp->clear_fdb_work, mrp_clear_fdb_expired);
+	wheel_timer_init(&mrp->ring_open_work, mrp_ring_open_expired);
+	wheel_timer_init(&mrp->ring_topo_work, mrp_ring_topo_expired);
+	wheel_timer_init(&mrp->ring_test_work, mrp_ring_test_expired);
+	wheel_timer_init(&mrp->ring_link_up_work, mrp_ring_link_up_expired);
+	wheel_timer_init(&mrp->ring_link_down_work, mrp_ring_link_down_expired);
+	wheel_timer_init(&mrp->ring_ext_work, mrp_ring_ext_expired);
+	wheel_timer_init(&mrp->in_test_work, mrp_in_test_expired);
+	wheel_timer_init(&mrp->in_topo_work, mrp_in_topo_expired);
+	wheel_timer_init(&mrp->in_link_up_work, mrp_in_link_up_expired);
+	wheel_timer_init(&mrp->in_link_down_work, mrp_in_link_down_expired);
+	wheel_timer_init(&mrp->in_link_status_work, mrp_in_link_status_expired);
+	wheel_timer_init(&mrp->cfm_ccm_work, mrp_cfm_ccm_expired);
 }
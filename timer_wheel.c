@@ -0,0 +1,328 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ev.h>
+
+#include "timer_wheel.h"
+#include "shard.h"
+#include "utils.h"
+#include "print.h"
+
+struct timer_wheel {
+	struct list_head	slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+	/* Slots that may hold timers, a cleared bit means an empty slot */
+	uint64_t		occupied[TIMER_WHEEL_LEVELS];
+	/* Next tick to be processed */
+	uint64_t		now;
+	/* Tick at which the timerfd expires, UINT64_MAX if it is disarmed */
+	uint64_t		armed;
+	bool			running;
+	int			fd;
+	ev_io			watcher;
+	struct ev_loop		*loop;
+};
+
+/* Each event loop has its own wheel, the timers of an instance are always
+ * started and stopped from the loop that runs it
+ */
+static __thread struct timer_wheel wheel = {
+	.fd = -1,
+};
+
+/* Worst delay in ns from the expiry of the timerfd until the loop ran it */
+static __thread uint64_t wheel_latency_max;
+
+static uint64_t timer_wheel_ticks(uint64_t ns)
+{
+	return (ns + TIMER_WHEEL_TICK_NS - 1) / TIMER_WHEEL_TICK_NS;
+}
+
+static uint64_t timer_wheel_ror(uint64_t val, unsigned int n)
+{
+	if (!n)
+		return val;
+
+	return (val >> n) | (val << (64 - n));
+}
+
+static void timer_wheel_arm(uint64_t tick)
+{
+	struct itimerspec its = { 0 };
+	uint64_t ns;
+
+	if (wheel.fd < 0)
+		return;
+
+	if (tick != UINT64_MAX) {
+		ns = tick * TIMER_WHEEL_TICK_NS;
+		its.it_value.tv_sec = ns / 1000000000ULL;
+		its.it_value.tv_nsec = ns % 1000000000ULL;
+	}
+
+	if (timerfd_settime(wheel.fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		pr_err("timerfd_settime failed: %d", errno);
+		return;
+	}
+
+	wheel.armed = tick;
+}
+
+static void timer_wheel_add(struct wheel_timer *t)
+{
+	uint64_t delta = t->expires - wheel.now;
+	unsigned int level = 0;
+	unsigned int slot;
+
+	if ((int64_t)delta < 0) {
+		/* Already expired, run it at the next tick. The expiry is
+		 * moved to that tick, else timer_wheel_next returns the stale
+		 * one and the loop is armed in the past until the tick runs
+		 */
+		t->expires = wheel.now;
+		slot = wheel.now & TIMER_WHEEL_MASK;
+	} else {
+		while (level < TIMER_WHEEL_LEVELS - 1 &&
+		       delta >= 1ULL << ((level + 1) * TIMER_WHEEL_BITS))
+			level++;
+
+		if (delta >= 1ULL << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS))
+			t->expires = wheel.now +
+				     (1ULL << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) - 1;
+
+		slot = (t->expires >> (level * TIMER_WHEEL_BITS)) &
+		       TIMER_WHEEL_MASK;
+	}
+
+	list_add_tail(&t->list, &wheel.slots[level][slot]);
+	wheel.occupied[level] |= 1ULL << slot;
+
+	if (!wheel.running && t->expires < wheel.armed)
+		timer_wheel_arm(t->expires);
+}
+
+/* Moves the timers of a slot to the lower levels */
+static void timer_wheel_cascade(unsigned int level, unsigned int slot)
+{
+	struct wheel_timer *t, *tmp;
+	LIST_HEAD(list);
+
+	list_splice_init(&wheel.slots[level][slot], &list);
+	wheel.occupied[level] &= ~(1ULL << slot);
+
+	list_for_each_entry_safe(t, tmp, &list, list) {
+		list_del_init(&t->list);
+		timer_wheel_add(t);
+	}
+}
+
+/* Runs all the timers that expire up to and including the tick 'target' */
+static void timer_wheel_run(uint64_t target)
+{
+	struct wheel_timer *t;
+	unsigned int level;
+	unsigned int slot;
+	uint64_t tick;
+	LIST_HEAD(expired);
+
+	wheel.running = true;
+
+	while (wheel.now <= target) {
+		tick = wheel.now;
+		slot = tick & TIMER_WHEEL_MASK;
+
+		if (!slot) {
+			for (level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+				unsigned int idx;
+
+				idx = (tick >> (level * TIMER_WHEEL_BITS)) &
+				      TIMER_WHEEL_MASK;
+				timer_wheel_cascade(level, idx);
+				if (idx)
+					break;
+			}
+		}
+
+		/* Nothing expires before the next cascade */
+		if (!wheel.occupied[0]) {
+			wheel.now = (tick | TIMER_WHEEL_MASK) + 1;
+			if (wheel.now > target + 1)
+				wheel.now = target + 1;
+			continue;
+		}
+
+		list_splice_init(&wheel.slots[0][slot], &expired);
+		wheel.occupied[0] &= ~(1ULL << slot);
+		wheel.now = tick + 1;
+
+		/* The callbacks may stop or restart any timer in the list */
+		while (!list_empty(&expired)) {
+			t = list_entry(expired.next, struct wheel_timer, list);
+			list_del_init(&t->list);
+
+			if (t->repeat) {
+				t->expires += t->repeat;
+				if (t->expires < wheel.now)
+					t->expires = tick + t->repeat;
+				timer_wheel_add(t);
+			}
+
+			t->cb(t);
+		}
+	}
+
+	wheel.running = false;
+}
+
+/* Returns the tick of the first timer that expires */
+static uint64_t timer_wheel_next(void)
+{
+	uint64_t next = UINT64_MAX;
+	struct list_head *head;
+	struct wheel_timer *t;
+	unsigned int level;
+	unsigned int start;
+	unsigned int slot;
+	uint64_t occ;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		start = (wheel.now >> (level * TIMER_WHEEL_BITS)) &
+			TIMER_WHEEL_MASK;
+		/* On the upper levels the current slot is cascaded when the
+		 * wheel enters it, after that the timers in it expire only
+		 * after a full rotation
+		 */
+		if (wheel.now & ((1ULL << (level * TIMER_WHEEL_BITS)) - 1))
+			start = (start + 1) & TIMER_WHEEL_MASK;
+
+		while ((occ = wheel.occupied[level])) {
+			slot = (start + __builtin_ctzll(timer_wheel_ror(occ, start))) &
+			       TIMER_WHEEL_MASK;
+			head = &wheel.slots[level][slot];
+
+			if (list_empty(head)) {
+				wheel.occupied[level] &= ~(1ULL << slot);
+				continue;
+			}
+
+			/* The slots are ordered in time starting from the
+			 * current one, so the first used slot holds the first
+			 * timer of the level
+			 */
+			list_for_each_entry(t, head, list)
+				if (t->expires < next)
+					next = t->expires;
+			break;
+		}
+	}
+
+	return next;
+}
+
+static void timer_wheel_expired(EV_P_ ev_io *w, int revents)
+{
+	uint64_t count, ns;
+
+	if (read(wheel.fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		pr_err("timerfd read failed: %d", errno);
+
+	ns = get_ns();
+	if (wheel.armed != UINT64_MAX &&
+	    ns > wheel.armed * TIMER_WHEEL_TICK_NS &&
+	    ns - wheel.armed * TIMER_WHEEL_TICK_NS > wheel_latency_max)
+		wheel_latency_max = ns - wheel.armed * TIMER_WHEEL_TICK_NS;
+
+	timer_wheel_run(ns / TIMER_WHEEL_TICK_NS);
+	timer_wheel_arm(timer_wheel_next());
+}
+
+void wheel_timer_init(struct wheel_timer *t,
+		      void (*cb)(struct wheel_timer *t))
+{
+	INIT_LIST_HEAD(&t->list);
+	t->expires = 0;
+	t->repeat = 0;
+	t->cb = cb;
+}
+
+/* Starts the timer to expire after 'after' us and then every 'repeat' us. If
+ * the timer is already running, it is restarted.
+ */
+void wheel_timer_start(struct wheel_timer *t, uint32_t after, uint32_t repeat)
+{
+	uint64_t ns = get_ns();
+
+	list_del_init(&t->list);
+
+	/* The wheel doesn't move while it is empty, so bring it to the
+	 * current time before the timer is added relative to it
+	 */
+	if (wheel.armed == UINT64_MAX && !wheel.running)
+		wheel.now = ns / TIMER_WHEEL_TICK_NS;
+
+	t->expires = timer_wheel_ticks(ns + (uint64_t)after * 1000);
+	t->repeat = timer_wheel_ticks((uint64_t)repeat * 1000);
+	timer_wheel_add(t);
+}
+
+/* Same as ev_timer_again, restarts the timer to expire every 'repeat' us or
+ * stops it if 'repeat' is 0.
+ */
+void wheel_timer_again(struct wheel_timer *t, uint32_t repeat)
+{
+	if (!repeat) {
+		wheel_timer_stop(t);
+		return;
+	}
+
+	wheel_timer_start(t, repeat, repeat);
+}
+
+void wheel_timer_stop(struct wheel_timer *t)
+{
+	/* The timerfd is not rearmed, if it was armed for this timer there
+	 * is one wakeup that finds nothing to run
+	 */
+	list_del_init(&t->list);
+}
+
+uint64_t timer_wheel_get_latency_max(void)
+{
+	return wheel_latency_max;
+}
+
+int timer_wheel_init(void)
+{
+	unsigned int level, slot;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+		for (slot = 0; slot < TIMER_WHEEL_SIZE; slot++)
+			INIT_LIST_HEAD(&wheel.slots[level][slot]);
+
+	wheel.now = get_ns() / TIMER_WHEEL_TICK_NS;
+	wheel.armed = UINT64_MAX;
+
+	wheel.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (wheel.fd < 0) {
+		pr_err("timerfd_create failed: %d", errno);
+		return -1;
+	}
+
+	wheel.loop = shard_loop();
+	ev_io_init(&wheel.watcher, timer_wheel_expired, wheel.fd, EV_READ);
+	ev_io_start(wheel.loop, &wheel.watcher);
+
+	return 0;
+}
+
+void timer_wheel_uninit(void)
+{
+	if (wheel.fd < 0)
+		return;
+
+	ev_io_stop(wheel.loop, &wheel.watcher);
+	close(wheel.fd);
+	wheel.fd = -1;
+}
@@ -0,0 +1,49 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "list.h"
+
+/* Resolution of the timer wheel */
+#define TIMER_WHEEL_TICK_NS	100000ULL
+
+/* The wheel has TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SIZE slots, each
+ * level covering TIMER_WHEEL_SIZE times the range of the previous one. With a
+ * tick of 100us the levels cover 6.4ms, 409.6ms, 26.2s, 27.9min and 29.8h.
+ * Longer timeouts are clamped to the range of the last level.
+ */
+#define TIMER_WHEEL_BITS	6
+#define TIMER_WHEEL_SIZE	(1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK	(TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_LEVELS	5
+
+struct wheel_timer {
+	struct list_head	list;
+	/* Tick at which the timer expires */
+	uint64_t		expires;
+	/* Period in ticks, 0 for one shot timers */
+	uint64_t		repeat;
+	void			(*cb)(struct wheel_timer *t);
+};
+
+void wheel_timer_init(struct wheel_timer *t,
+		      void (*cb)(struct wheel_timer *t));
+void wheel_timer_start(struct wheel_timer *t, uint32_t after, uint32_t repeat);
+void wheel_timer_again(struct wheel_timer *t, uint32_t repeat);
+void wheel_timer_stop(struct wheel_timer *t);
+
+static inline bool wheel_timer_active(const struct wheel_timer *t)
+{
+	return !list_empty(&t->list);
+}
+
+uint64_t timer_wheel_get_latency_max(void);
+int timer_wheel_init(void);
+void timer_wheel_uninit(void);
+
+#endif /* TIMER_WHEEL_H */
@@ -0,0 +1,773 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include "state_machine.h"
+#include "transition.h"
+#include "print.h"
+
+/* The state machines of the roles are tables with an entry for each (state,
+ * event) pair. An entry has the actions to run, in order, and the next state.
+ * The pairs that are ignored have no actions and keep the state. The entry of
+ * a pair is found by indexing the table, and its ID is logged.
+ */
+
+#define MRP_ACTIONS_MAX		8
+
+/* Stay in the current state, the state is not set again */
+#define MRP_SAME		0xff
+
+typedef void (*mrp_action_t)(struct mrp *mrp, const struct mrp_event *e);
+
+struct mrp_transition {
+	uint8_t		id;
+	uint8_t		next;
+	/* ends at the first NULL */
+	mrp_action_t	actions[MRP_ACTIONS_MAX];
+};
+
+#define MRP_MRM_STATE_COUNT	(MRP_MRM_STATE_CHK_RC + 1)
+#define MRP_MRC_STATE_COUNT	(MRP_MRC_STATE_PT_IDLE + 1)
+#define MRP_MIM_STATE_COUNT	(MRP_MIM_STATE_CHK_IC + 1)
+#define MRP_MIC_STATE_COUNT	(MRP_MIC_STATE_IP_IDLE + 1)
+
+#define MRP_MRM_STATE_SAME	MRP_SAME
+#define MRP_MRC_STATE_SAME	MRP_SAME
+#define MRP_MIM_STATE_SAME	MRP_SAME
+#define MRP_MIC_STATE_SAME	MRP_SAME
+
+/* A table is written once as a list of T(role, state, event, next, actions...)
+ * and I(role, state, event) and expanded twice. The first expansion gives an
+ * enumerator per pair, which is the ID of the pair. A pair listed twice is a
+ * redefined enumerator, and a missing pair makes the count of enumerators
+ * smaller than states * events, so both fail to build.
+ */
+#define MRP_CELL(role, s, e)	MRP_##role##_CELL_##s##_##e
+
+#define MRP_CELL_T(role, s, e, ...)	MRP_CELL(role, s, e),
+#define MRP_CELL_I(role, s, e)		MRP_CELL(role, s, e),
+
+#define MRP_T(role, s, e, n, ...)					\
+	[MRP_##role##_STATE_##s][MRP_##role##_EV_##e] = {		\
+		.id = MRP_CELL(role, s, e),				\
+		.next = MRP_##role##_STATE_##n,				\
+		.actions = { __VA_ARGS__ },				\
+	},
+
+#define MRP_I(role, s, e)						\
+	[MRP_##role##_STATE_##s][MRP_##role##_EV_##e] = {		\
+		.id = MRP_CELL(role, s, e),				\
+		.next = MRP_SAME,					\
+	},
+
+/* Port states */
+static void mrp_act_p_fwd(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp_port_netlink_set_state(mrp->p_port, BR_MRP_PORT_STATE_FORWARDING);
+}
+
+static void mrp_act_p_block(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp_port_netlink_set_state(mrp->p_port, BR_MRP_PORT_STATE_BLOCKED);
+}
+
+static void mrp_act_s_fwd(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp_port_netlink_set_state(mrp->s_port, BR_MRP_PORT_STATE_FORWARDING);
+}
+
+static void mrp_act_s_block(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp_port_netlink_set_state(mrp->s_port, BR_MRP_PORT_STATE_BLOCKED);
+}
+
+static void mrp_act_i_fwd(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp_port_netlink_set_state(mrp->i_port, BR_MRP_PORT_STATE_FORWARDING);
+}
+
+static void mrp_act_i_block(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp_port_netlink_set_state(mrp->i_port, BR_MRP_PORT_STATE_BLOCKED);
+}
+
+/* The port of the event becomes the primary port if it was the secondary
+ * port, and the secondary port if it was the primary port
+ */
+static void mrp_act_swap_ports(struct mrp *mrp, const struct mrp_event *e)
+{
+	struct mrp_port *p = mrp->p_port;
+
+	mrp->p_port = mrp->s_port;
+	mrp->s_port = p;
+}
+
+/* MRM */
+static void mrp_act_ring_test(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp_ring_test_req(mrp, mrp->timing->ring_test_interval);
+}
+
+static void mrp_act_ring_test_stop(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp_ring_test_stop(mrp);
+}
+
+static void mrp_act_ring_test_restart(struct mrp *mrp,
+				      const struct mrp_event *e)
+{
+	mrp->ring_test_curr_max = mrp->timing->ring_test_max - 1;
+	mrp->ring_test_curr = 0;
+}
+
+static void mrp_act_ring_test_max(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp->ring_test_curr_max = mrp->timing->ring_test_max - 1;
+}
+
+/* Sends an additional test frame if none is pending */
+static void mrp_act_add_test_short(struct mrp *mrp, const struct mrp_event *e)
+{
+	if (mrp->add_test)
+		return;
+
+	mrp->add_test = true;
+	mrp_ring_test_req(mrp, mrp->timing->ring_test_short);
+}
+
+static void mrp_act_add_test_interval(struct mrp *mrp,
+				      const struct mrp_event *e)
+{
+	if (mrp->add_test)
+		return;
+
+	mrp->add_test = true;
+	mrp_ring_test_req(mrp, mrp->timing->ring_test_interval);
+}
+
+/* Sends an additional test frame, or the next one if one is pending */
+static void mrp_act_add_test(struct mrp *mrp, const struct mrp_event *e)
+{
+	if (mrp->add_test) {
+		mrp_ring_test_req(mrp, mrp->timing->ring_test_interval);
+		return;
+	}
+
+	mrp->add_test = true;
+	mrp_ring_test_req(mrp, mrp->timing->ring_test_short);
+}
+
+static void mrp_act_no_tc(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp->no_tc = true;
+}
+
+static void mrp_act_clear_loc(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp->p_port->loc = 0;
+	mrp->s_port->loc = 0;
+}
+
+static void mrp_act_ring_topo(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp_ring_topo_req(mrp, mrp->timing->ring_topo_interval);
+}
+
+static void mrp_act_ring_topo_now(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp_ring_topo_req(mrp, 0);
+}
+
+static void mrp_act_ring_transition(struct mrp *mrp,
+				    const struct mrp_event *e)
+{
+	mrp->ring_transitions++;
+}
+
+static void mrp_act_no_tc_clear(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp->no_tc = false;
+}
+
+static void mrp_act_add_test_clear(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp->add_test = false;
+}
+
+static void mrp_act_ring_test_timer_stop(struct mrp *mrp,
+					 const struct mrp_event *e)
+{
+	wheel_timer_stop(&mrp->ring_test_work);
+}
+
+static void mrp_act_ring_topo_react(struct mrp *mrp,
+				    const struct mrp_event *e)
+{
+	mrp_ring_topo_req(mrp, mrp->react_on_link_change ? 0 :
+			  mrp->timing->ring_topo_interval);
+}
+
+static void mrp_act_ring_unblock(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp_ring_unblock(mrp);
+}
+
+static void mrp_act_ring_open_false(struct mrp *mrp,
+				    const struct mrp_event *e)
+{
+	mrp_ring_test_open_false(mrp);
+}
+
+static void mrp_act_ring_ext_back(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp_ring_test_ext_back(mrp);
+}
+
+/* MRC */
+static void mrp_act_ring_link_max(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp->ring_link_curr_max = mrp->timing->ring_link_max;
+}
+
+static void mrp_act_ring_link_up_start(struct mrp *mrp,
+				       const struct mrp_event *e)
+{
+	mrp_ring_link_up_start(mrp, mrp->timing->ring_link_interval);
+}
+
+static void mrp_act_ring_link_up_stop(struct mrp *mrp,
+				      const struct mrp_event *e)
+{
+	mrp_ring_link_up_stop(mrp);
+}
+
+static void mrp_act_ring_link_down_start(struct mrp *mrp,
+					 const struct mrp_event *e)
+{
+	mrp_ring_link_down_start(mrp, mrp->timing->ring_link_interval);
+}
+
+static void mrp_act_ring_link_down_stop(struct mrp *mrp,
+					const struct mrp_event *e)
+{
+	mrp_ring_link_down_stop(mrp);
+}
+
+static void mrp_act_ring_link(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp_ring_link_req(mrp->p_port, e->up,
+			  mrp->ring_link_curr_max *
+			  mrp->timing->ring_link_interval);
+}
+
+static void mrp_act_clear_fdb(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp_clear_fdb_start(mrp, e->interval);
+}
+
+/* MIM */
+static void mrp_act_in_test(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp_in_test_req(mrp, mrp->timing->in_test_interval);
+}
+
+static void mrp_act_in_test_restart(struct mrp *mrp,
+				    const struct mrp_event *e)
+{
+	mrp->in_test_curr_max = mrp->timing->in_test_max - 1;
+	mrp->in_test_curr = 0;
+}
+
+static void mrp_act_in_test_max(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp->in_test_curr_max = mrp->timing->in_test_max;
+}
+
+static void mrp_act_in_topo(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp_in_topo_req(mrp, mrp->timing->in_topo_interval);
+}
+
+static void mrp_act_in_link_status(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp_in_link_status_req(mrp, mrp->timing->in_link_status_interval);
+}
+
+static void mrp_act_in_link_status_max(struct mrp *mrp,
+				       const struct mrp_event *e)
+{
+	mrp->in_link_status_curr_max = mrp->timing->in_link_status_max;
+}
+
+static void mrp_act_in_link_status_stop(struct mrp *mrp,
+					const struct mrp_event *e)
+{
+	mrp_in_link_status_stop(mrp);
+}
+
+/* MIC */
+static void mrp_act_in_link_max(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp->in_link_curr_max = mrp->timing->in_link_max;
+}
+
+static void mrp_act_in_link_up_start(struct mrp *mrp,
+				     const struct mrp_event *e)
+{
+	mrp_in_link_up_start(mrp, mrp->timing->in_link_interval);
+}
+
+static void mrp_act_in_link_up_stop(struct mrp *mrp,
+				    const struct mrp_event *e)
+{
+	mrp_in_link_up_stop(mrp);
+}
+
+static void mrp_act_in_link_down_start(struct mrp *mrp,
+				       const struct mrp_event *e)
+{
+	mrp_in_link_down_start(mrp, mrp->timing->in_link_interval);
+}
+
+static void mrp_act_in_link_down_stop(struct mrp *mrp,
+				      const struct mrp_event *e)
+{
+	mrp_in_link_down_stop(mrp);
+}
+
+static void mrp_act_in_link(struct mrp *mrp, const struct mrp_event *e)
+{
+	mrp_in_link_req(mrp, e->up, mrp->timing->in_link_max *
+			mrp->timing->in_link_interval);
+}
+
+/* Answers to a MRP_InLinkStatusPoll */
+static void mrp_act_in_link_report_up(struct mrp *mrp,
+				      const struct mrp_event *e)
+{
+	mrp_in_link_req(mrp, true, 0);
+}
+
+static void mrp_act_in_link_report_down(struct mrp *mrp,
+					const struct mrp_event *e)
+{
+	mrp_in_link_req(mrp, false, 0);
+}
+
+#define MRP_MRM_TABLE(T, I)						\
+	T(MRM, AC_STAT1, P_UP, PRM_UP,					\
+	  mrp_act_p_fwd, mrp_act_ring_test)				\
+	I(MRM, AC_STAT1, P_DOWN)					\
+	T(MRM, AC_STAT1, S_UP, PRM_UP,					\
+	  mrp_act_swap_ports, mrp_act_p_fwd, mrp_act_ring_test)		\
+	I(MRM, AC_STAT1, S_DOWN)					\
+	I(MRM, AC_STAT1, LINK_UP)					\
+	I(MRM, AC_STAT1, LINK_DOWN)					\
+	I(MRM, AC_STAT1, LINK_UP_BLK)					\
+	I(MRM, AC_STAT1, LINK_DOWN_BLK)					\
+	I(MRM, AC_STAT1, LINK_UP_REACT)					\
+	I(MRM, AC_STAT1, LINK_DOWN_REACT)				\
+	I(MRM, AC_STAT1, LINK_UP_BLK_REACT)				\
+	I(MRM, AC_STAT1, LINK_DOWN_BLK_REACT)				\
+	T(MRM, AC_STAT1, RING_OPEN, SAME,				\
+	  mrp_act_add_test_clear, mrp_act_ring_test)			\
+	I(MRM, AC_STAT1, TEST_RECV)					\
+	I(MRM, AC_STAT1, TEST_TIMEOUT)					\
+									\
+	I(MRM, PRM_UP, P_UP)						\
+	T(MRM, PRM_UP, P_DOWN, AC_STAT1,				\
+	  mrp_act_ring_test_stop, mrp_act_p_block)			\
+	T(MRM, PRM_UP, S_UP, CHK_RC,					\
+	  mrp_act_ring_test_restart, mrp_act_no_tc, mrp_act_ring_test,	\
+	  mrp_act_clear_loc)						\
+	I(MRM, PRM_UP, S_DOWN)						\
+	T(MRM, PRM_UP, LINK_UP, SAME,					\
+	  mrp_act_add_test_short, mrp_act_ring_topo_now)		\
+	I(MRM, PRM_UP, LINK_DOWN)					\
+	T(MRM, PRM_UP, LINK_UP_BLK, SAME,				\
+	  mrp_act_add_test_interval)					\
+	T(MRM, PRM_UP, LINK_DOWN_BLK, SAME,				\
+	  mrp_act_add_test_interval)					\
+	T(MRM, PRM_UP, LINK_UP_REACT, SAME,				\
+	  mrp_act_add_test_short, mrp_act_ring_topo_now)		\
+	I(MRM, PRM_UP, LINK_DOWN_REACT)					\
+	T(MRM, PRM_UP, LINK_UP_BLK_REACT, SAME,				\
+	  mrp_act_add_test_interval)					\
+	T(MRM, PRM_UP, LINK_DOWN_BLK_REACT, SAME,			\
+	  mrp_act_add_test_interval)					\
+	T(MRM, PRM_UP, RING_OPEN, SAME,					\
+	  mrp_act_add_test_clear, mrp_act_ring_test)			\
+	T(MRM, PRM_UP, TEST_RECV, CHK_RC,				\
+	  mrp_act_ring_test_restart, mrp_act_no_tc_clear,		\
+	  mrp_act_ring_test)						\
+	T(MRM, PRM_UP, TEST_TIMEOUT, SAME,				\
+	  mrp_act_add_test_clear, mrp_act_ring_test_timer_stop)		\
+									\
+	I(MRM, CHK_RO, P_UP)						\
+	T(MRM, CHK_RO, P_DOWN, PRM_UP,					\
+	  mrp_act_swap_ports, mrp_act_s_block, mrp_act_ring_test,	\
+	  mrp_act_ring_topo)						\
+	I(MRM, CHK_RO, S_UP)						\
+	T(MRM, CHK_RO, S_DOWN, PRM_UP,					\
+	  mrp_act_s_block)						\
+	T(MRM, CHK_RO, LINK_UP, CHK_RC,					\
+	  mrp_act_s_block, mrp_act_ring_test_restart, mrp_act_add_test,	\
+	  mrp_act_ring_topo_now)					\
+	T(MRM, CHK_RO, LINK_DOWN, SAME,					\
+	  mrp_act_add_test_short)					\
+	T(MRM, CHK_RO, LINK_UP_BLK, SAME,				\
+	  mrp_act_add_test_short)					\
+	T(MRM, CHK_RO, LINK_DOWN_BLK, SAME,				\
+	  mrp_act_add_test_short)					\
+	T(MRM, CHK_RO, LINK_UP_REACT, CHK_RC,				\
+	  mrp_act_s_block, mrp_act_ring_test_restart, mrp_act_add_test,	\
+	  mrp_act_ring_topo_now)					\
+	T(MRM, CHK_RO, LINK_DOWN_REACT, SAME,				\
+	  mrp_act_add_test_short)					\
+	T(MRM, CHK_RO, LINK_UP_BLK_REACT, SAME,				\
+	  mrp_act_add_test_short)					\
+	T(MRM, CHK_RO, LINK_DOWN_BLK_REACT, SAME,			\
+	  mrp_act_add_test_short)					\
+	T(MRM, CHK_RO, RING_OPEN, SAME,					\
+	  mrp_act_add_test_clear, mrp_act_ring_test)			\
+	T(MRM, CHK_RO, TEST_RECV, CHK_RC,				\
+	  mrp_act_ring_open_false, mrp_act_s_block,			\
+	  mrp_act_ring_test_restart, mrp_act_no_tc_clear,		\
+	  mrp_act_ring_test, mrp_act_ring_topo_react)			\
+	T(MRM, CHK_RO, TEST_TIMEOUT, SAME,				\
+	  mrp_act_add_test_clear, mrp_act_ring_test_timer_stop)		\
+									\
+	I(MRM, CHK_RC, P_UP)						\
+	T(MRM, CHK_RC, P_DOWN, PRM_UP,					\
+	  mrp_act_swap_ports, mrp_act_s_block, mrp_act_p_fwd,		\
+	  mrp_act_ring_test, mrp_act_ring_topo, mrp_act_ring_transition) \
+	I(MRM, CHK_RC, S_UP)						\
+	T(MRM, CHK_RC, S_DOWN, PRM_UP,					\
+	  mrp_act_ring_transition)					\
+	I(MRM, CHK_RC, LINK_UP)						\
+	I(MRM, CHK_RC, LINK_DOWN)					\
+	T(MRM, CHK_RC, LINK_UP_BLK, SAME,				\
+	  mrp_act_add_test_short)					\
+	T(MRM, CHK_RC, LINK_DOWN_BLK, SAME,				\
+	  mrp_act_add_test_short)					\
+	T(MRM, CHK_RC, LINK_UP_REACT, SAME,				\
+	  mrp_act_ring_test_max, mrp_act_ring_topo_now)			\
+	T(MRM, CHK_RC, LINK_DOWN_REACT, CHK_RO,				\
+	  mrp_act_s_fwd, mrp_act_ring_transition, mrp_act_ring_topo_now) \
+	T(MRM, CHK_RC, LINK_UP_BLK_REACT, SAME,				\
+	  mrp_act_ring_test_max, mrp_act_ring_topo_now)			\
+	T(MRM, CHK_RC, LINK_DOWN_BLK_REACT, CHK_RO,			\
+	  mrp_act_s_fwd, mrp_act_ring_transition, mrp_act_ring_topo_now) \
+	T(MRM, CHK_RC, RING_OPEN, CHK_RO,				\
+	  mrp_act_ring_unblock)						\
+	T(MRM, CHK_RC, TEST_RECV, SAME,					\
+	  mrp_act_ring_test_restart, mrp_act_no_tc_clear,		\
+	  mrp_act_ring_ext_back)					\
+	T(MRM, CHK_RC, TEST_TIMEOUT, SAME,				\
+	  mrp_act_add_test_clear, mrp_act_ring_test_timer_stop)
+
+#define MRP_MRC_TABLE(T, I)						\
+	T(MRC, AC_STAT1, P_UP, DE_IDLE,					\
+	  mrp_act_p_fwd)						\
+	I(MRC, AC_STAT1, P_DOWN)					\
+	T(MRC, AC_STAT1, S_UP, DE_IDLE,					\
+	  mrp_act_swap_ports, mrp_act_p_fwd)				\
+	I(MRC, AC_STAT1, S_DOWN)					\
+	I(MRC, AC_STAT1, TOPO)						\
+									\
+	I(MRC, DE_IDLE, P_UP)						\
+	T(MRC, DE_IDLE, P_DOWN, AC_STAT1,				\
+	  mrp_act_p_block)						\
+	T(MRC, DE_IDLE, S_UP, PT,					\
+	  mrp_act_ring_link_max, mrp_act_ring_link_up_start,		\
+	  mrp_act_ring_link)						\
+	I(MRC, DE_IDLE, S_DOWN)						\
+	T(MRC, DE_IDLE, TOPO, SAME,					\
+	  mrp_act_clear_fdb)						\
+									\
+	I(MRC, PT, P_UP)						\
+	T(MRC, PT, P_DOWN, DE,						\
+	  mrp_act_ring_link_max, mrp_act_ring_link_up_stop,		\
+	  mrp_act_swap_ports, mrp_act_p_fwd, mrp_act_s_block,		\
+	  mrp_act_ring_link_down_start, mrp_act_ring_link)		\
+	I(MRC, PT, S_UP)						\
+	T(MRC, PT, S_DOWN, DE,						\
+	  mrp_act_ring_link_max, mrp_act_ring_link_up_stop,		\
+	  mrp_act_s_block, mrp_act_ring_link_down_start,		\
+	  mrp_act_ring_link)						\
+	T(MRC, PT, TOPO, PT_IDLE,					\
+	  mrp_act_ring_link_max, mrp_act_ring_link_up_stop,		\
+	  mrp_act_s_fwd, mrp_act_clear_fdb)				\
+									\
+	I(MRC, DE, P_UP)						\
+	T(MRC, DE, P_DOWN, AC_STAT1,					\
+	  mrp_act_ring_link_max, mrp_act_p_block,			\
+	  mrp_act_ring_link_down_stop)					\
+	T(MRC, DE, S_UP, PT,						\
+	  mrp_act_ring_link_max, mrp_act_ring_link_down_stop,		\
+	  mrp_act_ring_link_up_start, mrp_act_ring_link)		\
+	I(MRC, DE, S_DOWN)						\
+	T(MRC, DE, TOPO, DE_IDLE,					\
+	  mrp_act_ring_link_max, mrp_act_ring_link_down_stop,		\
+	  mrp_act_clear_fdb)						\
+									\
+	I(MRC, PT_IDLE, P_UP)						\
+	T(MRC, PT_IDLE, P_DOWN, DE,					\
+	  mrp_act_ring_link_max, mrp_act_swap_ports, mrp_act_s_block,	\
+	  mrp_act_ring_link_down_start, mrp_act_ring_link)		\
+	I(MRC, PT_IDLE, S_UP)						\
+	T(MRC, PT_IDLE, S_DOWN, DE,					\
+	  mrp_act_ring_link_max, mrp_act_s_block,			\
+	  mrp_act_ring_link_down_start, mrp_act_ring_link)		\
+	T(MRC, PT_IDLE, TOPO, SAME,					\
+	  mrp_act_clear_fdb)
+
+#define MRP_MIM_TABLE(T, I)						\
+	T(MIM, AC_STAT1, RC_UP, CHK_IC,					\
+	  mrp_act_i_block, mrp_act_in_test_restart, mrp_act_in_test)	\
+	I(MIM, AC_STAT1, RC_DOWN)					\
+	T(MIM, AC_STAT1, LC_UP, CHK_IC,					\
+	  mrp_act_in_link_status_max, mrp_act_i_block,			\
+	  mrp_act_in_link_status)					\
+	I(MIM, AC_STAT1, LC_DOWN)					\
+	I(MIM, AC_STAT1, IN_LINK_UP)					\
+	I(MIM, AC_STAT1, IN_LINK_DOWN)					\
+									\
+	I(MIM, CHK_IO, RC_UP)						\
+	T(MIM, CHK_IO, RC_DOWN, AC_STAT1,				\
+	  mrp_act_i_block, mrp_act_in_topo, mrp_act_in_test)		\
+	I(MIM, CHK_IO, LC_UP)						\
+	T(MIM, CHK_IO, LC_DOWN, AC_STAT1,				\
+	  mrp_act_i_block, mrp_act_in_link_status_stop)			\
+	T(MIM, CHK_IO, IN_LINK_UP, SAME,				\
+	  mrp_act_in_test)						\
+	I(MIM, CHK_IO, IN_LINK_DOWN)					\
+									\
+	I(MIM, CHK_IC, RC_UP)						\
+	T(MIM, CHK_IC, RC_DOWN, AC_STAT1,				\
+	  mrp_act_i_block, mrp_act_in_topo, mrp_act_in_test)		\
+	I(MIM, CHK_IC, LC_UP)						\
+	T(MIM, CHK_IC, LC_DOWN, AC_STAT1,				\
+	  mrp_act_i_block)						\
+	T(MIM, CHK_IC, IN_LINK_UP, SAME,				\
+	  mrp_act_in_test_max, mrp_act_in_topo)				\
+	T(MIM, CHK_IC, IN_LINK_DOWN, CHK_IO,				\
+	  mrp_act_i_fwd, mrp_act_in_topo)
+
+#define MRP_MIC_TABLE(T, I)						\
+	T(MIC, AC_STAT1, RC_UP, PT,					\
+	  mrp_act_in_link_max, mrp_act_in_link_down_stop,		\
+	  mrp_act_in_link_up_start, mrp_act_in_link)			\
+	I(MIC, AC_STAT1, RC_DOWN)					\
+	T(MIC, AC_STAT1, LC_UP, PT,					\
+	  mrp_act_in_link_max, mrp_act_in_link_down_stop,		\
+	  mrp_act_in_link_up_start, mrp_act_in_link)			\
+	I(MIC, AC_STAT1, LC_DOWN)					\
+	T(MIC, AC_STAT1, IN_TOPO, SAME,					\
+	  mrp_act_in_link_down_stop)					\
+	I(MIC, AC_STAT1, IN_TOPO_OTHER)					\
+	T(MIC, AC_STAT1, LINK_STATUS, SAME,				\
+	  mrp_act_in_link_report_down)					\
+									\
+	I(MIC, PT, RC_UP)						\
+	T(MIC, PT, RC_DOWN, AC_STAT1,					\
+	  mrp_act_in_link_max, mrp_act_in_link_up_stop, mrp_act_i_block, \
+	  mrp_act_in_link_down_start, mrp_act_in_link)			\
+	I(MIC, PT, LC_UP)						\
+	T(MIC, PT, LC_DOWN, AC_STAT1,					\
+	  mrp_act_in_link_max, mrp_act_in_link_up_stop, mrp_act_i_block, \
+	  mrp_act_in_link_down_start, mrp_act_in_link)			\
+	T(MIC, PT, IN_TOPO, IP_IDLE,					\
+	  mrp_act_in_link_max, mrp_act_in_link_up_stop, mrp_act_i_fwd)	\
+	T(MIC, PT, IN_TOPO_OTHER, IP_IDLE,				\
+	  mrp_act_in_link_max, mrp_act_in_link_up_stop, mrp_act_i_fwd)	\
+	T(MIC, PT, LINK_STATUS, SAME,					\
+	  mrp_act_in_link_report_up)					\
+									\
+	I(MIC, IP_IDLE, RC_UP)						\
+	T(MIC, IP_IDLE, RC_DOWN, AC_STAT1,				\
+	  mrp_act_in_link_max, mrp_act_i_block,				\
+	  mrp_act_in_link_down_start, mrp_act_in_link)			\
+	I(MIC, IP_IDLE, LC_UP)						\
+	T(MIC, IP_IDLE, LC_DOWN, AC_STAT1,				\
+	  mrp_act_in_link_max, mrp_act_in_link_up_stop, mrp_act_i_block, \
+	  mrp_act_in_link_down_start, mrp_act_in_link)			\
+	I(MIC, IP_IDLE, IN_TOPO)					\
+	I(MIC, IP_IDLE, IN_TOPO_OTHER)					\
+	T(MIC, IP_IDLE, LINK_STATUS, SAME,				\
+	  mrp_act_in_link_report_up)
+
+enum { MRP_MRM_TABLE(MRP_CELL_T, MRP_CELL_I) MRP_MRM_CELLS };
+enum { MRP_MRC_TABLE(MRP_CELL_T, MRP_CELL_I) MRP_MRC_CELLS };
+enum { MRP_MIM_TABLE(MRP_CELL_T, MRP_CELL_I) MRP_MIM_CELLS };
+enum { MRP_MIC_TABLE(MRP_CELL_T, MRP_CELL_I) MRP_MIC_CELLS };
+
+_Static_assert(MRP_MRM_CELLS == MRP_MRM_STATE_COUNT * MRP_MRM_EV_COUNT,
+	       "the MRM table misses a (state, event) pair");
+_Static_assert(MRP_MRC_CELLS == MRP_MRC_STATE_COUNT * MRP_MRC_EV_COUNT,
+	       "the MRC table misses a (state, event) pair");
+_Static_assert(MRP_MIM_CELLS == MRP_MIM_STATE_COUNT * MRP_MIM_EV_COUNT,
+	       "the MIM table misses a (state, event) pair");
+_Static_assert(MRP_MIC_CELLS == MRP_MIC_STATE_COUNT * MRP_MIC_EV_COUNT,
+	       "the MIC table misses a (state, event) pair");
+_Static_assert(MRP_MRM_CELLS < MRP_SAME,
+	       "the IDs don't fit in struct mrp_transition");
+
+static const struct mrp_transition
+mrp_mrm_table[MRP_MRM_STATE_COUNT][MRP_MRM_EV_COUNT] = {
+	MRP_MRM_TABLE(MRP_T, MRP_I)
+};
+
+static const struct mrp_transition
+mrp_mrc_table[MRP_MRC_STATE_COUNT][MRP_MRC_EV_COUNT] = {
+	MRP_MRC_TABLE(MRP_T, MRP_I)
+};
+
+static const struct mrp_transition
+mrp_mim_table[MRP_MIM_STATE_COUNT][MRP_MIM_EV_COUNT] = {
+	MRP_MIM_TABLE(MRP_T, MRP_I)
+};
+
+static const struct mrp_transition
+mrp_mic_table[MRP_MIC_STATE_COUNT][MRP_MIC_EV_COUNT] = {
+	MRP_MIC_TABLE(MRP_T, MRP_I)
+};
+
+static const char *const mrp_mrm_events[MRP_MRM_EV_COUNT] = {
+	[MRP_MRM_EV_P_UP] = "P_UP",
+	[MRP_MRM_EV_P_DOWN] = "P_DOWN",
+	[MRP_MRM_EV_S_UP] = "S_UP",
+	[MRP_MRM_EV_S_DOWN] = "S_DOWN",
+	[MRP_MRM_EV_LINK_UP] = "LINK_UP",
+	[MRP_MRM_EV_LINK_DOWN] = "LINK_DOWN",
+	[MRP_MRM_EV_LINK_UP_BLK] = "LINK_UP_BLK",
+	[MRP_MRM_EV_LINK_DOWN_BLK] = "LINK_DOWN_BLK",
+	[MRP_MRM_EV_LINK_UP_REACT] = "LINK_UP_REACT",
+	[MRP_MRM_EV_LINK_DOWN_REACT] = "LINK_DOWN_REACT",
+	[MRP_MRM_EV_LINK_UP_BLK_REACT] = "LINK_UP_BLK_REACT",
+	[MRP_MRM_EV_LINK_DOWN_BLK_REACT] = "LINK_DOWN_BLK_REACT",
+	[MRP_MRM_EV_RING_OPEN] = "RING_OPEN",
+	[MRP_MRM_EV_TEST_RECV] = "TEST_RECV",
+	[MRP_MRM_EV_TEST_TIMEOUT] = "TEST_TIMEOUT",
+};
+
+static const char *const mrp_mrc_events[MRP_MRC_EV_COUNT] = {
+	[MRP_MRC_EV_P_UP] = "P_UP",
+	[MRP_MRC_EV_P_DOWN] = "P_DOWN",
+	[MRP_MRC_EV_S_UP] = "S_UP",
+	[MRP_MRC_EV_S_DOWN] = "S_DOWN",
+	[MRP_MRC_EV_TOPO] = "TOPO",
+};
+
+static const char *const mrp_mim_events[MRP_MIM_EV_COUNT] = {
+	[MRP_MIM_EV_RC_UP] = "RC_UP",
+	[MRP_MIM_EV_RC_DOWN] = "RC_DOWN",
+	[MRP_MIM_EV_LC_UP] = "LC_UP",
+	[MRP_MIM_EV_LC_DOWN] = "LC_DOWN",
+	[MRP_MIM_EV_IN_LINK_UP] = "IN_LINK_UP",
+	[MRP_MIM_EV_IN_LINK_DOWN] = "IN_LINK_DOWN",
+};
+
+static const char *const mrp_mic_events[MRP_MIC_EV_COUNT] = {
+	[MRP_MIC_EV_RC_UP] = "RC_UP",
+	[MRP_MIC_EV_RC_DOWN] = "RC_DOWN",
+	[MRP_MIC_EV_LC_UP] = "LC_UP",
+	[MRP_MIC_EV_LC_DOWN] = "LC_DOWN",
+	[MRP_MIC_EV_IN_TOPO] = "IN_TOPO",
+	[MRP_MIC_EV_IN_TOPO_OTHER] = "IN_TOPO_OTHER",
+	[MRP_MIC_EV_LINK_STATUS] = "LINK_STATUS",
+};
+
+/* Runs the actions of the transition and returns the next state */
+static uint8_t mrp_transition_run(const struct mrp_transition *t,
+				  struct mrp *mrp, const struct mrp_event *e)
+{
+	int i;
+
+	for (i = 0; i < MRP_ACTIONS_MAX && t->actions[i]; ++i)
+		t->actions[i](mrp, e);
+
+	return t->next;
+}
+
+void mrp_mrm_event(struct mrp *mrp, enum mrp_mrm_event_type ev,
+		   const struct mrp_event *e)
+{
+	const struct mrp_transition *t;
+	uint8_t state, next;
+
+	if (mrp->mrm_state >= MRP_MRM_STATE_COUNT || ev >= MRP_MRM_EV_COUNT)
+		return;
+
+	state = mrp->mrm_state;
+	t = &mrp_mrm_table[state][ev];
+
+	/* The actions run before the log, so that a ring open unblocks the
+	 * port first. The events of each test interval are logged only for
+	 * debugging.
+	 */
+	next = mrp_transition_run(t, mrp, e);
+
+	print(ev >= MRP_MRM_EV_TEST_RECV ? LOG_DEBUG : LOG_INFO,
+	      "mrm_state: %s, event: %s, transition: %d",
+	      mrp_get_mrm_state(state), mrp_mrm_events[ev], t->id);
+
+	if (next != MRP_SAME)
+		mrp_set_mrm_state(mrp, next);
+}
+
+void mrp_mrc_event(struct mrp *mrp, enum mrp_mrc_event_type ev,
+		   const struct mrp_event *e)
+{
+	const struct mrp_transition *t;
+	uint8_t next;
+
+	if (mrp->mrc_state >= MRP_MRC_STATE_COUNT || ev >= MRP_MRC_EV_COUNT)
+		return;
+
+	t = &mrp_mrc_table[mrp->mrc_state][ev];
+
+	pr_info("mrc_state: %s, event: %s, transition: %d",
+		mrp_get_mrc_state(mrp->mrc_state), mrp_mrc_events[ev], t->id);
+
+	next = mrp_transition_run(t, mrp, e);
+	if (next != MRP_SAME)
+		mrp_set_mrc_state(mrp, next);
+}
+
+void mrp_mim_event(struct mrp *mrp, enum mrp_mim_event_type ev,
+		   const struct mrp_event *e)
+{
+	const struct mrp_transition *t;
+	uint8_t next;
+
+	if (mrp->mim_state >= MRP_MIM_STATE_COUNT || ev >= MRP_MIM_EV_COUNT)
+		return;
+
+	t = &mrp_mim_table[mrp->mim_state][ev];
+
+	pr_info("mim_state: %s, event: %s, transition: %d",
+		mrp_get_mim_state(mrp->mim_state), mrp_mim_events[ev], t->id);
+
+	next = mrp_transition_run(t, mrp, e);
+	if (next != MRP_SAME)
+		mrp_set_mim_state(mrp, next);
+}
+
+void mrp_mic_event(struct mrp *mrp, enum mrp_mic_event_type ev,
+		   const struct mrp_event *e)
+{
+	const struct mrp_transition *t;
+	uint8_t next;
+
+	if (mrp->mic_state >= MRP_MIC_STATE_COUNT || ev >= MRP_MIC_EV_COUNT)
+		return;
+
+	t = &mrp_mic_table[mrp->mic_state][ev];
+
+	pr_info("mic_state: %s, event: %s, transition: %d",
+		mrp_get_mic_state(mrp->mic_state), mrp_mic_events[ev], t->id);
+
+	next = mrp_transition_run(t, mrp, e);
+	if (next != MRP_SAME)
+		mrp_set_mic_state(mrp, next);
+}
@@ -0,0 +1,101 @@
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef TRANSITION_H
+#define TRANSITION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct mrp;
+struct mrp_port;
+
+/* The events of the role state machines. Each role has a table with an entry
+ * for each (state, event) pair that gives the actions to run and the next
+ * state, see transition.c
+ */
+
+/* P_ is for the current primary port and S_ for the other ring port. The
+ * LINK_ events are the MRP_LinkChange frames, with the blocked and the
+ * react_on_link_change conditions of the instance folded in. RING_OPEN is the
+ * notification of the kernel that the MRP_Test frames are missed. TEST_RECV
+ * is an own MRP_Test frame, or the notification that they are received
+ * again, and TEST_TIMEOUT the end of an additional test. These two come
+ * with each test interval and are last.
+ */
+enum mrp_mrm_event_type {
+	MRP_MRM_EV_P_UP,
+	MRP_MRM_EV_P_DOWN,
+	MRP_MRM_EV_S_UP,
+	MRP_MRM_EV_S_DOWN,
+	MRP_MRM_EV_LINK_UP,
+	MRP_MRM_EV_LINK_DOWN,
+	MRP_MRM_EV_LINK_UP_BLK,
+	MRP_MRM_EV_LINK_DOWN_BLK,
+	MRP_MRM_EV_LINK_UP_REACT,
+	MRP_MRM_EV_LINK_DOWN_REACT,
+	MRP_MRM_EV_LINK_UP_BLK_REACT,
+	MRP_MRM_EV_LINK_DOWN_BLK_REACT,
+	MRP_MRM_EV_RING_OPEN,
+	MRP_MRM_EV_TEST_RECV,
+	MRP_MRM_EV_TEST_TIMEOUT,
+	MRP_MRM_EV_COUNT,
+};
+
+/* TOPO is a MRP_TopologyChange frame */
+enum mrp_mrc_event_type {
+	MRP_MRC_EV_P_UP,
+	MRP_MRC_EV_P_DOWN,
+	MRP_MRC_EV_S_UP,
+	MRP_MRC_EV_S_DOWN,
+	MRP_MRC_EV_TOPO,
+	MRP_MRC_EV_COUNT,
+};
+
+/* The link of the interconnect port in RC and LC mode, and the
+ * MRP_InLinkChange frames of the own interconnection
+ */
+enum mrp_mim_event_type {
+	MRP_MIM_EV_RC_UP,
+	MRP_MIM_EV_RC_DOWN,
+	MRP_MIM_EV_LC_UP,
+	MRP_MIM_EV_LC_DOWN,
+	MRP_MIM_EV_IN_LINK_UP,
+	MRP_MIM_EV_IN_LINK_DOWN,
+	MRP_MIM_EV_COUNT,
+};
+
+/* IN_TOPO is a MRP_InTopologyChange frame of the own interconnection and
+ * IN_TOPO_OTHER of another one, LINK_STATUS a MRP_InLinkStatusPoll frame
+ */
+enum mrp_mic_event_type {
+	MRP_MIC_EV_RC_UP,
+	MRP_MIC_EV_RC_DOWN,
+	MRP_MIC_EV_LC_UP,
+	MRP_MIC_EV_LC_DOWN,
+	MRP_MIC_EV_IN_TOPO,
+	MRP_MIC_EV_IN_TOPO_OTHER,
+	MRP_MIC_EV_LINK_STATUS,
+	MRP_MIC_EV_COUNT,
+};
+
+/* The arguments of an event that the actions use */
+struct mrp_event {
+	/* port that changed its link or received the frame */
+	struct mrp_port *p;
+	/* link state to send in the link change frames */
+	bool up;
+	/* interval of a received topology change, in us */
+	uint32_t interval;
+};
+
+void mrp_mrm_event(struct mrp *mrp, enum mrp_mrm_event_type ev,
+		   const struct mrp_event *e);
+void mrp_mrc_event(struct mrp *mrp, enum mrp_mrc_event_type ev,
+		   const struct mrp_event *e);
+void mrp_mim_event(struct mrp *mrp, enum mrp_mim_event_type ev,
+		   const struct mrp_event *e);
+void mrp_mic_event(struct mrp *mrp, enum mrp_mic_event_type ev,
+		   const struct mrp_event *e);
+
+#endif /* TRANSITION_H */
@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: (GPL-2.0)
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <getopt.h>
@@ -14,18 +15,132 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <time.h>
 #include <stdbool.h>
+#include <pthread.h>
 #include <linux/if_ether.h>
 
 #include "utils.h"
+#include "list.h"
+
+#define IF_CACHE_BITS	8
+#define IF_CACHE_SIZE	(1 << IF_CACHE_BITS)
+
+struct if_entry {
+	struct hlist_node node;
+	struct if_info info;
+};
 
 static int netsock = 0;
+static struct hlist_head if_cache[IF_CACHE_SIZE];
+/* The cache is updated by the main loop and read by all the loops */
+static pthread_rwlock_t if_cache_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static __thread uint64_t if_cache_hit;
+static __thread uint64_t if_cache_miss;
+
+/* Taken by the writer around if_cache_get and if_cache_del and the changes of
+ * the returned entry
+ */
+void if_cache_lock(void)
+{
+	pthread_rwlock_wrlock(&if_cache_rwlock);
+}
+
+void if_cache_unlock(void)
+{
+	pthread_rwlock_unlock(&if_cache_rwlock);
+}
+
+static struct if_entry *if_cache_lookup(int ifindex)
+{
+	struct hlist_head *head;
+	struct hlist_node *pos;
+	struct if_entry *e;
+
+	head = &if_cache[hash_32(ifindex, IF_CACHE_BITS)];
+	hlist_for_each_entry(e, pos, head, node) {
+		if (e->info.ifindex == ifindex)
+			return e;
+	}
+
+	return NULL;
+}
+
+/* Returns the cached information about the interface. If the interface is not
+ * in the cache and create is set then a new empty entry is added.
+ */
+struct if_info *if_cache_get(int ifindex, bool create)
+{
+	struct if_entry *e;
+
+	e = if_cache_lookup(ifindex);
+	if (e)
+		return &e->info;
+
+	if (!create)
+		return NULL;
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return NULL;
+
+	e->info.ifindex = ifindex;
+	hlist_add_head(&e->node, &if_cache[hash_32(ifindex, IF_CACHE_BITS)]);
+
+	return &e->info;
+}
+
+void if_cache_del(int ifindex)
+{
+	struct if_entry *e;
+
+	e = if_cache_lookup(ifindex);
+	if (!e)
+		return;
+
+	hlist_del(&e->node);
+	free(e);
+}
+
+static void if_cache_flush(void)
+{
+	struct hlist_node *pos, *n;
+	struct if_entry *e;
+	int i;
+
+	for (i = 0; i < IF_CACHE_SIZE; ++i) {
+		hlist_for_each_entry_safe(e, pos, n, &if_cache[i], node) {
+			hlist_del(&e->node);
+			free(e);
+		}
+	}
+}
+
+/* Adds the counters of the loop to stats */
+void if_get_stats(struct mrp_stats *stats)
+{
+	stats->if_cache_hit += if_cache_hit;
+	stats->if_cache_miss += if_cache_miss;
+}
 
 int if_get_mac(int ifindex, unsigned char *mac)
 {
 	char name[IF_NAMESIZE];
+	struct if_info *info;
 	struct ifreq ifr;
 
+	pthread_rwlock_rdlock(&if_cache_rwlock);
+	info = if_cache_get(ifindex, false);
+	if (info && info->has_mac) {
+		memcpy(mac, info->macaddr, ETH_ALEN);
+		pthread_rwlock_unlock(&if_cache_rwlock);
+		if_cache_hit++;
+		return 0;
+	}
+	pthread_rwlock_unlock(&if_cache_rwlock);
+
+	if_cache_miss++;
+
 	memset(&ifr, 0, sizeof(ifr));
 	if (!if_indextoname(ifindex, name))
 		return 0;
@@ -41,7 +156,21 @@ int if_get_mac(int ifindex, unsigned char *mac)
 int if_get_link(int ifindex)
 {
 	char name[IF_NAMESIZE];
+	struct if_info *info;
 	struct ifreq ifr;
+	int link;
+
+	pthread_rwlock_rdlock(&if_cache_rwlock);
+	info = if_cache_get(ifindex, false);
+	if (info) {
+		link = info->flags & IFF_RUNNING;
+		pthread_rwlock_unlock(&if_cache_rwlock);
+		if_cache_hit++;
+		return link;
+	}
+	pthread_rwlock_unlock(&if_cache_rwlock);
+
+	if_cache_miss++;
 
 	memset(&ifr, 0, sizeof(ifr));
 	if (!if_indextoname(ifindex, name))
@@ -129,7 +258,17 @@ uint32_t get_ms(void)
 	return tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
 
+uint64_t get_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 void if_cleanup(void)
 {
+	if_cache_flush();
 	close(netsock);
 }
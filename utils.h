@@ -7,6 +7,7 @@
 #include <string.h>
 
 #include <netinet/in.h>
+#include <net/if.h>
 #include <linux/if_bridge.h>
 #include <linux/cfm_bridge.h>
 #include <asm/byteorder.h>
@@ -16,6 +17,12 @@
 
 #define COUNT_OF(x) ((sizeof(x)/sizeof(0[x])) / ((size_t)(!(sizeof(x) % sizeof(0[x])))))
 
+/* Multiplicative hash, same as the kernel's hash_32 */
+static inline uint32_t hash_32(uint32_t val, unsigned int bits)
+{
+	return (val * 0x61C88647) >> (32 - bits);
+}
+
 enum mrp_ring_recovery_type {
 	MRP_RING_RECOVERY_500,
 	MRP_RING_RECOVERY_200,
@@ -82,6 +89,25 @@ struct frame_buf {
 	uint32_t size;
 };
 
+/* Interface information learned from rtnetlink */
+struct if_info {
+	int ifindex;
+	int master;
+	unsigned int flags;
+	uint8_t operstate;
+	uint8_t carrier;
+	bool has_mac;
+	unsigned char macaddr[ETH_ALEN];
+	char name[IF_NAMESIZE];
+};
+
+struct mrp_stats;
+
+void if_cache_lock(void);
+void if_cache_unlock(void);
+struct if_info *if_cache_get(int ifindex, bool create);
+void if_cache_del(int ifindex);
+void if_get_stats(struct mrp_stats *stats);
 int if_get_mac(int ifindex, unsigned char *mac);
 int if_get_link(int ifindex);
 struct frame_buf *fb_alloc(uint32_t size);
@@ -90,6 +116,8 @@ void ether_addr_copy(uint8_t *dst, const uint8_t *src);
 bool ether_addr_equal(const uint8_t *addr1, const uint8_t *addr2);
 uint64_t ether_addr_to_u64(const uint8_t *addr);
 uint32_t get_ms(void);
+uint64_t get_ns(void);
+uint64_t malloc_count_get(void);
 
 int if_init(void);
 void if_cleanup(void);
@@ -112,6 +140,34 @@ struct ctl_msg_hdr
 
 #define MRP_SERVER_SOCK_NAME ".mrp_server"
 
+/* Timing parameters of an instance, the intervals and periods are in us */
+struct mrp_timing {
+	uint32_t ring_topo_interval;
+	uint32_t ring_topo_max;
+	uint32_t ring_test_short;
+	uint32_t ring_test_interval;
+	uint32_t ring_test_max;
+	uint32_t ring_test_ext_max;
+	uint32_t ring_test_period;
+	/* time without transient loss before the extended monitoring stops,
+	 * 0 if it is disabled
+	 */
+	uint32_t ring_test_ext_hold;
+	uint32_t ring_link_interval;
+	uint32_t ring_link_max;
+	uint32_t in_topo_interval;
+	uint32_t in_topo_max;
+	uint32_t in_test_interval;
+	uint32_t in_test_max;
+	uint32_t in_test_period;
+	uint32_t in_link_interval;
+	uint32_t in_link_max;
+	uint32_t in_link_status_interval;
+	uint32_t in_link_status_max;
+};
+
+#define MRP_PROFILE_NAME_LEN 32
+
 #define MAX_MRP_INSTANCES 20
 struct mrp_status {
 	int br;
@@ -130,6 +186,83 @@ struct mrp_status {
 	int in_id;
 	int in_mode;
 	int in_recv;
+	uint64_t wakeups;
+	uint32_t wakeups_rate;
+	/* name of the applied profile, empty if none */
+	char profile[MRP_PROFILE_NAME_LEN];
+	struct mrp_timing timing;
+	int ring_test_ext;
+	uint64_t ring_open_false;
+	uint64_t ring_open_suppressed;
+};
+
+/* Number of log2 buckets of the batch histograms, the last bucket counts
+ * all the bigger batches.
+ */
+#define MRP_STATS_BATCH_HIST 8
+
+/* Bitmap of the VLANs whose FDB entries are flushed on a topology change */
+#define MRP_VLAN_N_VID		4096
+#define MRP_VLAN_BITMAP_LEN	(MRP_VLAN_N_VID / 8)
+
+/* Number of ports for which the FDB flushes are counted */
+#define MRP_STATS_FLUSH_PORTS 16
+
+struct mrp_flush_stats {
+	uint32_t ifindex;
+	/* Flushes requested by the state machines and flushes sent */
+	uint64_t requests;
+	uint64_t flushes;
+	/* Time in ns from the first request until the ACK of the flush */
+	uint64_t latency_last;
+	uint64_t latency_max;
+};
+
+struct mrp_stats {
+	uint64_t if_cache_hit;
+	uint64_t if_cache_miss;
+	uint64_t rx_frames;
+	uint64_t rx_batch[MRP_STATS_BATCH_HIST];
+	uint64_t rx_invalid;
+	uint64_t tx_frames;
+	uint64_t tx_batches;
+	uint64_t tx_dropped;
+	/* Time in ns from the first queued frame until sendmmsg returns */
+	uint64_t tx_latency_sum;
+	uint64_t tx_latency_max;
+	uint64_t nl_async_sent;
+	uint64_t nl_async_errors;
+	/* Requests that waited for the ACK because they couldn't be queued */
+	uint64_t nl_async_sync;
+	uint64_t nl_async_pending;
+	/* Time in ns from sending a request until its ACK was received */
+	uint64_t nl_async_latency_max;
+	/* Messages sent together by a netlink transaction */
+	uint64_t nl_txn_commits;
+	uint64_t nl_txn_msgs;
+	/* Requests that were not sent because the kernel has the value */
+	uint64_t nl_avoided;
+	/* Values that were found different in the kernel and sent again */
+	uint64_t nl_drift;
+	/* Time from the ring open notification to the ACK of the unblock */
+	uint64_t ring_open_count;
+	uint64_t ring_open_last;
+	uint64_t ring_open_max;
+	/* FDB entries moved to the forwarding ring port instead of a flush */
+	uint64_t fdb_migrations;
+	uint64_t fdb_migrated;
+	/* Time in ns to dump the FDB and queue the moved entries */
+	uint64_t fdb_migrate_latency_max;
+	/* Callbacks of the timers of the instances, the rate is per second
+	 * since the previous request
+	 */
+	uint64_t timer_wakeups;
+	uint64_t timer_wakeups_rate;
+	/* Worst delay in ns of a loop to run its timers after they expired */
+	uint64_t sched_latency_max;
+	/* Allocations since the start, only counted with MRP_MALLOC_COUNT */
+	uint64_t mallocs;
+	struct mrp_flush_stats flush[MRP_STATS_FLUSH_PORTS];
 };
 
 #define CTL_DECLARE(name) \
@@ -233,6 +366,63 @@ struct getmrp_OUT
 #define getmrp_CALL (&out->count, out->status)
 CTL_DECLARE(getmrp);
 
+#define CMD_CODE_getstats  104
+#define getstats_ARGS (struct mrp_stats *stats)
+struct getstats_IN
+{
+};
+struct getstats_OUT
+{
+	struct mrp_stats stats;
+};
+#define getstats_COPY_IN ({ (void)0; })
+#define getstats_COPY_OUT ({ *stats = out->stats; })
+#define getstats_CALL (&out->stats)
+CTL_DECLARE(getstats);
+
+#define CMD_CODE_setflushvlans 105
+#define setflushvlans_ARGS (int br, int ring_nr, uint8_t *vlans)
+struct setflushvlans_IN
+{
+	int br;
+	int ring_nr;
+	uint8_t vlans[MRP_VLAN_BITMAP_LEN];
+};
+struct setflushvlans_OUT
+{
+};
+#define setflushvlans_COPY_IN \
+    ({                                                           \
+     in->br = br;                                                \
+     in->ring_nr = ring_nr;                                      \
+     memcpy(in->vlans, vlans, MRP_VLAN_BITMAP_LEN);              \
+     })
+#define setflushvlans_COPY_OUT ({ (void)0; })
+#define setflushvlans_CALL (in->br, in->ring_nr, in->vlans)
+CTL_DECLARE(setflushvlans);
+
+#define CMD_CODE_setprofile 106
+#define setprofile_ARGS (int br, int ring_nr, char *profile)
+struct setprofile_IN
+{
+	int br;
+	int ring_nr;
+	char profile[MRP_PROFILE_NAME_LEN];
+};
+struct setprofile_OUT
+{
+};
+#define setprofile_COPY_IN \
+    ({                                                           \
+     in->br = br;                                                \
+     in->ring_nr = ring_nr;                                      \
+     strncpy(in->profile, profile, MRP_PROFILE_NAME_LEN - 1);    \
+     in->profile[MRP_PROFILE_NAME_LEN - 1] = 0;                  \
+     })
+#define setprofile_COPY_OUT ({ (void)0; })
+#define setprofile_CALL (in->br, in->ring_nr, in->profile)
+CTL_DECLARE(setprofile);
+
 #define CLIENT_SIDE_FUNCTION(name)                               \
 CTL_DECLARE(name)                                                \
 {                                                                \